@@ -27,6 +27,7 @@
 
 
 #include "string_utils.h"
+#include "trace.h"
 #include "utils.h"
 
 #define MAIN_STACKSIZE	 4096
@@ -554,8 +555,13 @@ uint8_t systemBus::receiveByte() { return protocol->receiveByte(); }
 std::string systemBus::receiveBytes() { return protocol->receiveBytes(); }
 
 bool systemBus::sendByte(const char c, bool eoi) { return protocol->sendByte(c, eoi); }
-size_t systemBus::sendBytes(const char *buf, size_t len, bool eoi) { return protocol->sendBytes(buf, len, eoi); }
-size_t systemBus::sendBytes(std::string s, bool eoi) { return protocol->sendBytes(s.c_str(), s.size(), eoi); }
+size_t systemBus::sendBytes(const char *buf, size_t len, bool eoi)
+{
+    TRACE_SPAN(TRACE_SEND_BYTES);
+    TRACE_ARG(len);
+    return protocol->sendBytes(buf, len, eoi);
+}
+size_t systemBus::sendBytes(std::string s, bool eoi) { return sendBytes(s.c_str(), s.size(), eoi); }
 
 bool IRAM_ATTR systemBus::turnAround()
 {
@@ -631,6 +637,12 @@ void systemBus::reset_all_our_devices()
     // are automatically closed.
 }
 
+void systemBus::selectFastLoader(bus_protocol_t p)
+{
+    detected_protocol = p;
+    protocol = selectProtocol();
+}
+
 void systemBus::setBitTiming(std::string set, int p1, int p2, int p3, int p4)
 {
      uint8_t i = 0; // Send
@@ -526,6 +526,13 @@ public:
      */
     void setBitTiming(std::string set, int p1 = 0, int p2 = 0, int p3 = 0, int p4 = 0);
 
+    /**
+     * @brief Switch to the protocol of a fast loader a device recognized.
+     * Commands under ATN still go back to standard serial.
+     * @param p the protocol
+     */
+    void selectFastLoader(bus_protocol_t p);
+
 
     uint8_t receiveByte();
     std::string receiveBytes();
@@ -68,7 +68,7 @@ bool DolphinDOS::sendByte ( uint8_t data, bool eoi )
     IEC.flags &= CLEAR_LOW;
 
     // Set the data on the user port
-    PARALLEL.data = data;
+    PARALLEL.writeByte( data );
 
     // Say we're ready
     IEC_RELEASE ( PIN_IEC_CLK_OUT );
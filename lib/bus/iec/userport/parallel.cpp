@@ -166,18 +166,25 @@ void parallelBus::setMode(parallel_mode_t mode)
 void parallelBus::handShake()
 {
     // Signal received or sent
-    
+
+#ifdef GPIOX_XRA1405
+    // LOW then HIGH, queued behind the data so the caller can move on
+    GPIOX.pulse( FLAG2 );
+#else
     // LOW
     GPIOX.digitalWrite( FLAG2, 0 );
     
     // HIGH
     GPIOX.digitalWrite( FLAG2, 1 );
+#endif
 }
 
 uint8_t parallelBus::readByte()
 {
 
-    this->data = GPIOX.read( USERPORT_DATA );
+    // Data and flags come back from the same read
+    GPIOX.read( GPIOX_BOTH );
+    this->data = GPIOX.PORT1;
     this->flags = GPIOX.PORT0;
 
     //Debug_printv("flags[%.2x] data[%.2x]", this->flags, this->data);
@@ -192,11 +199,20 @@ void parallelBus::writeByte( uint8_t byte )
 {
     this->data = byte;
 
-    Debug_printv("flags[%.2x] data[%.2x] byte[%.2x]", this->flags, this->data, byte);
-    GPIOX.write( USERPORT_DATA, byte);
+    //Debug_printv("flags[%.2x] data[%.2x] byte[%.2x]", this->flags, this->data, byte);
+#ifdef GPIOX_XRA1405
+    GPIOX.writeQueued( USERPORT_DATA, byte );
+#else
+    GPIOX.write( USERPORT_DATA, byte );
+#endif
 
     // Tell receiver byte is ready to read
     this->handShake();
+
+#ifdef GPIOX_XRA1405
+    // Callers signal on the IEC bus next, the byte has to be on the port by then
+    GPIOX.flush();
+#endif
 }
 
 
@@ -2,6 +2,12 @@
 #define _FN_CONFIG_H
 
 #include <string>
+#include <mutex>
+
+#ifdef ESP_PLATFORM
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
 
 #include "printer.h"
 #include "../encrypt/crypt.h"
@@ -23,6 +29,7 @@
 #ifdef ESP_PLATFORM
 #define HSIO_INVALID_INDEX -1
 #define CONFIG_FILENAME SYSTEM_DIR "/config.ini"
+#define CONFIG_SNAPSHOT_FILENAME SYSTEM_DIR "/config.bin" // on FLASH, even when the INI is kept on SD
 // ESP_PLATFORM
 #else
 // !ESP_PLATFORM
@@ -44,6 +51,18 @@
 
 #define CONFIG_FILEBUFFSIZE 2048
 
+// Binary snapshot of the parsed config, used at boot while the INI it was made from is unchanged
+#define CONFIG_SNAPSHOT_MAGIC 0x464E434D // "MCNF"
+#define CONFIG_SNAPSHOT_VERSION 1        // bump whenever the fields in _snapshot_fields() change
+
+// save() writes once changes have settled for CONFIG_SAVE_DELAY_MS, but no later than
+// CONFIG_SAVE_MAX_DELAY_MS after the first of them
+#define CONFIG_SAVE_DELAY_MS 2000
+#define CONFIG_SAVE_MAX_DELAY_MS 10000
+#define CONFIG_SAVE_STACKSIZE 4096
+#define CONFIG_SAVE_PRIORITY 2
+#define CONFIG_SAVE_CPUAFFINITY 0 // the bus runs on core 1
+
 #define CONFIG_DEFAULT_SNTPSERVER "pool.ntp.org"
 
 #define PHONEBOOK_CHAR_WIDTH 12
@@ -296,7 +315,10 @@ public:
 #endif
 
     void load();
+    // On the ESP the config is written by a background task once changes settle
     void save();
+    // Writes any unsaved or pending changes before returning, for reboots
+    void save_now();
 
     void mark_dirty() { _dirty = true; };
 
@@ -305,6 +327,31 @@ public:
 private:
     bool _dirty = false;
 
+    // INI text last read or written, a save that produces the same text isn't written
+    uint32_t _ini_crc = 0;
+    size_t _ini_size = 0;
+
+    std::mutex _save_mutex;
+    bool _save_pending = false;
+    std::string _pending_ini;
+    std::string _pending_snapshot;
+#ifdef ESP_PLATFORM
+    TaskHandle_t _save_task = nullptr;
+    static void _save_task_main(void *arg);
+    static void _save_shutdown_handler();
+#endif
+    void _flush_save();
+    bool _write_ini(const std::string &ini);
+
+    // Binary snapshot, see fnc_snapshot.cpp
+    static uint32_t _crc32(const char *data, size_t len);
+    std::string _snapshot_path();
+    template <class IO> void _snapshot_fields(IO &io);
+    std::string _snapshot_encode();
+    bool _snapshot_decode(const std::string &payload);
+    bool _snapshot_load(const std::string &ini);
+    void _snapshot_store(const std::string &ini, const std::string &payload);
+
     int _read_line(std::stringstream &ss, std::string &line, char abort_if_starts_with = '\0');
 
     void _read_section_general(std::stringstream &ss);
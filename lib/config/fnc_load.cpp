@@ -14,7 +14,8 @@
 #include "../../include/debug.h"
 
 /* Load configuration data from FLASH. If no config file exists in FLASH,
-   copy it from SD if a copy exists there.
+   copy it from SD if a copy exists there. The parsed result is restored
+   from the binary snapshot instead while the INI text hasn't changed.
 */
 void fnConfig::load()
 {
@@ -130,13 +131,20 @@ New behavior: copy from SD first if available, then read FLASH.
         return;
     }
     inibuffer[i] = '\0';
+    std::string ini(inibuffer);
+    free(inibuffer);
     // Put the data in a stringstream
     std::stringstream ss;
-    ss << inibuffer;
-    free(inibuffer);
+    ss << ini;
+
+    _ini_size = ini.size();
+    _ini_crc = _crc32(ini.data(), ini.size());
+
+    // Parsing is skipped when the snapshot was made from this same text
+    bool from_snapshot = _snapshot_load(ini);
 
     std::string line;
-    while (_read_line(ss, line) >= 0)
+    while (!from_snapshot && _read_line(ss, line) >= 0)
     {
         int index = 0;
         switch (_find_section_in_line(line, index))
@@ -204,6 +212,9 @@ New behavior: copy from SD first if available, then read FLASH.
         }
     }
 
+    if (!from_snapshot)
+        _snapshot_store(ini, _snapshot_encode());
+
     _dirty = false;
 
 #ifdef ESP_PLATFORM
@@ -6,9 +6,15 @@
 #include <cstring>
 #include <sstream>
 
+#ifdef ESP_PLATFORM
+#include <esp_system.h>
+#endif
+
 #include "../../include/debug.h"
 
 /* Save configuration data to FLASH. If SD is mounted, save a backup copy there.
+   On the ESP the files are written by a background task once changes settle,
+   and not at all if the INI text comes out the same as what's stored.
 */
 void fnConfig::save()
 {
@@ -199,6 +205,86 @@ void fnConfig::save()
     ss << "flowcontrol=" << _bos.flowcontrol << LINETERM;
 #endif
 
+    // The text and snapshot are taken now, the files may be written later
+    {
+        std::lock_guard<std::mutex> lock(_save_mutex);
+        _pending_ini = ss.str();
+        _pending_snapshot = _snapshot_encode();
+        _save_pending = true;
+    }
+    _dirty = false;
+
+#ifdef ESP_PLATFORM
+    if (_save_task == nullptr)
+    {
+        if (xTaskCreatePinnedToCore(_save_task_main, "fn_config_save", CONFIG_SAVE_STACKSIZE, this, CONFIG_SAVE_PRIORITY, &_save_task, CONFIG_SAVE_CPUAFFINITY) != pdPASS)
+        {
+            _save_task = nullptr;
+            _flush_save();
+            return;
+        }
+        // esp_restart() doesn't wait for the task, write what's pending first
+        esp_register_shutdown_handler(_save_shutdown_handler);
+    }
+    xTaskNotifyGive(_save_task);
+#else
+    _flush_save();
+#endif
+}
+
+void fnConfig::save_now()
+{
+    save();
+    _flush_save();
+}
+
+#ifdef ESP_PLATFORM
+// Writes the config once save() hasn't been called for a while, so a burst of
+// changes from the UI is written to FLASH once
+void fnConfig::_save_task_main(void *arg)
+{
+    fnConfig *config = (fnConfig *)arg;
+    while (true)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        TickType_t first = xTaskGetTickCount();
+        while (xTaskGetTickCount() - first < pdMS_TO_TICKS(CONFIG_SAVE_MAX_DELAY_MS)
+               && ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CONFIG_SAVE_DELAY_MS)) > 0)
+            ;
+
+        config->_flush_save();
+    }
+}
+
+void fnConfig::_save_shutdown_handler()
+{
+    Config.save_now();
+}
+#endif
+
+void fnConfig::_flush_save()
+{
+    // Held while writing, so saves land in order
+    std::lock_guard<std::mutex> lock(_save_mutex);
+    if (!_save_pending)
+        return;
+    _save_pending = false;
+
+    if (_pending_ini.size() == _ini_size && _crc32(_pending_ini.data(), _pending_ini.size()) == _ini_crc)
+    {
+        Debug_println("fnConfig::save unchanged, not writing");
+    }
+    else if (_write_ini(_pending_ini))
+    {
+        _snapshot_store(_pending_ini, _pending_snapshot);
+    }
+    _pending_ini.clear();
+    _pending_snapshot.clear();
+}
+
+bool fnConfig::_write_ini(const std::string &result)
+{
 #ifdef ESP_PLATFORM
     // Write the results out
     FILE *fout = NULL;
@@ -208,7 +294,7 @@ void fnConfig::save()
         if ( !(fout = fsFlash.file_open(CONFIG_FILENAME, "w")))
         {
             Debug_println("Failed to Open config on FLASH");
-            return;
+            return false;
         }
     }
     else
@@ -217,7 +303,7 @@ void fnConfig::save()
         if ( !(fout = fnSDFAT.file_open(CONFIG_FILENAME, "w")))
         {
             Debug_println("Failed to Open config on SD");
-            return;
+            return false;
         }
     }
 #else
@@ -227,16 +313,16 @@ void fnConfig::save()
     if (fout == nullptr)
     {
         Debug_printf("Failed to open config file\r\n");
-        return;
+        return false;
     }
 #endif
-    std::string result = ss.str();
     size_t z = fwrite(result.c_str(), 1, result.length(), fout);
     (void)z; // Get around unused var
     Debug_printf("fnConfig::save wrote %u bytes\r\n", (unsigned)z);
     fclose(fout);
-    
-    _dirty = false;
+
+    _ini_size = result.size();
+    _ini_crc = _crc32(result.data(), result.size());
 
 #ifdef ESP_PLATFORM
     // Copy to SD if possible, only when wrote FLASH first 
@@ -246,8 +332,8 @@ void fnConfig::save()
         if (0 == fnSystem.copy_file(&fsFlash, CONFIG_FILENAME, &fnSDFAT, CONFIG_FILENAME))
         {
             Debug_println("Failed to copy config to SD");
-            return;
         }
     }
 #endif
+    return true;
 }
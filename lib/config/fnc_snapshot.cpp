@@ -0,0 +1,371 @@
+#include "fnConfig.h"
+
+#include "fnFS.h"
+#include "fsFlash.h"
+
+#include <cstring>
+#include <type_traits>
+
+#include "../../include/debug.h"
+
+/* Binary snapshot of the parsed configuration. It is written next to the
+   INI whenever the INI is read or written, and carries the size and CRC of
+   the INI text it was made from. At boot the snapshot is used instead of
+   parsing the INI as long as both still match.
+*/
+
+struct config_snapshot_header
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t ini_size;
+    uint32_t ini_crc;
+    uint32_t payload_size;
+    uint32_t payload_crc;
+};
+
+// CRC-32 (IEEE), the INI is only a couple of KB so no table
+uint32_t fnConfig::_crc32(const char *data, size_t len)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < len; i++)
+    {
+        crc ^= (uint8_t)data[i];
+        for (int b = 0; b < 8; b++)
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
+
+// Writes and reads the same fields in the same order, see _snapshot_fields()
+class config_snapshot_writer
+{
+public:
+    std::string out;
+
+    void field(const std::string &s)
+    {
+        uint16_t len = s.size();
+        field(len);
+        out.append(s.data(), len);
+    };
+    void field(const char *s, size_t size)
+    {
+        field(std::string(s, strnlen(s, size)));
+    };
+    template <typename T>
+    void field(const T &v)
+    {
+        static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value, "not a plain value");
+        out.append((const char *)&v, sizeof(v));
+    };
+};
+
+class config_snapshot_reader
+{
+public:
+    config_snapshot_reader(const std::string &in) : _in(in) {};
+    bool ok() { return _ok && _pos == _in.size(); };
+
+    void field(std::string &s)
+    {
+        uint16_t len = 0;
+        field(len);
+        if (!_take(len))
+            return;
+        s.assign(_in.data() + _pos - len, len);
+    };
+    void field(char *s, size_t size)
+    {
+        std::string v;
+        field(v);
+        if (v.size() >= size)
+            _ok = false;
+        else if (_ok)
+            strcpy(s, v.c_str());
+    };
+    template <typename T>
+    void field(T &v)
+    {
+        static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value, "not a plain value");
+        if (_take(sizeof(v)))
+            memcpy(&v, _in.data() + _pos - sizeof(v), sizeof(v));
+    };
+
+private:
+    const std::string &_in;
+    size_t _pos = 0;
+    bool _ok = true;
+
+    bool _take(size_t len)
+    {
+        if (!_ok || _in.size() - _pos < len)
+            return _ok = false;
+        _pos += len;
+        return true;
+    };
+};
+
+// Walks the payload like the reader without storing anything, so a payload
+// that doesn't fit is refused before any field changes
+class config_snapshot_checker
+{
+public:
+    config_snapshot_checker(const std::string &in) : _in(in) {};
+    bool ok() { return _ok && _pos == _in.size(); };
+
+    void field(const std::string &)
+    {
+        _string();
+    };
+    void field(const char *, size_t size)
+    {
+        if (_string() >= size)
+            _ok = false;
+    };
+    template <typename T>
+    void field(const T &v)
+    {
+        static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value, "not a plain value");
+        _take(sizeof(v));
+    };
+
+private:
+    const std::string &_in;
+    size_t _pos = 0;
+    bool _ok = true;
+
+    bool _take(size_t len)
+    {
+        if (!_ok || _in.size() - _pos < len)
+            return _ok = false;
+        _pos += len;
+        return true;
+    };
+    // Length of the string skipped
+    size_t _string()
+    {
+        uint16_t len = 0;
+        if (_take(sizeof(len)))
+            memcpy(&len, _in.data() + _pos - sizeof(len), sizeof(len));
+        _take(len);
+        return len;
+    };
+};
+
+// Everything the INI sections set, CONFIG_SNAPSHOT_VERSION has to change along with this
+template <class IO>
+void fnConfig::_snapshot_fields(IO &io)
+{
+    int i;
+
+    io.field(_general.devicename);
+    io.field(_general.hsio_index);
+    io.field(_general.timezone);
+    io.field(_general.rotation_sounds);
+    io.field(_general.config_enabled);
+    io.field(_general.config_filename);
+    io.field(_general.boot_mode);
+    io.field(_general.fnconfig_spifs);
+    io.field(_general.status_wait_enabled);
+    io.field(_general.encrypt_passphrase);
+    io.field(_general.printer_enabled);
+
+    io.field(_wifi.ssid);
+    io.field(_wifi.passphrase);
+    io.field(_wifi.enabled);
+    for (i = 0; i < MAX_WIFI_STORED; i++)
+    {
+        io.field(_wifi_stored[i].ssid);
+        io.field(_wifi_stored[i].passphrase);
+        io.field(_wifi_stored[i].enabled);
+    }
+
+    io.field(_bt.bt_status);
+    io.field(_bt.bt_baud);
+    io.field(_bt.bt_devname);
+
+    io.field(_network.sntpserver, sizeof(_network.sntpserver));
+
+    for (i = 0; i < MAX_HOST_SLOTS; i++)
+    {
+        io.field(_host_slots[i].type);
+        io.field(_host_slots[i].name);
+    }
+    for (i = 0; i < MAX_MOUNT_SLOTS; i++)
+    {
+        io.field(_mount_slots[i].host_slot);
+        io.field(_mount_slots[i].mode);
+        io.field(_mount_slots[i].path);
+    }
+    for (i = 0; i < MAX_PRINTER_SLOTS; i++)
+    {
+#ifdef PRINTER_CLASS
+        io.field(_printer_slots[i].type);
+#endif
+        io.field(_printer_slots[i].port);
+    }
+    for (i = 0; i < MAX_TAPE_SLOTS; i++)
+    {
+        io.field(_tape_slots[i].host_slot);
+        io.field(_tape_slots[i].mode);
+        io.field(_tape_slots[i].path);
+    }
+
+    io.field(_modem.modem_enabled);
+    io.field(_modem.sniffer_enabled);
+
+    for (i = 0; i < MAX_PB_SLOTS; i++)
+    {
+        io.field(_phonebook_slots[i].phnumber);
+        io.field(_phonebook_slots[i].hostname);
+        io.field(_phonebook_slots[i].port);
+    }
+
+    io.field(_cassette.cassette_enabled);
+    io.field(_cassette.pulldown);
+    io.field(_cassette.button);
+
+    io.field(_cpm.cpm_enabled);
+    io.field(_cpm.ccp);
+
+    io.field(_denable.device_1_enabled);
+    io.field(_denable.device_2_enabled);
+    io.field(_denable.device_3_enabled);
+    io.field(_denable.device_4_enabled);
+    io.field(_denable.device_5_enabled);
+    io.field(_denable.device_6_enabled);
+    io.field(_denable.device_7_enabled);
+    io.field(_denable.device_8_enabled);
+    io.field(_denable.apetime);
+    io.field(_denable.pclink);
+
+    io.field(_boip.boip_enabled);
+    io.field(_boip.host);
+    io.field(_boip.port);
+
+#ifndef ESP_PLATFORM
+    io.field(_serial.port);
+    io.field(_serial.baud);
+    io.field(_serial.command);
+    io.field(_serial.proceed);
+
+    io.field(_netsio.netsio_enabled);
+    io.field(_netsio.host);
+    io.field(_netsio.port);
+
+    io.field(_bos.bos_enabled);
+    io.field(_bos.port_name);
+    io.field(_bos.baud);
+    io.field(_bos.bits);
+    io.field(_bos.parity);
+    io.field(_bos.stop_bits);
+    io.field(_bos.flowcontrol);
+#endif
+}
+
+std::string fnConfig::_snapshot_encode()
+{
+    config_snapshot_writer writer;
+    _snapshot_fields(writer);
+    return writer.out;
+}
+
+bool fnConfig::_snapshot_decode(const std::string &payload)
+{
+    // Make sure it all fits before anything is changed
+    config_snapshot_checker check(payload);
+    _snapshot_fields(check);
+    if (!check.ok())
+        return false;
+
+    config_snapshot_reader reader(payload);
+    _snapshot_fields(reader);
+    return reader.ok();
+}
+
+std::string fnConfig::_snapshot_path()
+{
+#ifdef ESP_PLATFORM
+    return CONFIG_SNAPSHOT_FILENAME;
+#else
+    std::string path = _general.config_file_path;
+    size_t dot = path.find_last_of('.');
+    if (dot != std::string::npos && path.find_first_of("/\\", dot) == std::string::npos)
+        path.erase(dot);
+    return path + ".bin";
+#endif
+}
+
+// Restores the config from the snapshot if it was made from this INI text
+bool fnConfig::_snapshot_load(const std::string &ini)
+{
+    std::string path = _snapshot_path();
+#ifdef ESP_PLATFORM
+    FILE *fin = fsFlash.file_open(path.c_str(), FILE_READ);
+#else
+    FILE *fin = fopen(path.c_str(), FILE_READ);
+#endif
+    if (fin == nullptr)
+        return false;
+
+    config_snapshot_header header;
+    std::string payload;
+    bool ok = fread(&header, 1, sizeof(header), fin) == sizeof(header)
+        && header.magic == CONFIG_SNAPSHOT_MAGIC
+        && header.version == CONFIG_SNAPSHOT_VERSION
+        && header.header_size == sizeof(header)
+        && header.ini_size == ini.size()
+        && header.ini_crc == _crc32(ini.data(), ini.size())
+        && header.payload_size <= CONFIG_FILEBUFFSIZE * 4;
+    if (ok)
+    {
+        payload.resize(header.payload_size);
+        ok = fread(&payload[0], 1, payload.size(), fin) == payload.size()
+            && header.payload_crc == _crc32(payload.data(), payload.size());
+    }
+    fclose(fin);
+
+    if (!ok)
+    {
+        Debug_println("fnConfig snapshot is stale or damaged, parsing INI");
+        return false;
+    }
+    if (!_snapshot_decode(payload))
+    {
+        Debug_println("fnConfig snapshot doesn't match its version, parsing INI");
+        return false;
+    }
+
+    Debug_printf("fnConfig::load restored %u bytes from snapshot\r\n", (unsigned)payload.size());
+    return true;
+}
+
+void fnConfig::_snapshot_store(const std::string &ini, const std::string &payload)
+{
+    config_snapshot_header header;
+    header.magic = CONFIG_SNAPSHOT_MAGIC;
+    header.version = CONFIG_SNAPSHOT_VERSION;
+    header.header_size = sizeof(header);
+    header.ini_size = ini.size();
+    header.ini_crc = _crc32(ini.data(), ini.size());
+    header.payload_size = payload.size();
+    header.payload_crc = _crc32(payload.data(), payload.size());
+
+    std::string path = _snapshot_path();
+#ifdef ESP_PLATFORM
+    FILE *fout = fsFlash.file_open(path.c_str(), FILE_WRITE);
+#else
+    FILE *fout = fopen(path.c_str(), FILE_WRITE);
+#endif
+    if (fout == nullptr)
+    {
+        Debug_printf("Failed to open config snapshot \"%s\"\r\n", path.c_str());
+        return;
+    }
+    // A write cut short leaves a snapshot whose CRC doesn't match, and the INI is parsed instead
+    fwrite(&header, 1, sizeof(header), fout);
+    fwrite(payload.data(), 1, payload.size(), fout);
+    fclose(fout);
+}
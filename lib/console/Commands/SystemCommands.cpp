@@ -6,6 +6,7 @@
 #include <esp_ota_ops.h>
 #include <esp_system.h>
 #include <getopt.h>
+#include <sys/syslimits.h>
 
 #include <soc/efuse_reg.h>
 
@@ -20,6 +21,9 @@
 #include <esp_flash.h>
 
 #include "../ESP32Console.h"
+#include "../Helpers/PWDHelpers.h"
+
+#include "trace.h"
 
 #include "Esp.h"
 
@@ -256,6 +260,55 @@ static int date(int argc, char **argv)
     return EXIT_SUCCESS;
 }
 
+static int trace(int argc, char **argv)
+{
+    const char *json = nullptr;
+    bool reset = false;
+
+    int c;
+    opterr = 0;
+    optind = 1;
+
+    while ((c = getopt(argc, argv, "rj:")) != -1)
+        switch (c)
+        {
+        case 'r':
+            reset = true;
+            break;
+        case 'j':
+            json = optarg;
+            break;
+        case '?':
+            printf("Unknown option: %c\n", optopt);
+            return 1;
+        }
+
+    if (json)
+    {
+        char filename[PATH_MAX];
+        ESP32Console::console_realpath(json, filename);
+
+        FILE *f = fopen(filename, "w");
+        if (!f)
+        {
+            fprintf(stderr, "Could not open %s: %s\n", filename, strerror(errno));
+            return 1;
+        }
+        std::string out = Trace::chrome();
+        fwrite(out.data(), 1, out.size(), f);
+        fclose(f);
+        printf("Chrome trace written to %s\r\n", filename);
+        return EXIT_SUCCESS;
+    }
+
+    printf("%s", Trace::histograms().c_str());
+
+    if (reset)
+        Trace::reset();
+
+    return EXIT_SUCCESS;
+}
+
 namespace ESP32Console::Commands
 {
     const ConsoleCommand getRestartCommand()
@@ -282,4 +335,9 @@ namespace ESP32Console::Commands
     {
         return ConsoleCommand("date", &date, "Shows and modify the system time");
     }
+
+    const ConsoleCommand getTraceCommand()
+    {
+        return ConsoleCommand("trace", &trace, "Shows LOAD latency histograms, -r to reset them, -j <file> to save a Chrome trace");
+    }
 }
\ No newline at end of file
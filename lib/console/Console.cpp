@@ -42,6 +42,7 @@ namespace ESP32Console
         registerCommand(getMemInfoCommand());
         registerCommand(getTaskInfoCommand());
         registerCommand(getDateCommand());
+        registerCommand(getTraceCommand());
     }
 
     void ESP32Console::Console::registerNetworkCommands()
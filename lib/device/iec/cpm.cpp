@@ -50,14 +50,14 @@ static void cpmTask(void *arg)
 
 iecCpm::iecCpm()
 {
-    rxq = xQueueCreate(2048, sizeof(char));
-    txq = xQueueCreate(2048, sizeof(char));
+    rxbuf = xStreamBufferCreate(2048, 1);
+    txbuf = xStreamBufferCreate(2048, 1);
 }
 
 iecCpm::~iecCpm()
 {
-    vQueueDelete(rxq);
-    vQueueDelete(txq);
+    vStreamBufferDelete(rxbuf);
+    vStreamBufferDelete(txbuf);
 }
 
 void iecCpm::iec_open()
@@ -72,6 +72,13 @@ void iecCpm::iec_close()
 {
     if (cpmTaskHandle != NULL)
         vTaskDelete(cpmTaskHandle);
+    cpmTaskHandle = NULL;
+
+    // Nothing left over for the next session
+    _cache_close();
+    xStreamBufferReset(rxbuf);
+    xStreamBufferReset(txbuf);
+    talk_len = 0;
 
     commanddata.init();
     state = DEVICE_IDLE;
@@ -80,14 +87,13 @@ void iecCpm::iec_close()
 
 void iecCpm::poll_interrupt(unsigned char c)
 {    
-    if (uxQueueMessagesWaiting(rxq))
+    if (talk_len || xStreamBufferBytesAvailable(rxbuf))
         IEC.assert_interrupt();
 }
 
 void iecCpm::iec_reopen_talk()
 {
     bool set_eoi = false;
-    bool atn = true; // inverted
 
     if (cpmTaskHandle == NULL)
     {
@@ -95,20 +101,26 @@ void iecCpm::iec_reopen_talk()
         return;
     }
 
-    while (atn)
+    // Send whatever CP/M has written in as few transfers as possible,
+    // until the output runs dry or the computer asserts ATN
+    while (true)
     {
-        char b;
-        atn = fnSystem.digital_read(PIN_IEC_ATN);
-
-        if (!uxQueueMessagesWaiting(rxq))
+        talk_len += xStreamBufferReceive(rxbuf, talk_buf + talk_len, sizeof(talk_buf) - talk_len, 0);
+        if (talk_len == 0)
         {
             IEC.senderTimeout();
             break;
         }
 
-        xQueueReceive(rxq,&b,portMAX_DELAY);
-        IEC.sendByte(b, set_eoi);
-        atn = fnSystem.digital_read(PIN_IEC_ATN);
+        size_t sent = IEC.sendBytes(talk_buf, talk_len, set_eoi);
+
+        // Keep what the computer didn't take for the next TALK
+        if (sent < talk_len)
+            memmove(talk_buf, talk_buf + sent, talk_len - sent);
+        talk_len -= sent;
+
+        if (talk_len)
+            break;
     }
 }
 
@@ -120,22 +132,10 @@ void iecCpm::iec_reopen_listen()
         return;
     }
 
-#if 0
-    while (!(IEC.flags & EOI_RECVD))
-    {
-        int16_t b = IEC.receiveByte();
-
-        if (b<0)
-        {
-            Debug_printf("Error on receive.\r\n");
-            return;
-        }
-
-        xQueueSend(txq,&b,portMAX_DELAY);
-    }
-#else
-#warning FIXME - use payload
-#endif
+    // Keyboard input, the CP/M task picks it up in _getch(). Never block the bus on it.
+    size_t len = xStreamBufferSend(txbuf, payload.data(), payload.size(), 0);
+    if (len < payload.size())
+        Debug_printf("iecCpm::iec_reopen_listen() - Input buffer full, %u bytes dropped.\r\n", payload.size() - len);
 }
 
 void iecCpm::iec_reopen()
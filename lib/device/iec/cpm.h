@@ -5,6 +5,9 @@
 
 #define FOLDERCHAR '/'
 
+// Console output sent to the computer per TALK, at most
+#define CPM_TALK_CHUNK 256
+
 // Silly typedefs that runcpm uses
 typedef unsigned char   uint8;
 typedef unsigned short  uint16;
@@ -42,6 +45,10 @@ class iecCpm : public virtualDevice
 
     TaskHandle_t cpmTaskHandle = NULL;    
 
+    // Console output taken from the stream buffer but not yet accepted by the computer
+    char talk_buf[CPM_TALK_CHUNK];
+    size_t talk_len = 0;
+
     virtual void poll_interrupt(unsigned char c) override;
     
     void iec_open();
@@ -20,6 +20,7 @@
 
 #include "drive.h"
 
+#include <cctype>
 #include <cstring>
 #include <sstream>
 #include <unordered_map>
@@ -32,9 +33,11 @@
 #include "fnFsSD.h"
 #include "led.h"
 #include "led_strip.h"
+#include "trace.h"
 #include "utils.h"
 
 #include "meat_media.h"
+#include "wrappers/save_stream.h"
 
 
 iecDrive::iecDrive()
@@ -114,6 +117,7 @@ bool iecDrive::write_blank(FILE *f, uint16_t sectorSize, uint16_t numSectors)
 #if 1
 device_state_t iecDrive::openChannel(/*int chan, IECPayload &payload*/)
 {
+  std::lock_guard<LoadPrefetch> media(LoadPrefetch::instance());
   if (commanddata.channel == CHANNEL_COMMAND)
     iec_command();
   else
@@ -124,6 +128,7 @@ device_state_t iecDrive::openChannel(/*int chan, IECPayload &payload*/)
 
 device_state_t iecDrive::closeChannel(/*int chan*/)
 {
+  std::lock_guard<LoadPrefetch> media(LoadPrefetch::instance());
   if (_base == nullptr) {
     IEC.senderTimeout();
     return state;
@@ -135,6 +140,7 @@ device_state_t iecDrive::closeChannel(/*int chan*/)
 
 device_state_t iecDrive::readChannel(/*int chan*/)
 {
+  std::lock_guard<LoadPrefetch> media(LoadPrefetch::instance());
   if (commanddata.channel == CHANNEL_COMMAND)
     iec_talk_command_buffer_status();
   else {
@@ -152,6 +158,7 @@ device_state_t iecDrive::readChannel(/*int chan*/)
 
 device_state_t iecDrive::writeChannel(/*int chan, IECPayload &payload*/)
 {
+    std::lock_guard<LoadPrefetch> media(LoadPrefetch::instance());
     if (_base == nullptr) {
         IEC.senderTimeout();
         return state;
@@ -285,10 +292,20 @@ void iecDrive::iec_open()
 
     Debug_printv("_base[%s] payload[%s]", _base->url.c_str(), payload.c_str());
 
+    if ( mstr::startsWith(payload, "#") )
+    {
+        // Direct access channel, no file involved
+        openBufferChannel(commanddata.channel);
+        return;
+    }
+
+    // "@:" saves over an existing file
+    bool replace = false;
     if ( mstr::startsWith(payload, "@") )
     {
         // Remove @? [blueangels-xiphoid.d64]
         payload = mstr::drop(payload, 1);
+        replace = true;
     }
     if ( mstr::startsWith(payload, "0:") )
     {
@@ -331,7 +348,7 @@ void iecDrive::iec_open()
             //     Debug_printv("File Doesn't Exist [%s]", _base->url.c_str());
             // }
 
-            if ( !registerStream(commanddata.channel) )
+            if ( !registerStream(commanddata.channel, replace) )
             {
                 Debug_printv("File Doesn't Exist [%s]", _base->url.c_str());
             }
@@ -442,11 +459,30 @@ void iecDrive::iec_talk_command()
 
 void iecDrive::iec_talk_command_buffer_status()
 {
+    if ( !memory_response.empty() )
+    {
+        // M-R data goes out once, in place of the status
+        IEC.sendBytes(memory_response, true);
+        memory_response.clear();
+        return;
+    }
+
     // std::ostringstream ss;
     // ss << iecStatus.error << "," << "\"" << iecStatus.msg << "\"" << "," << iecStatus.connected << "," << iecStatus.channel;
     // std::string s = ss.str();
-    std::string s = "00, OK,00,00\r";
+    std::string s = mstr::format("%02d,%s,%02d,%02d\r", error_response.errnum, error_response.msg.c_str(), error_response.track, error_response.sector);
     IEC.sendBytes(s, true);
+
+    // Reading the status clears it
+    set_status(0, " OK");
+}
+
+void iecDrive::set_status(uint8_t errnum, std::string msg, uint8_t track, uint8_t sector)
+{
+    error_response.errnum = errnum;
+    error_response.msg = msg;
+    error_response.track = track;
+    error_response.sector = sector;
 }
 
 void iecDrive::iec_command()
@@ -462,19 +498,12 @@ void iecDrive::iec_command()
             {
                 // B-P buffer pointer
                 if (payload[2] == 'P')
-                {
-                    payload = mstr::drop(payload, 3);
-                    mstr::trim(payload);
-                    mstr::replaceAll(payload, "  ", " ");
-                    pti = util_tokenize_uint8(payload);
-                    Debug_printv("payload[%s] channel[%d] position[%d]", payload.c_str(), pti[0], pti[1]);
-
-                    auto stream = retrieveStream( pti[0] );
-                    if ( stream )
-                    {
-                        stream->position( pti[1] );
-                    }
-                }
+                    dos_buffer_pointer();
+                // B-R / B-W block read / write
+                else if (payload[2] == 'R')
+                    dos_block(false, false);
+                else if (payload[2] == 'W')
+                    dos_block(true, false);
                 // B-A allocate bit in BAM not implemented
                 // B-F free bit in BAM not implemented
                 // B-E block execute impossible at this level of emulation!
@@ -483,10 +512,10 @@ void iecDrive::iec_command()
             Debug_printv( "block/buffer");
         break;
         case 'C':
-            if ( payload[1] != 'D' && payload[2] == ':')
+            if ( payload[1] != 'D' && payload[1] != 'P' && mstr::contains(payload, ":") )
             {
-                //Copy(); // Copy File
                 Debug_printv( "copy file");
+                dos_copy();
             }
         break;
         case 'D':
@@ -501,69 +530,42 @@ void iecDrive::iec_command()
             if ( payload[1] == '-' ) // Memory
             {
                 if (payload[2] == 'R') // M-R memory read
-                {
-                    payload = mstr::drop(payload, 3);
-                    std::string code = mstr::toHex(payload);
-                    uint16_t address = (payload[0] | payload[1] << 8);
-                    uint8_t size = payload[2];
-                    Debug_printv("Memory Read [%s]", code.c_str());
-                    Debug_printv("address[%.4X] size[%d]", address, size);
-                }
+                    dos_memory_read();
                 else if (payload[2] == 'W') // M-W memory write
-                {
-                    payload = mstr::drop(payload, 3);
-                    std::string code = mstr::toHex(payload);
-                    uint16_t address = (payload[0] | payload[1] << 8);
-                    Debug_printv("Memory Write address[%.4X][%s]", address, code.c_str());
-                }
+                    dos_memory_write();
                 else if (payload[2] == 'E') // M-E memory execute
-                {
-                    payload = mstr::drop(payload, 3);
-                    std::string code = mstr::toHex(payload);
-                    uint16_t address = (payload[0] | payload[1] << 8);
-                    Debug_printv("Memory Execute address[%.4X][%s]", address, code.c_str());
-                }
+                    dos_memory_execute();
             }
         break;
         case 'N':
-            //New();
             Debug_printv( "new (format)");
+            dos_new();
         break;
         case 'R':
-            if ( payload[1] != 'D' && payload[2] == ':' ) // Rename
+            if ( payload[1] != 'D' && mstr::contains(payload, ":") ) // Rename
             {
                 Debug_printv( "rename file");
-                // Rename();
+                dos_rename();
             }
         break;
         case 'S':
-            if (payload[2] == ':') // Scratch
+            if ( payload[1] != '-' && mstr::contains(payload, ":") ) // Scratch
             {
                 Debug_printv( "scratch");
-                //Scratch();
+                dos_scratch();
             }
         break;
         case 'U':
             Debug_printv( "user 01a2b");
             //User();
-            if (payload[1] == '1') // User 1
-            {
-                payload = mstr::drop(payload, 3);
-                mstr::trim(payload);
-                mstr::replaceAll(payload, "  ", " ");
-                pti = util_tokenize_uint8(payload);
-                Debug_printv("payload[%s] channel[%d] media[%d] track[%d] sector[%d]", payload.c_str(), pti[0], pti[1], pti[2], pti[3]);
-
-                auto stream = retrieveStream( pti[0] );
-                if ( stream )
-                {
-                    stream->seekSector( pti[2], pti[3] );
-                    stream->reset();
-                }
-            }
+            if (payload[1] == '1' || payload[1] == 'A') // User 1, block read
+                dos_block(false, true);
+            else if (payload[1] == '2' || payload[1] == 'B') // User 2, block write
+                dos_block(true, true);
         break;
         case 'V':
             Debug_printv( "validate bam");
+            dos_validate();
         break;
         default:
             //Error(ERROR_31_SYNTAX_ERROR);
@@ -727,12 +729,571 @@ void iecDrive::get_prefix()
 }
 
 
+// Drop the drive number and turn a name from the bus into a path
+static std::string dos_name(std::string name)
+{
+    mstr::trim(name);
+    if ( name.size() > 1 && isdigit(name[0]) && name[1] == ':' )
+        name = mstr::drop(name, 2);
+
+    return mstr::toUTF8(name);
+}
+
+static bool dos_wildcard(std::string &name)
+{
+    return mstr::contains(name, "*") || mstr::contains(name, "?");
+}
+
+static std::string dos_join(MFile* dir, std::string name)
+{
+    return mstr::endsWith(dir->url, "/") ? dir->url + name : dir->url + "/" + name;
+}
+
+// Directory a name lives in, relative to the current one. pattern gets the last part of the name.
+MFile* iecDrive::dos_directory(std::string name, std::string &pattern)
+{
+    std::unique_ptr<MFile> cwd( MFSOwner::File( _base->isDirectory() ? _base->url : _base->base() ) );
+    if ( cwd == nullptr )
+        return nullptr;
+
+    auto slash = name.find_last_of('/');
+    if ( slash == std::string::npos )
+    {
+        pattern = name;
+        return cwd.release();
+    }
+
+    pattern = name.substr(slash + 1);
+    return cwd->cd( name.substr(0, slash) );
+}
+
+MFile* iecDrive::dos_file(std::string name)
+{
+    std::unique_ptr<MFile> cwd( MFSOwner::File( _base->isDirectory() ? _base->url : _base->base() ) );
+    if ( cwd == nullptr )
+        return nullptr;
+
+    return cwd->cd( name );
+}
+
+// Names in dir matching a CBM DOS pattern, in directory order
+std::vector<std::string> iecDrive::dos_match(MFile* dir, std::string pattern)
+{
+    std::vector<std::string> names;
+
+    if ( dir == nullptr || pattern.empty() || !dir->isDirectory() || !dir->rewindDirectory() )
+        return names;
+
+    // Media images list raw PETSCII names, everything else is matched without case
+    if ( !dir->isPETSCII )
+        mstr::toLower(pattern);
+
+    std::unique_ptr<MFile> entry( dir->getNextFileInDir() );
+    while ( entry != nullptr )
+    {
+        std::string name = dir->isPETSCII ? mstr::toUTF8(entry->name) : entry->name;
+        std::string match = name;
+        if ( !dir->isPETSCII )
+            mstr::toLower(match);
+
+        if ( mstr::matchPattern(pattern, match) )
+            names.push_back(name);
+
+        entry.reset( dir->getNextFileInDir() );
+    }
+
+    return names;
+}
+
+// Append every source to a new target through the shared buffer, committed when the target closes
+bool iecDrive::dos_copy_files(const std::vector<std::string> &sources, MFile* target)
+{
+    std::unique_ptr<MStream> ostream( target->getSourceStream(std::ios_base::out) );
+    if ( ostream == nullptr || !ostream->isOpen() )
+    {
+        set_status(26, "WRITE PROTECT ON");
+        return false;
+    }
+
+    if ( copy_buffer.empty() )
+        copy_buffer.resize(DOS_COPY_BUFFER_SIZE);
+
+    for ( auto &url : sources )
+    {
+        std::unique_ptr<MFile> source( MFSOwner::File(url) );
+        std::unique_ptr<MStream> istream( source->getSourceStream() );
+        if ( istream == nullptr || !istream->isOpen() )
+        {
+            set_status(62, "FILE NOT FOUND");
+            return false;
+        }
+
+        // Within one image, the target must not write the image back while a source still reads it
+        if ( source->isPETSCII && target->isPETSCII
+             && source->streamFile != nullptr && target->streamFile != nullptr
+             && source->streamFile->url == target->streamFile->url
+             && ( ostream->position() + istream->size() ) / 254 >= MEDIA_WRITE_CACHE_MAX - 8 )
+        {
+            set_status(70, "NO CHANNEL");
+            return false;
+        }
+
+        uint32_t len;
+        while ( ( len = istream->read(copy_buffer.data(), copy_buffer.size()) ) > 0 )
+        {
+            if ( ostream->write(copy_buffer.data(), len) != len )
+            {
+                set_status(72, "DISK FULL");
+                return false;
+            }
+        }
+
+        Debug_printv("copied [%s] > [%s] %lu bytes", url.c_str(), target->url.c_str(), ostream->position());
+    }
+
+    ostream->close();
+    if ( ostream->error() )
+    {
+        if ( ostream->error() == 72 )
+            set_status(72, "DISK FULL");
+        else
+            set_status(25, "WRITE ERROR");
+        return false;
+    }
+
+    return true;
+}
+
+void iecDrive::dos_copy()
+{
+    // C[0]:new=[0:]old[,[0:]old...]
+    LoadPrefetch::instance().invalidate();
+    std::string args = payload.substr(payload.find(':') + 1);
+    auto equals = args.find('=');
+    if ( equals == std::string::npos )
+    {
+        set_status(30, "SYNTAX ERROR");
+        return;
+    }
+
+    std::vector<std::string> sources;
+    for ( auto &s : util_tokenize(args.substr(equals + 1), ',') )
+    {
+        std::string name = dos_name(s);
+        if ( name.empty() )
+            continue;
 
+        if ( dos_wildcard(name) )
+        {
+            std::string pattern;
+            std::unique_ptr<MFile> dir( dos_directory(name, pattern) );
+            for ( auto &match : dos_match(dir.get(), pattern) )
+                sources.push_back( dos_join(dir.get(), match) );
+        }
+        else
+        {
+            std::unique_ptr<MFile> file( dos_file(name) );
+            if ( file != nullptr )
+                sources.push_back( file->url );
+        }
+    }
+    if ( sources.empty() )
+    {
+        set_status(62, "FILE NOT FOUND");
+        return;
+    }
+
+    std::string name = dos_name(args.substr(0, equals));
+    std::string pattern;
+    std::unique_ptr<MFile> dir( dos_directory(name, pattern) );
+    std::unique_ptr<MFile> target( dos_file(name) );
+    if ( dir == nullptr || target == nullptr || dos_wildcard(pattern) )
+    {
+        set_status(30, "SYNTAX ERROR");
+        return;
+    }
+
+    if ( pattern.empty() || ( target->exists() && target->isDirectory() ) )
+    {
+        // Into a directory or image, every file keeps its name
+        uint16_t copied = 0;
+        for ( auto &url : sources )
+        {
+            std::string source_name = url.substr(url.find_last_of('/') + 1);
+            if ( !dos_match(target.get(), source_name).empty() )
+            {
+                set_status(63, "FILE EXISTS");
+                return;
+            }
+
+            std::unique_ptr<MFile> file( MFSOwner::File( dos_join(target.get(), source_name) ) );
+            if ( !dos_copy_files({ url }, file.get()) )
+                return;
+            copied++;
+        }
+        Debug_printv("%d files copied to [%s]", copied, target->url.c_str());
+    }
+    else
+    {
+        // One target, the sources are joined in order
+        if ( !dos_match(dir.get(), pattern).empty() )
+        {
+            set_status(63, "FILE EXISTS");
+            return;
+        }
+
+        if ( !dos_copy_files(sources, target.get()) )
+            return;
+    }
+
+    set_status(0, " OK");
+}
+
+void iecDrive::dos_scratch()
+{
+    // S[0]:pattern[,pattern...]
+    LoadPrefetch::instance().invalidate();
+    uint16_t count = 0;
+
+    for ( auto &s : util_tokenize(payload.substr(payload.find(':') + 1), ',') )
+    {
+        std::string pattern;
+        std::unique_ptr<MFile> dir( dos_directory(dos_name(s), pattern) );
+        auto matches = dos_match(dir.get(), pattern);
+        if ( matches.empty() )
+            continue;
+
+        if ( dir->isPETSCII )
+        {
+            // Media images scratch every match in one pass
+            std::unique_ptr<MFile> file( MFSOwner::File( dos_join(dir.get(), pattern) ) );
+            if ( file->remove() )
+                count += matches.size();
+        }
+        else
+        {
+            for ( auto &match : matches )
+            {
+                std::unique_ptr<MFile> file( MFSOwner::File( dos_join(dir.get(), match) ) );
+                if ( file->remove() )
+                    count++;
+            }
+        }
+    }
+
+    set_status(1, " FILES SCRATCHED", count, 0);
+}
+
+void iecDrive::dos_rename()
+{
+    // R[0]:new=[0:]old
+    LoadPrefetch::instance().invalidate();
+    std::string args = payload.substr(payload.find(':') + 1);
+    auto equals = args.find('=');
+    if ( equals == std::string::npos )
+    {
+        set_status(30, "SYNTAX ERROR");
+        return;
+    }
+
+    std::string new_name = dos_name(args.substr(0, equals));
+    std::string old_name = dos_name(args.substr(equals + 1));
+    std::string new_pattern, old_pattern;
+    std::unique_ptr<MFile> new_dir( dos_directory(new_name, new_pattern) );
+    std::unique_ptr<MFile> old_dir( dos_directory(old_name, old_pattern) );
+    if ( new_dir == nullptr || old_dir == nullptr || new_pattern.empty() || dos_wildcard(new_pattern) )
+    {
+        set_status(30, "SYNTAX ERROR");
+        return;
+    }
+
+    if ( dos_match(old_dir.get(), old_pattern).empty() )
+    {
+        set_status(62, "FILE NOT FOUND");
+        return;
+    }
+    if ( !dos_match(new_dir.get(), new_pattern).empty() )
+    {
+        set_status(63, "FILE EXISTS");
+        return;
+    }
+
+    std::unique_ptr<MFile> file( MFSOwner::File( dos_join(old_dir.get(), old_pattern) ) );
+    std::unique_ptr<MFile> target( MFSOwner::File( dos_join(new_dir.get(), new_pattern) ) );
+    if ( !file->rename(target->path) )
+    {
+        set_status(26, "WRITE PROTECT ON");
+        return;
+    }
+
+    set_status(0, " OK");
+}
+
+void iecDrive::dos_new()
+{
+    // N[0]:name[,id]
+    LoadPrefetch::instance().invalidate();
+    std::string args = payload.substr(payload.find(':') + 1);
+    auto parts = util_tokenize(args, ',');
+    std::string header_name = parts.size() ? dos_name(parts[0]) : "";
+    std::string id = ( parts.size() > 1 ) ? mstr::toUTF8(parts[1]) : "";
+
+    std::unique_ptr<MFile> image( MFSOwner::File( _base->isDirectory() ? _base->url : _base->base() ) );
+    if ( image == nullptr || !image->format(header_name, id) )
+    {
+        set_status(26, "WRITE PROTECT ON");
+        return;
+    }
+
+    set_status(0, " OK");
+}
+
+void iecDrive::dos_validate()
+{
+    LoadPrefetch::instance().invalidate();
+    std::unique_ptr<MFile> image( MFSOwner::File( _base->isDirectory() ? _base->url : _base->base() ) );
+    if ( image == nullptr || !image->validate() )
+    {
+        set_status(26, "WRITE PROTECT ON");
+        return;
+    }
+
+    set_status(0, " OK");
+}
+
+
+
+
+
+// Numeric parameters of a block command, separated by spaces, commas, colons or cursor right
+static std::vector<uint8_t> dos_params(std::string args)
+{
+    std::vector<uint8_t> params;
+
+    for ( auto &c : args )
+    {
+        if ( c == ',' || c == ':' || c == 0x1D )
+            c = ' ';
+    }
+
+    std::istringstream ss(args);
+    int value;
+    while ( ss >> value )
+        params.push_back(value);
+
+    return params;
+}
+
+bool iecDrive::openBufferChannel(uint8_t channel)
+{
+    // "#" takes any free buffer, "#n" asks for buffer n
+    int8_t wanted = ( payload.size() > 1 ) ? atoi(payload.c_str() + 1) : -1;
+
+    closeStream( channel );
+    int8_t n = memory.allocateBuffer(wanted);
+    if ( n < 0 )
+    {
+        set_status(70, "NO CHANNEL");
+        return false;
+    }
+
+    auto stream = std::make_shared<DriveBufferStream>(&memory, n);
+    stream->url = mstr::format("%s/#%d", _base->url.c_str(), n);
+    streams.insert( std::make_pair(channel, stream) );
+    buffer_channels[channel] = stream;
+
+    Debug_printv("channel[%d] buffer[%d]", channel, n);
+    return true;
+}
+
+// The current image, opened once and kept while direct access channels are open,
+// so repeated block reads come out of its sector cache
+MStream* iecDrive::blockImage()
+{
+    if ( block_image != nullptr && block_image->url == _base->url )
+        return block_image.get();
+
+    // Changed image, the old one gets its block writes first
+    block_image.reset();
+    if ( !_base->isDirectory() )
+        return nullptr;
+
+    block_image.reset( _base->getSourceStream() );
+    if ( block_image == nullptr || !block_image->isOpen() )
+    {
+        block_image.reset();
+        return nullptr;
+    }
+
+    return block_image.get();
+}
+
+void iecDrive::dos_block(bool write, bool user)
+{
+    // U1/U2 ch dr t s, B-R/B-W ch dr t s
+    if ( write )
+        LoadPrefetch::instance().invalidate();
+    pti = dos_params(mstr::drop(payload, user ? 2 : 3));
+    if ( pti.size() < 4 )
+    {
+        set_status(30, "SYNTAX ERROR");
+        return;
+    }
+
+    uint8_t track = pti[2];
+    uint8_t sector = pti[3];
+    Debug_printv("%s channel[%d] track[%d] sector[%d]", write ? "write" : "read", pti[0], track, sector);
+
+    auto found = buffer_channels.find(pti[0]);
+    if ( found == buffer_channels.end() )
+    {
+        set_status(70, "NO CHANNEL");
+        return;
+    }
+    auto buffer = found->second;
+    uint8_t *data = memory.buffer(buffer->buffer());
+
+    auto image = blockImage();
+    if ( image == nullptr )
+    {
+        set_status(74, "DRIVE NOT READY");
+        return;
+    }
+
+    if ( !write )
+    {
+        if ( !image->readSector(track, sector, data) )
+        {
+            set_status(66, "ILLEGAL TRACK OR SECTOR", track, sector);
+            return;
+        }
+
+        // U1 hands over the whole sector, B-R the bytes up to the index in byte 0
+        buffer->setEnd( ( user || data[0] == 0 ) ? 256 : data[0] + 1 );
+        buffer->position( user ? 0 : 1 );
+    }
+    else
+    {
+        // B-W records the index of the last byte written in byte 0
+        if ( !user )
+            data[0] = buffer->position() ? buffer->position() - 1 : 0;
+
+        if ( !image->writeSector(track, sector, data) )
+        {
+            if ( image->error() == 26 )
+                set_status(26, "WRITE PROTECT ON", track, sector);
+            else
+                set_status(66, "ILLEGAL TRACK OR SECTOR", track, sector);
+            return;
+        }
+    }
+
+    set_status(0, " OK");
+}
+
+void iecDrive::dos_buffer_pointer()
+{
+    // B-P ch pos
+    pti = dos_params(mstr::drop(payload, 3));
+    if ( pti.size() < 2 )
+    {
+        set_status(30, "SYNTAX ERROR");
+        return;
+    }
+    Debug_printv("channel[%d] position[%d]", pti[0], pti[1]);
+
+    auto stream = retrieveStream( pti[0] );
+    if ( stream == nullptr )
+    {
+        set_status(70, "NO CHANNEL");
+        return;
+    }
+
+    stream->position( pti[1] );
+}
+
+void iecDrive::dos_memory_read()
+{
+    // M-R lo hi [count]
+    if ( payload.size() < 5 )
+    {
+        set_status(30, "SYNTAX ERROR");
+        return;
+    }
+
+    uint16_t address = (uint8_t)payload[3] | ((uint8_t)payload[4] << 8);
+    uint16_t size = ( payload.size() > 5 ) ? (uint8_t)payload[5] : 1;
+    if ( size == 0 )
+        size = 256;
+    Debug_printv("address[%.4X] size[%d]", address, size);
+
+    // ROM is mapped to end at $FFFF, whatever model it is for
+    std::unique_ptr<MStream> rom_stream;
+    uint32_t rom_base = 0x10000;
+    if ( !memory.isRAM(address) || !memory.isRAM(address + size - 1) )
+    {
+        if ( rom == nullptr )
+            rom.reset( MFSOwner::File(DRIVE_ROM_PATH) );
+
+        if ( rom->exists() )
+            rom_stream.reset( rom->getSourceStream() );
+
+        if ( rom_stream != nullptr && rom_stream->isOpen() && rom_stream->size() <= 0x8000 )
+            rom_base -= rom_stream->size();
+    }
+
+    memory_response.clear();
+    for ( uint16_t i = 0; i < size; i++ )
+    {
+        uint16_t a = address + i;
+        uint8_t b = 0;
+
+        if ( memory.isRAM(a) )
+            b = memory.read(a);
+        else if ( a >= rom_base && rom_stream->seek(a - rom_base) )
+            rom_stream->read(&b, 1);
+
+        memory_response += (char)b;
+    }
+}
+
+void iecDrive::dos_memory_write()
+{
+    // M-W lo hi count data...
+    if ( payload.size() < 6 )
+    {
+        set_status(30, "SYNTAX ERROR");
+        return;
+    }
+
+    uint16_t address = (uint8_t)payload[3] | ((uint8_t)payload[4] << 8);
+    uint8_t size = payload[5];
+    Debug_printv("address[%.4X] size[%d]", address, size);
+
+    memory.write(address, payload.substr(6, size));
+}
+
+void iecDrive::dos_memory_execute()
+{
+    // M-E lo hi
+    if ( payload.size() < 5 )
+    {
+        set_status(30, "SYNTAX ERROR");
+        return;
+    }
+
+    uint16_t address = (uint8_t)payload[3] | ((uint8_t)payload[4] << 8);
+
+    // Nothing runs here, but a known fast loader tells us how the computer will talk next
+    auto loader = memory.execute(address);
+    if ( loader != nullptr )
+        IEC.selectFastLoader(loader->protocol);
+}
 
 
 // used to start working with a stream, registering it as underlying stream of some
 // IEC channel on some IEC device
-bool iecDrive::registerStream ( uint8_t channel )
+bool iecDrive::registerStream ( uint8_t channel, bool replace )
 {
     // Debug_printv("dc_basepath[%s]",  device_config.basepath().c_str());
     // Debug_printv("_file[%s]", _file.c_str());
@@ -750,20 +1311,52 @@ bool iecDrive::registerStream ( uint8_t channel )
     // LOAD / GET / INPUT
     if ( channel == CHANNEL_LOAD )
     {
-        if ( !_base->exists() )
-            return false;
+        // Read ahead while the last LOAD was idle
+        new_stream = LoadPrefetch::instance().opened(_base.get());
+        if ( new_stream == nullptr )
+        {
+            if ( !_base->exists() )
+                return false;
 
-        Debug_printv("LOAD \"%s\"", _base->url.c_str());
-        new_stream = std::shared_ptr<MStream>(_base->getSourceStream());
+            Debug_printv("LOAD \"%s\"", _base->url.c_str());
+            new_stream = std::shared_ptr<MStream>(_base->getSourceStream());
+        }
     }
 
     // SAVE / PUT / PRINT / WRITE
-    else if ( channel == CHANNEL_SAVE )
+    else if ( channel == CHANNEL_SAVE || (pt.size() > 2 && mstr::startsWith(pt[2], "W", false)) )
     {
         Debug_printv("SAVE \"%s\"", _base->url.c_str());
+        LoadPrefetch::instance().invalidate();
+
+        // Inside an image "@:" lets the file be replaced, plain files are always overwritten
+        std::ios_base::openmode mode = std::ios::out;
+        if ( replace && !_base->pathInStream.empty() )
+            mode |= std::ios::trunc;
+
         // CREATE STREAM HERE FOR OUTPUT
-        new_stream = std::shared_ptr<MStream>(_base->getSourceStream(std::ios::out));
-        new_stream->open(std::ios::out);
+        new_stream = std::shared_ptr<MStream>(_base->getSourceStream(mode));
+        if ( new_stream == nullptr && !replace && !_base->pathInStream.empty() && _base->exists() )
+            set_status(63, "FILE EXISTS");
+        if ( new_stream != nullptr )
+        {
+            new_stream->open(std::ios::out);
+
+            // ",S" / ",U" open mode, SAVE is always PRG
+            uint8_t file_type = 2;
+            if ( channel != CHANNEL_SAVE && pt.size() > 1 && !pt[1].empty() )
+                file_type = mstr::startsWith(pt[1], "S", false) ? 1 : mstr::startsWith(pt[1], "U", false) ? 3 : 2;
+            new_stream->setFileType(file_type);
+
+            // Collect the data and hand it to the target in large blocks, committed on CLOSE
+            if ( new_stream->isOpen() )
+            {
+                std::string backend = _base->scheme;
+                if ( backend.empty() )
+                    backend = mstr::startsWith(_base->path, "/sd") ? "sd" : "flash";
+                new_stream = std::make_shared<SaveStream>(new_stream, backend);
+            }
+        }
     }
     else
     {
@@ -830,6 +1423,18 @@ bool iecDrive::closeStream ( uint8_t channel, bool close_all )
     if ( found != streams.end() )
     {
         auto closingStream = (*found).second;
+        closingStream->close(); // writes back anything saved into an image
+
+        auto buffer = buffer_channels.find(channel);
+        if ( buffer != buffer_channels.end() )
+        {
+            memory.freeBuffer(buffer->second->buffer());
+            buffer_channels.erase(buffer);
+
+            // Last direct access channel, block writes go to the image now
+            if ( buffer_channels.empty() )
+                block_image.reset();
+        }
         ImageBroker::dispose(closingStream->url);
         auto closingMFile(MFSOwner::File(closingStream->url));
         Debug_printv("Stream closed. key[%d] count[%d] url[%s] path[%s]", channel, streams.size(), closingStream->url.c_str(), closingMFile->pathInStream.c_str());
@@ -1265,7 +1870,11 @@ bool iecDrive::sendFile()
 #endif
 
         // Read bytes
-        len = istream->read(buf, sizeof(buf));
+        {
+            TRACE_SPAN(TRACE_READ);
+            len = istream->read(buf, sizeof(buf));
+            TRACE_ARG(len);
+        }
         count = istream->position();
         avail = istream->available();
 
@@ -1333,6 +1942,10 @@ bool iecDrive::sendFile()
     //fnLedManager.set(eLed::LED_BUS, false);
     //oLedStrip.stopRainbow();
 
+    // The computer is busy with this one for a while, fetch the next
+    if ( commanddata.channel == CHANNEL_LOAD && eoi && !istream->error() )
+        LoadPrefetch::instance().completed();
+
     if ( istream->error() )
     {
         printf("sendFile: Transfer aborted!\r\n");
@@ -1378,7 +1991,11 @@ bool iecDrive::saveFile()
 
         printf("saveFile: [$%.4X]\r\n=================================\r\n", load_address);
 
-	ostream->write((const uint8_t *) payload.data(), payload.size());
+        if ( ostream->write((const uint8_t *) payload.data(), payload.size()) != payload.size() )
+        {
+            printf("saveFile: write failed!\r\n");
+            success = false;
+        }
     }
 
     printf("=================================\r\n%lu bytes saved\r\n", ostream->position());
@@ -19,11 +19,17 @@
 #include "../meatloaf/wrappers/iec_buffer.h"
 #include "../meatloaf/wrappers/directory_stream.h"
 
+#include "drive_memory.h"
+#include "drive_prefetch.h"
+
 #include "dos/_dos.h"
 #include "dos/cbmdos.2.6.h"
 
 #define PRODUCT_ID "MEATLOAF CBM"
 
+// Bytes moved per read/write when copying files
+#define DOS_COPY_BUFFER_SIZE 4096
+
 class iecDrive : public virtualDevice
 {
 private:
@@ -46,8 +52,9 @@ protected:
     // RAM/ROM
     // https://g3sl.github.io/c1541rom.html
     // https://www.ythiee.com/2021/06/06/floppy-drive-deep-dive/
-//    std::streambuf ram;
+    DriveMemory memory;
     std::unique_ptr<MFile> rom;     // ROM File for current drive model if available
+    std::string memory_response;    // M-R data, read back instead of the status
 
     // Directory
     void sendListing();
@@ -62,7 +69,7 @@ protected:
     void sendFileNotFound();
 
     // Named Channel functions
-    bool registerStream (uint8_t channel);
+    bool registerStream (uint8_t channel, bool replace = false);
     std::shared_ptr<MStream> retrieveStream ( uint8_t channel );
     bool closeStream ( uint8_t channel, bool close_all = false );
 #if 0
@@ -191,6 +198,41 @@ protected:
      */
     void get_prefix();
 
+    /**
+     * @brief CBM DOS copy, scratch, rename, new and validate, carried out on the storage side
+     */
+    void dos_copy();
+    void dos_scratch();
+    void dos_rename();
+    void dos_new();
+    void dos_validate();
+
+    /**
+     * @brief Set the message read back from the command channel
+     */
+    void set_status(uint8_t errnum, std::string msg, uint8_t track = 0, uint8_t sector = 0);
+
+    MFile* dos_directory(std::string name, std::string &pattern);
+    MFile* dos_file(std::string name);
+    std::vector<std::string> dos_match(MFile* dir, std::string pattern);
+    bool dos_copy_files(const std::vector<std::string> &sources, MFile* target);
+
+    std::vector<uint8_t> copy_buffer;   // shared by every copy, allocated on first use
+
+    /**
+     * @brief Direct access ('#') channels and the block and memory commands working on them
+     */
+    bool openBufferChannel(uint8_t channel);
+    MStream* blockImage();
+    void dos_block(bool write, bool user);
+    void dos_buffer_pointer();
+    void dos_memory_read();
+    void dos_memory_write();
+    void dos_memory_execute();
+
+    std::unordered_map<uint8_t, std::shared_ptr<DriveBufferStream>> buffer_channels;
+    std::shared_ptr<MStream> block_image;   // image the block commands work on, shared by all '#' channels
+
 
 
 public:
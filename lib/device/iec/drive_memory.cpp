@@ -0,0 +1,223 @@
+#ifdef BUILD_IEC
+
+#include "drive_memory.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#include <esp_rom_crc.h>
+
+#include "../../include/debug.h"
+
+#include "string_utils.h"
+
+
+/********************************************************
+ * Fast loader signatures
+ ********************************************************/
+
+// Entries come from add() or DRIVE_CODE_PATH. Unknown uploads are logged by
+// DriveMemory::execute() in the same form, ready to be added to the file.
+std::vector<DriveCodeSignature> DriveCode::signatures;
+bool DriveCode::loaded = false;
+
+void DriveCode::add(DriveCodeSignature signature)
+{
+    signatures.push_back(signature);
+}
+
+const DriveCodeSignature* DriveCode::find(uint16_t address, uint16_t length, uint32_t crc)
+{
+    load();
+
+    for (auto &s : signatures)
+    {
+        if (s.address == address && s.length == length && s.crc == crc)
+            return &s;
+    }
+
+    return nullptr;
+}
+
+void DriveCode::load()
+{
+    if (loaded)
+        return;
+    loaded = true;
+
+    std::unique_ptr<MFile> file(MFSOwner::File(DRIVE_CODE_PATH));
+    if (file == nullptr || !file->exists())
+        return;
+
+    std::unique_ptr<MStream> stream(file->getSourceStream());
+    if (stream == nullptr || !stream->isOpen())
+        return;
+
+    std::string text;
+    uint8_t buf[256];
+    uint32_t len;
+    while ((len = stream->read(buf, sizeof(buf))) > 0)
+        text.append((const char *)buf, len);
+
+    static const std::pair<const char *, bus_protocol_t> protocols[] = {
+        {"serial", PROTOCOL_SERIAL},
+        {"saucedos", PROTOCOL_SAUCEDOS},
+        {"jiffydos", PROTOCOL_JIFFYDOS},
+        {"epyxfastload", PROTOCOL_EPYXFASTLOAD},
+        {"warpspeed", PROTOCOL_WARPSPEED},
+        {"speeddos", PROTOCOL_SPEEDDOS},
+        {"dolphindos", PROTOCOL_DOLPHINDOS},
+    };
+
+    std::istringstream lines(text);
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        mstr::trim(line);
+        if (line.empty() || line[0] == '#' || line[0] == ';')
+            continue;
+
+        std::istringstream fields(line);
+        std::string address, length, crc, protocol, name;
+        if (!(fields >> address >> length >> crc >> protocol))
+        {
+            Debug_printv("Bad line [%s]", line.c_str());
+            continue;
+        }
+        std::getline(fields, name);
+        mstr::trim(name);
+        mstr::toLower(protocol);
+
+        for (auto &p : protocols)
+        {
+            if (protocol == p.first)
+            {
+                add({(uint16_t)strtoul(address.c_str(), nullptr, 16), (uint16_t)strtoul(length.c_str(), nullptr, 10),
+                     (uint32_t)strtoul(crc.c_str(), nullptr, 16), p.second, name});
+                break;
+            }
+        }
+    }
+
+    Debug_printv("signatures[%d]", signatures.size());
+}
+
+
+/********************************************************
+ * Drive RAM
+ ********************************************************/
+
+void DriveMemory::reset()
+{
+    std::fill(ram.begin(), ram.end(), 0);
+    buffers_used = 0;
+    upload_start = upload_end = 0;
+}
+
+int8_t DriveMemory::allocateBuffer(int8_t n)
+{
+    if (n >= DRIVE_BUFFER_COUNT)
+        return -1;
+
+    if (n < 0)
+    {
+        for (n = 0; n < DRIVE_BUFFER_COUNT; n++)
+            if (!(buffers_used & (1 << n)))
+                break;
+
+        if (n == DRIVE_BUFFER_COUNT)
+            return -1;
+    }
+    else if (buffers_used & (1 << n))
+        return -1;
+
+    buffers_used |= (1 << n);
+    return n;
+}
+
+void DriveMemory::freeBuffer(uint8_t n)
+{
+    buffers_used &= ~(1 << n);
+}
+
+void DriveMemory::write(uint16_t address, const std::string &data)
+{
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        if (isRAM(address + i))
+            ram[(address + i) % DRIVE_RAM_SIZE] = data[i];
+    }
+
+    // Loaders upload in small pieces, one after the other
+    uint16_t end = address + data.size();
+    if (upload_end == upload_start || address != upload_end)
+        upload_start = address;
+    upload_end = end;
+}
+
+const DriveCodeSignature* DriveMemory::execute(uint16_t address)
+{
+    uint16_t start = upload_start;
+    uint16_t length = upload_end - upload_start;
+    upload_start = upload_end = 0;
+
+    if (length == 0 || address < start || address >= start + length || !isRAM(start + length - 1))
+    {
+        Debug_printv("M-E $%.4X, no code uploaded there", address);
+        return nullptr;
+    }
+
+    // The code is contiguous in RAM unless it wrapped around the mirror
+    std::vector<uint8_t> code(length);
+    for (uint16_t i = 0; i < length; i++)
+        code[i] = read(start + i);
+    uint32_t crc = esp_rom_crc32_le(0, code.data(), length);
+
+    auto signature = DriveCode::find(address, length, crc);
+    if (signature == nullptr)
+        Debug_printv("Unknown drive code [%.4X %d %.8lX] from $%.4X", address, length, crc, start);
+    else
+        Debug_printv("Drive code [%s] protocol[%d]", signature->name.c_str(), signature->protocol);
+
+    return signature;
+}
+
+
+/********************************************************
+ * Direct access channel
+ ********************************************************/
+
+uint32_t DriveBufferStream::read(uint8_t* buf, uint32_t size)
+{
+    if (size > available())
+        size = available();
+
+    memcpy(buf, _memory->buffer(_buffer) + _position, size);
+    _position += size;
+    return size;
+}
+
+uint32_t DriveBufferStream::write(const uint8_t *buf, uint32_t size)
+{
+    // Writing past the end of the buffer wraps the pointer, like the drive does
+    uint8_t *data = _memory->buffer(_buffer);
+    for (uint32_t i = 0; i < size; i++)
+    {
+        data[_position & 0xFF] = buf[i];
+        _position = (_position + 1) & 0xFF;
+    }
+    _size = block_size;
+    return size;
+}
+
+bool DriveBufferStream::seek(uint32_t pos)
+{
+    if (pos >= block_size)
+        return false;
+
+    _position = pos;
+    return true;
+}
+
+#endif // BUILD_IEC
@@ -0,0 +1,128 @@
+#ifndef DRIVE_MEMORY_H
+#define DRIVE_MEMORY_H
+
+//
+// Emulated 1541 memory
+//
+// RAM holds the five 256 byte job buffers used by direct access ('#')
+// channels, and whatever the computer puts there with M-W. Code uploaded
+// with M-W and started with M-E is matched against a table of known
+// fast loaders, so the bus can switch to the protocol it speaks.
+//
+// https://g3sl.github.io/c1541rom.html
+// http://unusedino.de/ec64/technical/aay/c1541/
+//
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../../bus/bus.h"
+#include "../meatloaf/meatloaf.h"
+
+#define DRIVE_RAM_SIZE          0x0800
+#define DRIVE_BUFFER_BASE       0x0300
+#define DRIVE_BUFFER_COUNT      5
+
+// Drive ROM image, mapped so that it ends at $FFFF
+#define DRIVE_ROM_PATH          "/.sys/rom/dos1541.rom"
+// Extra drive code signatures, one per line: address length crc32 protocol name
+#define DRIVE_CODE_PATH         "/.sys/drivecode.txt"
+
+
+/********************************************************
+ * Fast loader signatures
+ ********************************************************/
+
+struct DriveCodeSignature
+{
+    uint16_t address;           // M-E address
+    uint16_t length;            // bytes uploaded with M-W, ending at or after address
+    uint32_t crc;               // CRC32 of those bytes
+    bus_protocol_t protocol;
+    std::string name;
+};
+
+class DriveCode
+{
+public:
+    static void add(DriveCodeSignature signature);
+    static const DriveCodeSignature* find(uint16_t address, uint16_t length, uint32_t crc);
+
+    // Read DRIVE_CODE_PATH once, on first use
+    static void load();
+
+private:
+    static std::vector<DriveCodeSignature> signatures;
+    static bool loaded;
+};
+
+
+/********************************************************
+ * Drive RAM
+ ********************************************************/
+
+class DriveMemory
+{
+public:
+    DriveMemory() : ram(DRIVE_RAM_SIZE, 0) {};
+
+    void reset();
+
+    uint8_t* buffer(uint8_t n) { return &ram[DRIVE_BUFFER_BASE + (n * 256)]; };
+
+    // A specific buffer, or the first free one when n < 0. Returns -1 if none.
+    int8_t allocateBuffer(int8_t n = -1);
+    void freeBuffer(uint8_t n);
+
+    // M-R / M-W, RAM only, mirrored through $0000-$17FF like the real drive
+    bool isRAM(uint16_t address) { return address < 0x1800; };
+    uint8_t read(uint16_t address) { return ram[address % DRIVE_RAM_SIZE]; };
+    void write(uint16_t address, const std::string &data);
+
+    // M-E, the fast loader the code run at address belongs to, if known
+    const DriveCodeSignature* execute(uint16_t address);
+
+private:
+    std::vector<uint8_t> ram;
+    uint8_t buffers_used = 0;   // bit n set = buffer n taken
+
+    // RAM written with M-W since the last M-E
+    uint16_t upload_start = 0;
+    uint16_t upload_end = 0;
+};
+
+
+/********************************************************
+ * Direct access channel
+ ********************************************************/
+
+// A '#' channel reads and writes one RAM buffer at its buffer pointer (B-P)
+
+class DriveBufferStream: public MStream {
+public:
+    DriveBufferStream(DriveMemory *memory, uint8_t buffer) : _memory(memory), _buffer(buffer) {
+        _size = block_size;
+    };
+
+    uint8_t buffer() { return _buffer; };
+
+    bool isOpen() override { return true; };
+    bool isRandomAccess() override { return true; };
+    bool open(std::ios_base::openmode mode) override { return true; };
+    void close() override {};
+
+    uint32_t read(uint8_t* buf, uint32_t size) override;
+    uint32_t write(const uint8_t *buf, uint32_t size) override;
+    bool seek(uint32_t pos) override;
+
+    // Data ends at the last byte index held in byte 0 (B-R), or runs the whole sector (U1)
+    void setEnd(uint16_t end) { _size = end; };
+
+private:
+    DriveMemory *_memory;
+    uint8_t _buffer;
+};
+
+#endif // DRIVE_MEMORY_H
@@ -0,0 +1,337 @@
+#ifdef BUILD_IEC
+
+#include "drive_prefetch.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+
+#include "../../include/debug.h"
+
+#include "string_utils.h"
+#include "utils.h"
+
+
+/********************************************************
+ * Prefetched file
+ ********************************************************/
+
+uint32_t PrefetchStream::read(uint8_t* buf, uint32_t size)
+{
+    if (size > available())
+        size = available();
+
+    memcpy(buf, _data.data() + _position, size);
+    _position += size;
+    return size;
+}
+
+bool PrefetchStream::seek(uint32_t pos)
+{
+    if (pos > _size)
+        return false;
+
+    _position = pos;
+    return true;
+}
+
+
+/********************************************************
+ * Load history and read-ahead
+ ********************************************************/
+
+LoadPrefetch& LoadPrefetch::instance()
+{
+    static LoadPrefetch prefetch;
+    return prefetch;
+}
+
+static std::string prefetch_join(const std::string &image, const std::string &name)
+{
+    return mstr::endsWith(image, "/") ? image + name : image + "/" + name;
+}
+
+std::shared_ptr<MStream> LoadPrefetch::opened(MFile *file)
+{
+    // Files in an image are keyed by the image, everything else by its directory
+    std::string image, name;
+    if (file->pathInStream.empty() || file->streamFile == nullptr)
+    {
+        image = file->base();
+        name = file->name;
+    }
+    else
+    {
+        image = file->streamFile->url;
+        name = file->pathInStream;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (!_history_loaded)
+    {
+        _history_loaded = true;
+        load();
+    }
+
+    if (_task == nullptr)
+        xTaskCreatePinnedToCore(task, "ml_prefetch", PREFETCH_STACKSIZE, this, PREFETCH_PRIORITY, &_task, PREFETCH_CPUAFFINITY);
+
+    // Learn the step from the last LOAD to this one
+    if (image == _last_image && !_last_name.empty())
+    {
+        _history[image][_last_name][name]++;
+        _history_dirty = true;
+
+        auto found = std::find(_history_order.begin(), _history_order.end(), image);
+        if (found != _history_order.end())
+            _history_order.erase(found);
+        _history_order.push_back(image);
+
+        while (_history_order.size() > PREFETCH_HISTORY_IMAGES)
+        {
+            _history.erase(_history_order.front());
+            _history_order.erase(_history_order.begin());
+        }
+    }
+    _last_image = image;
+    _last_name = name;
+
+    // Hand over the read-ahead copy if it is this file
+    std::shared_ptr<MStream> stream;
+    if (!_want_url.empty())
+    {
+        if (_ready_url == file->url)
+        {
+            _stats.hits++;
+            _stats.bytes += _ready_data.size();
+            _stats.saved_us += _ready_us;
+            Debug_printv("prefetch hit [%s] size[%d] saved[%lldms]", file->url.c_str(), _ready_data.size(), _ready_us / 1000);
+            stream = std::make_shared<PrefetchStream>(file->url, std::move(_ready_data), _ready_subdirs);
+        }
+        else if (_want_url == file->url)
+            _stats.late++;
+        else
+            _stats.misses++;
+    }
+
+    // Whatever is still being read is of no use now
+    _want_url.clear();
+    _ready_url.clear();
+    _ready_data.clear();
+    _ready_data.shrink_to_fit();
+    _generation++;
+
+    return stream;
+}
+
+void LoadPrefetch::completed()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (_task == nullptr || _last_image.empty())
+        return;
+
+    auto image = _history.find(_last_image);
+    if (image != _history.end())
+    {
+        auto steps = image->second.find(_last_name);
+        if (steps != image->second.end())
+        {
+            // Follow the step taken most often
+            auto next = std::max_element(steps->second.begin(), steps->second.end(),
+                [](const std::pair<const std::string, uint32_t> &a, const std::pair<const std::string, uint32_t> &b) {
+                    return a.second < b.second;
+                });
+
+            if (next != steps->second.end() && next->second >= PREFETCH_MIN_COUNT)
+            {
+                _want_url = prefetch_join(_last_image, next->first);
+                _generation++;
+                Debug_printv("prefetch next [%s] count[%lu]", _want_url.c_str(), next->second);
+            }
+        }
+    }
+
+    // Wake the task even with nothing to read, it saves the history once LOADs stop
+    xTaskNotifyGive(_task);
+}
+
+void LoadPrefetch::invalidate()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _want_url.clear();
+    _ready_url.clear();
+    _ready_data.clear();
+    _ready_data.shrink_to_fit();
+    _generation++;
+}
+
+LoadPrefetchStats LoadPrefetch::stats()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+}
+
+void LoadPrefetch::lock()
+{
+    // A read-ahead sees this and lets go after its current read
+    _media_waiting++;
+    _media_mutex.lock();
+    _media_waiting--;
+}
+
+void LoadPrefetch::unlock()
+{
+    _media_mutex.unlock();
+}
+
+void LoadPrefetch::task(void *arg)
+{
+    auto prefetch = (LoadPrefetch *)arg;
+
+    while (true)
+    {
+        bool dirty;
+        {
+            std::lock_guard<std::mutex> lock(prefetch->_mutex);
+            dirty = prefetch->_history_dirty;
+        }
+
+        // Nothing new for a while, the history can go to flash
+        if (!ulTaskNotifyTake(pdTRUE, dirty ? pdMS_TO_TICKS(PREFETCH_SAVE_DELAY_MS) : portMAX_DELAY))
+        {
+            prefetch->save();
+            continue;
+        }
+
+        std::string url;
+        uint32_t generation;
+        {
+            std::lock_guard<std::mutex> lock(prefetch->_mutex);
+            url = prefetch->_want_url;
+            generation = prefetch->_generation;
+        }
+
+        if (!url.empty())
+            prefetch->fetch(url, generation);
+    }
+}
+
+void LoadPrefetch::fetch(std::string url, uint32_t generation)
+{
+    std::lock_guard<std::mutex> media(_media_mutex);
+    int64_t start = esp_timer_get_time();
+
+    std::unique_ptr<MFile> file(MFSOwner::File(url));
+    if (file == nullptr)
+        return;
+
+    std::unique_ptr<MStream> stream(file->getSourceStream());
+    if (stream == nullptr || !stream->isOpen())
+        return;
+
+    uint32_t size = stream->size();
+    if (size == 0 || size > PREFETCH_MAX_SIZE
+        || heap_caps_get_largest_free_block(MALLOC_CAP_8BIT) < size + PREFETCH_HEAP_RESERVE)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stats.skipped++;
+        return;
+    }
+
+    std::string data(size, '\0');
+    uint32_t count = 0;
+    while (count < size)
+    {
+        // The bus moved on or needs meatloaf, stop reading
+        if (generation != _generation || _media_waiting)
+            return;
+
+        uint32_t len = stream->read((uint8_t *)&data[count], std::min<uint32_t>(size - count, PREFETCH_READ_SIZE));
+        if (len < 1 || stream->error())
+            break;
+        count += len;
+    }
+    data.resize(count);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (generation != _generation || count == 0)
+        return;
+
+    _ready_url = url;
+    _ready_data = std::move(data);
+    _ready_subdirs = stream->has_subdirs;
+    _ready_us = esp_timer_get_time() - start;
+    _stats.predictions++;
+    Debug_printv("prefetched [%s] size[%lu] in [%lldms]", url.c_str(), count, _ready_us / 1000);
+}
+
+void LoadPrefetch::load()
+{
+    std::unique_ptr<MFile> file(MFSOwner::File(PREFETCH_HISTORY_PATH));
+    if (file == nullptr || !file->exists())
+        return;
+
+    std::unique_ptr<MStream> stream(file->getSourceStream());
+    if (stream == nullptr || !stream->isOpen())
+        return;
+
+    std::string text;
+    uint8_t buf[256];
+    uint32_t len;
+    while ((len = stream->read(buf, sizeof(buf))) > 0)
+        text.append((const char *)buf, len);
+
+    std::istringstream lines(text);
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        auto fields = util_tokenize(line, '\t');
+        if (fields.size() != 4)
+            continue;
+
+        _history[fields[0]][fields[1]][fields[2]] = strtoul(fields[3].c_str(), nullptr, 10);
+        if (std::find(_history_order.begin(), _history_order.end(), fields[0]) == _history_order.end())
+            _history_order.push_back(fields[0]);
+    }
+
+    Debug_printv("images[%d]", _history.size());
+}
+
+void LoadPrefetch::save()
+{
+    // Written in least recently used order, so load() gets the order back
+    std::string text;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_history_dirty)
+            return;
+        _history_dirty = false;
+
+        for (auto &image : _history_order)
+            for (auto &steps : _history[image])
+                for (auto &next : steps.second)
+                    text += image + "\t" + steps.first + "\t" + next.first + "\t" + std::to_string(next.second) + "\n";
+    }
+
+    std::lock_guard<std::mutex> media(_media_mutex);
+    std::unique_ptr<MFile> file(MFSOwner::File(PREFETCH_HISTORY_PATH));
+    if (file == nullptr)
+        return;
+
+    std::unique_ptr<MStream> stream(file->getSourceStream(std::ios_base::out));
+    if (stream == nullptr)
+        return;
+
+    stream->open(std::ios_base::out);
+    if (!stream->isOpen() || stream->write((const uint8_t *)text.data(), text.size()) != text.size())
+        Debug_printv("Can't write [%s]", PREFETCH_HISTORY_PATH);
+    stream->close();
+}
+
+#endif // BUILD_IEC
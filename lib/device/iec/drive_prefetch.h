@@ -0,0 +1,146 @@
+#ifndef DRIVE_PREFETCH_H
+#define DRIVE_PREFETCH_H
+
+//
+// Predictive prefetch of the next LOAD
+//
+// Multi-load games and demos LOAD their parts in the same order every time.
+// Each LOAD from an image (or a directory) is recorded as a step from the
+// file loaded before it. When a LOAD finishes, the file most often loaded
+// after it is read in the background, on the core the bus doesn't run on,
+// and handed over as a memory stream if the computer asks for it next.
+//
+// The history survives a restart in PREFETCH_HISTORY_PATH, one step per
+// line: image, file, next file, count (tab separated). It is written once
+// LOADs have stopped for PREFETCH_SAVE_DELAY_MS, not after every one.
+//
+// Meatloaf isn't thread safe. The drive locks LoadPrefetch while it handles
+// a channel, and the read-ahead only uses meatloaf with that lock held. A
+// read-ahead gives the lock up between reads as soon as the drive wants it.
+//
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "../meatloaf/meatloaf.h"
+
+#define PREFETCH_HISTORY_PATH   "/.sys/loadhistory.txt"
+// Images remembered, the least recently loaded from is forgotten first
+#define PREFETCH_HISTORY_IMAGES 32
+// Largest file read ahead, and free heap left over after it
+#define PREFETCH_MAX_SIZE       65536
+#define PREFETCH_HEAP_RESERVE   32768
+// A step seen once is enough to follow
+#define PREFETCH_MIN_COUNT      1
+// Read-ahead block, the drive waits for at most one of these
+#define PREFETCH_READ_SIZE      4096
+// Quiet time before the history is written to flash
+#define PREFETCH_SAVE_DELAY_MS  30000
+
+#define PREFETCH_STACKSIZE      4096
+#define PREFETCH_PRIORITY       5
+#define PREFETCH_CPUAFFINITY    0   // the bus runs on core 1
+
+
+/********************************************************
+ * Prefetched file
+ ********************************************************/
+
+class PrefetchStream: public MStream {
+public:
+    PrefetchStream(std::string url, std::string data, bool subdirs) : _data(std::move(data)) {
+        this->url = url;
+        has_subdirs = subdirs;
+        mode = std::ios_base::in;
+        _size = _data.size();
+    };
+
+    bool isOpen() override { return true; };
+    bool isRandomAccess() override { return true; };
+    bool open(std::ios_base::openmode mode) override { return true; };
+    void close() override {};
+
+    uint32_t read(uint8_t* buf, uint32_t size) override;
+    uint32_t write(const uint8_t *buf, uint32_t size) override { return 0; };
+    bool seek(uint32_t pos) override;
+
+private:
+    std::string _data;
+};
+
+
+/********************************************************
+ * Load history and read-ahead
+ ********************************************************/
+
+struct LoadPrefetchStats {
+    uint32_t predictions = 0;   // files read ahead
+    uint32_t hits = 0;          // ...and then loaded
+    uint32_t misses = 0;        // another file was loaded instead
+    uint32_t late = 0;          // the right file, but still being read
+    uint32_t skipped = 0;       // predicted, but too large or not enough memory
+    uint64_t bytes = 0;         // read ahead and used
+    uint64_t saved_us = 0;      // time the hits took to read ahead
+};
+
+class LoadPrefetch {
+    // image -> file -> next file -> count
+    typedef std::map<std::string, std::map<std::string, uint32_t>> Steps;
+    std::map<std::string, Steps> _history;
+    std::vector<std::string> _history_order;
+    bool _history_loaded = false;
+    bool _history_dirty = false;
+
+    // Last LOAD, the step to the next one starts here
+    std::string _last_image;
+    std::string _last_name;
+
+    // Read-ahead, wanted by the bus and done by the task
+    std::string _want_url;
+    std::string _ready_url;
+    std::string _ready_data;
+    bool _ready_subdirs = false;
+    int64_t _ready_us = 0;
+    volatile uint32_t _generation = 0;   // bumped whenever a read-ahead goes stale
+
+    LoadPrefetchStats _stats;
+    std::mutex _mutex;
+    TaskHandle_t _task = nullptr;
+
+    // Held while meatloaf is used, see lock()
+    std::mutex _media_mutex;
+    std::atomic<uint32_t> _media_waiting{0};
+
+    static void task(void *arg);
+    void fetch(std::string url, uint32_t generation);
+    void load();
+    void save();
+
+public:
+    static LoadPrefetch& instance();
+
+    // A LOAD is opening file, returns the read-ahead copy if there is one
+    std::shared_ptr<MStream> opened(MFile *file);
+
+    // The LOAD went through, start reading the likely next file
+    void completed();
+
+    // The media was written to, drop what was read ahead
+    void invalidate();
+
+    LoadPrefetchStats stats();
+
+    // Taken by the drive around everything that touches meatloaf
+    void lock();
+    void unlock();
+};
+
+#endif // DRIVE_PREFETCH_H
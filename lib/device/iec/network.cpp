@@ -243,8 +243,22 @@ void iecNetwork::iec_reopen_load()
         if ((!ns.connected) || ns.error == 136) // EOF
             eoi = true;
 
-        IEC.sendBytes(channel_data.receiveBuffer, true);
-        channel_data.receiveBuffer.erase(0, blockSize);
+        // Send straight out of the receive buffer, one contiguous segment at a time.
+        // EOI goes with the last byte of the last block.
+        size_t len;
+        const uint8_t *data;
+        while ((data = channel_data.receiveBuffer.peek(len)) != nullptr)
+        {
+            bool last = eoi && len == channel_data.receiveBuffer.length();
+            size_t sent = IEC.sendBytes((const char *)data, len, last);
+            channel_data.receiveBuffer.consume(sent);
+
+            if (sent < len)
+            {
+                Debug_printv("LOAD aborted by host after %u bytes", (unsigned)sent);
+                return;
+            }
+        }
     }
 
     iecStatus.error = NETWORK_ERROR_END_OF_FILE;
@@ -397,32 +411,26 @@ void iecNetwork::iec_reopen_channel_talk()
     }
 
     // ALWAYS translate the data to PETSCII towards the host. Translation mode needs rewriting.
-    util_devicespec_fix_9b((uint8_t *) channel_data.receiveBuffer.data(), channel_data.receiveBuffer.length());
-    channel_data.receiveBuffer = mstr::toPETSCII2(channel_data.receiveBuffer);
-
-    // Debug_printv("TALK: sending data to host: >%s< [%s]", receiveBuffer[commanddata.channel]->c_str(), mstr::toHex(*receiveBuffer[commanddata.channel]).c_str());
-    do
+    // Each contiguous segment of the receive buffer is converted in place the first
+    // time it reaches the head, then sent as is. Whatever the host doesn't take
+    // before ATN stays in the buffer for the next TALK.
+    size_t len;
+    const uint8_t *data = channel_data.receiveBuffer.peekPetscii(len, util_devicespec_fix_9b);
+    while (data != nullptr)
     {
-        char b = channel_data.receiveBuffer.front();
+        set_eoi = (len == channel_data.receiveBuffer.length());
 
-        if (channel_data.receiveBuffer.empty())
-        {
-            //Debug_printv("Receive Buffer Empty.");
-            set_eoi = true;
-        }
+        size_t sent = IEC.sendBytes((const char *)data, len, set_eoi);
+        channel_data.receiveBuffer.consume(sent);
 
-        if (!IEC.sendByte(b, set_eoi))
+        if (sent < len)
         {
-	    //Debug_printv("TALK ERROR! flags[%d]\n", IEC.flags);
+            //Debug_printv("TALK ERROR! flags[%d]\n", IEC.flags);
             return;
         }
 
-#if 0
-        if ( !(IEC.flags & ATN_ASSERTED) )
-            channel_data.receiveBuffer.erase(0, 1);
-#endif
-
-    } while( /*!(IEC.flags & ATN_ASSERTED) &&*/ !set_eoi );
+        data = channel_data.receiveBuffer.peekPetscii(len, util_devicespec_fix_9b);
+    }
 }
 
 void iecNetwork::set_login_password()
@@ -494,6 +502,9 @@ void iecNetwork::parse_json()
 
     channel_data.protocol->status(&ns);
 
+    // Optional JSON Pointer: only keep that part of the document
+    channel_data.json->setParseFilter(pt.size() > 2 ? pt[2] : "");
+
     if (!channel_data.json->parse())
     {
         Debug_printf("could not parse json\r\n");
@@ -551,7 +562,7 @@ void iecNetwork::query_json()
     size_t len = channel_data.json->readValueLen();
     std::vector<uint8_t> buffer(len);
     channel_data.json->readValue(buffer.data(), buffer.size());
-    channel_data.receiveBuffer += std::string(buffer.begin(), buffer.end());
+    channel_data.receiveBuffer.append((const char *)buffer.data(), buffer.size());
 
     snprintf(reply, 80, "query set to %s", s.c_str());
     iecStatus.error = NETWORK_ERROR_SUCCESS;
@@ -593,11 +604,12 @@ void iecNetwork::parse_bite()
     //mstr::replaceAll(*receiveBuffer[channel], ":", "\":\"");
     //mstr::replaceAll(*receiveBuffer[channel], "\r", "\"\r\"");
     //mstr::replaceAll(*receiveBuffer[channel], "\"", "\"\"");
-    mstr::replaceAll(channel_data.receiveBuffer, "\"", "");
+    std::string data = channel_data.receiveBuffer.toString();
+    mstr::replaceAll(data, "\"", "");
 
     // break up receiveBuffer[channel] into bites less than bite_size bytes
     std::string bites = "\"";
-    bites.reserve(channel_data.receiveBuffer.size() + (channel_data.receiveBuffer.size() / bite_size));
+    bites.reserve(data.size() + (data.size() / bite_size));
 
     int start = 0;
     int end = 0;
@@ -608,18 +620,18 @@ void iecNetwork::parse_bite()
         start = end;
 
         // Set remaining length
-        len = channel_data.receiveBuffer.size() - start;
+        len = data.size() - start;
         if ( len > bite_size )
             len = bite_size;
 
         // Don't make extra bites!
-        end = channel_data.receiveBuffer.find('\r', start);
+        end = data.find('\r', start);
         if ( end == std::string::npos )
             end = start + len; // None found so set end
 
         // Take a bite
         Debug_printv("start[%d] end[%d] len[%d] bite_size[%d]", start, end, len, bite_size);
-        std::string bite = channel_data.receiveBuffer.substr(start, len);
+        std::string bite = data.substr(start, len);
         bites += bite;
         Debug_printv("bite[%s]", bite.c_str());
 
@@ -628,11 +640,11 @@ void iecNetwork::parse_bite()
              bites += "\r\"";
 
         count++;
-    } while ( end < channel_data.receiveBuffer.size() );
+    } while ( end < data.size() );
  
     //bites += "\"";
     //Debug_printv("[%s]", bites.c_str());
-    channel_data.receiveBuffer = bites;
+    channel_data.receiveBuffer.assign(bites);
 }
 
 void iecNetwork::set_translation_mode()
@@ -168,7 +168,7 @@ private:
     uint8_t active_status_channel=0;
 
     /**
-     * @brief parse JSON
+     * @brief parse JSON, jsonparse,<channel>[,<json pointer to keep>]
      */
     void parse_json();
 
@@ -48,6 +48,7 @@ FNJSON::~FNJSON()
 void FNJSON::setLineEnding(const std::string &_lineEnding)
 {
     lineEnding = _lineEnding;
+    _valueValid = false;
 }
 
 /**
@@ -79,10 +80,22 @@ void FNJSON::setReadQuery(const std::string &queryString, uint8_t queryParam)
 #endif
     _queryString = queryString;
     _queryParam = queryParam;
+    _valueValid = false;
     _item = resolveQuery();
     json_bytes_remaining = readValueLen();
 }
 
+/**
+ * Set JSON Pointer of the only subtree to keep on the next parse()
+ */
+void FNJSON::setParseFilter(const std::string &pointer)
+{
+#ifdef VERBOSE_PROTOCOL
+    Debug_printf("FNJSON::setParseFilter(%s)\r\n", pointer.c_str());
+#endif
+    _parseFilter = pointer;
+}
+
 /**
  * Resolve query string
  */
@@ -91,6 +104,16 @@ cJSON *FNJSON::resolveQuery()
     if (_queryString.empty())
         return _json;
 
+    // With a parse filter, _json is the filtered subtree. Accept the full
+    // pointer as well as one relative to the filter.
+    if (!_parseFilter.empty() && _queryString.compare(0, _parseFilter.size(), _parseFilter) == 0)
+    {
+        if (_queryString.size() == _parseFilter.size())
+            return _json;
+        if (_queryString[_parseFilter.size()] == '/')
+            return cJSONUtils_GetPointer(_json, _queryString.c_str() + _parseFilter.size());
+    }
+
     return cJSONUtils_GetPointer(_json, _queryString.c_str());
 }
 
@@ -272,6 +295,20 @@ std::string FNJSON::getValue(cJSON *item)
     return ss.str();
 }
 
+/**
+ * Rendered value of the current query, built once per query
+ */
+const std::string &FNJSON::value()
+{
+    if (!_valueValid)
+    {
+        _value = getValue(_item);
+        _valueValid = true;
+    }
+
+    return _value;
+}
+
 /**
  * Return requested value
  */
@@ -280,7 +317,8 @@ bool FNJSON::readValue(uint8_t *rx_buf, unsigned short len)
     if (_item == nullptr)
         return true; // error
 
-    memcpy(rx_buf, getValue(_item).data(), len);
+    const std::string &v = value();
+    memcpy(rx_buf, v.data(), len < v.size() ? len : v.size());
 
     return false; // no error.
 }
@@ -293,7 +331,7 @@ int FNJSON::readValueLen()
     if (_item == nullptr)
         return 0;
 
-    return getValue(_item).size();
+    return value().size();
 }
 
 /**
@@ -309,13 +347,18 @@ bool FNJSON::parse()
         cJSON_Delete(_json);
         _json = nullptr;
     }
+    _item = nullptr;
+    _valueValid = false;
 
     if (_protocol == nullptr)
     {
         // Debug_printf("FNJSON::parse() - NULL protocol.\r\n");
         return false;
     }
-    _parseBuffer.clear();
+    // Parse as the data arrives, the raw response is never held in memory.
+    FNJSONStream stream(_parseFilter);
+    bool gotData = false;
+
     _protocol->status(&ns);
 #ifdef VERBOSE_PROTOCOL
     Debug_printf("json parse, initial status: ns.rxBW: %d, ns.conn: %d, ns.err: %d\r\n", ns.rxBytesWaiting, ns.connected, ns.error);
@@ -331,8 +374,15 @@ bool FNJSON::parse()
         if (ns.rxBytesWaiting > 0)
         {
             _protocol->read(ns.rxBytesWaiting);
-            _parseBuffer += *_protocol->receiveBuffer;
-            _protocol->receiveBuffer->clear();
+
+            size_t len;
+            const uint8_t *data;
+            while ((data = _protocol->receiveBuffer->peek(len)) != nullptr)
+            {
+                stream.feed((const char *)data, len);
+                _protocol->receiveBuffer->consume(len);
+                gotData = true;
+            }
         }
         _protocol->status(&ns);
 #ifdef ESP_PLATFORM
@@ -340,20 +390,14 @@ bool FNJSON::parse()
 #endif
     }
 
-    // Debug_printf("S: %s\r\n", _parseBuffer.c_str());
-
-    // only try and parse the buffer if it has data. Empty response doesn't need parsing.
-    if (!_parseBuffer.empty())
-    {
-        std::string b = util_hexdump(&_parseBuffer, _parseBuffer.size());
-        Debug_printf("%s", b.c_str());
-        _json = cJSON_Parse(_parseBuffer.c_str());
-    }
+    // Empty response doesn't need parsing.
+    if (gotData && stream.finish())
+        _json = stream.detach();
 
     if (_json == nullptr)
     {
 #ifdef VERBOSE_PROTOCOL
-        Debug_printf("FNJSON::parse() - Could not parse JSON, parseBuffer length: %d\r\n", _parseBuffer.size());
+        Debug_printf("FNJSON::parse() - Could not parse JSON, %u bytes read, filter: %s\r\n", (unsigned)stream.bytesParsed(), _parseFilter.c_str());
 #endif
         return false;
     }
@@ -13,6 +13,7 @@
 #include <string.h>
 
 #include "../network-protocol/Protocol.h"
+#include "fnjson_stream.h"
 
 class FNJSON
 {
@@ -23,6 +24,7 @@ public:
     void setLineEnding(const std::string &_lineEnding);
     void setProtocol(NetworkProtocol *newProtocol);
     void setReadQuery(const std::string &queryString, uint8_t queryParam);
+    void setParseFilter(const std::string &pointer);
     cJSON *resolveQuery();
     bool status(NetworkStatus *status);
     
@@ -41,7 +43,10 @@ private:
     uint8_t _queryParam = 0;
     std::string lineEnding;
     std::string getValue(cJSON *item);
-    std::string _parseBuffer;
+    const std::string &value();
+    std::string _parseFilter;
+    std::string _value;
+    bool _valueValid = false;
 };
 
 #endif /* JSON_H */
\ No newline at end of file
@@ -0,0 +1,462 @@
+/**
+ * Incremental JSON parser for #FujiNet
+ */
+
+#include "fnjson_stream.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Same nesting limit as cJSON_Parse()
+#ifndef CJSON_NESTING_LIMIT
+#define CJSON_NESTING_LIMIT 1000
+#endif
+
+/**
+ * Case insensitive compare, like cJSONUtils_GetPointer()
+ */
+static bool key_matches(const std::string &key, const std::string &token)
+{
+    if (key.size() != token.size())
+        return false;
+
+    for (size_t i = 0; i < key.size(); i++)
+        if (tolower((unsigned char)key[i]) != tolower((unsigned char)token[i]))
+            return false;
+
+    return true;
+}
+
+/**
+ * ctor - split the JSON Pointer into unescaped reference tokens
+ */
+FNJSONStream::FNJSONStream(const std::string &pointer)
+{
+    // Like cJSONUtils_GetPointer(), anything not starting with '/' selects the whole document
+    if (pointer.empty() || pointer[0] != '/')
+        return;
+
+    std::string token;
+    for (size_t i = 1; i <= pointer.size(); i++)
+    {
+        if (i == pointer.size() || pointer[i] == '/')
+        {
+            _pointer.push_back(token);
+            token.clear();
+        }
+        else if (pointer[i] == '~' && i + 1 < pointer.size() && (pointer[i + 1] == '0' || pointer[i + 1] == '1'))
+        {
+            token += pointer[++i] == '0' ? '~' : '/';
+        }
+        else
+            token += pointer[i];
+    }
+}
+
+/**
+ * dtor
+ */
+FNJSONStream::~FNJSONStream()
+{
+    if (_root != nullptr)
+        cJSON_Delete(_root);
+}
+
+cJSON *FNJSONStream::detach()
+{
+    cJSON *root = _root;
+    _root = nullptr;
+    return root;
+}
+
+/**
+ * Decide whether the value starting now is stored, walked or dropped
+ */
+FNJSONStream::KeepMode FNJSONStream::keepForNext()
+{
+    if (_stack.empty())
+        return _pointer.empty() ? KEEP : PATH;
+
+    const Frame &parent = _stack.back();
+
+    if (parent.keep == KEEP)
+        return KEEP;
+
+    if (parent.keep == SKIP || _found)
+        return SKIP;
+
+    const std::string &token = _pointer[_stack.size() - 1];
+    bool match = parent.isObject ? key_matches(_key, token)
+                                 : token == std::to_string(parent.index);
+
+    if (!match)
+        return SKIP;
+
+    return _stack.size() == _pointer.size() ? KEEP : PATH;
+}
+
+/**
+ * Attach a new KEEP value to its parent, or make it the result
+ */
+void FNJSONStream::addValue(cJSON *item)
+{
+    if (_stack.empty() || _stack.back().keep != KEEP)
+    {
+        _root = item;
+        _found = true;
+    }
+    else if (_stack.back().isObject)
+        cJSON_AddItemToObject(_stack.back().node, _key.c_str(), item);
+    else
+        cJSON_AddItemToArray(_stack.back().node, item);
+}
+
+void FNJSONStream::afterValue()
+{
+    if (_stack.empty())
+    {
+        _state = DONE;
+        return;
+    }
+
+    _stack.back().index++;
+    _state = _stack.back().isObject ? OBJECT_NEXT : ARRAY_NEXT;
+}
+
+bool FNJSONStream::beginContainer(bool isObject)
+{
+    if (_stack.size() >= CJSON_NESTING_LIMIT)
+        return false;
+
+    cJSON *node = nullptr;
+    if (_valueKeep == KEEP)
+    {
+        node = isObject ? cJSON_CreateObject() : cJSON_CreateArray();
+        if (node == nullptr)
+            return false;
+        addValue(node);
+    }
+
+    _stack.push_back({node, _valueKeep, isObject, 0});
+    _state = isObject ? OBJECT_KEY : ARRAY_FIRST;
+    return true;
+}
+
+bool FNJSONStream::endContainer(bool isObject)
+{
+    if (_stack.empty() || _stack.back().isObject != isObject)
+        return false;
+
+    _stack.pop_back();
+    afterValue();
+    return true;
+}
+
+/**
+ * Turn the lexed string/number/literal into a value
+ */
+bool FNJSONStream::finishScalar()
+{
+    cJSON *item = nullptr;
+
+    if (_state == NUMBER)
+    {
+        char *end = nullptr;
+        double num = strtod(_token.c_str(), &end);
+        if (end != _token.c_str() + _token.size())
+            return false;
+        if (_valueKeep == KEEP)
+            item = cJSON_CreateNumber(num);
+    }
+    else if (_state == LITERAL)
+    {
+        if (_token == "true")
+            item = _valueKeep == KEEP ? cJSON_CreateTrue() : nullptr;
+        else if (_token == "false")
+            item = _valueKeep == KEEP ? cJSON_CreateFalse() : nullptr;
+        else if (_token == "null")
+            item = _valueKeep == KEEP ? cJSON_CreateNull() : nullptr;
+        else
+            return false;
+    }
+    else if (_valueKeep == KEEP)
+        item = cJSON_CreateString(_token.c_str());
+
+    if (_valueKeep == KEEP)
+    {
+        if (item == nullptr)
+            return false;
+        addValue(item);
+    }
+
+    _token.clear();
+    afterValue();
+    return true;
+}
+
+/**
+ * Append a code point from a \u escape as UTF-8
+ */
+void FNJSONStream::appendCodepoint(uint32_t cp)
+{
+    if (!_store)
+        return;
+
+    if (cp < 0x80)
+        _token += (char)cp;
+    else if (cp < 0x800)
+    {
+        _token += (char)(0xC0 | (cp >> 6));
+        _token += (char)(0x80 | (cp & 0x3F));
+    }
+    else if (cp < 0x10000)
+    {
+        _token += (char)(0xE0 | (cp >> 12));
+        _token += (char)(0x80 | ((cp >> 6) & 0x3F));
+        _token += (char)(0x80 | (cp & 0x3F));
+    }
+    else
+    {
+        _token += (char)(0xF0 | (cp >> 18));
+        _token += (char)(0x80 | ((cp >> 12) & 0x3F));
+        _token += (char)(0x80 | ((cp >> 6) & 0x3F));
+        _token += (char)(0x80 | (cp & 0x3F));
+    }
+}
+
+/**
+ * Advance the state machine by one character
+ */
+bool FNJSONStream::step(char c)
+{
+    bool ws = (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+
+    switch (_state)
+    {
+    case VALUE:
+    case ARRAY_FIRST:
+        if (ws)
+            return true;
+        if (_state == ARRAY_FIRST && c == ']')
+            return endContainer(false);
+
+        _valueKeep = keepForNext();
+        _token.clear();
+
+        if (c == '{')
+            return beginContainer(true);
+        if (c == '[')
+            return beginContainer(false);
+        if (c == '"')
+        {
+            _stringIsKey = false;
+            _store = (_valueKeep == KEEP);
+            _state = STRING;
+            return true;
+        }
+        if (c == '-' || (c >= '0' && c <= '9'))
+        {
+            _token += c;
+            _state = NUMBER;
+            return true;
+        }
+        if (c == 't' || c == 'f' || c == 'n')
+        {
+            _token += c;
+            _state = LITERAL;
+            return true;
+        }
+        return false;
+
+    case OBJECT_KEY:
+        if (ws)
+            return true;
+        if (c == '}' && _stack.back().index == 0)
+            return endContainer(true);
+        if (c != '"')
+            return false;
+        _stringIsKey = true;
+        _store = (_stack.back().keep != SKIP);
+        _token.clear();
+        _state = STRING;
+        return true;
+
+    case OBJECT_COLON:
+        if (ws)
+            return true;
+        if (c != ':')
+            return false;
+        _state = VALUE;
+        return true;
+
+    case OBJECT_NEXT:
+        if (ws)
+            return true;
+        if (c == ',')
+        {
+            _state = OBJECT_KEY;
+            return true;
+        }
+        return c == '}' && endContainer(true);
+
+    case ARRAY_NEXT:
+        if (ws)
+            return true;
+        if (c == ',')
+        {
+            _state = VALUE;
+            return true;
+        }
+        return c == ']' && endContainer(false);
+
+    case STRING:
+        if (c == '\\')
+        {
+            _state = STRING_ESCAPE;
+            return true;
+        }
+        if (c != '"')
+        {
+            if (_store)
+                _token += c;
+            return true;
+        }
+        if (_stringIsKey)
+        {
+            _key.swap(_token);
+            _token.clear();
+            _state = OBJECT_COLON;
+            return true;
+        }
+        return finishScalar();
+
+    case STRING_ESCAPE:
+        _state = STRING;
+        switch (c)
+        {
+        case '"':
+        case '\\':
+        case '/':
+            break;
+        case 'b':
+            c = '\b';
+            break;
+        case 'f':
+            c = '\f';
+            break;
+        case 'n':
+            c = '\n';
+            break;
+        case 'r':
+            c = '\r';
+            break;
+        case 't':
+            c = '\t';
+            break;
+        case 'u':
+            _unicode = 0;
+            _unicodeDigits = 0;
+            _state = STRING_UNICODE;
+            return true;
+        default:
+            return false;
+        }
+        if (_store)
+            _token += c;
+        return true;
+
+    case STRING_UNICODE:
+        if (c >= '0' && c <= '9')
+            _unicode = (_unicode << 4) | (c - '0');
+        else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+            _unicode = (_unicode << 4) | ((c | 0x20) - 'a' + 10);
+        else
+            return false;
+
+        if (++_unicodeDigits < 4)
+            return true;
+
+        _state = STRING;
+        if (_unicode >= 0xD800 && _unicode <= 0xDBFF)
+            _surrogate = _unicode;
+        else if (_unicode >= 0xDC00 && _unicode <= 0xDFFF)
+        {
+            if (_surrogate == 0)
+                return false;
+            appendCodepoint(0x10000 + ((_surrogate - 0xD800) << 10) + (_unicode - 0xDC00));
+            _surrogate = 0;
+        }
+        else
+            appendCodepoint(_unicode);
+        return true;
+
+    case NUMBER:
+        if ((c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-')
+        {
+            _token += c;
+            return true;
+        }
+        // The terminator belongs to whatever follows the number
+        return finishScalar() && step(c);
+
+    case LITERAL:
+        if (c >= 'a' && c <= 'z' && _token.size() < 5)
+        {
+            _token += c;
+            return true;
+        }
+        return finishScalar() && step(c);
+
+    case DONE:
+        // Like cJSON_Parse(), ignore anything after the document
+        return true;
+
+    case FAILED:
+        return false;
+    }
+
+    return false;
+}
+
+bool FNJSONStream::feed(const char *data, size_t len)
+{
+    size_t i = 0;
+
+    while (i < len)
+    {
+        if (_state == STRING)
+        {
+            // Copy a run of plain characters in one go
+            size_t j = i;
+            while (j < len && data[j] != '"' && data[j] != '\\')
+                j++;
+            if (_store)
+                _token.append(data + i, j - i);
+            i = j;
+            if (i == len)
+                break;
+        }
+
+        if (!step(data[i]))
+        {
+            _state = FAILED;
+            return false;
+        }
+        i++;
+    }
+
+    _parsed += len;
+    return true;
+}
+
+bool FNJSONStream::finish()
+{
+    // A bare number or literal at the top level has no terminator
+    if ((_state == NUMBER || _state == LITERAL) && _stack.empty())
+    {
+        if (!finishScalar())
+            _state = FAILED;
+    }
+
+    return _state == DONE;
+}
@@ -0,0 +1,111 @@
+/**
+ * Incremental JSON parser for #FujiNet
+ *
+ * Builds a cJSON tree from data pushed in arbitrary chunks, so the raw
+ * response never has to be held in memory. With a JSON Pointer filter,
+ * only the subtree the pointer selects is materialized; everything else
+ * is tokenized and dropped.
+ */
+
+#ifndef JSON_STREAM_H
+#define JSON_STREAM_H
+
+#include <cJSON.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class FNJSONStream
+{
+public:
+    /**
+     * @param pointer JSON Pointer of the subtree to keep, empty keeps the whole document
+     */
+    FNJSONStream(const std::string &pointer = "");
+    ~FNJSONStream();
+
+    /**
+     * @brief Push the next chunk of the document.
+     * @return false on a syntax error, further input is ignored.
+     */
+    bool feed(const char *data, size_t len);
+
+    /**
+     * @brief Signal end of input.
+     * @return true if a complete document was parsed and the pointer matched.
+     */
+    bool finish();
+
+    /**
+     * @brief Hand over the parsed (sub)tree, caller owns it.
+     */
+    cJSON *detach();
+
+    /**
+     * @brief Bytes consumed so far, for diagnostics.
+     */
+    size_t bytesParsed() const { return _parsed; }
+
+private:
+    enum ParseState
+    {
+        VALUE,           // expecting a value
+        OBJECT_KEY,      // after '{' or ',' in an object
+        OBJECT_COLON,    // after a key
+        OBJECT_NEXT,     // after a member value
+        ARRAY_FIRST,     // after '['
+        ARRAY_NEXT,      // after an element
+        STRING,          // inside a string
+        STRING_ESCAPE,   // after a backslash
+        STRING_UNICODE,  // inside \uXXXX
+        NUMBER,
+        LITERAL,
+        DONE,
+        FAILED
+    };
+
+    // Whether a value ends up in the tree
+    enum KeepMode
+    {
+        KEEP,            // materialized
+        PATH,            // ancestor of the pointer target, walked but not stored
+        SKIP             // dropped
+    };
+
+    struct Frame
+    {
+        cJSON *node;     // nullptr unless KEEP
+        KeepMode keep;
+        bool isObject;
+        int index;       // next array index / member count
+    };
+
+    std::vector<std::string> _pointer;
+    std::vector<Frame> _stack;
+    cJSON *_root = nullptr;
+    bool _found = false;
+
+    ParseState _state = VALUE;
+    bool _stringIsKey = false;
+    KeepMode _valueKeep = KEEP; // keep mode of the value being parsed
+    bool _store = false;        // keep the characters of the current token
+    std::string _token;         // string/number/literal being lexed
+    std::string _key;           // last object key
+    uint32_t _unicode = 0;      // \uXXXX accumulator
+    uint8_t _unicodeDigits = 0;
+    uint32_t _surrogate = 0;    // pending high surrogate
+    size_t _parsed = 0;
+
+    KeepMode keepForNext();
+    void afterValue();
+    void addValue(cJSON *item);
+    bool beginContainer(bool isObject);
+    bool endContainer(bool isObject);
+    bool finishScalar();
+    void appendCodepoint(uint32_t cp);
+    bool step(char c);
+};
+
+#endif /* JSON_STREAM_H */
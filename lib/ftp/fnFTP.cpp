@@ -781,7 +781,7 @@ bool fnFTP::reconnect()
     return login(username, password, hostname, control_port);
 }
 
-bool fnFTP::open_file(string path, bool stor)
+bool fnFTP::open_file(string path, bool stor, uint32_t offset)
 {
     if (!control->connected())
     {
@@ -803,6 +803,26 @@ bool fnFTP::open_file(string path, bool stor)
         return true;
     }
 
+    // Start part way into the file
+    if (stor == false && offset > 0)
+    {
+        REST(offset);
+
+        if (parse_response())
+        {
+            Debug_printf("Timed out waiting for 350 response.\r\n");
+            data->stop();
+            return true;
+        }
+
+        if (!is_positive_intermediate_reply())
+        {
+            Debug_printf("Server could not restart at %lu. Response was: %s\r\n", offset, controlResponse.c_str());
+            data->stop();
+            return true;
+        }
+    }
+
     // Do command
     if (stor == true)
     {
@@ -885,7 +905,7 @@ bool fnFTP::open_directory(string path, string pattern)
     //     return true;
     // }
 
-    int tmout_counter = 1 + FTP_TIMEOUT / 50;
+    bool timed_out = false;
     bool got_response = false;
 
     // Reset buffer
@@ -894,27 +914,22 @@ bool fnFTP::open_directory(string path, string pattern)
     // Retrieve listing into buffer.
     do
     {
-        if (data->available() == 0)
+        // Sleeps in select() until data arrives or the server closes the data connection
+        int len = data->wait_available(FTP_TIMEOUT);
+        if (len == 0 && data->connected())
         {
-            if (--tmout_counter == 0)
-            {
-                // no data & no control message
-                Debug_printf("fnFTP::open_directory - Timeout\r\n");
-                break;
-            }
-            fnSystem.delay(50); // wait for more data or control message
+            // no data & no control message
+            Debug_printf("fnFTP::open_directory - Timeout\r\n");
+            timed_out = true;
+            break;
         }
-        if (data->available() > 0)
+        while (len > 0)
         {
-            Debug_printf("Retrieving directory list\r\n");
-            while (data->available())
-            {
-                int len = data->available();
-                memset(buf, 0, sizeof(buf));
-                int num_read = data->read(buf, len > sizeof(buf) ? sizeof(buf) : len);
-                dirBuffer << string((const char *)buf, num_read);
-            }
-            tmout_counter = 1 + FTP_TIMEOUT / 50; // reset timeout counter
+            int num_read = data->read(buf, len > sizeof(buf) ? sizeof(buf) : len);
+            if (num_read <= 0)
+                break;
+            dirBuffer << string((const char *)buf, num_read);
+            len = data->available();
         }
         if (got_response == false && control->available())
         {
@@ -924,7 +939,7 @@ bool fnFTP::open_directory(string path, string pattern)
 
     data->stop();
 
-    if (tmout_counter == 0 || (got_response == false && parse_response()))
+    if (timed_out || (got_response == false && parse_response()))
     {
         Debug_printf("fnFTP::open_directory(%s%s) Timed out waiting for 226 response.\r\n", path.c_str(), pattern.c_str());
         return true;
@@ -964,6 +979,80 @@ bool fnFTP::read_file(uint8_t *buf, unsigned short len)
     return len != data->read(buf, len);
 }
 
+int fnFTP::read_data(uint8_t *buf, uint32_t len)
+{
+    int available = data->wait_available(FTP_TIMEOUT);
+    if (available == 0)
+    {
+        // Nothing came: either the server is done sending or it stalled
+        if (!data->connected())
+            return 0;
+
+        Debug_printf("fnFTP::read_data(%p,%lu) - Timeout\r\n", buf, len);
+        return -1;
+    }
+
+    return data->read(buf, ((uint32_t)available < len) ? available : len);
+}
+
+bool fnFTP::close_file()
+{
+    Debug_printf("fnFTP::close_file()\r\n");
+
+    // Closing our end makes the server give up on the rest of the file
+    data->stop();
+
+    bool res = false;
+    if (_expect_control_response)
+    {
+        // 226 if the server was done, 426 if we cut it short, either is fine
+        if (parse_response())
+        {
+            Debug_printf("Timed out waiting for 226/426.\r\n");
+            res = true;
+        }
+        _expect_control_response = false;
+    }
+    return res;
+}
+
+bool fnFTP::get_size(string path, uint32_t &size)
+{
+    if (!control->connected())
+        return true;
+
+    SIZE(path);
+
+    if (parse_response())
+    {
+        Debug_printf("Timed out waiting for 213.\r\n");
+        return true;
+    }
+
+    // 213 <size>, directories and missing files get a 550
+    if (_statusCode != 213)
+        return true;
+
+    size = strtoul(controlResponse.substr(4).c_str(), nullptr, 10);
+    return false;
+}
+
+bool fnFTP::change_directory(string path)
+{
+    if (!control->connected())
+        return true;
+
+    CWD(path);
+
+    if (parse_response())
+    {
+        Debug_printf("Timed out waiting for 250.\r\n");
+        return true;
+    }
+
+    return !is_positive_completion_reply();
+}
+
 bool fnFTP::write_file(uint8_t *buf, unsigned short len)
 {
     Debug_printf("fnFTP::write_file(%p,%u)\r\n", buf, len);
@@ -1008,6 +1097,11 @@ int fnFTP::data_available()
     return data->available();
 }
 
+bool fnFTP::connected()
+{
+    return control != nullptr && control->connected();
+}
+
 bool fnFTP::data_connected()
 {
     if (_expect_control_response && control->available())
@@ -1068,19 +1162,14 @@ int fnFTP::read_response_line(char *buf, int buflen)
 {
     int num_read = 0;
     int c;
-    int tmout_counter = 1 + FTP_TIMEOUT / 50;
 
     while(true)
     {
-        if (control->available() == 0)
+        // Sleeps in select() until the server says something
+        if (control->wait_available(FTP_TIMEOUT) == 0)
         {
-            if (--tmout_counter == 0)
-            {
-                Debug_printf("fnFTP::read_response_line() - Timeout waiting response\r\n");
-                return -1;
-            }
-            fnSystem.delay(50);
-            continue;
+            Debug_printf("fnFTP::read_response_line() - Timeout waiting response\r\n");
+            return -1;
         }
 
         c = control->read(); // singe byte
@@ -1102,7 +1191,6 @@ int fnFTP::read_response_line(char *buf, int buflen)
         // store char, ignore rest of too long response
         if (num_read < buflen)
             buf[num_read++] = (char) c;
-        tmout_counter = 1 + FTP_TIMEOUT / 50; // reset timeout counter
     }
     return num_read;
 }
@@ -1208,6 +1296,18 @@ void fnFTP::RETR(string path)
     control->write("RETR " + path + "\r\n");
 }
 
+void fnFTP::REST(uint32_t offset)
+{
+    Debug_printf("fnFTP::REST(%lu)\r\n", offset);
+    control->write("REST " + std::to_string(offset) + "\r\n");
+}
+
+void fnFTP::SIZE(string path)
+{
+    Debug_printf("fnFTP::SIZE(%s)\r\n",path.c_str());
+    control->write("SIZE " + path + "\r\n");
+}
+
 void fnFTP::CWD(string path)
 {
     Debug_printf("fnFTP::CWD(%s)\r\n",path.c_str());
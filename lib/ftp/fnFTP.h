@@ -54,9 +54,33 @@ public:
      * Open file on FTP server
      * @param path to file to open.
      * @param stor TRUE means STOR, otherwise RETR
+     * @param offset byte to start a RETR from (REST), 0 for the whole file
      * @return TRUE if error, FALSE if successful.
      */
-    bool open_file(string path, bool stor);
+    bool open_file(string path, bool stor, uint32_t offset = 0);
+
+    /**
+     * End the current RETR, finished or not. Drops the data connection and
+     * consumes the transfer's final reply so the control connection is
+     * ready for the next command.
+     * @return TRUE if error, FALSE if successful.
+     */
+    bool close_file();
+
+    /**
+     * Ask the server for the size of a file (SIZE, RFC 3659)
+     * @param path file to query.
+     * @param size receives the size in bytes.
+     * @return TRUE if error (or not a plain file), FALSE if successful.
+     */
+    bool get_size(string path, uint32_t &size);
+
+    /**
+     * Check that path is a directory by changing into it.
+     * @param path directory to check.
+     * @return TRUE if error, FALSE if successful.
+     */
+    bool change_directory(string path);
 
     /**
      * Open directory on FTP server, grab it, and return back.
@@ -82,6 +106,14 @@ public:
      */
     bool read_file(uint8_t* buf, unsigned short len);
 
+    /**
+     * Read what is available from the data socket, waiting for it if needed.
+     * @param buf target buffer
+     * @param len length of target buffer
+     * @return bytes read, 0 at end of file, -1 on timeout or error.
+     */
+    int read_data(uint8_t* buf, uint32_t len);
+
     /**
      * Write file from buffer into data socket.
      * @param buf source buffer
@@ -114,6 +146,12 @@ public:
     bool data_connected();
 
 
+    /**
+     * @brief return if the control connection is up
+     * @return TRUE if logged in, FALSE if disconnected
+     */
+    bool connected();
+
     /**
      * Recovery FTP connection.
      * @return TRUE on error, FALSE on success
@@ -292,6 +330,18 @@ private:
      */
     void RETR(string path);
 
+    /**
+     * @brief Restart the next transfer at offset
+     * @param offset byte offset into the file
+     */
+    void REST(uint32_t offset);
+
+    /**
+     * @brief ask server for the size of path
+     * @param path file to query
+     */
+    void SIZE(string path);
+
     /**
      * @brief change current directory to path.
      * @param path path to change directory to.
@@ -1,7 +1,6 @@
-
 #ifdef GPIOX_XRA1405
 
-#include "pcf8575.h"
+#include "xra1405.h"
 
 #include <hal/gpio_types.h>
 
@@ -10,21 +9,45 @@
 XRA1405 GPIOX;
 
 XRA1405::XRA1405() :
-		_DIN(0), _DIN_LAST(0), _DOUT(0), _DDR(0), _address(0)
+		_spi(nullptr), _queue_next(0), _queued(0), _DIN(0), _DIN_LAST(0), _DOUT(0xFFFF), _DDR(0xFFFF)
 {
 }
 
-void XRA1405::begin(gpio_num_t sda, gpio_num_t scl, uint8_t address, uint16_t speed) {
+void XRA1405::begin(gpio_num_t cs, uint16_t speed) {
+
+	spi_bus_config_t bus_cfg =
+	{
+		.mosi_io_num = PIN_GPIOX_SPI_MOSI,
+		.miso_io_num = PIN_GPIOX_SPI_MISO,
+		.sclk_io_num = PIN_GPIOX_SPI_SCK,
+		.quadwp_io_num = -1,
+		.quadhd_io_num = -1,
+	};
+
+	// Already initialized is fine, the bus is shared with the SD card
+	esp_err_t e = spi_bus_initialize(GPIOX_SPI_HOST, &bus_cfg, SPI_DMA_CH_AUTO);
+	if ( e != ESP_OK && e != ESP_ERR_INVALID_STATE )
+	{
+		Debug_printv("spi_bus_initialize failed [%s]", esp_err_to_name(e));
+		return;
+	}
 
-	/* Store the I2C address and init the Wire library */
-	_address = address;
-    myI2C.begin(sda, scl, (speed * 1000)); // 400Khz Default
-    //myI2C.begin(GPIO_NUM_21, GPIO_NUM_22, 800000); // 800Khz Overclocked
-    //myI2C.begin(GPIO_NUM_21, GPIO_NUM_22, 1000000); // 1Mhz Overclocked
-    //myI2C.setTimeout(10);
-    //myI2C.scanner();
-	myI2C.reset();
+	spi_device_interface_config_t dev_cfg = {};
+	dev_cfg.mode = 0;
+	dev_cfg.clock_speed_hz = speed * 1000;
+	dev_cfg.spics_io_num = cs;
+	dev_cfg.queue_size = XRA1405_QUEUE_SIZE;
 
+	e = spi_bus_add_device(GPIOX_SPI_HOST, &dev_cfg, &_spi);
+	if ( e != ESP_OK )
+	{
+		Debug_printv("spi_bus_add_device failed [%s]", esp_err_to_name(e));
+		_spi = nullptr;
+		return;
+	}
+
+	// Power on state is all inputs, interrupt on any of them changing
+	transfer(XRA1405_IER, GPIOX_BOTH, false, 0xFFFF);
 	readGPIOX();
 }
 
@@ -33,58 +56,19 @@ void XRA1405::pinMode(uint8_t pin, pin_mode_t mode) {
 	/* Switch according mode */
 	if ( mode == GPIOX_MODE_INPUT )
 	{
-		_DDR |= (1 << pin);	
+		_DDR |= (1 << pin);
 	}
 	else if ( mode == GPIOX_MODE_OUTPUT ) {
 		_DDR &= ~(1 << pin);
-	} 
+	}
 
 	/* Update GPIO values */
-	updateGPIOX();
+	updateGPIOX( pin < P10 ? GPIOX_PORT0 : GPIOX_PORT1 );
 }
 
 void XRA1405::portMode(port_t port, pin_mode_t mode) {
 
-	if ( port == GPIOX_PORT0 )
-	{
-		// Modify P07-P00 (low byte)
-		if ( mode == GPIOX_MODE_INPUT )
-		{
-			_DDR = (_DDR & 0xFF00) | 0x00FF;    // set low byte to 0xFF
-		}
-		else if ( mode == GPIOX_MODE_OUTPUT ) 
-		{
-			_DDR &= 0xFF00;                     // set low byte to 0x00
-		}
-	}
-	else if ( port == GPIOX_PORT1 )
-	{
-		// Modify P17-P10 (high byte)
-		if ( mode == GPIOX_MODE_INPUT )
-		{
-			_DDR = (_DDR & 0x00FF) | 0xFF00;    // set high byte to 0xFF
-		}
-		else if ( mode == GPIOX_MODE_OUTPUT ) 
-		{
-			_DDR &= 0x00FF;                     // set high byte to 0x00
-		}
-	}
-	else if ( port == GPIOX_BOTH )
-	{
-		if ( mode == GPIOX_MODE_INPUT )
-		{
-			_DDR = 0xFFFF;  // set high/low byte to 0xFF
-		}
-		else if ( mode == GPIOX_MODE_OUTPUT ) 
-		{
-			_DDR = 0x0000;  // set high/low byte to 0x00
-		}
-	}
-
-	//Debug_printv("port[%.2X] mode[%.2X] _DDR[%.2X] _DOUT[%.2X]", port, mode, _DDR, _DOUT);
-
-	/* Update GPIO values */
-	updateGPIOX();
+	portMode(port, (uint16_t)(mode == GPIOX_MODE_INPUT ? 0xFFFF : 0x0000));
 }
 
 void XRA1405::portMode(port_t port, uint16_t mode) {
@@ -107,7 +91,7 @@ void XRA1405::portMode(port_t port, uint16_t mode) {
 	//Debug_printv("port[%.2X] mode[%.2X] _DDR[%.2X] _DOUT[%.2X]", port, mode, _DDR, _DOUT);
 
 	/* Update GPIO values */
-	updateGPIOX();
+	updateGPIOX(port);
 }
 
 void XRA1405::digitalWrite(uint8_t pin, uint8_t value) {
@@ -118,7 +102,7 @@ void XRA1405::digitalWrite(uint8_t pin, uint8_t value) {
 	else
 		_DOUT &= ~(1 << pin);
 
-	writeGPIOX();
+	writeGPIOX( pin < P10 ? GPIOX_PORT0 : GPIOX_PORT1 );
 }
 
 uint8_t XRA1405::digitalRead(uint8_t pin) {
@@ -127,30 +111,36 @@ uint8_t XRA1405::digitalRead(uint8_t pin) {
 	readGPIOX();
 
 	/* Read and return the pin state */
-	return (_DIN & (1 << pin));
+	return (_DIN & (1 << pin)) ? 1 : 0;
 }
 
 
 void XRA1405::write(port_t port, uint16_t value) {
 	/* Store pins values and apply */
 	if ( port == GPIOX_PORT0)
-		// low byte swap
-		_DOUT &= 0xFF00 | (value & 0x00FF);
+		_DOUT = (_DOUT & 0xFF00) | (value & 0x00FF);
 	else if ( port == GPIOX_PORT1 )
-		// hight byte swap
-		_DOUT &= 0x00FF | (value << 8 & 0xFF00);
+		_DOUT = (_DOUT & 0x00FF) | ((value << 8) & 0xFF00);
 	else
 		_DOUT = value;
 
 	/* Update GPIOX values */
-	writeGPIOX();
+	writeGPIOX(port);
 }
 
 void XRA1405::write(uint16_t value) {
-	_DOUT = value;
+	write(GPIOX_BOTH, value);
+}
 
-	/* Update GPIOX values */
-	writeGPIOX();
+void XRA1405::writeQueued(port_t port, uint16_t value) {
+	if ( port == GPIOX_PORT0)
+		_DOUT = (_DOUT & 0xFF00) | (value & 0x00FF);
+	else if ( port == GPIOX_PORT1 )
+		_DOUT = (_DOUT & 0x00FF) | ((value << 8) & 0xFF00);
+	else
+		_DOUT = value;
+
+	queue(XRA1405_OCR, port, _DOUT);
 }
 
 uint16_t XRA1405::read(port_t port) {
@@ -163,23 +153,15 @@ uint16_t XRA1405::read(port_t port) {
 	else if ( port == GPIOX_PORT1)
 		return PORT1;
 	else
-		return _DOUT;
+		return PORT0 | (PORT1 << 8);
 }
 
 void XRA1405::clear(port_t port) {
-
-	if ( port == GPIOX_BOTH )
-		write(0x0000);
-	else
-		write(port, 0x00);
+	write(port, 0x0000);
 }
 
 void XRA1405::set(port_t port) {
-
-	if ( port == GPIOX_BOTH )
-		write(0xFFFF);
-	else
-		write(port, 0xFF);
+	write(port, 0xFFFF);
 }
 
 void XRA1405::toggle(uint8_t pin) {
@@ -187,53 +169,114 @@ void XRA1405::toggle(uint8_t pin) {
 	/* Toggle pin state */
 	_DOUT ^= (1 << pin);
 
-	writeGPIOX();
+	writeGPIOX( pin < P10 ? GPIOX_PORT0 : GPIOX_PORT1 );
 }
 
+void XRA1405::pulse(uint8_t pin) {
 
-void XRA1405::readGPIOX() {
+	port_t port = pin < P10 ? GPIOX_PORT0 : GPIOX_PORT1;
+
+	queue(XRA1405_OCR, port, _DOUT ^ (1 << pin));
+	queue(XRA1405_OCR, port, _DOUT);
+}
 
-	_DIN_LAST = _DIN;
 
-	uint8_t buffer[2];
+uint16_t XRA1405::transfer(uint8_t reg, port_t port, bool read, uint16_t value) {
 
-	// Read two bytes
-	myI2C.readBytes(_address, 2, buffer);
-	_DIN = buffer[0];										// low byte
-	_DIN = (_DIN & 0x00FF) | ( (buffer[1] << 8) & 0xFF00);  // high byte
-	_DIN &= _DDR;
+	if ( _spi == nullptr )
+		return 0;
+
+	// Polling can't overtake what is still queued
+	flush();
+
+	if ( port == GPIOX_PORT1 )
+	{
+		reg++;
+		value >>= 8;
+	}
 
-	this->PORT0 = buffer[0];
-	this->PORT1 = buffer[1];
-	//Debug_printv("address[%.2X] port0[%.2X] port1[%.2X] din[%.2X] din_last[%.2X] ddr[%.2X]", _address, PORT0, PORT1, _DIN, _DIN_LAST, _DDR);
+	// Command byte: R/W, register address, 0
+	spi_transaction_t t = {};
+	t.flags = SPI_TRANS_USE_TXDATA | SPI_TRANS_USE_RXDATA;
+	t.length = ( port == GPIOX_BOTH ) ? 24 : 16;
+	t.tx_data[0] = ( read ? 0x80 : 0x00 ) | ( reg << 1 );
+	t.tx_data[1] = value & 0xFF;
+	t.tx_data[2] = value >> 8;
+
+	spi_device_polling_transmit(_spi, &t);
+
+	return t.rx_data[1] | ( t.rx_data[2] << 8 );
 }
 
+void XRA1405::queue(uint8_t reg, port_t port, uint16_t value) {
+
+	if ( _spi == nullptr )
+		return;
+
+	// Queue full, the oldest transaction gives its slot back
+	if ( _queued == XRA1405_QUEUE_SIZE )
+	{
+		spi_transaction_t *done;
+		spi_device_get_trans_result(_spi, &done, portMAX_DELAY);
+		_queued--;
+	}
 
-void XRA1405::writeGPIOX() {
+	if ( port == GPIOX_PORT1 )
+	{
+		reg++;
+		value >>= 8;
+	}
 
-	uint8_t buffer[2];
+	spi_transaction_t *t = &_queue[_queue_next];
+	_queue_next = (_queue_next + 1) % XRA1405_QUEUE_SIZE;
 
-	/* Compute new GPIO states */
-	uint16_t value = _DOUT | _DDR;
+	*t = {};
+	t->flags = SPI_TRANS_USE_TXDATA;
+	t->length = ( port == GPIOX_BOTH ) ? 24 : 16;
+	t->tx_data[0] = reg << 1;
+	t->tx_data[1] = value & 0xFF;
+	t->tx_data[2] = value >> 8;
 
-	// Write two bytes
-	buffer[0] = value & 0x00FF;  // low byte
-	buffer[1] = value >> 8;      // high byte
-	//Debug_printv("low[%.2X] high[%.2X]", buffer[0], buffer[1]);
-	myI2C.writeBytes(_address, 2, buffer);
-	//Debug_printv("address[%.2X] din[%.2X] dout[%.2X] ddr[%.2X] value[%.2X]", _address, _DIN, _DOUT, _DDR, value);
+	if ( spi_device_queue_trans(_spi, t, portMAX_DELAY) == ESP_OK )
+		_queued++;
 }
 
-void XRA1405::updateGPIOX() {
+void XRA1405::flush() {
+
+	spi_transaction_t *done;
+	while ( _queued )
+	{
+		spi_device_get_trans_result(_spi, &done, portMAX_DELAY);
+		_queued--;
+	}
+}
+
+
+void XRA1405::readGPIOX() {
+
+	_DIN_LAST = _DIN;
+
+	// Both ports in one transfer
+	uint16_t value = transfer(XRA1405_GSR, GPIOX_BOTH, true);
+	_DIN = value & _DDR;
+
+	this->PORT0 = value & 0xFF;
+	this->PORT1 = value >> 8;
+	//Debug_printv("port0[%.2X] port1[%.2X] din[%.2X] din_last[%.2X] ddr[%.2X]", PORT0, PORT1, _DIN, _DIN_LAST, _DDR);
+}
+
+
+void XRA1405::writeGPIOX(port_t port) {
+
+	transfer(XRA1405_OCR, port, false, _DOUT);
+	//Debug_printv("din[%.2X] dout[%.2X] ddr[%.2X]", _DIN, _DOUT, _DDR);
+}
 
-	uint8_t buffer[2];
+void XRA1405::updateGPIOX(port_t port) {
 
-	// Set input bit mask
-	buffer[0] = _DDR & 0x00FF;  // low byte
-	buffer[1] = _DDR >> 8;      // high byte
-	//Debug_printv("low[%.2X] high[%.2X]", buffer[0], buffer[1]);
-	myI2C.writeBytes(_address, 2, buffer);
-	//Debug_printv("address[%.2X] din[%.2X] dout[%.2X] ddr[%.2X]", _address, _DIN, _DOUT, _DDR);
+	// Outputs take the latched value as soon as they are switched on
+	transfer(XRA1405_GCR, port, false, _DDR);
+	//Debug_printv("din[%.2X] dout[%.2X] ddr[%.2X]", _DIN, _DOUT, _DDR);
 }
 
-#endif // GPIOX_XRA1405
\ No newline at end of file
+#endif // GPIOX_XRA1405
@@ -9,12 +9,41 @@
 
 #include "../../include/pinmap.h"
 
-#include <I2Cbus.hpp>
-
-#define I2C_SDA      PIN_GPIOX_SDA
-#define I2C_SCL      PIN_GPIOX_SCL
-#define I2C_ADDRESS  GPIOX_ADDRESS
-#define I2C_SPEED    GPIOX_SPEED
+#include <driver/spi_master.h>
+
+// The XRA1405 shares the SD card's SPI bus unless the pinmap gives it one
+#ifndef PIN_GPIOX_SPI_SCK
+#define GPIOX_SPI_HOST       SPI2_HOST
+#define PIN_GPIOX_SPI_SCK    PIN_SD_HOST_SCK
+#define PIN_GPIOX_SPI_MOSI   PIN_SD_HOST_MOSI
+#define PIN_GPIOX_SPI_MISO   PIN_SD_HOST_MISO
+#endif
+#ifndef GPIOX_SPI_HOST
+#define GPIOX_SPI_HOST       SPI3_HOST
+#endif
+// Chip select, the I2C data pin is free when the expander is on SPI
+#ifndef PIN_GPIOX_SPI_CS
+#define PIN_GPIOX_SPI_CS     PIN_GPIOX_SDA
+#endif
+#ifndef GPIOX_SPI_SPEED
+#define GPIOX_SPI_SPEED      20000  // Khz, the XRA1405 is good for 26Mhz
+#endif
+
+// Transactions that can be in flight before write() and friends have to wait
+#define XRA1405_QUEUE_SIZE   8
+
+/* XRA1405 registers, P00-P07 at the address, P10-P17 at the next one */
+#define XRA1405_GSR   0x00  // GPIO State (read only, clears the interrupt)
+#define XRA1405_OCR   0x02  // Output Control
+#define XRA1405_PIR   0x04  // Input Polarity Inversion
+#define XRA1405_GCR   0x06  // GPIO Configuration, 1 = input
+#define XRA1405_PUR   0x08  // Input Internal Pull-up Resistor Enable
+#define XRA1405_IER   0x0A  // Input Interrupt Enable
+#define XRA1405_TSCR  0x0C  // Output Three-State Control
+#define XRA1405_ISR   0x0E  // Input Interrupt Status
+#define XRA1405_REIR  0x10  // Input Rising Edge Interrupt Enable
+#define XRA1405_FEIR  0x12  // Input Falling Edge Interrupt Enable
+#define XRA1405_IFR   0x14  // Input Filter Enable
 
 /* XRA1405 port bits */
 #define P00  0
@@ -48,6 +77,15 @@ typedef enum {
 
 /**
  * @brief XRA1405
+ *
+ * 16 bit GPIO expander on SPI. Every access is one SPI transaction of a
+ * command byte followed by the register, or by both registers of a pair:
+ * the address auto-increments, so P00-P17 are read or written in a single
+ * 24 bit transfer.
+ *
+ * read() and the mode changes are polled, they need the answer right away.
+ * pulse() and writeQueued() are queued to the SPI driver and return at once,
+ * the transfers run behind the caller in order until flush() waits for them.
  */
 class XRA1405 {
 public:
@@ -61,13 +99,13 @@ public:
 	uint8_t PORT1; // PINS 10-17
 
 	/**
-	 * Start the I2C controller and store the XRA1405 chip address
+	 * Add the XRA1405 to its SPI bus (starting the bus if needed) and read the pins
 	 */
-	void begin(gpio_num_t sda = I2C_SDA, gpio_num_t scl = I2C_SCL, uint8_t address = I2C_ADDRESS, uint16_t speed = I2C_SPEED);
+	void begin(gpio_num_t cs = PIN_GPIOX_SPI_CS, uint16_t speed = GPIOX_SPI_SPEED);
 
 	/**
 	 * Set the direction of a pin (OUTPUT, INPUT)
-	 * 
+	 *
 	 * @param pin The pin to set
 	 * @param mode The new mode of the pin
 	 */
@@ -75,7 +113,7 @@ public:
 
 	/**
 	 * Set the direction of all port pins (INPUT, OUTPUT)
-	 * 
+	 *
 	 * @param port The port to set
 	 * @param mode The new mode of the pins
 	 */
@@ -84,16 +122,15 @@ public:
 
 	/**
 	 * Set the state of a pin (HIGH or LOW)
-	 * 
+	 *
 	 * @param pin The pin to set
 	 * @param value The new state of the pin
-	 * @remarks Software pull-up resistors are not available on the XRA1405
 	 */
 	void digitalWrite(uint8_t pin, uint8_t value);
 
 	/**
 	 * Read the state of a pin
-	 * 
+	 *
 	 * @param pin The pin to read back
 	 * @return
 	 */
@@ -101,16 +138,23 @@ public:
 
 	/**
 	 * Set the state of all pins in one go
-	 * 
+	 *
 	 * @param value The new value of all pins (1 bit = 1 pin, '1' = HIGH, '0' = LOW)
 	 */
 	void write(port_t port, uint16_t value);
 	void write(uint16_t value);
 
+	/**
+	 * Like write(), but queued, returns before the pins change
+	 */
+	void writeQueued(port_t port, uint16_t value);
+
 	/**
 	 * Read the state of all pins in one go
-	 * 
-	 * @return The current value of all pins (1 bit = 1 pin, '1' = HIGH, '0' = LOW)
+	 *
+	 * Both ports are always read, in one transfer, and left in PORT0 / PORT1
+	 *
+	 * @return The current value of the port, or of all pins
 	 */
 	uint16_t read(port_t port = GPIOX_BOTH);
 
@@ -130,9 +174,24 @@ public:
 	 */
 	void toggle(uint8_t pin);
 
+	/**
+	 * Toggle a pin and put it back, queued (handshake strobes)
+	 */
+	void pulse(uint8_t pin);
+
+	/**
+	 * Wait for the queued transactions to finish
+	 */
+	void flush();
+
 protected:
 
-	I2C_t& myI2C = i2c0;  // i2c0 and i2c1 are the default objects
+	spi_device_handle_t _spi;
+
+	/** Queued transactions, reused in order */
+	spi_transaction_t _queue[XRA1405_QUEUE_SIZE];
+	uint8_t _queue_next;
+	uint8_t _queued;
 
 	/** Current input pins values */
 	volatile uint16_t _DIN;
@@ -144,34 +203,40 @@ protected:
 	/** Pins modes values (OUTPUT or INPUT) */
 	volatile uint16_t _DDR;
 
-	/** GPIOX I2C address */
-	uint8_t _address;
+	/**
+	 * Read or write one register (port) or a register pair (GPIOX_BOTH), polled
+	 */
+	uint16_t transfer(uint8_t reg, port_t port, bool read, uint16_t value = 0);
+
+	/**
+	 * Queue a register write, see transfer()
+	 */
+	void queue(uint8_t reg, port_t port, uint16_t value);
 
-	/** 
+	/**
 	 * Read GPIO states and store them in _DIN variable
 	 *
 	 * @remarks Before reading current GPIO states, current _DIN variable value is moved to _DIN_LAST variable
 	 */
 	void readGPIOX();
 
-	/** 
+	/**
 	 * Write value of _DOUT variable to the GPIOX
-	 * 
-	 * @remarks Only pin marked as OUTPUT are set, for INPUT pins their value are unchanged
-	 * @warning To work properly (and avoid any states conflicts) readGPIO() MUST be called before call this function !
+	 *
+	 * @remarks Only pin marked as OUTPUT are driven, INPUT pins ignore it
 	 */
-	void writeGPIOX();
+	void writeGPIOX(port_t port = GPIOX_BOTH);
 
-	/** 
+	/**
 	 * Update INPUT/OUTPUT mode of all GPIOX pins
-	 * 
+	 *
 	 * @remarks All pins modes are set to be equal to _DDR
 	 */
-	void updateGPIOX();
+	void updateGPIOX(port_t port = GPIOX_BOTH);
 };
 
 extern XRA1405 GPIOX;
 
 #endif // XRA1405_H
 
-#endif // GPIOX_XRA1405
\ No newline at end of file
+#endif // GPIOX_XRA1405
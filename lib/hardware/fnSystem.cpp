@@ -53,6 +53,7 @@
 #include "../../include/pinmap.h"
 
 #include "bus.h"
+#include "fnConfig.h"
 
 #include "fsFlash.h"
 #include "fnFsSD.h"
@@ -413,6 +414,8 @@ void SystemManager::yield()
 // TODO: Close open files first
 void SystemManager::reboot()
 {
+    // don't lose a save that's still waiting to be written
+    Config.save_now();
     SYSTEM_BUS.shutdown();
     fnWiFi.stop();
     esp_restart();
@@ -17,12 +17,14 @@ using namespace fujinet;
 
 #define HTTPCLIENT_WAIT_FOR_CONSUMER_TASK 20000 // 20s
 #define HTTPCLIENT_WAIT_FOR_HTTP_TASK 20000     // 20s
+#define HTTPCLIENT_WAIT_SLICE 50                // 50ms
+#define HTTPCLIENT_RING_SIZE (DEFAULT_HTTP_BUF_SIZE * 8)
 
 const char *webdav_depths[] = {"0", "1", "infinity"};
 
 fnHttpClient::fnHttpClient()
 {
-    _buffer = (char *)malloc(DEFAULT_HTTP_BUF_SIZE);
+    _ring = xStreamBufferCreate(HTTPCLIENT_RING_SIZE, 1);
 }
 
 // Close connection, destroy any resoruces
@@ -36,8 +38,8 @@ fnHttpClient::~fnHttpClient()
         esp_http_client_cleanup(_handle);
     }
 
-    free(_buffer);
-    _buffer = nullptr;
+    vStreamBufferDelete(_ring);
+    _ring = nullptr;
     Debug_printv("AFTER free heap/low: %lu/%lu", esp_get_free_heap_size(), esp_get_free_internal_heap_size());
 }
 
@@ -116,58 +118,39 @@ int fnHttpClient::read(uint8_t *dest_buffer, int dest_bufflen)
     if (_handle == nullptr || dest_buffer == nullptr)
         return -1;
 
-    int bytes_left;
-    int bytes_to_copy;
-
     int bytes_copied = 0;
+    TickType_t last_data = xTaskGetTickCount();
 
-    // Start by using our own buffer if there's data there
-    if (_buffer_len > 0 && _buffer_pos < _buffer_len)
-    {
-        bytes_left = _buffer_len - _buffer_pos;
-        bytes_to_copy = dest_bufflen > bytes_left ? bytes_left : dest_bufflen;
-
-#ifdef VERBOSE_HTTP
-        Debug_printf("::read from buffer %d\r\n", bytes_to_copy);
-#endif
-        memcpy(dest_buffer, _buffer + _buffer_pos, bytes_to_copy);
-        _buffer_pos += bytes_to_copy;
-        _buffer_total_read += bytes_to_copy;
-
-        // Go ahead and return if we got as many bytes as requested
-        if (dest_bufflen == bytes_to_copy)
-            return bytes_to_copy;
-
-        bytes_copied = bytes_to_copy;
-    }
-
-    // Nothing left to read - later ESP-IDF versions provide esp_http_client_is_complete_data_received()
-    if (_transaction_done)
+    while (bytes_copied < dest_bufflen)
     {
-        // Debug_println("::read download done");
-        return bytes_copied;
-    }
+        // Take whatever the HTTP task has put in the ring so far
+        size_t n = xStreamBufferReceive(_ring, dest_buffer + bytes_copied, dest_bufflen - bytes_copied, 0);
+        if (n > 0)
+        {
+            bytes_copied += n;
+            _buffer_total_read += n;
+            continue;
+        }
 
-    // Make sure store our current task handle to respond to
-    _taskh_consumer = xTaskGetCurrentTaskHandle();
+        // Ring is drained and nothing else is coming - later ESP-IDF versions provide esp_http_client_is_complete_data_received()
+        if (_transaction_done || _taskh_subtask == nullptr)
+        {
+            // The HTTP task may have sent its last data between our receive and the check
+            n = xStreamBufferReceive(_ring, dest_buffer + bytes_copied, dest_bufflen - bytes_copied, 0);
+            if (n > 0)
+            {
+                bytes_copied += n;
+                _buffer_total_read += n;
+                continue;
+            }
+            // Debug_println("::read download done");
+            break;
+        }
 
-    // Our HTTP subtask is gone - say there's nothing left to read...
-    if (_taskh_subtask == nullptr)
-    {
-#ifdef VERBOSE_HTTP
-        Debug_println("::read subtask gone");
-#endif
-        return bytes_copied;
-    }
+        // Make sure store our current task handle to respond to
+        _taskh_consumer = xTaskGetCurrentTaskHandle();
 
-    while (bytes_copied < dest_bufflen)
-    {
-        // Let the HTTP process task know to fill the buffer
-        // Debug_println("::read notifyGive");
-        xTaskNotifyGive(_taskh_subtask);
-        // Wait till the HTTP task lets us know it's filled the buffer
-        // Debug_println("::read notifyTake...");
-        if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(HTTPCLIENT_WAIT_FOR_HTTP_TASK)) != 1)
+        if (xTaskGetTickCount() - last_data >= pdMS_TO_TICKS(HTTPCLIENT_WAIT_FOR_HTTP_TASK))
         {
             // Abort if we timed-out receiving the data
 #ifdef VERBOSE_HTTP
@@ -175,26 +158,22 @@ int fnHttpClient::read(uint8_t *dest_buffer, int dest_bufflen)
 #endif
             return -1;
         }
-        // Debug_println("::read got notification");
-        if (_buffer_len <= 0)
-        {
-            // Debug_println("::read download done");
-            return bytes_copied;
-        }
 
-        int dest_size = dest_bufflen - bytes_copied;
-        bytes_to_copy = dest_size > _buffer_len ? _buffer_len : dest_size;
+        /*
+         Wait for more data. The HTTP task also notifies us when it's finished, but a
+         blocking receive clears a notification that lands just before it, so only
+         wait a slice at a time before checking _transaction_done again.
+        */
+        n = xStreamBufferReceive(_ring, dest_buffer + bytes_copied, dest_bufflen - bytes_copied, pdMS_TO_TICKS(HTTPCLIENT_WAIT_SLICE));
+        if (n > 0)
+            last_data = xTaskGetTickCount();
+        bytes_copied += n;
+        _buffer_total_read += n;
+    }
 
 #ifdef VERBOSE_HTTP
-        Debug_printf("dest_size=%d, dest_bufflen=%d, bytes_copied=%d, bytes_to_copy=%d\r\n", dest_size, dest_bufflen, bytes_copied, bytes_to_copy);
+    Debug_printf("::read dest_bufflen=%d, bytes_copied=%d\r\n", dest_bufflen, bytes_copied);
 #endif
-
-        memcpy(dest_buffer + bytes_copied, _buffer, bytes_to_copy);
-        _buffer_pos += bytes_to_copy;
-        _buffer_total_read += bytes_to_copy;
-        bytes_copied += bytes_to_copy;
-    }
-
     return bytes_copied;
 }
 
@@ -205,29 +184,12 @@ void fnHttpClient::_flush_response()
     if (_handle == nullptr)
         return;
 
-    _buffer_len = 0;
     esp_http_client_set_post_field(_handle, nullptr, 0);
 
-    // Nothing left to read
-    if (_transaction_done)
-        return;
-
-    // Our HTTP subtask is gone - nothing to do
-    if (_taskh_subtask == nullptr)
-        return;
-
-    // Make sure store our current task handle to respond to
-    _taskh_consumer = xTaskGetCurrentTaskHandle();
-    do
-    {
-        // Let the HTTP process task know to fill the buffer
-        // Debug_println("::flush_response notifyGive");
-        xTaskNotifyGive(_taskh_subtask);
-        // Wait till the HTTP task lets us know it's filled the buffer
-        // Debug_println("::flush_response notifyTake...");
-        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(HTTPCLIENT_WAIT_FOR_HTTP_TASK));
-
-    } while (!_transaction_done);
+    // Drain the ring until the HTTP task is done with the response
+    uint8_t scratch[128];
+    while (read(scratch, sizeof(scratch)) == sizeof(scratch))
+        ;
     // Debug_println("fnHttpClient::flush_response done");
 }
 
@@ -236,6 +198,7 @@ void fnHttpClient::close()
 {
     // Debug_println("::close");
     _delete_subtask_if_running();
+    _reset_ring();
 
     if (_handle != nullptr)
         esp_http_client_close(_handle);
@@ -336,22 +299,22 @@ esp_err_t fnHttpClient::_httpevent_handler(esp_http_client_event_t *evt)
             xTaskNotifyGive(client->_taskh_consumer);
         }
 
-        // Wait to be told we can fill the buffer
-#ifdef VERBOSE_HTTP
-        Debug_println("HTTP_EVENT_ON_DATA: Waiting to start reading");
-#endif
-        ulTaskNotifyTake(1, pdMS_TO_TICKS(HTTPCLIENT_WAIT_FOR_CONSUMER_TASK));
-
 #ifdef VERBOSE_HTTP
         Debug_printf("HTTP_EVENT_ON_DATA: Data: %p, Datalen: %d\r\n", evt->data, evt->data_len);
 #endif
 
-        client->_buffer_pos = 0;
-        client->_buffer_len = (evt->data_len > DEFAULT_HTTP_BUF_SIZE) ? DEFAULT_HTTP_BUF_SIZE : evt->data_len;
-        memcpy(client->_buffer, evt->data, client->_buffer_len);
-
-        // Now let the reader know there's data in the buffer
-        xTaskNotifyGive(client->_taskh_consumer);
+        // Queue all of it, only waiting when the reader has fallen a whole ring behind
+        int sent = 0;
+        while (sent < evt->data_len)
+        {
+            size_t n = xStreamBufferSend(client->_ring, (uint8_t *)evt->data + sent, evt->data_len - sent, pdMS_TO_TICKS(HTTPCLIENT_WAIT_FOR_CONSUMER_TASK));
+            if (n == 0)
+            {
+                Debug_printf("HTTP_EVENT_ON_DATA: Reader stopped, dropping %d bytes\r\n", evt->data_len - sent);
+                break;
+            }
+            sent += n;
+        }
         break;
     }
 
@@ -384,7 +347,6 @@ void fnHttpClient::_perform_subtask(void *param)
     parent->_transaction_begin = true;
     parent->_transaction_done = false;
     parent->_redirect_count = 0;
-    parent->_buffer_len = 0;
 
     // Debug_printf("esp_http_client_perform start\r\n");
 
@@ -399,23 +361,13 @@ void fnHttpClient::_perform_subtask(void *param)
     // Indicate there's nothing else to read
     parent->_transaction_done = true;
 
-    // Don't send notifications if we're ignoring the response body
+    /*
+     If we handled the HTTP_EVENT_ON_DATA event, then read() may be waiting on the ring
+     for data that isn't coming. If we didn't handle that event, then _perform() is waiting
+     for a notification. Either way this wakes it up.
+    */
     if (false == parent->_ignore_response_body)
-    {
-        /*
-         If _transaction_begin is false, then we handled the HTTP_EVENT_ON_DATA event, and
-         read() has sent us a notification we need to accept before continuing.
-        */
-        if (false == parent->_transaction_begin)
-            ulTaskNotifyTake(1, pdMS_TO_TICKS(HTTPCLIENT_WAIT_FOR_CONSUMER_TASK));
-
-        /*
-         If we handled the HTTP_EVENT_ON_DATA event, then read() is waiting for a notification.
-         If we didn't handle that event, then _perform() is waiting for a notification.
-         Notify whichever of the two that they can continue.
-        */
         xTaskNotifyGive(parent->_taskh_consumer);
-    }
 
 #ifdef VERBOSE_HTTP
     Debug_printv("_perform_subtask_exiting");
@@ -434,6 +386,18 @@ void fnHttpClient::_delete_subtask_if_running()
     }
 }
 
+// Throw away anything left in the ring
+void fnHttpClient::_reset_ring()
+{
+    // A reset is refused while a task is still registered as blocked on the ring,
+    // which is the case when the subtask was deleted mid-send. Start a new one instead.
+    if (xStreamBufferReset(_ring) != pdPASS)
+    {
+        vStreamBufferDelete(_ring);
+        _ring = xStreamBufferCreate(HTTPCLIENT_RING_SIZE, 1);
+    }
+}
+
 /*
  Performs an HTTP transaction using esp_http_client_perform()
  Outside of POST data, this can't write to the server.  However, it's the only way to
@@ -456,6 +420,10 @@ int fnHttpClient::_perform()
 
     // Start a new task to perform the http client work
     _delete_subtask_if_running();
+    _reset_ring();
+
+    // Drop any wake-up left over from the last transaction's end
+    ulTaskNotifyTake(pdTRUE, 0);
     xTaskCreate(_perform_subtask, "perform_subtask", 4096, this, 5, &_taskh_subtask);
 #ifdef VERBOSE_HTTP
     // Debug_printf("%08lx _perform subtask created\r\n", fnSystem.millis());
@@ -572,10 +540,12 @@ int fnHttpClient::_perform_stream(esp_http_client_method_t method, uint8_t *writ
 #endif
 
     // Read any returned data
-    int r = esp_http_client_read(_handle, _buffer, DEFAULT_HTTP_BUF_SIZE);
+    char buffer[DEFAULT_HTTP_BUF_SIZE];
+    _reset_ring();
+    int r = esp_http_client_read(_handle, buffer, sizeof(buffer));
     if (r > 0)
     {
-        _buffer_len = r;
+        xStreamBufferSend(_ring, buffer, r, 0);
 #ifdef VERBOSE_HTTP
         Debug_printf("_perform_write read %d bytes\r\n", r);
 #endif
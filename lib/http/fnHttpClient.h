@@ -3,6 +3,7 @@
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/stream_buffer.h>
 
 #include <string>
 #include <map>
@@ -18,9 +19,9 @@ private:
     typedef std::map<std::string,std::string> header_map_t;
     typedef std::pair<std::string,std::string> header_entry_t;
 
-    char *_buffer = nullptr; // Will be allocated to DEFAULT_HTTP_BUF_SIZE
-    int _buffer_pos = 0;
-    int _buffer_len = 0;
+    // Response body on its way from the HTTP subtask to read(), the subtask
+    // keeps filling it while the consumer drains it
+    StreamBufferHandle_t _ring = nullptr;
     int _buffer_total_read = 0;
 
     TaskHandle_t _taskh_consumer = nullptr;
@@ -44,6 +45,7 @@ private:
     static esp_err_t _httpevent_handler(esp_http_client_event_t *evt);
 
     void _delete_subtask_if_running();
+    void _reset_ring();
 
     void _flush_response();
 
@@ -1,6 +1,8 @@
 
 #include "ark.h"
 
+#include <cstring>
+
 //#include "endianness.h"
 #include "utils.h"
 
@@ -19,7 +21,7 @@ bool ARKMStream::seekEntry( std::string filename )
     {
         while (seekEntry(index))
         {
-            std::string entryFilename = entry.filename;
+            std::string entryFilename(entry.filename, strnlen(entry.filename, sizeof(entry.filename)));
             uint8_t i = entryFilename.find_first_of(0xA0);
             entryFilename = entryFilename.substr(0, i);
             //mstr::rtrimA0(entryFilename);
@@ -191,7 +193,7 @@ MFile *ARKMFile::getNextFileInDir()
 
     if (image->seekNextImageEntry())
     {
-        std::string filename = image->entry.filename;
+        std::string filename(image->entry.filename, strnlen(image->entry.filename, sizeof(image->entry.filename)));
         uint8_t i = filename.find_first_of(0xA0);
         filename = filename.substr(0, i);
         // mstr::rtrimA0(filename);
@@ -0,0 +1,257 @@
+#include "crt.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "endianness.h"
+
+/********************************************************
+ * Streams
+ ********************************************************/
+
+std::string CRTMStream::decodeType(uint8_t file_type, bool show_hidden)
+{
+    // Everything that isn't a program is a ROM image for the EasyFlash menu
+    if ( (file_type & EFS_TYPE_MASK) == EFS_TYPE_PRG )
+        return "PRG";
+
+    return "USR";
+}
+
+int16_t CRTMStream::loadEntries()
+{
+    seekHeader();
+    if ( strncmp(header.signature, "C64 CARTRIDGE", 13) )
+    {
+        Debug_printv("Error: invalid signature, not a CRT file?");
+        return -1;
+    }
+
+    hardware_type = UINT16_FROM_HILOBYTES(header.hardware_type[0], header.hardware_type[1]);
+    uint32_t offset = (header.header_length[0] << 24) | (header.header_length[1] << 16) | (header.header_length[2] << 8) | header.header_length[3];
+    if ( offset < sizeof(Header) )
+        offset = sizeof(Header);
+
+    // Walk the CHIP packets once, only their headers are read
+    Chip chip;
+    while ( containerStream->seek(offset) && containerStream->read((uint8_t *)&chip, sizeof(chip)) == sizeof(chip) )
+    {
+        if ( strncmp(chip.signature, "CHIP", 4) )
+            break;
+
+        uint32_t length = (chip.packet_length[0] << 24) | (chip.packet_length[1] << 16) | (chip.packet_length[2] << 8) | chip.packet_length[3];
+        uint16_t bank = UINT16_FROM_HILOBYTES(chip.bank[0], chip.bank[1]);
+        uint16_t load_address = UINT16_FROM_HILOBYTES(chip.load_address[0], chip.load_address[1]);
+        uint16_t image_size = UINT16_FROM_HILOBYTES(chip.image_size[0], chip.image_size[1]);
+        if ( length <= sizeof(chip) )
+            break;
+
+        // ROML, ROMH or both for a 16K chip
+        uint32_t half = bank * 2 + ((load_address == 0x8000) ? 0 : 1);
+        uint32_t data = offset + sizeof(chip);
+        for ( uint32_t i = 0; i < image_size; i += CRT_HALF_SIZE, half++, data += CRT_HALF_SIZE )
+        {
+            if ( half >= chips.size() )
+                chips.resize(half + 1, 0);
+            chips[half] = data;
+        }
+
+        offset += length;
+    }
+
+    Debug_printv("hardware_type[%d] halves[%d]", hardware_type, chips.size());
+
+    // Only EasyFlash carts carry a directory
+    if ( hardware_type != CRT_TYPE_EASYFLASH || chips.empty() || !chips[0] )
+        return 0;
+
+    // One read for the whole directory
+    uint32_t count = (CRT_HALF_SIZE - EFS_DIR_OFFSET) / sizeof(Entry);
+    std::vector<Entry> table(count);
+    containerStream->seek(chips[0] + EFS_DIR_OFFSET);
+    count = containerStream->read((uint8_t *)table.data(), count * sizeof(Entry)) / sizeof(Entry);
+
+    for ( uint32_t i = 0; i < count && (table[i].flags & EFS_TYPE_MASK) != EFS_TYPE_END; i++ )
+    {
+        std::string name(table[i].filename, strnlen(table[i].filename, sizeof(table[i].filename)));
+        name = mstr::toUTF8(name);
+
+        entries.push_back(table[i]);
+        addEntryName(std::move(name));
+    }
+
+    entry_count = entries.size();
+    Debug_printv("entries[%d]", entry_count);
+    return entry_count;
+}
+
+bool CRTMStream::seekEntry( std::string filename )
+{
+    if ( seekEntry( findEntry(filename) ) )
+        return true;
+
+    entry.filename[0] = '\0';
+
+    return false;
+}
+
+bool CRTMStream::seekEntry( uint16_t index )
+{
+    if ( index && index <= entries.size() )
+    {
+        entry = entries[index - 1];
+        entry_index = index;
+        return true;
+    }
+
+    return false;
+}
+
+// Read from the cartridge address space, moving on to the next
+// chip whenever the read crosses an 8K boundary
+uint32_t CRTMStream::readCart(uint8_t* buf, uint32_t size) {
+    uint32_t bytesRead = 0;
+
+    while ( bytesRead < size )
+    {
+        uint32_t half = _address / CRT_HALF_SIZE;
+        if ( half >= chips.size() || !chips[half] )
+        {
+            Debug_printv("No chip for bank[%d] half[%d]", half / 2, half % 2);
+            _error = 1;
+            break;
+        }
+
+        uint32_t within = _address % CRT_HALF_SIZE;
+        uint32_t chunk = std::min(size - bytesRead, CRT_HALF_SIZE - within);
+        if ( within == 0 || bytesRead == 0 )
+            containerStream->seek(chips[half] + within);
+
+        uint32_t r = containerStream->read(buf + bytesRead, chunk);
+        bytesRead += r;
+        _address += r;
+        if ( r < chunk )
+            break;
+    }
+
+    return bytesRead;
+}
+
+uint32_t CRTMStream::readFile(uint8_t* buf, uint32_t size) {
+    if ( size > _size - _position )
+        size = _size - _position;
+
+    return readCart(buf, size);
+}
+
+bool CRTMStream::seekPath(std::string path) {
+    // Implement this to skip a queue of file streams to start of file by name
+    // this will cause the next read to return bytes of 'path'
+    seekCalled = true;
+
+    entry_index = 0;
+
+    // call image method to obtain file bytes here, return true on success:
+    if ( seekEntry(path) )
+    {
+        // The file is stored whole, load address included
+        _size = entry.size[0] | (entry.size[1] << 8) | (entry.size[2] << 16);
+        _address = (entry.bank * CRT_BANK_SIZE) + UINT16_FROM_HILOBYTES(entry.offset[1], entry.offset[0]);
+
+        // Set position to beginning of file
+        _position = 0;
+
+        Debug_printv("File Size: size[%lu] available[%lu] bank[%d] address[%lu]", _size, available(), entry.bank, _address);
+
+        return true;
+    }
+    else
+    {
+        Debug_printv( "Not found! [%s]", path.c_str());
+    }
+
+    return false;
+};
+
+/********************************************************
+ * File implementations
+ ********************************************************/
+
+bool CRTMFile::isDirectory() {
+    //Debug_printv("pathInStream[%s]", pathInStream.c_str());
+    if ( pathInStream == "" )
+        return true;
+    else
+        return false;
+};
+
+bool CRTMFile::rewindDirectory() {
+    Debug_printv("streamFile->url[%s]", streamFile->url.c_str());
+    auto image = ImageBroker::obtain<CRTMStream>(streamFile->url);
+    if ( image == nullptr )
+    {
+        Debug_printv("image pointer is null");
+        return false;
+    }
+
+    dirIsOpen = true;
+    image->resetEntryCounter();
+
+    // Read Header
+    image->seekHeader();
+
+    // Set Media Info Fields
+    media_header = mstr::format("%.16s", image->header.name);
+    media_id = (image->hardware_type == CRT_TYPE_EASYFLASH) ? " EFS " : " CRT ";
+    media_blocks_free = 0;
+    media_block_size = image->block_size;
+    media_image = name;
+
+    Debug_printv("media_header[%s] media_id[%s] media_blocks_free[%d] media_block_size[%d] media_image[%s]", media_header.c_str(), media_id.c_str(), media_blocks_free, media_block_size, media_image.c_str());
+
+    return true;
+}
+
+MFile* CRTMFile::getNextFileInDir() {
+
+    if(!dirIsOpen && !rewindDirectory())
+        return nullptr;
+
+    // Get entry pointed to by containerStream
+    auto image = ImageBroker::obtain<CRTMStream>(streamFile->url);
+    if ( image == nullptr )
+        return nullptr;
+
+    bool r = false;
+    do
+    {
+        r = image->seekNextImageEntry();
+    } while ( r && (image->entry.flags & EFS_FLAG_HIDDEN) && !image->show_hidden ); // Skip hidden files
+
+    if ( r )
+    {
+        std::string filename(image->entry.filename, strnlen(image->entry.filename, sizeof(image->entry.filename)));
+        mstr::replaceAll(filename, "/", "\\");
+        //Debug_printv( "entry[%s]", (streamFile->url + "/" + filename).c_str() );
+        auto file = MFSOwner::File(streamFile->url + "/" + filename);
+        file->extension = image->decodeType(image->entry.flags);
+        return file;
+    }
+    else
+    {
+        //Debug_printv( "END OF DIRECTORY");
+        dirIsOpen = false;
+        return nullptr;
+    }
+}
+
+
+uint32_t CRTMFile::size() {
+    // use CRT to get size of the file in image
+    auto image = ImageBroker::obtain<CRTMStream>(streamFile->url);
+    if ( image == nullptr )
+        return 0;
+
+    auto &entry = image->entry;
+    return entry.size[0] | (entry.size[1] << 8) | (entry.size[2] << 16);
+}
@@ -2,13 +2,32 @@
 // https://vice-emu.sourceforge.io/vice_17.html#SEC369
 // https://ist.uwaterloo.ca/~schepers/formats/CRT.TXT
 //
+// EasyFlash carts carrying an EasyFS directory are browsable,
+// each directory entry shows up as a file.
+// https://skoe.de/easyflash/develdocs/
+//
 
 
 #ifndef MEATLOAF_MEDIA_CRT
 #define MEATLOAF_MEDIA_CRT
 
-#include "meatloaf.h"
-#include "meat_media.h"
+#include "../meatloaf.h"
+#include "../meat_media.h"
+
+// Hardware types from the CRT header
+#define CRT_TYPE_NORMAL         0
+#define CRT_TYPE_EASYFLASH      32
+
+// Banks are two 8K halves, ROML at $8000 and ROMH at $A000 (or $E000)
+#define CRT_HALF_SIZE           0x2000
+#define CRT_BANK_SIZE           0x4000
+
+// EasyFS directory, bank 0 ROML at $9800 up to the end of the chip
+#define EFS_DIR_OFFSET          0x1800
+#define EFS_TYPE_MASK           0x1F
+#define EFS_TYPE_PRG            0x01
+#define EFS_TYPE_END            0x1F
+#define EFS_FLAG_HIDDEN         0x80
 
 
 /********************************************************
@@ -19,27 +38,53 @@ class CRTMStream : public MMediaStream {
     // override everything that requires overriding here
 
 public:
-    CRTMStream(std::shared_ptr<MStream> is) : MMediaStream(is) {};
+    CRTMStream(std::shared_ptr<MStream> is) : MMediaStream(is) {
+        loadEntries();
+    };
 
 protected:
     struct Header {
-        char disk_name[16];
+        char signature[16];
+        uint8_t header_length[4];   // big endian, like everything in CRT
+        uint8_t version[2];
+        uint8_t hardware_type[2];
+        uint8_t exrom;
+        uint8_t game;
+        uint8_t reserved[6];
+        char name[32];
+    };
+
+    struct Chip {
+        char signature[4];
+        uint8_t packet_length[4];
+        uint8_t chip_type[2];
+        uint8_t bank[2];
+        uint8_t load_address[2];
+        uint8_t image_size[2];
     };
 
     struct Entry {
         char filename[16];
-        uint8_t file_type;
-        uint8_t file_start_address[2]; // from tcrt file system at 0xD8
-        uint8_t file_size[3];
-        uint8_t file_load_address[2];
-        uint16_t bundle_compatibility;
-        uint16_t bundle_main_start;
-        uint16_t bundle_main_length;
-        uint16_t bundle_main_call_address;
+        uint8_t flags;
+        uint8_t bank;
+        uint8_t bank_high;
+        uint8_t offset[2];          // within the 16K bank
+        uint8_t size[3];
     };
 
+    // Where each 8K half of each bank starts in the container (0 not present),
+    // filled from the CHIP packets once at open
+    std::vector<uint32_t> chips;
+    uint16_t hardware_type = 0;
+
+    // EasyFS directory, read once at open
+    std::vector<Entry> entries;
+    int16_t loadEntries();
+    // "*" is the first PRG that isn't hidden
+    bool loadableEntry( uint16_t index ) override { return entries[index - 1].flags == EFS_TYPE_PRG; };
+
     void seekHeader() override {
-        containerStream->seek(0x18);
+        containerStream->seek(0x00);
         containerStream->read((uint8_t*)&header, sizeof(header));
     }
 
@@ -55,6 +100,10 @@ protected:
     std::string decodeType(uint8_t file_type, bool show_hidden = false) override;
 
 private:
+    // Cartridge address of the next byte, bank * 16K + offset
+    uint32_t _address = 0;
+    uint32_t readCart(uint8_t* buf, uint32_t size);
+
     friend class CRTMFile;
 };
 
@@ -72,7 +121,7 @@ public:
         media_image = name;
         isPETSCII = true;
     };
-    
+
     ~CRTMFile() {
         // don't close the stream here! It will be used by shared ptr D64Util to keep reading image params
     }
@@ -56,6 +56,8 @@ public:
                 sectorsPerTrack = { 144 };
                 break;
         }
+
+        mapBlocks();
     };
 
     // virtual std::unordered_map<std::string, std::string> info() override { 
@@ -136,36 +136,39 @@ public:
         partitions.push_back(p);
         sectorsPerTrack = { 256 };
 
-        // // The header's size is 256 bytes, that's exactly one sector. The header is
-        // // always the first sector in the image (track 1, sector 0).
-        // //
-        // // $00 - $17 : magic (0x00, dreamload file archive, 0x00)
-        // // $18 - $1b : version (bit 0-15: minor, 16-31: major. $00010000 is v1.0)
-        // // $1c - $1f : tracks in this image (a track has always 256 sectors)
-        // // $20 - $21 : root dir track and sektor
-        // // $22 - $23 : bam track and sector
-        // // $24 - $5f : reserved
-        // // $60 - $ff : comment or notes
-        // this.seek(0x20);
-        seek ( 0x20 );
-        // this.partitions[0].track = this.read();
-        partitions[0].header_track = read();
-        // this.partitions[0].sector = this.read();
-        partitions[0].header_sector = read();
-        // this.partitions[0].block_allocation_map[0].track = this.read();
-        partitions[0].block_allocation_map[0].track = read();
-        // this.partitions[0].block_allocation_map[0].sector = this.read();
-        partitions[0].block_allocation_map[0].sector = read();
-
-        // this.partitions[0].directory_track = this.partitions[0].track;
-        partitions[0].directory_track = partitions[0].header_track;
-        // this.partitions[0].directory_sector = this.partitions[0].sector + 1;
-        partitions[0].directory_sector = partitions[0].header_sector + 1;
+        // The header is the first sector, read it in one go
+        containerStream->seek(0x00);
+        if ( containerStream->read((uint8_t *)&dfi_header, sizeof(dfi_header)) == sizeof(dfi_header) )
+        {
+            // Tracks in the image, little endian
+            uint32_t tracks = dfi_header.tracks[0] | (dfi_header.tracks[1] << 8) | (dfi_header.tracks[2] << 16) | (dfi_header.tracks[3] << 24);
+            if ( tracks > 0 && tracks <= 0xFF )
+                partitions[0].block_allocation_map[0].end_track = tracks;
+
+            partitions[0].header_track = dfi_header.root_dir_track;
+            partitions[0].header_sector = dfi_header.root_dir_sector;
+            partitions[0].block_allocation_map[0].track = dfi_header.bam_track;
+            partitions[0].block_allocation_map[0].sector = dfi_header.bam_sector;
+
+            partitions[0].directory_track = partitions[0].header_track;
+            partitions[0].directory_sector = partitions[0].header_sector + 1;
+        }
+
+        mapBlocks();
     };
 
     virtual uint8_t speedZone(uint8_t track) override { return 0; };
 
 protected:
+    struct DFIHeader {
+        char magic[24];         // 0x00, "DREAMLOAD FILE ARCHIVE", 0x00
+        uint8_t version[4];     // bit 0-15 minor, 16-31 major
+        uint8_t tracks[4];      // 256 sectors each
+        uint8_t root_dir_track;
+        uint8_t root_dir_sector;
+        uint8_t bam_track;
+        uint8_t bam_sector;
+    } dfi_header;
 
 private:
     friend class DFIMFile;
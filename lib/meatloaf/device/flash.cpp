@@ -33,7 +33,8 @@ MFile* FlashMFileSystem::getFile(std::string path)
 
 bool FlashMFile::pathValid(std::string path) 
 {
-    auto apath = std::string(basepath + path).c_str();
+    std::string full_path = basepath + path;
+    auto apath = full_path.c_str();
     while (*apath) {
         const char *slash = strchr(apath, '/');
         if (!slash) {
@@ -351,8 +352,8 @@ bool FlashMStream::open(std::ios_base::openmode mode) {
         handle->obtain(localPath, "a+");
 
     // The below code will definitely destroy whatever open above does, because it will move the file pointer
-    // so I just wrapped it to be called only for in
-    if(isOpen() && mode == std::ios_base::in) {
+    // so I just wrapped it to be called only for in, and in|out where writes seek first anyway
+    if(isOpen() && (mode == std::ios_base::in || mode == (std::ios_base::in | std::ios_base::out))) {
         //Debug_printv("IStream: past obtain");
         // Set file size
         fseek(handle->file_h, 0, SEEK_END);
@@ -1,4 +1,3 @@
-#ifndef TEST_NATIVE
 #ifndef MEATLOAF_DEVICE_FLASH
 #define MEATLOAF_DEVICE_FLASH
 
@@ -160,4 +159,3 @@ protected:
 
 
 #endif // MEATLOAF_DEVICE_FLASH
-#endif // TEST_NATIVE
\ No newline at end of file
@@ -4,42 +4,53 @@
 //#include "meat_broker.h"
 #include "../meat_media.h"
 #include "endianness.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstring>
 
 // D64 Utility Functions
 
-bool D64MStream::seekBlock(uint64_t index, uint8_t offset)
+void D64MStream::mapBlocks()
 {
-    uint16_t sectorOffset = 0;
-    uint8_t track = 0;
+    // Highest track of any partition
+    uint8_t end_track = 0;
+    for (auto &p : partitions)
+        for (auto &b : p.block_allocation_map)
+            end_track = std::max(end_track, b.end_track);
 
-    // Debug_printv("track[%d] sector[%d] offset[%d]", track, sector, offset);
+    track_offset.assign(end_track + 2, 0);
+    for (uint16_t t = 1; t <= end_track; t++)
+        track_offset[t + 1] = track_offset[t] + getSectorCount(t);
+
+    //Debug_printv("end_track[%d] blocks[%lu]", end_track, track_offset[end_track + 1]);
+}
+
+bool D64MStream::seekBlock(uint64_t index, uint8_t offset)
+{
+    if (track_offset.empty())
+        mapBlocks();
 
     // Determine actual track & sector from index
-    do
+    if (index >= track_offset.back())
     {
-        track++;
-        uint8_t count = getSectorCount(track);
-        if (sectorOffset + count < index)
-            sectorOffset += count;
-        else
-            break;
-
-        // Debug_printv("track[%d] speedZone[%d] secotorsPerTrack[%d] sectorOffset[%d]", track, speedZone(track), count, sectorOffset);
-    } while (true);
-    uint8_t sector = index - sectorOffset;
+        Debug_printv("Invalid Block: index[%llu] blocks[%lu]", index, track_offset.back());
+        return false;
+    }
+    auto t = std::upper_bound(track_offset.begin() + 1, track_offset.end(), (uint32_t)index) - 1;
 
     this->block = index;
-    this->track = track;
-    this->sector = sector;
+    this->track = t - track_offset.begin();
+    this->sector = index - *t;
 
-    // Debug_printv("track[%d] sector[%d] speedZone[%d] sectorOffset[%d]", track, sector, speedZone(track), sectorOffset);
+    // Debug_printv("track[%d] sector[%d] offset[%d]", track, sector, offset);
 
     return containerStream->seek((index * block_size) + offset);
 }
 
 bool D64MStream::seekSector(uint8_t track, uint8_t sector, uint8_t offset)
 {
-    uint16_t sectorOffset = 0;
+    TRACE_SPAN(TRACE_SEEK_SECTOR);
 
     //Debug_printv("track[%d] sector[%d] offset[%d]", track, sector, offset);
 
@@ -55,20 +66,15 @@ bool D64MStream::seekSector(uint8_t track, uint8_t sector, uint8_t offset)
 
     // Is this a valid sector?
     c = getSectorCount(track);
-    if (sector > c)
+    if (sector >= c)
     {
         Debug_printv("Invalid Sector: sector[%d] sectorsPerTrack[%d]", sector, c);
         return false;
     }
 
-    track--;
-    for (uint8_t index = 0; index < track; ++index)
-    {
-        sectorOffset += getSectorCount(index + 1);
-        //Debug_printv("track[%d] speedZone[%d] secotorsPerTrack[%d] sectorOffset[%d]", (index + 1), speedZone(index), getSectorCount(index + 1), sectorOffset);
-    }
-    track++;
-    sectorOffset += sector;
+    if (track_offset.empty())
+        mapBlocks();
+    uint32_t sectorOffset = track_offset[track] + sector;
 
     this->block = sectorOffset;
     this->track = track;
@@ -86,115 +92,737 @@ bool D64MStream::seekSector(std::vector<uint8_t> trackSectorOffset)
 
 std::string D64MStream::readBlock(uint8_t track, uint8_t sector)
 {
-    return "";
+    if (!seekSector(track, sector))
+        return "";
+
+    // Sectors written since the last flush are served from the cache
+    uint32_t offset = containerStream->position();
+    std::string data;
+    if (cacheLookup(offset, data) || readCacheLookup(offset, block_size, data))
+        return data;
+
+    // Read up to the end of the track, block commands and chains mostly move forward
+    data.resize(readAheadCount(track, sector) * block_size);
+    uint32_t len = readContainer((uint8_t *)&data[0], data.size());
+    if (len < block_size)
+        return "";
+
+    data.resize(len - (len % block_size));
+    readCacheStore(offset, data);
+    data.resize(block_size);
+
+    return data;
+}
+
+uint16_t D64MStream::readAheadCount(uint8_t track, uint8_t sector)
+{
+    // Never more than the read cache keeps, big DFI tracks would be read and thrown away
+    return std::min<uint32_t>(getSectorCount(track) - sector, MEDIA_READ_CACHE_SIZE / block_size);
 }
 
 bool D64MStream::writeBlock(uint8_t track, uint8_t sector, std::string data)
 {
+    if (!write_support || data.size() != block_size)
+        return false;
+
+    if (!seekSector(track, sector))
+        return false;
+
+    return cacheStore(containerStream->position(), data);
+}
+
+bool D64MStream::readSector(uint8_t track, uint8_t sector, uint8_t *buf)
+{
+    std::string data = readBlock(track, sector);
+    if (data.size() != block_size)
+        return false;
+
+    memcpy(buf, data.data(), block_size);
+    return true;
+}
+
+bool D64MStream::writeSector(uint8_t track, uint8_t sector, const uint8_t *buf)
+{
+    if (!isWritable())
+        return false;
+
+    // The sector may hold part of the BAM, reload it before the next allocation
+    track_bam.clear();
+    return writeBlock(track, sector, std::string((const char *)buf, block_size));
+}
+
+uint64_t D64MStream::sectorMask(uint8_t track)
+{
+    uint16_t count = getSectorCount(track);
+    if (count >= 64)
+        return ~0ULL;
+    return (1ULL << count) - 1;
+}
+
+bool D64MStream::isReservedTrack(uint8_t track)
+{
+    // File data never goes on the directory or BAM tracks
+    if (track == partitions[partition].directory_track)
+        return true;
+
+    for (auto &b : partitions[partition].block_allocation_map)
+    {
+        if (track == b.track)
+            return true;
+    }
+
+    return false;
+}
+
+bool D64MStream::loadBAM()
+{
+    if (!track_bam.empty())
+        return true;
+
+    auto &bam_map = partitions[partition].block_allocation_map;
+    std::vector<TrackAvailability> tracks(bam_map.back().end_track + 1, {0, 0});
+
+    for (auto &b : bam_map)
+    {
+        std::string data = readBlock(b.track, b.sector);
+        if (data.size() != block_size || (size_t)(b.offset + (b.end_track - b.start_track + 1) * b.byte_count) > block_size)
+            return false;
+
+        // Entries of 4 bytes or more start with the free count, shorter ones are only the bitmap
+        uint8_t skip = (b.byte_count > 3) ? 1 : 0;
+        for (uint8_t t = b.start_track; t <= b.end_track; t++)
+        {
+            const uint8_t *e = (const uint8_t *)data.data() + b.offset + (t - b.start_track) * b.byte_count;
+            uint64_t map = 0;
+            for (uint8_t i = skip; i < b.byte_count; i++)
+                map |= (uint64_t)e[i] << (8 * (i - skip));
+            map &= sectorMask(t);
+
+            tracks[t] = {(uint8_t)std::bitset<64>(map).count(), map};
+        }
+    }
+
+    track_bam.swap(tracks);
+    return true;
+}
+
+bool D64MStream::storeBAM()
+{
+    if (track_bam.empty())
+        return true;
+
+    for (auto &b : partitions[partition].block_allocation_map)
+    {
+        std::string data = readBlock(b.track, b.sector);
+        if (data.size() != block_size)
+            return false;
+
+        uint8_t skip = (b.byte_count > 3) ? 1 : 0;
+        for (uint8_t t = b.start_track; t <= b.end_track; t++)
+        {
+            uint8_t *e = (uint8_t *)&data[b.offset + (t - b.start_track) * b.byte_count];
+            if (skip)
+                e[0] = track_bam[t].free;
+            for (uint8_t i = skip; i < b.byte_count; i++)
+                e[i] = (track_bam[t].map >> (8 * (i - skip))) & 0xFF;
+        }
+
+        if (!writeBlock(b.track, b.sector, data))
+            return false;
+    }
+
     return true;
 }
 
 bool D64MStream::allocateBlock(uint8_t track, uint8_t sector)
 {
-    // int offset;
-    // byte bitmask;
+    if (!loadBAM() || track >= track_bam.size() || sector >= getSectorCount(track))
+        return false;
 
-    // offset = (track-1) * 4 + 4;							// offset to correct Track-Info
-    // if (bam->GetRawSector()[offset] > 0)
-    // {
-    // 	bam->GetRawSector()[offset] -= 1;				// reduce free Sectors
-    // }
-    // offset++;											// Move to Bitmask
-    // offset += (sector >> 3);							// move to the correct byte (sector div 8)
-    // bitmask = (byte)(1 << (sector % 8));				// generate Bitmask for Sector
-    // if ((bam->GetRawSector()[offset] & bitmask) == 0)	// was already set to 'used' ?
-    // {
-    // 	return false;
-    // }
-    // bitmask ^= 255;										// invert bitmask (0 means "Sector is used")
-    // bam->GetRawSector()[offset] &= bitmask;				// clear bit in BAM
-    // WriteSector(bam);									// Write back to Image
+    uint64_t bit = 1ULL << sector;
+    if ((track_bam[track].map & bit) == 0) // already in use
+        return false;
+
+    track_bam[track].map &= ~bit;
+    track_bam[track].free--;
     return true;
 }
 
 bool D64MStream::deallocateBlock(uint8_t track, uint8_t sector)
 {
-    // int offset;
-    // byte bitmask;
+    if (!loadBAM() || track >= track_bam.size() || sector >= getSectorCount(track))
+        return false;
 
-    // offset = (track - 1) * 4 + 4;						// offset to correct Track-Info
-    // bam->GetRawSector()[offset] += 1;					// increase free Sectors
-    // offset++;											// Move to Bitmask
-    // offset += (sector >> 3);							// move to the correct byte (sector div 8)
-    // bitmask = (byte)(1 << (sector % 8));				// generate Bitmask for Sector
-    // if ((bam->GetRawSector()[offset] & bitmask) == 1)	// Sector already free ?
-    // {
-    // 	return false;
-    // }
-    // bam->GetRawSector()[offset] |= bitmask;				// clear bit in BAM (1 means "Sector is free")
-    // WriteSector(bam);									// Write back to Image
+    uint64_t bit = 1ULL << sector;
+    if (track_bam[track].map & bit) // already free
+        return false;
+
+    track_bam[track].map |= bit;
+    track_bam[track].free++;
+    return true;
+}
+
+bool D64MStream::findFreeSector(uint8_t track, uint8_t from, uint8_t *foundSector)
+{
+    uint64_t map = track_bam[track].map;
+    if (map == 0)
+        return false;
+
+    // Rotate the bitmap so the search starts at 'from' and take the lowest free sector
+    uint8_t count = getSectorCount(track);
+    from %= count;
+    uint64_t rotated = ((map >> from) | (map << (count - from))) & sectorMask(track);
+
+    *foundSector = (from + __builtin_ctzll(rotated)) % count;
     return true;
 }
 
 bool D64MStream::getNextFreeBlock(uint8_t startTrack, uint8_t startSector, uint8_t *foundTrack, uint8_t *foundSector)
 {
-    uint8_t track, sector;
-    bool found = false;
-    bool wrapped = false;
-    track = startTrack;
+    if (!loadBAM())
+        return false;
+
+    int dir = partitions[partition].directory_track;
+    int first = partitions[partition].block_allocation_map[0].start_track;
+    int last = track_bam.size() - 1;
 
-    sector = startSector;
-    while (!found)
+    if (startTrack)
     {
-        if (!isBlockFree(track, sector))
+        // Stay on the same track, one interleave further on
+        if (!isReservedTrack(startTrack) && findFreeSector(startTrack, startSector + interleave[1], foundSector))
+        {
+            *foundTrack = startTrack;
+            return true;
+        }
+
+        // Then keep moving away from the directory track
+        int step = (startTrack < dir) ? -1 : 1;
+        for (int t = startTrack + step; t >= first && t <= last; t += step)
         {
-            if (sector == startSector && track == startTrack)
+            if (!isReservedTrack(t) && findFreeSector(t, 0, foundSector))
             {
-                sector++; // Skip StartSector
-                if (wrapped)
-                {
-                    break; // already wrapped, exit (no free sector found)
-                }
+                *foundTrack = t;
+                return true;
             }
-            else
+        }
+    }
+
+    // First block of a file, or that side is full: the track closest to the directory
+    for (int distance = 1; distance <= last; distance++)
+    {
+        for (int t : {dir - distance, dir + distance})
+        {
+            if (t >= first && t <= last && !isReservedTrack(t) && findFreeSector(t, 0, foundSector))
             {
-                sector++;
+                *foundTrack = t;
+                return true;
             }
+        }
+    }
+
+    return false;
+}
 
-            if (sector > getSectorCount(track))
+bool D64MStream::isBlockFree(uint8_t track, uint8_t sector)
+{
+    if (!loadBAM() || track >= track_bam.size() || sector >= getSectorCount(track))
+        return false;
+
+    return (track_bam[track].map >> sector) & 1;
+}
+
+bool D64MStream::freeChain(uint8_t track, uint8_t sector)
+{
+    while (track)
+    {
+        std::string data = readBlock(track, sector);
+        if (data.size() != block_size)
+            return false;
+
+        // A block that is already free means the chain loops or is damaged
+        if (!deallocateBlock(track, sector))
+            break;
+
+        track = data[0];
+        sector = data[1];
+    }
+
+    return true;
+}
+
+bool D64MStream::isWritable()
+{
+    if (write_support && isLocalContainer())
+        return true;
+
+    Debug_printv("Image is read only [%s]", url.c_str());
+    _error = 26; // WRITE PROTECT ON
+    return false;
+}
+
+bool D64MStream::createFile(std::string filename)
+{
+    if (!isWritable())
+        return false;
+
+    mstr::replaceAll(filename, "\\", "/");
+    if (filename.empty() || mstr::contains(filename, "*") || mstr::contains(filename, "?") || !loadBAM())
+        return false;
+
+    write_entry_track = 0;
+    if (seekEntry(filename))
+    {
+        // Only "@:" replaces a file, opened with trunc
+        if (!(mode & std::ios_base::trunc))
+        {
+            Debug_printv("File exists [%s]", filename.c_str());
+            _error = 63; // FILE EXISTS
+            return false;
+        }
+
+        // Replace the existing file, its directory entry and blocks are reused
+        write_entry_track = entry_track;
+        write_entry_sector = entry_sector;
+        write_entry_slot = (entry_index - 1) % 8;
+        if (!freeChain(entry.start_track, entry.start_sector))
+            return false;
+    }
+
+    write_name = filename;
+    write_block.assign(block_size, 0);
+    write_offset = 0;
+    write_track = 0;
+    write_sector = 0;
+    write_start_track = 0;
+    write_start_sector = 0;
+    write_blocks = 0;
+    writing = true;
+
+    _size = 0;
+    _position = 0;
+    _error = 0;
+
+    return true;
+}
+
+bool D64MStream::advanceWriteBlock()
+{
+    uint8_t t, s;
+    if (!getNextFreeBlock(write_track, write_sector, &t, &s) || !allocateBlock(t, s))
+    {
+        Debug_printv("Disk full [%s]", url.c_str());
+        _error = 72; // DISK FULL
+        return false;
+    }
+
+    if (write_track)
+    {
+        // Link the finished block to the new one
+        write_block[0] = t;
+        write_block[1] = s;
+        if (!writeBlock(write_track, write_sector, write_block))
+            return false;
+    }
+    else
+    {
+        write_start_track = t;
+        write_start_sector = s;
+    }
+
+    write_track = t;
+    write_sector = s;
+    write_block.assign(block_size, 0);
+    write_offset = 2;
+    write_blocks++;
+
+    return true;
+}
+
+uint32_t D64MStream::writeFile(const uint8_t *buf, uint32_t size)
+{
+    uint32_t bytesWritten = 0;
+
+    if (!writing || _error)
+        return 0;
+
+    while (bytesWritten < size)
+    {
+        // Only take a new block once there is data for it
+        if (write_offset == 0 || write_offset == block_size)
+        {
+            if (!advanceWriteBlock())
+                break;
+        }
+
+        uint32_t n = std::min<uint32_t>(size - bytesWritten, block_size - write_offset);
+        write_block.replace(write_offset, n, (const char *)buf + bytesWritten, n);
+        write_offset += n;
+        bytesWritten += n;
+    }
+
+    return bytesWritten;
+}
+
+bool D64MStream::writeEntry()
+{
+    uint8_t t = write_entry_track;
+    uint8_t s = write_entry_sector;
+    uint8_t slot = write_entry_slot;
+    std::string dir;
+
+    if (t)
+    {
+        dir = readBlock(t, s);
+        if (dir.size() != block_size)
+            return false;
+    }
+    else
+    {
+        // First unused slot in the directory chain
+        t = partitions[partition].directory_track;
+        s = partitions[partition].directory_sector;
+        for (uint16_t n = 0; n < getSectorCount(t); n++)
+        {
+            dir = readBlock(t, s);
+            if (dir.size() != block_size)
+                return false;
+
+            for (slot = 0; slot < 8; slot++)
             {
-                track++;
-                sector = 0;
-                if (track > getTrackCount())
-                {
-                    track = 1; // Start from the beginning
-                    wrapped = true;
-                }
+                if (dir[slot * 32 + 2] == 0)
+                    break;
             }
+            if (slot < 8 || dir[0] == 0)
+                break;
+
+            t = dir[0];
+            s = dir[1];
         }
-        else
+
+        if (slot == 8)
         {
-            found = true;
+            // Directory sector is full, link in another one from the directory track
+            uint8_t ns;
+            if (!findFreeSector(t, s + interleave[0], &ns) || !allocateBlock(t, ns))
+            {
+                Debug_printv("Directory full [%s]", url.c_str());
+                _error = 72; // DISK FULL
+                return false;
+            }
+
+            dir[0] = t;
+            dir[1] = ns;
+            if (!writeBlock(t, s, dir))
+                return false;
+
+            s = ns;
+            dir.assign(block_size, 0);
+            dir[1] = 0xFF;
+            slot = 0;
         }
     }
-    *foundTrack = track;
-    *foundSector = sector;
-    return found;
+
+    std::string name = mstr::toPETSCII2(write_name).substr(0, 16);
+
+    // Leave the link bytes alone, they belong to the sector
+    uint8_t *e = (uint8_t *)&dir[slot * 32];
+    e[2] = 0x80 | write_type; // closed
+    e[3] = write_start_track;
+    e[4] = write_start_sector;
+    memset(e + 5, 0xA0, 16);
+    memcpy(e + 5, name.data(), name.size());
+    memset(e + 21, 0, 9);
+    e[30] = write_blocks & 0xFF;
+    e[31] = write_blocks >> 8;
+
+    return writeBlock(t, s, dir);
 }
 
-bool D64MStream::isBlockFree(uint8_t track, uint8_t sector)
+bool D64MStream::closeFile()
+{
+    writing = false;
+
+    if (_error)
+        return false;
+
+    // Even an empty file takes a block
+    if (write_track == 0 && !advanceWriteBlock())
+        return false;
+
+    // Last block has no link, the second byte is the index of the last byte used
+    write_block[0] = 0;
+    write_block[1] = write_offset - 1;
+
+    return writeBlock(write_track, write_sector, write_block) && writeEntry() && storeBAM();
+}
+
+void D64MStream::close()
 {
-    // int offset;
-    // byte bitmask;
+    if (writing && !closeFile())
+    {
+        // Nothing was written to the image yet, leave it as it was
+        Debug_printv("Discarding write [%s]", url.c_str());
+        cacheDiscard();
+        track_bam.clear();
+    }
+
+    MMediaStream::close();
+}
+
+bool D64MStream::resetBAM()
+{
+    if (!loadBAM())
+        return false;
+
+    // Data tracks all free, tracks holding only BAM sectors all used
+    uint8_t dir = partitions[partition].directory_track;
+    for (auto &b : partitions[partition].block_allocation_map)
+    {
+        for (uint8_t t = b.start_track; t <= b.end_track; t++)
+        {
+            if (isReservedTrack(t) && t != dir)
+                track_bam[t] = {0, 0};
+            else
+                track_bam[t] = {(uint8_t)getSectorCount(t), sectorMask(t)};
+        }
+    }
+
+    // Header and BAM sectors on the directory track, the directory chain is up to the caller
+    allocateBlock(partitions[partition].header_track, partitions[partition].header_sector);
+    for (auto &b : partitions[partition].block_allocation_map)
+    {
+        if (b.track == dir)
+            allocateBlock(b.track, b.sector);
+    }
 
-    // offset = (track-1) * 4 + 4;                 // offset to correct Track-Info
-    // offset++;									// Move to Bitmask
-    // offset += (sector >> 3);                    // move to the correct byte (sector div 8)
-    // bitmask = (byte)(1 << (sector % 8));        // generate Bitmask for Sector
-    // return (bam->GetRawSector()[offset] & bitmask) == bitmask;
     return true;
 }
 
+bool D64MStream::allocateChain(uint8_t track, uint8_t sector)
+{
+    while (track)
+    {
+        // Stops on a block that is out of range or already used by another chain
+        if (!allocateBlock(track, sector))
+            return false;
+
+        std::string data = readBlock(track, sector);
+        if (data.size() != block_size)
+            return false;
+
+        track = data[0];
+        sector = data[1];
+    }
+
+    return true;
+}
+
+std::string D64MStream::entryName(const uint8_t *e)
+{
+    std::string name((const char *)e + 5, 16);
+    name = name.substr(0, name.find_first_of((char)0xA0));
+
+    return mstr::toUTF8(name);
+}
+
+std::vector<D64MStream::EntrySlot> D64MStream::findEntries(std::string pattern)
+{
+    std::vector<EntrySlot> found;
+    uint8_t t = partitions[partition].directory_track;
+    uint8_t s = partitions[partition].directory_sector;
+
+    mstr::replaceAll(pattern, "\\", "/");
+
+    // Bounded, so a directory chain that loops back on itself still ends
+    for (uint16_t n = 0; t && n < 256; n++)
+    {
+        std::string dir = readBlock(t, s);
+        if (dir.size() != block_size)
+            break;
+
+        for (uint8_t slot = 0; slot < 8; slot++)
+        {
+            const uint8_t *e = (const uint8_t *)&dir[slot * 32];
+            if (e[2] && mstr::matchPattern(pattern, entryName(e)))
+                found.push_back({t, s, slot});
+        }
+
+        t = dir[0];
+        s = dir[1];
+    }
+
+    return found;
+}
+
+std::vector<std::pair<uint8_t, uint8_t>> D64MStream::entryChains(const uint8_t *e)
+{
+    std::vector<std::pair<uint8_t, uint8_t>> chains = {{e[3], e[4]}};
+
+    if ((e[2] & 0b00000111) == 4)
+    {
+        // REL side sectors
+        chains.push_back({e[21], e[22]});
+    }
+    else if (e[24])
+    {
+        // GEOS info block, and for VLIR files one chain per record in the index block
+        chains.push_back({e[21], e[22]});
+        if (e[23] == 1)
+        {
+            std::string index = readBlock(e[3], e[4]);
+            for (size_t i = 2; i + 1 < index.size(); i += 2)
+            {
+                if (index[i])
+                    chains.push_back({(uint8_t)index[i], (uint8_t)index[i + 1]});
+            }
+        }
+    }
+
+    return chains;
+}
+
+uint16_t D64MStream::scratch(std::string pattern)
+{
+    uint16_t count = 0;
+
+    if (!isWritable() || !loadBAM())
+        return 0;
+
+    for (auto &f : findEntries(pattern))
+    {
+        std::string dir = readBlock(f.track, f.sector);
+        uint8_t *e = (uint8_t *)&dir[f.slot * 32];
+
+        // Locked
+        if (e[2] & 0b01000000)
+            continue;
+
+        for (auto &c : entryChains(e))
+            freeChain(c.first, c.second);
+
+        e[2] = 0x00;
+        if (!writeBlock(f.track, f.sector, dir))
+            break;
+
+        count++;
+    }
+
+    if (count && !storeBAM())
+        return 0;
+
+    return count;
+}
+
+bool D64MStream::renameEntry(std::string from, std::string to)
+{
+    if (!isWritable())
+        return false;
+
+    if (to.empty() || mstr::contains(to, "*") || mstr::contains(to, "?"))
+    {
+        _error = 30; // SYNTAX ERROR
+        return false;
+    }
+
+    if (!findEntries(to).empty())
+    {
+        _error = 63; // FILE EXISTS
+        return false;
+    }
+
+    auto found = findEntries(from);
+    if (found.empty())
+    {
+        _error = 62; // FILE NOT FOUND
+        return false;
+    }
+
+    std::string dir = readBlock(found[0].track, found[0].sector);
+    std::string name = mstr::toPETSCII2(to).substr(0, 16);
+    uint8_t *e = (uint8_t *)&dir[found[0].slot * 32];
+    memset(e + 5, 0xA0, 16);
+    memcpy(e + 5, name.data(), name.size());
+
+    return writeBlock(found[0].track, found[0].sector, dir);
+}
+
+bool D64MStream::validate()
+{
+    if (!isWritable() || !resetBAM())
+        return false;
+
+    // Rebuild the BAM from the directory, dropping files that were never closed
+    uint8_t t = partitions[partition].directory_track;
+    uint8_t s = partitions[partition].directory_sector;
+    while (t && allocateBlock(t, s))
+    {
+        std::string dir = readBlock(t, s);
+        if (dir.size() != block_size)
+            return false;
+
+        bool dirty = false;
+        for (uint8_t slot = 0; slot < 8; slot++)
+        {
+            uint8_t *e = (uint8_t *)&dir[slot * 32];
+            if (e[2] == 0)
+                continue;
+
+            if ((e[2] & 0b10000000) == 0)
+            {
+                e[2] = 0x00;
+                dirty = true;
+                continue;
+            }
+
+            for (auto &c : entryChains(e))
+                allocateChain(c.first, c.second);
+        }
+
+        if (dirty && !writeBlock(t, s, dir))
+            return false;
+
+        t = dir[0];
+        s = dir[1];
+    }
+
+    return storeBAM();
+}
+
+bool D64MStream::format(std::string header_name, std::string id)
+{
+    if (!isWritable() || !resetBAM())
+        return false;
+
+    auto &p = partitions[partition];
+
+    // Disk name and, when given, a new ID
+    std::string data = readBlock(p.header_track, p.header_sector);
+    if (data.size() != block_size)
+        return false;
+
+    std::string name = mstr::toPETSCII2(header_name).substr(0, 16);
+    uint8_t *h = (uint8_t *)&data[p.header_offset];
+    memset(h, 0xA0, 16);
+    memcpy(h, name.data(), name.size());
+    if (!id.empty())
+    {
+        std::string disk_id = mstr::toPETSCII2(id).substr(0, 2);
+        h[18] = disk_id[0];
+        h[19] = (disk_id.size() > 1) ? disk_id[1] : 0xA0;
+    }
+    if (!writeBlock(p.header_track, p.header_sector, data))
+        return false;
+
+    // Empty directory, a single sector with no link
+    data.assign(block_size, 0);
+    data[1] = 0xFF;
+    if (!writeBlock(p.directory_track, p.directory_sector, data))
+        return false;
+    allocateBlock(p.directory_track, p.directory_sector);
+
+    return storeBAM();
+}
+
 bool D64MStream::seekEntry( std::string filename )
 {
     uint16_t index = 1;
@@ -206,7 +834,14 @@ bool D64MStream::seekEntry( std::string filename )
     {
         while (seekEntry(index))
         {
-            std::string entryFilename = entry.filename;
+            // Scratched
+            if (entry.file_type == 0x00)
+            {
+                index++;
+                continue;
+            }
+
+            std::string entryFilename(entry.filename, strnlen(entry.filename, sizeof(entry.filename)));
             uint8_t i = entryFilename.find_first_of(0xA0);
             entryFilename = entryFilename.substr(0, i);
             //mstr::rtrimA0(entryFilename);
@@ -261,35 +896,32 @@ bool D64MStream::seekEntry( uint16_t index )
     //Debug_printv("----------");
     //Debug_printv("index[%d] sectorOffset[%d] entryOffset[%d] entry_index[%d]", index, sectorOffset, entryOffset, entry_index);
 
+    std::string dir;
     if (index == 0 || index != entry_index)
     {
         // Start at first sector of directory
-        next_track = 0;
-        if (!seekSector(
-                partitions[partition].directory_track,
-                partitions[partition].directory_sector,
-                partitions[partition].directory_offset))
+        entry_track = partitions[partition].directory_track;
+        entry_sector = partitions[partition].directory_sector;
+        dir = readBlock(entry_track, entry_sector);
+        if (dir.size() != block_size)
             return false;
+        next_track = dir[partitions[partition].directory_offset];
+        next_sector = dir[partitions[partition].directory_offset + 1];
 
         // Find sector with requested entry
-        do
+        while (sectorOffset-- > 0)
         {
-            if (next_track)
-            {
-                //Debug_printv("next_track[%d] next_sector[%d]", entry.next_track, entry.next_sector);
-                if (!seekSector(entry.next_track, entry.next_sector))
-                    return false;
-            }
-
-            readContainer((uint8_t *)&entry, sizeof(entry));
-            next_track = entry.next_track;
-            next_sector = entry.next_sector;
-
-            //Debug_printv("sectorOffset[%d] -> track[%d] sector[%d]", sectorOffset, track, sector);
+            //Debug_printv("next_track[%d] next_sector[%d]", next_track, next_sector);
+            entry_track = next_track;
+            entry_sector = next_sector;
+            dir = readBlock(entry_track, entry_sector);
+            if (dir.size() != block_size)
+                return false;
+            next_track = dir[0];
+            next_sector = dir[1];
 
-        } while (sectorOffset-- > 0);
-        if (!seekSector(track, sector, entryOffset))
-            return false;
+            //Debug_printv("sectorOffset[%d] -> track[%d] sector[%d]", sectorOffset, entry_track, entry_sector);
+        }
     }
     else
     {
@@ -299,12 +931,15 @@ bool D64MStream::seekEntry( uint16_t index )
                 return false;
 
             //Debug_printv("Follow link track[%d] sector[%d] entryOffset[%d]", next_track, next_sector, entryOffset);
-            if (!seekSector(next_track, next_sector, entryOffset))
-                return false;
+            entry_track = next_track;
+            entry_sector = next_sector;
         }
+        dir = readBlock(entry_track, entry_sector);
+        if (dir.size() != block_size)
+            return false;
     }
 
-    readContainer((uint8_t *)&entry, sizeof(entry));
+    memcpy(&entry, &dir[entryOffset], sizeof(entry));
 
     // If we are at the first entry in the sector then get next_track/next_sector
     if (entryOffset == 0)
@@ -326,25 +961,21 @@ uint16_t D64MStream::blocksFree()
 {
     uint16_t free_count = 0;
 
-    for (uint8_t x = 0; x < partitions[partition].block_allocation_map.size(); x++)
+    for (auto &b : partitions[partition].block_allocation_map)
     {
-        uint8_t bam[partitions[partition].block_allocation_map[x].byte_count];
-        // Debug_printv("start_track[%d] end_track[%d]", block_allocation_map[x].start_track, block_allocation_map[x].end_track);
-
-        if (!seekSector(
-                partitions[partition].block_allocation_map[x].track,
-                partitions[partition].block_allocation_map[x].sector,
-                partitions[partition].block_allocation_map[x].offset))
+        // Debug_printv("start_track[%d] end_track[%d]", b.start_track, b.end_track);
+        std::string data = readBlock(b.track, b.sector);
+        if (data.size() < b.offset + (b.end_track - b.start_track + 1) * b.byte_count)
             return 0;
 
-        for (uint8_t i = partitions[partition].block_allocation_map[x].start_track; i <= partitions[partition].block_allocation_map[x].end_track; i++)
+        const uint8_t *bam = (const uint8_t *)&data[b.offset];
+        for (uint8_t i = b.start_track; i <= b.end_track; i++, bam += b.byte_count)
         {
-            readContainer((uint8_t *)&bam, sizeof(bam));
-            if (sizeof(bam) > 3)
+            if (b.byte_count > 3)
             {
                 if (i != partitions[partition].directory_track)
                 {
-                    // Debug_printv("x[%d] track[%d] count[%d] size[%d]", x, i, bam[0], sizeof(bam));
+                    // Debug_printv("track[%d] count[%d] size[%d]", i, bam[0], b.byte_count);
                     free_count += bam[0];
                 }
             }
@@ -356,7 +987,7 @@ uint16_t D64MStream::blocksFree()
                 bit_count += std::bitset<8>(bam[1]).count();
                 bit_count += std::bitset<8>(bam[2]).count();
 
-                // Debug_printv("x[%d] track[%d] count[%d] size[%d] bam0[%d] bam1[%d] bam2[%d] (counting 1 bits)", x, i, bit_count, sizeof(bam), bam[0], bam[1], bam[2]);
+                // Debug_printv("track[%d] count[%d] bam0[%d] bam1[%d] bam2[%d] (counting 1 bits)", i, bit_count, bam[0], bam[1], bam[2]);
                 free_count += bit_count;
             }
         }
@@ -365,15 +996,43 @@ uint16_t D64MStream::blocksFree()
     return free_count;
 }
 
+uint32_t D64MStream::seekFileSize(uint8_t start_track, uint8_t start_sector)
+{
+    // Calculate file size
+    Debug_print("Calculating file size...\r\n");
+
+    uint32_t blocks = 0;
+    uint8_t last_byte = 0;
+    while (start_track)
+    {
+        std::string data = readBlock(start_track, start_sector);
+        if (data.size() != block_size)
+            break;
+
+        //Debug_printf("t[%d] s[%d] b[%d]\r", start_track, start_sector, blocks);
+        start_track = data[0];
+        start_sector = data[1];
+        last_byte = start_sector;
+        blocks++;
+    }
+    uint32_t size = blocks ? ((blocks - 1) * (block_size - 2)) + last_byte - 1 : 0;
+    Debug_printf("File size is [%lu] bytes...\r\n", size);
+    return size;
+}
+
 uint32_t D64MStream::readFile(uint8_t *buf, uint32_t size)
 {
+    // The sector may have been written since the last flush, so it comes through the cache
+    std::string data = readBlock(track, sector);
+    if (data.size() != block_size)
+        return 0;
 
     if (sector_offset % block_size == 0)
     {
         // We are at the beginning of the block
         // Read track/sector link
-        readContainer((uint8_t *)&next_track, 1);
-        readContainer((uint8_t *)&next_sector, 1);
+        next_track = data[0];
+        next_sector = data[1];
         sector_offset += 2;
         //Debug_printv("next_track[%d] next_sector[%d] sector_offset[%d]", next_track, next_sector, sector_offset);
     }
@@ -388,7 +1047,8 @@ uint32_t D64MStream::readFile(uint8_t *buf, uint32_t size)
         // Only read up to the bytes remaining in this sector
         size = std::min(size, (uint32_t) (block_size - sector_offset % block_size));
 
-        bytesRead += readContainer(buf, size);
+        memcpy(buf, &data[sector_offset % block_size], size);
+        bytesRead += size;
         sector_offset += bytesRead;
 
         if (next_track && sector_offset % block_size == 0)
@@ -423,6 +1083,9 @@ bool D64MStream::seekPath(std::string path)
 
     entry_index = 0;
 
+    if (mode & std::ios_base::out)
+        return createFile(path);
+
     // call image method to obtain file bytes here, return true on success:
     // return D64Image.seekFile(containerIStream, path);
     if (mstr::endsWith(path, "#")) // Direct Access Mode
@@ -519,7 +1182,7 @@ MFile *D64MFile::getNextFileInDir()
 
     if (r)
     {
-        std::string filename = image->entry.filename;
+        std::string filename(image->entry.filename, strnlen(image->entry.filename, sizeof(image->entry.filename)));
         uint8_t i = filename.find_first_of(0xA0);
         filename = filename.substr(0, i);
         // mstr::rtrimA0(filename);
@@ -555,6 +1218,69 @@ time_t D64MFile::getCreationTime()
     return mktime(entry_time);
 }
 
+D64MStream *D64MFile::openImage()
+{
+    if (streamFile == nullptr)
+        return nullptr;
+
+    std::shared_ptr<MStream> container(streamFile->getSourceStream(std::ios_base::in));
+    if (container == nullptr || !container->isOpen())
+        return nullptr;
+    if (container->url.empty())
+        container->url = streamFile->url;
+
+    auto image = (D64MStream *)getDecodedStream(container);
+    if (image == nullptr)
+        return nullptr;
+    image->url = streamFile->url;
+    return image;
+}
+
+bool D64MFile::remove()
+{
+    // The image file itself
+    if (pathInStream.empty())
+        return streamFile != nullptr && streamFile->remove();
+
+    std::unique_ptr<D64MStream> image(openImage());
+    if (image == nullptr)
+        return false;
+
+    // A pattern scratches every match in one pass over the image
+    return image->scratch(pathInStream) > 0 && image->flush();
+}
+
+bool D64MFile::rename(std::string dest)
+{
+    if (pathInStream.empty())
+        return streamFile != nullptr && streamFile->rename(dest);
+
+    // Entries stay in this image, only the last part of dest is used
+    std::unique_ptr<D64MStream> image(openImage());
+    if (image == nullptr)
+        return false;
+
+    return image->renameEntry(pathInStream, dest.substr(dest.find_last_of('/') + 1)) && image->flush();
+}
+
+bool D64MFile::format(std::string header_name, std::string id)
+{
+    std::unique_ptr<D64MStream> image(openImage());
+    if (image == nullptr)
+        return false;
+
+    return image->format(header_name, id) && image->flush();
+}
+
+bool D64MFile::validate()
+{
+    std::unique_ptr<D64MStream> image(openImage());
+    if (image == nullptr)
+        return false;
+
+    return image->validate() && image->flush();
+}
+
 bool D64MFile::exists()
 {
     // here I'd rather use D64 logic to see if such file name exists in the image!
@@ -20,6 +20,7 @@
 #include <map>
 #include <bitset>
 #include <ctime>
+#include <cstring>
 
 #include "../meat_media.h"
 #include "string_utils.h"
@@ -90,6 +91,9 @@ public:
     bool error_info = false;
     std::string bam_message = "";
 
+    // Geometry and BAM layout are known well enough to write to the image
+    bool write_support = false;
+
     D64MStream(std::shared_ptr<MStream> is) : MMediaStream(is)
     {
         // D64 Partition Info
@@ -121,10 +125,12 @@ public:
         switch (size + media_header_size) 
         {
             case 174848: // 35 tracks no errors
+                write_support = true;
                 break;
 
             case 175531: // 35 w/ errors
                 error_info = true;
+                write_support = true;
                 break;
 
             case 196608: // 40 tracks no errors
@@ -198,6 +204,10 @@ public:
 
     };
 
+    ~D64MStream() {
+        close();
+    }
+
 	// virtual std::unordered_map<std::string, std::string> info() override { 
     //     return {
     //         {"System", "Commodore"},
@@ -222,14 +232,17 @@ public:
     bool seekBlock( uint64_t index, uint8_t offset = 0 ) override;
     bool seekSector( uint8_t track, uint8_t sector, uint8_t offset = 0 ) override;
     bool seekSector( std::vector<uint8_t> trackSectorOffset ) override;
+    bool readSector( uint8_t track, uint8_t sector, uint8_t* buf ) override;
+    bool writeSector( uint8_t track, uint8_t sector, const uint8_t* buf ) override;
+    void setFileType( uint8_t file_type ) override { write_type = file_type; };
 
     void seekHeader() override {
-        seekSector( 
+        std::string data = readBlock( 
             partitions[partition].header_track, 
-            partitions[partition].header_sector, 
-            partitions[partition].header_offset 
+            partitions[partition].header_sector 
         );
-        readContainer((uint8_t*)&header, sizeof(header));
+        if ( data.size() >= partitions[partition].header_offset + sizeof(header) )
+            memcpy(&header, &data[partitions[partition].header_offset], sizeof(header));
     }
     uint16_t getSectorCount( uint16_t track )
     {
@@ -240,8 +253,23 @@ public:
         return partitions[0].block_allocation_map[0].end_track;
     }
 
+    // First block of each track (indexed by track, one past the last track
+    // holds the block count) so a seek is a lookup instead of a walk over
+    // the tracks. Built on the first seek, once the geometry is settled.
+    std::vector<uint32_t> track_offset;
+    void mapBlocks();
+
     virtual bool seekPath(std::string path) override;
+    uint32_t seekFileSize( uint8_t start_track, uint8_t start_sector ) override;
     uint32_t readFile(uint8_t* buf, uint32_t size) override;
+    uint32_t writeFile(const uint8_t* buf, uint32_t size) override;
+    void close() override;
+
+    // CBM DOS commands, the changes reach the image on flush() or close()
+    uint16_t scratch( std::string pattern );
+    bool renameEntry( std::string from, std::string to );
+    bool validate();
+    bool format( std::string header_name, std::string id );
 
     Header header;      // Directory header data
     Entry entry;        // Directory entry data
@@ -257,19 +285,75 @@ public:
     uint8_t next_sector = 0;
     uint8_t sector_offset = 0;
 
-private:
-    void sendListing();
-
-    bool seekEntry( std::string filename ) override;
-    bool seekEntry( uint16_t index = 0 ) override;
-
+protected:
+    // Sector access through the write-back cache, every read of the image goes through readBlock()
     std::string readBlock( uint8_t track, uint8_t sector );
     bool writeBlock( uint8_t track, uint8_t sector, std::string data );
+    // Sectors readBlock() reads at once, up to the end of the track
+    virtual uint16_t readAheadCount( uint8_t track, uint8_t sector );
+
+    // Directory sector holding the current entry
+    uint8_t entry_track = 0;
+    uint8_t entry_sector = 0;
+
+    // Block allocation, on an in-memory copy of the BAM
+    struct TrackAvailability {
+        uint8_t free;
+        uint64_t map;   // bit n set = sector n free
+    };
+    std::vector<TrackAvailability> track_bam;   // indexed by track, empty until loaded
+
+    bool loadBAM();
+    virtual bool storeBAM();
     bool allocateBlock( uint8_t track, uint8_t sector );
     bool deallocateBlock( uint8_t track, uint8_t sector );
     bool getNextFreeBlock(uint8_t startTrack, uint8_t startSector, uint8_t *foundTrack, uint8_t *foundSector);
     bool isBlockFree(uint8_t track, uint8_t sector);
 
+private:
+    void sendListing();
+
+    bool seekEntry( std::string filename ) override;
+    bool seekEntry( uint16_t index = 0 ) override;
+
+    uint64_t sectorMask( uint8_t track );
+    bool isReservedTrack( uint8_t track );
+    bool findFreeSector( uint8_t track, uint8_t from, uint8_t *foundSector );
+    bool isWritable();
+    bool resetBAM();
+    bool allocateChain( uint8_t track, uint8_t sector );
+
+    // Directory slot of an entry
+    struct EntrySlot {
+        uint8_t track;
+        uint8_t sector;
+        uint8_t slot;
+    };
+    std::vector<EntrySlot> findEntries( std::string pattern );
+    std::string entryName( const uint8_t *e );
+    std::vector<std::pair<uint8_t, uint8_t>> entryChains( const uint8_t *e );
+
+    // File being written
+    bool writing = false;
+    std::string write_name;
+    uint8_t write_type = 2;             // PRG unless the open mode said otherwise
+    std::string write_block;            // current sector, link bytes included
+    uint16_t write_offset = 0;
+    uint8_t write_track = 0;
+    uint8_t write_sector = 0;
+    uint8_t write_start_track = 0;
+    uint8_t write_start_sector = 0;
+    uint16_t write_blocks = 0;
+    uint8_t write_entry_track = 0;      // directory entry being replaced, 0 for a new file
+    uint8_t write_entry_sector = 0;
+    uint8_t write_entry_slot = 0;
+
+    bool createFile( std::string filename );
+    bool advanceWriteBlock();
+    bool closeFile();
+    bool writeEntry();
+    bool freeChain( uint8_t track, uint8_t sector );
+
     // Container
     friend class D8BMFile;
     friend class DFIMFile;
@@ -316,14 +400,20 @@ public:
     bool mkDir() override { return false; };
 
     bool exists() override;
-    bool remove() override { return false; };
-    bool rename(std::string dest) override { return false; };
+    bool remove() override;
+    bool rename(std::string dest) override;
+    bool format(std::string header_name, std::string id) override;
+    bool validate() override;
     time_t getLastWrite() override;
     time_t getCreationTime() override;
     uint32_t size() override;     
 
     bool isDir = true;
     bool dirIsOpen = false;
+
+protected:
+    // Private copy of the image for editing, separate from the one ImageBroker shares
+    D64MStream* openImage();
 };
 
 
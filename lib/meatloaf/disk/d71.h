@@ -43,40 +43,64 @@ public:
         };
 
         Partition p = {
-            1,     // track
+            18,    // track
             0,     // sector
-            0x04,  // header_offset
-            1,     // directory_track
-            4,     // directory_sector
+            0x90,  // header_offset
+            18,    // directory_track
+            1,     // directory_sector
             0x00,  // directory_offset
             b      // block_allocation_map
         };
         partitions.clear();
         partitions.push_back(p);
         sectorsPerTrack = { 17, 18, 19, 21 };
+        interleave = { 3, 6 }; // Directory, File
         dos_rom = "dos1571";
 
+        write_support = false;
         uint32_t size = containerStream->size();
         switch (size + media_header_size) 
         {
             case 349696: // 70 tracks no errors
+                write_support = true;
                 break;
 
             case 351062: // 70 w/ errors
                 error_info = true;
+                write_support = true;
                 break;
         }
     };
 
+    // ~D64MStream() would only reach D64MStream::storeBAM()
+    ~D71MStream() {
+        close();
+    }
+
     virtual uint8_t speedZone( uint8_t track) override
     {
-        if ( track < 35 )
+        if ( track <= 35 )
 		    return (track < 18) + (track < 25) + (track < 31);
         else
             return (track < 53) + (track < 60) + (track < 66);
     };
 
 protected:
+    // Free counts for tracks 36-70 live in 18/0 at $DD, apart from their bitmaps in 53/0
+    bool storeBAM() override
+    {
+        if ( !D64MStream::storeBAM() || track_bam.size() <= 70 )
+            return false;
+
+        std::string data = readBlock( 18, 0 );
+        if ( data.size() != block_size )
+            return false;
+
+        for ( uint8_t t = 36; t <= 70; t++ )
+            data[0xDD + (t - 36)] = track_bam[t].free;
+
+        return writeBlock( 18, 0, data );
+    }
 
 private:
     friend class D71MFile;
@@ -34,7 +34,7 @@ public:
             },
             {
                 40,     // track
-                0,      // sector
+                2,      // sector
                 0x10,   // offset
                 41,     // start_track
                 80,     // end_track
@@ -54,17 +54,21 @@ public:
         partitions.clear();
         partitions.push_back(p);
         sectorsPerTrack = { 40 };
+        interleave = { 1, 1 }; // Directory, File
         dos_rom = "dos1581";
         has_subdirs = true;
 
+        write_support = false;
         uint32_t size = containerStream->size();
         switch (size + media_header_size) 
         {
             case 819200:  // 80 tracks no errors
+                write_support = true;
                 break;
 
             case 822400:  // 80 w/ errors
                 error_info = true;
+                write_support = true;
                 break;
 
             // https://sourceforge.net/p/vice-emu/bugs/1890/
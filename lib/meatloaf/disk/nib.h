@@ -59,6 +59,8 @@ public:
     bool seekSector( uint8_t track, uint8_t sector, uint8_t offset = 0 ) override;
 
     uint32_t readContainer(uint8_t *buf, uint32_t size) override;
+    // Only the sector just decoded is in sector_buffer
+    uint16_t readAheadCount( uint8_t track, uint8_t sector ) override { return 1; };
 
     bool readSectorHeader();
     bool readSector();
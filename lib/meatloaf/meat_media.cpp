@@ -1,5 +1,9 @@
 #include "meat_media.h"
 
+#include <algorithm>
+#include <cstring>
+#include <sys/stat.h>
+
 std::unordered_map<std::string, MMediaStream*> ImageBroker::image_repo;
 
 // Utility Functions
@@ -153,6 +157,7 @@ bool MMediaStream::open(std::ios_base::openmode mode)
 void MMediaStream::close()
 {
     //Debug_printv("Heap[%lu]", esp_get_free_heap_size());
+    flush();
 };
 
 
@@ -237,7 +242,330 @@ std::string MMediaStream::readStringUntil( uint8_t delimiter )
 }
 
 uint32_t MMediaStream::write(const uint8_t *buf, uint32_t size) {
-    return -1;
+    // Only a file opened for writing with seekPath can be written
+    if ( !seekCalled || !(mode & std::ios_base::out) )
+        return 0;
+
+    uint32_t bytesWritten = writeFile(buf, size);
+
+    _position += bytesWritten;
+    if ( _position > _size )
+        _size = _position;
+
+    return bytesWritten;
+}
+
+bool MMediaStream::cacheLookup( uint32_t offset, std::string &data )
+{
+    auto found = sector_cache.find(offset);
+    if ( found == sector_cache.end() )
+        return false;
+
+    data = found->second;
+    return true;
+}
+
+bool MMediaStream::cacheStore( uint32_t offset, const std::string &data )
+{
+    auto found = sector_cache.find(offset);
+    if ( found != sector_cache.end() )
+    {
+        found->second = data;
+        return true;
+    }
+
+    if ( sector_cache.size() >= MEDIA_WRITE_CACHE_MAX && !stage() )
+        return false;
+
+    sector_cache.emplace(offset, data);
+    return true;
+}
+
+void MMediaStream::cacheDiscard()
+{
+    sector_cache.clear();
+    readCacheClear();
+    if ( !staged )
+        return;
+
+    // Back to the image as it was, the temporary copy goes
+    std::string image_url = containerStream->url;
+    containerStream->close();
+    staged = false;
+
+    std::unique_ptr<MFile> temp(MFSOwner::File(image_url + ".tmp"));
+    temp->remove();
+    reopenImage(image_url);
+}
+
+// Copies the container to out in one pass, substituting dirty sectors on the way
+bool MMediaStream::copyImage( MStream *out )
+{
+    uint32_t image_size = containerStream->size();
+    std::vector<uint8_t> chunk(MEDIA_FLUSH_CHUNK_SIZE);
+    auto dirty = sector_cache.begin();
+    bool ok = containerStream->seek(0);
+
+    for ( uint32_t pos = 0; ok && pos < image_size; )
+    {
+        uint32_t n = std::min<uint32_t>(chunk.size(), image_size - pos);
+        ok = ( containerStream->read(chunk.data(), n) == n );
+
+        for ( auto it = dirty; ok && it != sector_cache.end() && it->first < pos + n; ++it )
+        {
+            uint32_t from = std::max(it->first, pos);
+            uint32_t to = std::min<uint32_t>(it->first + it->second.size(), pos + n);
+            if ( from < to )
+                memcpy(&chunk[from - pos], it->second.data() + (from - it->first), to - from);
+        }
+        while ( dirty != sector_cache.end() && dirty->first + dirty->second.size() <= pos + n )
+            ++dirty;
+
+        ok = ok && ( out->write(chunk.data(), n) == n );
+        pos += n;
+    }
+
+    return ok;
+}
+
+// Writes the dirty sectors into the staged copy
+bool MMediaStream::writeDirty()
+{
+    for ( auto &it : sector_cache )
+    {
+        if ( !containerStream->seek(it.first) || containerStream->write((const uint8_t *)it.second.data(), it.second.size()) != it.second.size() )
+            return false;
+    }
+    return true;
+}
+
+bool MMediaStream::stage()
+{
+    std::string image_url = containerStream->url;
+
+    if ( !staged )
+    {
+        std::unique_ptr<MFile> temp(MFSOwner::File(image_url + ".tmp"));
+        std::unique_ptr<MStream> out(temp->getSourceStream(std::ios_base::out));
+        bool ok = ( out != nullptr && out->isOpen() && copyImage(out.get()) );
+        if ( out != nullptr )
+            out->close();
+
+        // Reads come from the copy from now on, it holds everything written so far
+        std::shared_ptr<MStream> copy(ok ? temp->getSourceStream(std::ios_base::in | std::ios_base::out) : nullptr);
+        if ( copy == nullptr || !copy->isOpen() )
+        {
+            Debug_printv("Can't stage writes in [%s]", temp->url.c_str());
+            temp->remove();
+            _error = 25; // WRITE ERROR
+            return false;
+        }
+        copy->url = image_url;
+        containerStream->close();
+        containerStream = copy;
+        staged = true;
+    }
+    else if ( !writeDirty() )
+    {
+        Debug_printv("Error staging writes [%s]", image_url.c_str());
+        _error = 25; // WRITE ERROR
+        return false;
+    }
+
+    // Clean copies of the sectors just staged are out of date
+    sector_cache.clear();
+    readCacheClear();
+    return true;
+}
+
+bool MMediaStream::readCacheLookup( uint32_t offset, uint32_t size, std::string &data )
+{
+    // Last run starting at or before offset
+    auto found = read_cache.upper_bound(offset);
+    if ( found == read_cache.begin() )
+        return false;
+    --found;
+
+    if ( offset + size > found->first + found->second.size() )
+        return false;
+
+    data = found->second.substr(offset - found->first, size);
+    return true;
+}
+
+void MMediaStream::readCacheStore( uint32_t offset, std::string data )
+{
+    if ( data.empty() || data.size() > MEDIA_READ_CACHE_SIZE )
+        return;
+
+    auto found = read_cache.find(offset);
+    if ( found != read_cache.end() )
+    {
+        read_cache_bytes -= found->second.size();
+        read_cache.erase(found);
+        read_cache_order.erase(std::find(read_cache_order.begin(), read_cache_order.end(), offset));
+    }
+
+    while ( read_cache_bytes + data.size() > MEDIA_READ_CACHE_SIZE && !read_cache_order.empty() )
+    {
+        auto oldest = read_cache.find(read_cache_order.front());
+        read_cache_bytes -= oldest->second.size();
+        read_cache.erase(oldest);
+        read_cache_order.erase(read_cache_order.begin());
+    }
+
+    read_cache_bytes += data.size();
+    read_cache_order.push_back(offset);
+    read_cache.emplace(offset, std::move(data));
+}
+
+void MMediaStream::readCacheClear()
+{
+    read_cache.clear();
+    read_cache_order.clear();
+    read_cache_bytes = 0;
+}
+
+bool MMediaStream::isLocalContainer()
+{
+    // The image has to be a plain file we can rename, not one inside an archive
+    std::unique_ptr<MFile> image(MFSOwner::File(containerStream->url));
+    if ( image == nullptr || !image->pathInStream.empty() || image->streamFile == nullptr )
+        return false;
+
+    if ( !image->scheme.empty() && image->scheme != "sd" )
+        return false;
+
+    struct stat st;
+    return stat(image->streamFile->path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+bool MMediaStream::flush()
+{
+    if ( sector_cache.empty() && !staged )
+        return true;
+
+    // The media file resolves to the image, its streamFile is the file on disk
+    std::string image_url = containerStream->url;
+    std::unique_ptr<MFile> media(MFSOwner::File(image_url));
+    MFile* image = ( media != nullptr ) ? media->streamFile : nullptr;
+    if ( image == nullptr )
+        return false;
+
+    std::unique_ptr<MFile> temp(MFSOwner::File(image_url + ".tmp"));
+    std::unique_ptr<MFile> backup(MFSOwner::File(image_url + ".bak"));
+
+    bool ok;
+    bool was_staged = staged;
+    if ( staged )
+    {
+        // The copy is already there, only the last dirty sectors are missing
+        ok = writeDirty();
+        staged = false;
+    }
+    else
+    {
+        std::unique_ptr<MStream> out(temp->getSourceStream(std::ios_base::out));
+        if ( out == nullptr || !out->isOpen() )
+        {
+            Debug_printv("Can't create [%s]", temp->url.c_str());
+            return false;
+        }
+
+        ok = copyImage(out.get());
+        out->close();
+    }
+
+    if ( !ok )
+    {
+        Debug_printv("Error writing [%s]", temp->url.c_str());
+        if ( !was_staged )
+        {
+            temp->remove();
+            return false;
+        }
+    }
+
+    // Swap the new image in, keeping the old one until the rename succeeded.
+    // Shared copies of the image let go of the file first.
+    ImageBroker::invalidate(image_url, this);
+    containerStream->close();
+    bool replaced = false;
+    backup->remove();
+    if ( ok && image->rename(backup->path) )
+    {
+        replaced = temp->rename(image->path);
+        if ( replaced )
+            backup->remove();
+        else
+            backup->rename(image->path);
+    }
+    if ( !replaced )
+    {
+        Debug_printv("Error replacing [%s]", image_url.c_str());
+        temp->remove();
+    }
+    if ( replaced || was_staged )
+    {
+        // Cached copies of the sectors just written are out of date, or went with the staged copy
+        sector_cache.clear();
+        readCacheClear();
+    }
+
+    if ( !reopenImage(image_url) )
+        return false;
+
+    return replaced;
+}
+
+bool MMediaStream::reopenImage( const std::string &image_url )
+{
+    std::unique_ptr<MFile> media(MFSOwner::File(image_url));
+    MFile* image = ( media != nullptr ) ? media->streamFile : nullptr;
+    std::shared_ptr<MStream> reopened(( image != nullptr ) ? image->getSourceStream(std::ios_base::in) : nullptr);
+    if ( reopened == nullptr )
+    {
+        // Keep the closed stream rather than none, the next read fails instead of crashing
+        Debug_printv("Error reopening [%s]", image_url.c_str());
+        _error = 74; // DRIVE NOT READY
+        return false;
+    }
+    reopened->url = image_url;
+    containerStream = reopened;
+    return true;
+}
+
+void MMediaStream::addEntryName( std::string name )
+{
+    entry_names.push_back(name);
+    entry_lookup.emplace(std::move(name), entry_names.size());
+}
+
+uint16_t MMediaStream::findEntry( std::string filename )
+{
+    mstr::replaceAll(filename, "\\", "/");
+
+    auto found = entry_lookup.find(filename); // Match exact
+    if ( found != entry_lookup.end() )
+        return found->second;
+
+    if ( mstr::contains(filename, "*") || mstr::contains(filename, "?") ) // Wildcard Match
+    {
+        for ( size_t i = 0; i < entry_names.size(); i++ )
+        {
+            if ( filename == "*" ) // Match first loadable file
+            {
+                if ( loadableEntry( i + 1 ) )
+                    return i + 1;
+            }
+            else if ( mstr::compare(filename, entry_names[i]) ) // X?XX?X* Wildcard match
+            {
+                return i + 1;
+            }
+        }
+    }
+
+    return 0;
 }
 
 // seek = (offset) => this.containerStream.seek(offset + this.media_header_size);
@@ -260,7 +588,7 @@ uint32_t MMediaStream::seekFileSize( uint8_t start_track, uint8_t start_sector )
     size_t blocks = 0; 
     do
     {
-        printf("t[%d] s[%d] b[%d]\r", start_track, start_sector, blocks);
+        //Debug_printf("t[%d] s[%d] b[%d]\r", start_track, start_sector, blocks);
         readContainer(&start_track, 1);
         readContainer(&start_sector, 1);
         blocks++;
@@ -270,6 +598,6 @@ uint32_t MMediaStream::seekFileSize( uint8_t start_track, uint8_t start_sector )
     } while ( start_track > 0 );
     blocks--;
     uint32_t size = (blocks * (block_size - 2)) + start_sector - 1;
-    printf("File size is [%lu] bytes...\r\n", size);
+    Debug_printf("File size is [%lu] bytes...\r\n", size);
     return size;
 };
\ No newline at end of file
@@ -13,6 +13,13 @@
 
 #include "string_utils.h"
 
+// Dirty sectors held in memory, beyond this they are staged in the temporary copy of the image
+#define MEDIA_WRITE_CACHE_MAX   128
+// Bytes copied per read/write while rewriting an image
+#define MEDIA_FLUSH_CHUNK_SIZE  4096
+// Clean sectors kept in memory for block reads, in bytes
+#define MEDIA_READ_CACHE_SIZE   16384
+
 
 /********************************************************
  * Streams
@@ -23,6 +30,7 @@ class MMediaStream: public MStream {
 public:
     MMediaStream(std::shared_ptr<MStream> is) {
         containerStream = is;
+        mode = std::ios_base::in;
         _is_open = true;
         has_subdirs = false;
     }
@@ -64,6 +72,9 @@ public:
 
     virtual uint32_t write(const uint8_t *buf, uint32_t size);
 
+    // Write dirty sectors back to the image
+    virtual bool flush();
+
     // seek = (offset) => this.containerStream.seek(offset + this.media_header_size);
     bool seek(uint32_t offset) override;
     // seekCurrent = (offset) => this.containerStream.seekCurrent(offset);
@@ -116,8 +127,50 @@ protected:
     virtual bool seekEntry( std::string filename ) { return false; };
     virtual bool seekEntry( uint16_t index ) { return false; };
 
+    // Formats that read their whole directory table at open (tapes, cartridges)
+    // index the names here, trimmed and in UTF-8 for matching. Exact names go
+    // through the index, entry n of the table is entry_names[n - 1].
+    std::vector<std::string> entry_names;
+    std::unordered_map<std::string, uint16_t> entry_lookup;
+    void addEntryName( std::string name );
+    // Index of the entry named filename, 0 if none. "*" is the first entry
+    // loadableEntry() accepts, other wildcards the first name that fits.
+    uint16_t findEntry( std::string filename );
+    virtual bool loadableEntry( uint16_t index ) { return true; };
+
     virtual uint32_t readContainer(uint8_t *buf, uint32_t size);
     virtual uint32_t readFile(uint8_t* buf, uint32_t size) = 0;
+    virtual uint32_t writeFile(const uint8_t* buf, uint32_t size) { return 0; };
+
+    // Write-back sector cache, keyed by offset in the container.
+    // Nothing reaches the image until flush(), which rewrites it in one pass
+    // to a temporary file and renames that over the original.
+    std::map<uint32_t, std::string> sector_cache;
+    bool cacheLookup( uint32_t offset, std::string &data );
+    bool cacheStore( uint32_t offset, const std::string &data );
+    // Drops the changes since the last flush()
+    void cacheDiscard();
+
+    // When the cache fills up, the dirty sectors move to that temporary file
+    // early and it becomes the container until flush() renames it, so a big
+    // write still replaces the image all at once.
+    bool staged = false;
+    bool stage();
+    bool copyImage( MStream *out );
+    bool writeDirty();
+    bool reopenImage( const std::string &image_url );
+
+    // Read cache of clean sectors, filled a run of sectors (usually the rest
+    // of a track) at a time and dropped oldest first. Dirty sectors above
+    // always take precedence.
+    std::map<uint32_t, std::string> read_cache;
+    std::vector<uint32_t> read_cache_order;
+    size_t read_cache_bytes = 0;
+    bool readCacheLookup( uint32_t offset, uint32_t size, std::string &data );
+    void readCacheStore( uint32_t offset, std::string data );
+    void readCacheClear();
+
+    bool isLocalContainer();
     virtual std::string decodeType(uint8_t file_type, bool show_hidden = false);
     virtual std::string decodeType(std::string file_type);
     virtual std::string decodeGEOSType(uint8_t geos_file_structure, uint8_t geos_file_type);
@@ -126,7 +179,7 @@ private:
 
     // Commodore Media
     // CARTRIDGE
-    friend class CRTFile;
+    friend class CRTMFile;
 
     // CONTAINER
     friend class D8BMFile;
@@ -206,6 +259,16 @@ public:
         Debug_printv("streams[%d]", image_repo.size());
     }
 
+    // Drop a cached image whose file was replaced underneath it
+    static void invalidate(std::string url, MMediaStream* keep = nullptr) {
+        auto found = image_repo.find(url);
+        if(found != image_repo.end() && found->second != keep) {
+            auto toDelete = found->second;
+            image_repo.erase(found);
+            delete toDelete;
+        }
+    }
+
     static void validate() {
         
     }
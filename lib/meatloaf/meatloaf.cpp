@@ -24,16 +24,20 @@ std::unordered_map<std::string, MStream*> StreamBroker::stream_repo;
 
 #include "string_utils.h"
 #include "peoples_url_parser.h"
+#include "trace.h"
 
 #include "MIOException.h"
 #include "../../include/debug.h"
 
 // Archive
+#ifndef TEST_NATIVE
 #include "archive/archive_ml.h"
+#endif
 #include "archive/ark.h"
 #include "archive/lbr.h"
 
 // Cartridge
+#include "cartridge/crt.h"
 
 // Container
 #include "container/d8b.h"
@@ -61,20 +65,26 @@ std::unordered_map<std::string, MStream*> StreamBroker::stream_repo;
 // Loaders
 
 // Network
+#ifndef TEST_NATIVE
+#include "network/ftp.h"
 #include "network/http.h"
+#include "network/smb.h"
 #include "network/tnfs.h"
+#endif
 // #include "network/ipfs.h"
-// #include "network/smb.h"
 // #include "network/ws.h"
 
 // Scanners
 
 // Service
+#ifndef TEST_NATIVE
 #include "service/csip.h"
 #include "service/ml.h"
+#endif
 
 // Tape
 #include "tape/t64.h"
+#include "tape/tap.h"
 #include "tape/tcrt.h"
 
 
@@ -90,11 +100,14 @@ SDFileSystem sdFS;
 
 
 // Archive
+#ifndef TEST_NATIVE
 ArchiveMFileSystem archiveFS;
+#endif
 ARKMFileSystem arkFS;
 LBRMFileSystem lbrFS;
 
 // Cartridge
+CRTMFileSystem crtFS;
 
 // Container
 D8BMFileSystem d8bFS;
@@ -115,18 +128,25 @@ G64MFileSystem g64FS;
 NIBMFileSystem nibFS;
 
 // Network
+#ifndef TEST_NATIVE
+FTPMFileSystem ftpFS;
 HTTPMFileSystem httpFS;
+SMBMFileSystem smbFS;
 TNFSMFileSystem tnfsFS;
+#endif
 // IPFSFileSystem ipfsFS;
 // TcpFileSystem tcpFS;
 //WSFileSystem wsFS;
 
 // Service
+#ifndef TEST_NATIVE
 CSIPMFileSystem csipFS;
 MLMFileSystem mlFS;
+#endif
 
 // Tape
 T64MFileSystem t64FS;
+TAPMFileSystem tapFS;
 TCRTMFileSystem tcrtFS;
 
 
@@ -137,15 +157,20 @@ std::vector<MFileSystem*> MFSOwner::availableFS {
 #ifdef SD_CARD
     &sdFS,
 #endif
+#ifndef TEST_NATIVE
     &archiveFS, // extension-based FS have to be on top to be picked first, otherwise the scheme will pick them!
+#endif
     &arkFS, &lbrFS,
+    &crtFS,
     &d64FS, &d71FS, &d80FS, &d81FS, &d82FS, &d90FS, &dnpFS, 
     &g64FS, &nibFS,
     &d8bFS, &dfiFS,
     &p00FS,
-    &httpFS, &tnfsFS,
+#ifndef TEST_NATIVE
+    &ftpFS, &httpFS, &smbFS, &tnfsFS,
     &csipFS, &mlFS,
-    &t64FS, &tcrtFS
+#endif
+    &t64FS, &tapFS, &tcrtFS
 //    &ipfsFS, &tcpFS,
 //    &tnfsFS
 };
@@ -196,6 +221,8 @@ MFile* MFSOwner::File(std::shared_ptr<MFile> file) {
 
 
 MFile* MFSOwner::File(std::string path) {
+    TRACE_SPAN(TRACE_FILE);
+
     // if(mstr::startsWith(path,"cs:", false)) {
     //     //printf("CServer path found!\r\n");
     //     return csFS.getFile(path);
@@ -370,6 +397,7 @@ bool MFile::operator!=(nullptr_t ptr) {
 }
 
 MStream* MFile::getSourceStream(std::ios_base::openmode mode) {
+    TRACE_SPAN(TRACE_SOURCE_STREAM);
 
     if ( streamFile == nullptr )
     {
@@ -380,12 +408,15 @@ MStream* MFile::getSourceStream(std::ios_base::openmode mode) {
     // has to return OPENED stream
     Debug_printv("pathInStream[%s] streamFile[%s]", pathInStream.c_str(), streamFile->url.c_str());
 
-    auto sourceStream = streamFile->getSourceStream(mode);
+    // A file inside an image is written through the decoded stream, the image itself is only ever read here
+    auto sourceStream = streamFile->getSourceStream(pathInStream.empty() ? mode : std::ios_base::in);
     if ( sourceStream == nullptr )
     {
         Debug_printv("null sourceStream");
         return nullptr;
     }
+    if ( sourceStream->url.empty() )
+        sourceStream->url = streamFile->url;
 
     // will be replaced by streamBroker->getSourceStream(streamFile, mode)
     std::shared_ptr<MStream> containerStream(sourceStream); // get its base stream, i.e. zip raw file contents
@@ -395,16 +426,22 @@ MStream* MFile::getSourceStream(std::ios_base::openmode mode) {
     // will be replaced by streamBroker->getDecodedStream(this, mode, containerStream)
     MStream* decodedStream(getDecodedStream(containerStream)); // wrap this stream into decoded stream, i.e. unpacked zip files
     decodedStream->url = this->url;
+    decodedStream->mode = mode;
     Debug_printv("decodedStream isRandomAccess[%d] isBrowsable[%d]", decodedStream->isRandomAccess(), decodedStream->isBrowsable());
 
     Debug_printv("pathInStream [%s]", pathInStream.c_str());
 
     if(decodedStream->isRandomAccess() && pathInStream != "") {
-        bool foundIt = decodedStream->seekPath(this->pathInStream);
+        bool foundIt;
+        {
+            TRACE_SPAN(TRACE_SEEK_PATH);
+            foundIt = decodedStream->seekPath(this->pathInStream);
+        }
 
         if(!foundIt)
         {
             Debug_printv("path in stream not found");
+            delete decodedStream;
             return nullptr;
         }        
     }
@@ -423,7 +460,10 @@ MStream* MFile::getSourceStream(std::ios_base::openmode mode) {
         }
         Debug_printv("path in stream not found!");
         if(pointedFile.empty())
+        {
+            delete decodedStream;
             return nullptr;
+        }
     }
 
     Debug_printv("returning decodedStream 2");
@@ -150,13 +150,22 @@ public:
     virtual bool seekSector( uint8_t track, uint8_t sector, uint8_t offset = 0 ) { return false; };
     virtual bool seekSector( std::vector<uint8_t> trackSectorOffset ) { return false; };
 
+    // Whole sector access for the block commands (U1/U2, B-R/B-W), media images only
+    virtual bool readSector( uint8_t track, uint8_t sector, uint8_t* buf ) { return false; };
+    virtual bool writeSector( uint8_t track, uint8_t sector, const uint8_t* buf ) { return false; };
+
+    // CBM file type (1 SEQ, 2 PRG, 3 USR) of a file being written, media images only
+    virtual void setFileType( uint8_t file_type ) {};
+
 private:
 
     // DEVICE
     friend class FlashMFile;
 
     // NETWORK
+    friend class FTPMFile;
     friend class HTTPMFile;
+    friend class SMBMFile;
     friend class TNFSMFile;
 
     // SERVICE
@@ -217,6 +226,9 @@ public:
     virtual bool exists();
     virtual bool remove() = 0;
     virtual bool rename(std::string dest) = 0;    
+    // Media images only, CBM DOS N: and V
+    virtual bool format(std::string header_name, std::string id) { return false; };
+    virtual bool validate() { return false; };
     virtual time_t getLastWrite() = 0 ;
     virtual time_t getCreationTime() = 0 ;
     virtual uint64_t getAvailableSpace();
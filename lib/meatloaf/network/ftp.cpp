@@ -0,0 +1,351 @@
+#include "ftp.h"
+
+#include "meatloaf.h"
+
+#include <algorithm>
+
+#include "../../../include/debug.h"
+
+
+/********************************************************
+ * Session pool
+ ********************************************************/
+
+MeatFtpPool& MeatFtpPool::instance() {
+    static MeatFtpPool pool;
+    return pool;
+}
+
+std::string MeatFtpPool::key(PeoplesUrlParser *url) {
+    std::string host = url->host;
+    mstr::toLower(host);
+
+    std::string port = url->port;
+    if ( port.empty() )
+        port = "21";
+
+    return url->user + "@" + host + ":" + port;
+}
+
+fnFTP *MeatFtpPool::acquire(PeoplesUrlParser *url) {
+    std::string k = key(url);
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto it = _idle.begin(); it != _idle.end(); ) {
+            if ( it->key != k ) {
+                ++it;
+                continue;
+            }
+
+            fnFTP *ftp = it->ftp;
+            it = _idle.erase(it);
+
+            // The server may have dropped us while we were idle
+            if ( ftp->connected() )
+                return ftp;
+
+            delete ftp;
+        }
+    }
+
+    std::string user = url->user.empty() ? "anonymous" : url->user;
+    std::string password = url->password.empty() ? "meatloaf@" : url->password;
+    uint16_t port = url->port.empty() ? 21 : atoi(url->port.c_str());
+
+    fnFTP *ftp = new fnFTP();
+    if ( ftp->login(user, password, url->host, port) ) {
+        Debug_printv("login failed host[%s] status[%d]", url->host.c_str(), ftp->status());
+        delete ftp;
+        return nullptr;
+    }
+
+    return ftp;
+}
+
+void MeatFtpPool::release(PeoplesUrlParser *url, fnFTP *ftp) {
+    if ( !ftp->connected() ) {
+        delete ftp;
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if ( _idle.size() >= FTP_POOL_MAX_IDLE ) {
+        _idle.front().ftp->logout();
+        delete _idle.front().ftp;
+        _idle.erase(_idle.begin());
+    }
+
+    _idle.push_back({key(url), ftp});
+}
+
+
+/********************************************************
+ * File implementations
+ ********************************************************/
+
+void FTPMFile::stat() {
+    if ( _stat != STAT_UNKNOWN )
+        return;
+
+    if ( path.empty() || path == "/" ) {
+        _stat = STAT_DIR;
+        return;
+    }
+
+    fnFTP *ftp = MeatFtpPool::instance().acquire(this);
+    if ( ftp == nullptr ) {
+        _stat = STAT_MISSING;
+        return;
+    }
+
+    if ( !ftp->get_size(path, _size) )
+        _stat = STAT_FILE;
+    else if ( !ftp->change_directory(path) )
+        _stat = STAT_DIR;
+    else
+        _stat = STAT_MISSING;
+
+    MeatFtpPool::instance().release(this, ftp);
+
+    //Debug_printv("path[%s] stat[%d] size[%lu]", path.c_str(), _stat, _size);
+}
+
+bool FTPMFile::isDirectory() {
+    stat();
+    return _stat == STAT_DIR;
+}
+
+bool FTPMFile::exists() {
+    stat();
+    return _stat != STAT_MISSING;
+}
+
+uint32_t FTPMFile::size() {
+    stat();
+    return _size;
+}
+
+MStream* FTPMFile::getSourceStream(std::ios_base::openmode mode) {
+    // has to return OPENED stream
+    MStream* istream = new FTPMStream(url);
+    istream->open(mode);
+    return istream;
+}
+
+MStream* FTPMFile::getDecodedStream(std::shared_ptr<MStream> is) {
+    return is.get(); // we don't have to process this stream in any way, just return the original stream
+}
+
+MStream* FTPMFile::createStream(std::ios_base::openmode mode)
+{
+    MStream* istream = new FTPMStream(url);
+    istream->open(mode);
+    return istream;
+}
+
+bool FTPMFile::rewindDirectory() {
+    _entries.clear();
+    _entry = 0;
+    dirIsOpen = false;
+
+    fnFTP *ftp = MeatFtpPool::instance().acquire(this);
+    if ( ftp == nullptr )
+        return false;
+
+    // The whole listing comes over in one go, keep it
+    if ( !ftp->open_directory(path.empty() ? "/" : path, "") ) {
+        std::string name;
+        long filesize = 0;
+        bool is_dir = false;
+        while ( true )
+        {
+            name.clear();
+            bool eof = ftp->read_directory(name, filesize, is_dir);
+            if ( !name.empty() && name != "." && name != ".." && name != "???" )
+                _entries.push_back({ name, (uint32_t)filesize, is_dir });
+
+            if ( eof )
+                break;
+        }
+
+        dirIsOpen = true;
+    }
+
+    MeatFtpPool::instance().release(this, ftp);
+
+    Debug_printv("path[%s] entries[%d]", path.c_str(), _entries.size());
+    return dirIsOpen;
+}
+
+MFile* FTPMFile::getNextFileInDir() {
+    if ( !dirIsOpen )
+        rewindDirectory();
+
+    if ( _entry >= _entries.size() ) {
+        dirIsOpen = false;
+        return nullptr;
+    }
+
+    auto &e = _entries[_entry++];
+    auto file = new FTPMFile(url + (mstr::endsWith(url, "/") ? "" : "/") + e.name);
+
+    // The listing already says what it is, save the round trips
+    file->_stat = e.is_dir ? STAT_DIR : STAT_FILE;
+    file->_size = e.size;
+    return file;
+}
+
+
+/********************************************************
+ * Streams
+ ********************************************************/
+
+bool FTPMStream::open(std::ios_base::openmode m) {
+    if ( isOpen() )
+        return true;
+
+    mode = m;
+    _url = PeoplesUrlParser::parseURL(url);
+    _ftp = MeatFtpPool::instance().acquire(_url.get());
+    if ( _ftp == nullptr ) {
+        _error = 1;
+        return false;
+    }
+
+    if ( mode & std::ios_base::out ) {
+        // STOR only goes from start to end
+        if ( _ftp->open_file(_url->path, true) ) {
+            close();
+            _error = 1;
+            return false;
+        }
+        _writing = true;
+        return true;
+    }
+
+    if ( _ftp->get_size(_url->path, _size) ) {
+        Debug_printv("not found [%s]", _url->path.c_str());
+        close();
+        _error = 1;
+        return false;
+    }
+
+    _position = 0;
+    return true;
+}
+
+void FTPMStream::close() {
+    if ( _ftp == nullptr )
+        return;
+
+    if ( _writing ) {
+        _ftp->close();
+        _writing = false;
+    }
+    endTransfer();
+
+    MeatFtpPool::instance().release(_url.get(), _ftp);
+    _ftp = nullptr;
+}
+
+bool FTPMStream::startTransfer() {
+    if ( _ftp->open_file(_url->path, false, _position) ) {
+        Debug_printv("RETR failed path[%s] position[%lu]", _url->path.c_str(), _position);
+        _error = 1;
+        return false;
+    }
+
+    _transfer = true;
+    _transfer_position = _position;
+    return true;
+}
+
+void FTPMStream::endTransfer() {
+    if ( !_transfer )
+        return;
+
+    _ftp->close_file();
+    _transfer = false;
+}
+
+bool FTPMStream::seek(uint32_t pos) {
+    if ( !isOpen() ) {
+        Debug_printv("error");
+        _error = 1;
+        return false;
+    }
+
+    // Nothing moves until the next read, which picks the cheapest way there
+    _position = pos;
+    return true;
+}
+
+uint32_t FTPMStream::read(uint8_t* buf, uint32_t size) {
+    if ( !isOpen() || _writing || size == 0 )
+        return 0;
+
+    if ( size > available() )
+        size = available();
+    if ( size == 0 )
+        return 0;
+
+    // Catch the transfer up with a short skip, otherwise restart it where we want to be
+    if ( _transfer && _position != _transfer_position ) {
+        uint32_t skip = _position - _transfer_position;
+        if ( _position < _transfer_position || skip > FTP_SKIP_MAX ) {
+            endTransfer();
+        }
+        else {
+            uint8_t scratch[256];
+            while ( skip ) {
+                int r = _ftp->read_data(scratch, std::min<uint32_t>(skip, sizeof(scratch)));
+                if ( r <= 0 ) {
+                    endTransfer();
+                    break;
+                }
+                skip -= r;
+                _transfer_position += r;
+            }
+        }
+    }
+
+    if ( !_transfer && !startTransfer() )
+        return 0;
+
+    uint32_t bytesRead = 0;
+    while ( bytesRead < size ) {
+        int r = _ftp->read_data(buf + bytesRead, size - bytesRead);
+        if ( r <= 0 ) {
+            // End of file or the connection stalled, the next read starts over
+            if ( r < 0 )
+                _error = 1;
+            endTransfer();
+            break;
+        }
+        bytesRead += r;
+    }
+
+    _position += bytesRead;
+    _transfer_position += bytesRead;
+    return bytesRead;
+};
+
+uint32_t FTPMStream::write(const uint8_t *buf, uint32_t size) {
+    if ( !_writing )
+        return 0;
+
+    // write_file() takes at most 64K at a time
+    uint32_t bytesWritten = 0;
+    while ( bytesWritten < size ) {
+        uint16_t chunk = std::min<uint32_t>(size - bytesWritten, 0xFFFF);
+        if ( _ftp->write_file((uint8_t *)buf + bytesWritten, chunk) ) {
+            _error = 1;
+            break;
+        }
+        bytesWritten += chunk;
+    }
+
+    _position += bytesWritten;
+    return bytesWritten;
+}
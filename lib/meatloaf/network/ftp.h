@@ -1 +1,158 @@
 // FTP:// - File Transfer Protocol
+//
+// Files are read on demand: a seek past what the data connection has
+// delivered restarts the transfer there with REST + RETR, so a disk image
+// is never downloaded whole. Logged in control connections are pooled per
+// server and reused by the next open.
+//
+
+#ifndef MEATLOAF_SCHEME_FTP
+#define MEATLOAF_SCHEME_FTP
+
+#include "meatloaf.h"
+
+#include <mutex>
+#include <vector>
+
+#include "fnFTP.h"
+
+#include "../../../include/debug.h"
+
+// Idle logged in sessions kept per process, oldest is dropped first
+#define FTP_POOL_MAX_IDLE 2
+// Bytes read and thrown away to reach a seek target ahead of the transfer,
+// anything further restarts it at the target instead
+#define FTP_SKIP_MAX 4096
+
+
+/**
+ * Process-wide pool of logged in fnFTP sessions keyed by user@host:port.
+ * A session serves one stream or listing at a time.
+ */
+class MeatFtpPool {
+    struct IdleSession {
+        std::string key;
+        fnFTP *ftp;
+    };
+
+    std::vector<IdleSession> _idle;
+    std::mutex _mutex;
+
+public:
+    static MeatFtpPool& instance();
+    static std::string key(PeoplesUrlParser *url);
+
+    // Logged in session for the server in url, nullptr if login fails
+    fnFTP *acquire(PeoplesUrlParser *url);
+    void release(PeoplesUrlParser *url, fnFTP *ftp);
+};
+
+
+/********************************************************
+ * File implementations
+ ********************************************************/
+
+class FTPMFile: public MFile {
+
+public:
+    FTPMFile(std::string path): MFile(path) {};
+    ~FTPMFile() override {};
+
+    bool isDirectory() override;
+
+    MStream* getSourceStream(std::ios_base::openmode mode=std::ios_base::in) override ; // has to return OPENED stream
+    MStream* getDecodedStream(std::shared_ptr<MStream> src);
+    MStream* createStream(std::ios_base::openmode mode) override;
+
+    time_t getLastWrite() override { return 0; };
+    time_t getCreationTime() override { return 0; };
+    bool rewindDirectory() override ;
+    MFile* getNextFileInDir() override ;
+    bool mkDir() override { return false; };
+    bool exists() override ;
+    uint32_t size() override ;
+    bool remove() override { return false; };
+    bool rename(std::string dest) override { return false; };
+
+private:
+    // SIZE, then CWD if that fails, once per file
+    enum { STAT_UNKNOWN, STAT_FILE, STAT_DIR, STAT_MISSING } _stat = STAT_UNKNOWN;
+    uint32_t _size = 0;
+    void stat();
+
+    struct DirEntry {
+        std::string name;
+        uint32_t size;
+        bool is_dir;
+    };
+    std::vector<DirEntry> _entries;
+    size_t _entry = 0;
+    bool dirIsOpen = false;
+};
+
+
+/********************************************************
+ * Streams
+ ********************************************************/
+
+class FTPMStream: public MStream {
+
+public:
+    FTPMStream(std::string path) {
+        url = path;
+    };
+
+    ~FTPMStream() {
+        close();
+    };
+
+    // MStream methods
+    bool isOpen() override { return _ftp != nullptr; };
+    bool isBrowsable() override { return false; };
+    bool isRandomAccess() override { return true; };
+
+    bool open(std::ios_base::openmode mode) override;
+    void close() override;
+
+    uint32_t read(uint8_t* buf, uint32_t size) override;
+    uint32_t write(const uint8_t *buf, uint32_t size) override;
+
+    bool seek(uint32_t pos) override;
+
+protected:
+    std::unique_ptr<PeoplesUrlParser> _url;
+    fnFTP *_ftp = nullptr;
+
+    // A RETR is running and its next byte is at _transfer_position
+    bool _transfer = false;
+    bool _writing = false;
+    uint32_t _transfer_position = 0;
+
+    bool startTransfer();
+    void endTransfer();
+};
+
+
+
+/********************************************************
+ * FS
+ ********************************************************/
+
+class FTPMFileSystem: public MFileSystem
+{
+    MFile* getFile(std::string path) override {
+        return new FTPMFile(path);
+    }
+
+    bool handles(std::string name) {
+        if ( mstr::equals(name, (char *)"ftp:", false) )
+            return true;
+
+        return false;
+    }
+public:
+    FTPMFileSystem(): MFileSystem("ftp") {};
+};
+
+
+#endif /* MEATLOAF_SCHEME_FTP */
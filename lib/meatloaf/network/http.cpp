@@ -1,10 +1,12 @@
 #include "http.h"
 
 #include <esp_idf_version.h>
+#include <esp_timer.h>
 
 #include "meatloaf.h"
 
 #include "../../../include/debug.h"
+#include "fnSystem.h"
 //#include "../../../include/global_defines.h"
 
 /********************************************************
@@ -165,6 +167,8 @@ bool HTTPMStream::open(std::ios_base::openmode mode) {
 void HTTPMStream::close() {
     //Debug_printv("CLOSE called explicitly on this HTTP stream!");
     _http.close();
+    if ( _http._error )
+        _error = 1;
 }
 
 bool HTTPMStream::seek(uint32_t pos) {
@@ -206,6 +210,138 @@ bool HTTPMStream::isOpen() {
 };
 
 
+/********************************************************
+ * Connection pool
+ ********************************************************/
+MeatHttpPool::MeatHttpPool() {
+    _max_idle = fnSystem.get_psram_size() ? HTTP_POOL_MAX_IDLE : HTTP_POOL_MAX_IDLE_NO_PSRAM;
+}
+
+MeatHttpPool& MeatHttpPool::instance() {
+    static MeatHttpPool pool;
+    return pool;
+}
+
+std::string MeatHttpPool::key(const std::string &url) {
+    auto u = PeoplesUrlParser::parseURL(url);
+    std::string scheme = u->scheme;
+    std::string host = u->host;
+    mstr::toLower(scheme);
+    mstr::toLower(host);
+
+    std::string port = u->port;
+    if ( port.empty() )
+        port = (scheme == "https") ? "443" : "80";
+
+    return scheme + "://" + host + ":" + port;
+}
+
+void MeatHttpPool::expire(int64_t now) {
+    for (auto it = _idle.begin(); it != _idle.end(); ) {
+        if ( now - it->since > HTTP_POOL_IDLE_TIMEOUT_US ) {
+            esp_http_client_cleanup(it->handle);
+            _stats.dropped++;
+            it = _idle.erase(it);
+        }
+        else
+            ++it;
+    }
+}
+
+esp_http_client_handle_t MeatHttpPool::acquire(const std::string &url, MeatHttpClient *owner, bool &reused) {
+    std::string k = key(url);
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        expire(esp_timer_get_time());
+
+        // Most recently released first, it is the most likely to still be connected
+        for (auto it = _idle.rbegin(); it != _idle.rend(); ++it) {
+            if ( it->key == k ) {
+                esp_http_client_handle_t h = it->handle;
+                _idle.erase(std::next(it).base());
+                _stats.reused++;
+                _stats.idle = _idle.size();
+                esp_http_client_set_user_data(h, owner);
+                reused = true;
+                //Debug_printv("reusing connection to [%s]", k.c_str());
+                return h;
+            }
+        }
+    }
+
+    esp_http_client_config_t config;
+    memset(&config, 0, sizeof(config));
+    config.url = url.c_str();
+    config.auth_type = HTTP_AUTH_TYPE_BASIC;
+    config.user_agent = USER_AGENT;
+    config.method = HTTP_METHOD_GET;
+    config.timeout_ms = 10000;
+    config.max_redirection_count = 10;
+    config.event_handler = MeatHttpClient::_http_event_handler;
+    config.user_data = owner;
+    config.keep_alive_enable = true;
+    config.keep_alive_idle = 5;
+    config.keep_alive_interval = 5;
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    // Keep the TLS session so reconnects on this handle resume instead of doing a full handshake
+    config.save_client_session = true;
+#endif
+
+    //Debug_printv("HTTP Init url[%s]", url.c_str());
+    esp_http_client_handle_t h = esp_http_client_init(&config);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if ( h != nullptr )
+        _stats.created++;
+    reused = false;
+    return h;
+}
+
+void MeatHttpPool::release(esp_http_client_handle_t handle, const std::string &url, bool reusable) {
+    if ( !reusable || url.size() < 5 ) {
+        esp_http_client_cleanup(handle);
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stats.dropped++;
+        return;
+    }
+
+    std::string k = key(url);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    int64_t now = esp_timer_get_time();
+    expire(now);
+
+    if ( _idle.size() >= _max_idle ) {
+        esp_http_client_cleanup(_idle.front().handle);
+        _idle.erase(_idle.begin());
+        _stats.dropped++;
+    }
+
+    esp_http_client_set_user_data(handle, nullptr);
+    _idle.push_back({k, handle, now});
+    _stats.idle = _idle.size();
+}
+
+void MeatHttpPool::recordTTFB(int64_t us, bool reused) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if ( reused ) {
+        _stats.ttfb_reused_count++;
+        _stats.ttfb_reused_us += us;
+    }
+    else {
+        _stats.ttfb_new_count++;
+        _stats.ttfb_new_us += us;
+    }
+}
+
+MeatHttpPoolStats MeatHttpPool::stats() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stats.idle = _idle.size();
+    return _stats;
+}
+
+
 /********************************************************
  * Meat HTTP client impls
  ********************************************************/
@@ -216,12 +352,12 @@ bool MeatHttpClient::GET(std::string dstUrl) {
 
 bool MeatHttpClient::POST(std::string dstUrl) {
     Debug_printv("POST");
-    return open(dstUrl, HTTP_METHOD_POST);
+    return openUpload(dstUrl, HTTP_METHOD_POST);
 }
 
 bool MeatHttpClient::PUT(std::string dstUrl) {
     Debug_printv("PUT");
-    return open(dstUrl, HTTP_METHOD_PUT);
+    return openUpload(dstUrl, HTTP_METHOD_PUT);
 }
 
 bool MeatHttpClient::HEAD(std::string dstUrl) {
@@ -233,6 +369,17 @@ bool MeatHttpClient::HEAD(std::string dstUrl) {
 bool MeatHttpClient::processRedirectsAndOpen(uint32_t position, uint32_t size) {
     wasRedirected = false;
 
+    // close() gave the handle back to the pool, take one again to reopen
+    if ( _http == nullptr ) {
+        mstr::replaceAll(url, " ", "%20");
+        _http = MeatHttpPool::instance().acquire(url, this, _pooled);
+        if ( _http == nullptr ) {
+            _error = 1;
+            _is_open = false;
+            return false;
+        }
+    }
+
     //Debug_printv("reopening url[%s] from position:%d", url.c_str(), range);
     lastRC = openAndFetchHeaders(lastMethod, position, size);
 
@@ -256,6 +403,7 @@ bool MeatHttpClient::processRedirectsAndOpen(uint32_t position, uint32_t size) {
     _is_open = true;
     _exists = true;
     _position = position;
+    _error = 0; // a failed attempt on a stale pooled connection doesn't count
 
     //Debug_printv("size[%d] avail[%d] isFriendlySkipper[%d] isText[%d] httpCode[%d] method[%d]", _size, available(), isFriendlySkipper, isText, lastRC, lastMethod);
 
@@ -270,13 +418,87 @@ bool MeatHttpClient::open(std::string dstUrl, esp_http_client_method_t meth) {
     return processRedirectsAndOpen(0);
 };
 
+bool MeatHttpClient::openUpload(std::string dstUrl, esp_http_client_method_t meth) {
+    url = dstUrl;
+    lastMethod = meth;
+    _error = 0;
+
+    mstr::replaceAll(url, " ", "%20");
+    if ( _http == nullptr ) {
+        _http = MeatHttpPool::instance().acquire(url, this, _pooled);
+        if ( _http == nullptr ) {
+            _error = 1;
+            return false;
+        }
+    }
+
+    esp_http_client_set_url(_http, url.c_str());
+    esp_http_client_set_method(_http, meth);
+    esp_http_client_delete_header(_http, "Range");
+    for (const auto& pair : headers)
+        esp_http_client_set_header(_http, pair.first.c_str(), pair.second.c_str());
+
+    // Length isn't known up front, the body goes out with chunked transfer encoding
+    _headersSeen = false;
+    if ( esp_http_client_open(_http, -1) != ESP_OK ) {
+        Debug_printv("opening upload failed");
+        _error = 1;
+        return false;
+    }
+
+    _uploading = true;
+    _is_open = true;
+    _position = 0;
+    _size = 0;
+    return true;
+}
+
+bool MeatHttpClient::finishUpload() {
+    _uploading = false;
+
+    // Terminating chunk, then the server's answer
+    if ( _error == 0
+         && esp_http_client_write(_http, "0\r\n\r\n", 5) == 5
+         && esp_http_client_fetch_headers(_http) >= 0
+         && _headersSeen ) {
+        lastRC = esp_http_client_get_status_code(_http);
+        if ( lastRC < 200 || lastRC > 299 )
+            _error = lastRC;
+    }
+    else if ( _error == 0 ) {
+        _error = 1;
+    }
+
+    // Don't send the next request on this handle chunked
+    esp_http_client_delete_header(_http, "Transfer-Encoding");
+
+    Debug_printv("upload url[%s] bytes[%lu] rc[%d]", url.c_str(), _position, lastRC);
+    return _error == 0;
+}
+
 void MeatHttpClient::close() {
     if(_http != nullptr) {
-        if ( _is_open ) {
-            esp_http_client_close(_http);
+        if ( _uploading )
+            finishUpload();
+
+        bool reusable = (_error == 0);
+
+        if ( _is_open && reusable && !esp_http_client_is_complete_data_received(_http) ) {
+            // Drain a short remainder so the connection stays usable, otherwise drop the
+            // socket. The handle (and its TLS session) goes back to the pool either way.
+            int len = 0;
+            if ( esp_http_client_is_chunked_response(_http)
+                 || available() > HTTP_POOL_MAX_DRAIN
+                 || esp_http_client_flush_response(_http, &len) != ESP_OK )
+                esp_http_client_close(_http);
         }
-        esp_http_client_cleanup(_http);
-        Debug_printv("HTTP Close and Cleanup");
+
+        // Headers stick to the handle, don't pass them on to the next user
+        for (const auto& pair : headers)
+            esp_http_client_delete_header(_http, pair.first.c_str());
+
+        MeatHttpPool::instance().release(_http, url, reusable);
+        //Debug_printv("HTTP Close and release");
         _http = nullptr;
     }
     _is_open = false;
@@ -321,9 +543,10 @@ bool MeatHttpClient::seek(uint32_t pos) {
     if(lastMethod == HTTP_METHOD_GET) {
         Debug_printv("Server doesn't support resume, reading from start and discarding");
         // server doesn't support resume, so...
-        if(pos<_position || pos == 0) {
-            // skipping backward let's simply reopen the stream...
-            esp_http_client_close(_http);
+        if(pos<_position || pos == 0 || !_is_open) {
+            // skipping backward (or closed) let's simply reopen the stream...
+            if ( _http != nullptr )
+                esp_http_client_close(_http);
             bool op = open(url, lastMethod);
             if(!op)
                 return false;
@@ -388,6 +611,25 @@ uint32_t MeatHttpClient::write(const uint8_t* buf, uint32_t size) {
         if ( setHeader( (char *)buf ) )
             return size;
     }
+    else if ( _uploading )
+    {
+        // One chunk per write, callers pass large blocks
+        char chunk_header[12];
+        int len = snprintf(chunk_header, sizeof chunk_header, "%lx\r\n", (unsigned long)size);
+
+        if ( size == 0 )
+            return 0;
+
+        if ( esp_http_client_write(_http, chunk_header, len) != len
+             || esp_http_client_write(_http, (char *)buf, size) != (int)size
+             || esp_http_client_write(_http, "\r\n", 2) != 2 )
+        {
+            _error = 1;
+            return 0;
+        }
+        _position += size;
+        return size;
+    }
     else
     {
         auto bytesWritten= esp_http_client_write(_http, (char *)buf, size );
@@ -429,6 +671,8 @@ int MeatHttpClient::openAndFetchHeaders(esp_http_client_method_t method, uint32_
     int retry = 5;
     do
     {
+        int64_t start = esp_timer_get_time();
+        _headersSeen = false;
         rc = esp_http_client_open(_http, 0); // or open? It's not entirely clear...
 
         if (rc == ESP_OK)
@@ -443,13 +687,21 @@ int MeatHttpClient::openAndFetchHeaders(esp_http_client_method_t method, uint32_
             }
         }
 
-        status = esp_http_client_get_status_code(_http);
+        // A pooled connection the server has since closed fails here. The status code
+        // would still be the one from the previous response, so don't trust it unless
+        // this request actually got headers back.
+        status = (rc == ESP_OK && _headersSeen) ? esp_http_client_get_status_code(_http) : -1;
         //Debug_printv("after open rc[%d] status[%d]", rc, status);
         if ( status < 0 )
         {
             Debug_printv("Connection failed... retrying... [%d]", retry);
             esp_http_client_close(_http);
         }
+        else
+        {
+            MeatHttpPool::instance().recordTTFB(esp_timer_get_time() - start, _pooled);
+            _pooled = true; // further requests on this handle reuse its connection
+        }
 
         retry--;
     } while ( status < 0 && retry > 0 );
@@ -462,6 +714,10 @@ esp_err_t MeatHttpClient::_http_event_handler(esp_http_client_event_t *evt)
 {
     MeatHttpClient* meatClient = (MeatHttpClient*)evt->user_data;
 
+    // Idle pooled handle, nobody to report to
+    if (meatClient == nullptr)
+        return ESP_OK;
+
     switch(evt->event_id) {
         case HTTP_EVENT_ERROR: // This event occurs when there are any errors during execution
             Debug_printv("HTTP_EVENT_ERROR");
@@ -478,6 +734,8 @@ esp_err_t MeatHttpClient::_http_event_handler(esp_http_client_event_t *evt)
             break;
 
         case HTTP_EVENT_ON_HEADER: // Occurs when receiving each header sent from the server
+            meatClient->_headersSeen = true;
+
             // Does this server support resume?
             // Accept-Ranges: bytes
 
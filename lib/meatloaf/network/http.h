@@ -13,6 +13,8 @@
 #include <esp_http_client.h>
 #include <functional>
 #include <map>
+#include <mutex>
+#include <vector>
 
 #include "../../../include/debug.h"
 #include "../../include/global_defines.h"
@@ -25,8 +27,67 @@
 //#define PLATFORM_DETAILS "C64; 6510; 2; NTSC; EN;" // Make configurable. This will help server side to select appropriate content.
 //#define USER_AGENT "MEATLOAF/" FN_VERSION_FULL " (" PLATFORM_DETAILS ")"
 
+// Idle connections kept per process, oldest is dropped first
+#define HTTP_POOL_MAX_IDLE 4
+// Each idle HTTPS handle holds a TLS context of ~40K, without PSRAM keep just one
+#define HTTP_POOL_MAX_IDLE_NO_PSRAM 1
+// Servers usually drop keep-alive connections after 5-15 seconds
+#define HTTP_POOL_IDLE_TIMEOUT_US (15 * 1000 * 1000)
+// Unread response bytes we are willing to drain to keep a connection
+#define HTTP_POOL_MAX_DRAIN 4096
+
+class MeatHttpClient;
+
+struct MeatHttpPoolStats {
+    uint32_t created = 0;       // handles initialized (full connect + TLS handshake)
+    uint32_t reused = 0;        // handles taken from the idle list
+    uint32_t dropped = 0;       // handles cleaned up (error, expired or pool full)
+    uint32_t idle = 0;          // handles currently idle
+    uint32_t ttfb_new_count = 0;
+    uint64_t ttfb_new_us = 0;   // time to first byte on fresh handles
+    uint32_t ttfb_reused_count = 0;
+    uint64_t ttfb_reused_us = 0;// time to first byte on pooled handles
+};
+
+/**
+ * Process-wide pool of esp_http_client handles keyed by scheme://host:port.
+ *
+ * A released handle keeps its keep-alive socket and, for HTTPS, its TLS
+ * session ticket, so the next request to the same host skips the DNS lookup
+ * and handshake, or at least gets an abbreviated (resumed) handshake.
+ */
+class MeatHttpPool {
+    struct IdleHandle {
+        std::string key;
+        esp_http_client_handle_t handle;
+        int64_t since;
+    };
+
+    std::vector<IdleHandle> _idle;
+    size_t _max_idle;
+    MeatHttpPoolStats _stats;
+    std::mutex _mutex;
+
+    void expire(int64_t now);
+
+public:
+    MeatHttpPool();
+
+    static MeatHttpPool& instance();
+    static std::string key(const std::string &url);
+
+    esp_http_client_handle_t acquire(const std::string &url, MeatHttpClient *owner, bool &reused);
+    void release(esp_http_client_handle_t handle, const std::string &url, bool reusable);
+    void recordTTFB(int64_t us, bool reused);
+    MeatHttpPoolStats stats();
+};
+
 class MeatHttpClient {
     esp_http_client_handle_t _http = nullptr;
+    bool _pooled = false;       // _http came from the idle pool
+    bool _headersSeen = false;  // a response arrived for the current request
+    bool _uploading = false;    // request body is being streamed by write()
+    friend class MeatHttpPool;
     static esp_err_t _http_event_handler(esp_http_client_event_t *evt);
     int openAndFetchHeaders(esp_http_client_method_t method, uint32_t position, uint32_t size = HTTP_BLOCK_SIZE);
     esp_http_client_method_t lastMethod;
@@ -39,24 +100,8 @@ class MeatHttpClient {
 
 public:
 
-    MeatHttpClient() {
-        esp_http_client_config_t config;
-        memset(&config, 0, sizeof(config));
-        config.url = "https://api.meatloaf.cc/?$";
-        config.auth_type = HTTP_AUTH_TYPE_BASIC;
-        config.user_agent = USER_AGENT;
-        config.method = HTTP_METHOD_GET;
-        config.timeout_ms = 10000;
-        config.max_redirection_count = 10;
-        config.event_handler = _http_event_handler;
-        config.user_data = this;
-        config.keep_alive_enable = true;
-        config.keep_alive_idle = 5;
-        config.keep_alive_interval = 5;
-
-        //Debug_printv("HTTP Init url[%s]", url.c_str());
-        _http = esp_http_client_init(&config);
-    }
+    // The esp_http_client handle is taken from MeatHttpPool on open()
+    MeatHttpClient() {}
     
     ~MeatHttpClient() {
         close();
@@ -83,6 +128,8 @@ public:
 
     bool processRedirectsAndOpen(uint32_t position, uint32_t size = HTTP_BLOCK_SIZE);
     bool open(std::string url, esp_http_client_method_t meth);
+    bool openUpload(std::string url, esp_http_client_method_t meth);
+    bool finishUpload();
     void close();
     void setOnHeader(const std::function<int(char*, char*)> &f);
     bool seek(uint32_t pos);
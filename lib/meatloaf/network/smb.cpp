@@ -0,0 +1,491 @@
+#include "smb.h"
+
+#include "meatloaf.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+
+#include "../../../include/debug.h"
+
+
+/********************************************************
+ * Session pool
+ ********************************************************/
+
+static bool smb_connected(struct smb2_context *smb) {
+    return smb2_get_fd(smb) != -1;
+}
+
+MeatSmbPool& MeatSmbPool::instance() {
+    static MeatSmbPool pool;
+    return pool;
+}
+
+void MeatSmbPool::splitPath(std::string path, std::string &share, std::string &file) {
+    while ( mstr::startsWith(path, "/") )
+        path = path.substr(1);
+
+    size_t slash = path.find('/');
+    if ( slash == std::string::npos ) {
+        share = path;
+        file.clear();
+        return;
+    }
+
+    share = path.substr(0, slash);
+    file = path.substr(slash + 1);
+    while ( mstr::endsWith(file, "/") )
+        file = mstr::dropLast(file, 1);
+}
+
+std::string MeatSmbPool::key(PeoplesUrlParser *url) {
+    std::string host = url->host;
+    mstr::toLower(host);
+
+    std::string share, file;
+    splitPath(url->path, share, file);
+    mstr::toLower(share);
+
+    return url->user + "@" + host + ":" + url->port + "/" + share;
+}
+
+struct smb2_context *MeatSmbPool::acquire(PeoplesUrlParser *url) {
+    std::string k = key(url);
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto it = _idle.begin(); it != _idle.end(); ) {
+            if ( it->key != k ) {
+                ++it;
+                continue;
+            }
+
+            struct smb2_context *smb = it->smb;
+            it = _idle.erase(it);
+
+            // The server may have dropped us while we were idle
+            if ( smb_connected(smb) )
+                return smb;
+
+            smb2_destroy_context(smb);
+        }
+    }
+
+    std::string share, file;
+    splitPath(url->path, share, file);
+    if ( share.empty() ) {
+        Debug_printv("no share in [%s]", url->url.c_str());
+        return nullptr;
+    }
+
+    struct smb2_context *smb = smb2_init_context();
+    if ( smb == nullptr )
+        return nullptr;
+
+    smb2_set_security_mode(smb, SMB2_NEGOTIATE_SIGNING_ENABLED);
+    smb2_set_timeout(smb, SMB_TIMEOUT);
+
+    const char *user = nullptr;
+    if ( !url->user.empty() ) {
+        user = url->user.c_str();
+        smb2_set_user(smb, user);
+    }
+    if ( !url->password.empty() )
+        smb2_set_password(smb, url->password.c_str());
+
+    std::string server = url->host;
+    if ( !url->port.empty() )
+        server += ":" + url->port;
+
+    if ( smb2_connect_share(smb, server.c_str(), share.c_str(), user) != 0 ) {
+        Debug_printv("connect failed server[%s] share[%s] error[%s]", server.c_str(), share.c_str(), smb2_get_error(smb));
+        smb2_destroy_context(smb);
+        return nullptr;
+    }
+
+    return smb;
+}
+
+void MeatSmbPool::release(PeoplesUrlParser *url, struct smb2_context *smb) {
+    if ( !smb_connected(smb) ) {
+        smb2_destroy_context(smb);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if ( _idle.size() >= SMB_POOL_MAX_IDLE ) {
+        smb2_disconnect_share(_idle.front().smb);
+        smb2_destroy_context(_idle.front().smb);
+        _idle.erase(_idle.begin());
+    }
+
+    _idle.push_back({key(url), smb});
+}
+
+
+/********************************************************
+ * File implementations
+ ********************************************************/
+
+void SMBMFile::stat() {
+    if ( _stat != STAT_UNKNOWN )
+        return;
+
+    std::string share, file;
+    MeatSmbPool::splitPath(path, share, file);
+    if ( file.empty() ) {
+        // The share itself
+        _stat = share.empty() ? STAT_MISSING : STAT_DIR;
+        return;
+    }
+
+    struct smb2_context *smb = MeatSmbPool::instance().acquire(this);
+    if ( smb == nullptr ) {
+        _stat = STAT_MISSING;
+        return;
+    }
+
+    struct smb2_stat_64 st;
+    if ( smb2_stat(smb, file.c_str(), &st) != 0 )
+        _stat = STAT_MISSING;
+    else if ( st.smb2_type == SMB2_TYPE_DIRECTORY )
+        _stat = STAT_DIR;
+    else {
+        _stat = STAT_FILE;
+        _size = st.smb2_size;
+    }
+
+    MeatSmbPool::instance().release(this, smb);
+
+    //Debug_printv("path[%s] stat[%d] size[%lu]", path.c_str(), _stat, _size);
+}
+
+bool SMBMFile::isDirectory() {
+    stat();
+    return _stat == STAT_DIR;
+}
+
+bool SMBMFile::exists() {
+    stat();
+    return _stat != STAT_MISSING;
+}
+
+uint32_t SMBMFile::size() {
+    stat();
+    return _size;
+}
+
+MStream* SMBMFile::getSourceStream(std::ios_base::openmode mode) {
+    // has to return OPENED stream
+    MStream* istream = new SMBMStream(url);
+    istream->open(mode);
+    return istream;
+}
+
+MStream* SMBMFile::getDecodedStream(std::shared_ptr<MStream> is) {
+    return is.get(); // we don't have to process this stream in any way, just return the original stream
+}
+
+MStream* SMBMFile::createStream(std::ios_base::openmode mode)
+{
+    MStream* istream = new SMBMStream(url);
+    istream->open(mode);
+    return istream;
+}
+
+bool SMBMFile::rewindDirectory() {
+    _entries.clear();
+    _entry = 0;
+    dirIsOpen = false;
+
+    struct smb2_context *smb = MeatSmbPool::instance().acquire(this);
+    if ( smb == nullptr )
+        return false;
+
+    // smb2_opendir() runs the whole QUERY_DIRECTORY enumeration up front,
+    // keep what it found so the entries need no further requests
+    std::string share, file;
+    MeatSmbPool::splitPath(path, share, file);
+    struct smb2dir *dir = smb2_opendir(smb, file.c_str());
+    if ( dir != nullptr ) {
+        struct smb2dirent *ent;
+        while ( (ent = smb2_readdir(smb, dir)) != nullptr )
+        {
+            if ( !strcmp(ent->name, ".") || !strcmp(ent->name, "..") )
+                continue;
+
+            _entries.push_back({ ent->name, (uint32_t)ent->st.smb2_size, ent->st.smb2_type == SMB2_TYPE_DIRECTORY });
+        }
+        smb2_closedir(smb, dir);
+
+        dirIsOpen = true;
+    }
+    else {
+        Debug_printv("opendir failed path[%s] error[%s]", file.c_str(), smb2_get_error(smb));
+    }
+
+    MeatSmbPool::instance().release(this, smb);
+
+    Debug_printv("path[%s] entries[%d]", path.c_str(), _entries.size());
+    return dirIsOpen;
+}
+
+MFile* SMBMFile::getNextFileInDir() {
+    if ( !dirIsOpen )
+        rewindDirectory();
+
+    if ( _entry >= _entries.size() ) {
+        dirIsOpen = false;
+        return nullptr;
+    }
+
+    auto &e = _entries[_entry++];
+    auto file = new SMBMFile(url + (mstr::endsWith(url, "/") ? "" : "/") + e.name);
+
+    // The listing already says what it is, save the round trips
+    file->_stat = e.is_dir ? STAT_DIR : STAT_FILE;
+    file->_size = e.size;
+    return file;
+}
+
+
+/********************************************************
+ * Streams
+ ********************************************************/
+
+bool SMBMStream::open(std::ios_base::openmode m) {
+    if ( isOpen() )
+        return true;
+
+    mode = m;
+    _url = PeoplesUrlParser::parseURL(url);
+
+    std::string share, file;
+    MeatSmbPool::splitPath(_url->path, share, file);
+
+    _smb = MeatSmbPool::instance().acquire(_url.get());
+    if ( _smb == nullptr ) {
+        _error = 1;
+        return false;
+    }
+
+    int flags = (mode & std::ios_base::out) ? (O_WRONLY | O_CREAT | O_TRUNC) : O_RDONLY;
+    _handle = smb2_open(_smb, file.c_str(), flags);
+    if ( _handle == nullptr ) {
+        Debug_printv("open failed path[%s] error[%s]", file.c_str(), smb2_get_error(_smb));
+        close();
+        _error = 1;
+        return false;
+    }
+
+    if ( !(mode & std::ios_base::out) ) {
+        struct smb2_stat_64 st;
+        if ( smb2_fstat(_smb, _handle, &st) != 0 ) {
+            close();
+            _error = 1;
+            return false;
+        }
+        _size = st.smb2_size;
+
+        // Every read in the window is as big as the server lets us ask for
+        _chunk = std::min<uint32_t>(smb2_get_max_read_size(_smb), SMB_READ_CHUNK_MAX);
+        if ( _chunk == 0 )
+            _chunk = SMB_READ_CHUNK_MAX;
+        _window.resize(_chunk * SMB_READS_IN_FLIGHT);
+        for ( int i = 0; i < SMB_READS_IN_FLIGHT; i++ )
+            _slots[i] = { this, _window.data() + (i * _chunk), 0, 0, 0, Slot::EMPTY };
+    }
+
+    _position = 0;
+    return true;
+}
+
+void SMBMStream::close() {
+    if ( _smb == nullptr )
+        return;
+
+    // libsmb2 still owns the buffers of reads in flight
+    drain();
+    if ( _pending || _broken ) {
+        // Destroying the context runs their callbacks with an error
+        smb2_destroy_context(_smb);
+        _smb = nullptr;
+        _handle = nullptr;
+        return;
+    }
+
+    if ( _handle != nullptr ) {
+        smb2_close(_smb, _handle);
+        _handle = nullptr;
+    }
+
+    MeatSmbPool::instance().release(_url.get(), _smb);
+    _smb = nullptr;
+}
+
+void SMBMStream::readCallback(struct smb2_context *smb, int status, void *command_data, void *cb_data) {
+    Slot *slot = (Slot *)cb_data;
+    slot->result = status;
+    slot->state = Slot::DONE;
+    slot->stream->_pending--;
+}
+
+bool SMBMStream::issue(Slot &slot, uint32_t offset) {
+    slot.offset = offset;
+    slot.length = std::min(_chunk, _size - offset);
+    slot.result = 0;
+
+    if ( smb2_pread_async(_smb, _handle, slot.data, slot.length, offset, readCallback, &slot) != 0 ) {
+        Debug_printv("pread failed offset[%lu] error[%s]", offset, smb2_get_error(_smb));
+        slot.state = Slot::EMPTY;
+        return false;
+    }
+
+    slot.state = Slot::PENDING;
+    _pending++;
+    _window_end = offset + slot.length;
+    return true;
+}
+
+// Start the window over at offset with a single read, read ahead only
+// opens up once the reader turns out to be sequential
+void SMBMStream::fill(uint32_t offset) {
+    drain();
+
+    // A slot still pending after drain() is one libsmb2 owns on a broken context
+    for ( auto &slot : _slots ) {
+        if ( slot.state != Slot::PENDING )
+            slot.state = Slot::EMPTY;
+    }
+
+    if ( offset < _size && _slots[0].state == Slot::EMPTY )
+        issue(_slots[0], offset);
+}
+
+// Put every slot the reader is done with back in flight after the window
+void SMBMStream::readAhead() {
+    for ( auto &slot : _slots ) {
+        if ( slot.state == Slot::DONE && slot.offset + slot.length <= _position )
+            slot.state = Slot::EMPTY;
+
+        if ( slot.state == Slot::EMPTY && _window_end < _size )
+            issue(slot, _window_end);
+    }
+}
+
+// Service the context until the slot's read has come back
+bool SMBMStream::wait(Slot &slot) {
+    while ( slot.state == Slot::PENDING && !_broken ) {
+        struct pollfd pfd;
+        pfd.fd = smb2_get_fd(_smb);
+        pfd.events = smb2_which_events(_smb);
+        pfd.revents = 0;
+
+        // Runs on a timeout too, that's where libsmb2 expires requests
+        if ( poll(&pfd, 1, 1000) < 0 || smb2_service(_smb, pfd.revents) < 0 ) {
+            Debug_printv("service failed error[%s]", smb2_get_error(_smb));
+            _broken = true;
+        }
+    }
+
+    return slot.state == Slot::DONE;
+}
+
+// Wait for every read in flight, EMPTY slots can sit between PENDING ones
+void SMBMStream::drain() {
+    for ( auto &slot : _slots ) {
+        if ( slot.state == Slot::PENDING && !wait(slot) )
+            break;
+    }
+}
+
+bool SMBMStream::seek(uint32_t pos) {
+    if ( !isOpen() ) {
+        Debug_printv("error");
+        _error = 1;
+        return false;
+    }
+
+    // The next read finds pos in the window or starts it over there
+    _position = pos;
+    return true;
+}
+
+uint32_t SMBMStream::read(uint8_t* buf, uint32_t size) {
+    if ( !isOpen() || (mode & std::ios_base::out) || size == 0 )
+        return 0;
+
+    if ( size > available() )
+        size = available();
+
+    uint32_t bytesRead = 0;
+    while ( bytesRead < size ) {
+        Slot *slot = nullptr;
+        for ( auto &s : _slots ) {
+            if ( s.state != Slot::EMPTY && _position >= s.offset && _position < s.offset + s.length ) {
+                slot = &s;
+                break;
+            }
+        }
+
+        if ( slot == nullptr ) {
+            fill(_position);
+            slot = &_slots[0];
+            if ( slot->state == Slot::EMPTY ) {
+                _error = 1;
+                break;
+            }
+        }
+
+        if ( !wait(*slot) || slot->result < 0 ) {
+            Debug_printv("read failed offset[%lu] result[%d]", slot->offset, slot->result);
+            slot->state = Slot::EMPTY;
+            _error = 1;
+            break;
+        }
+
+        // A short read leaves the rest of the slot unfilled
+        uint32_t within = _position - slot->offset;
+        if ( within >= (uint32_t)slot->result ) {
+            slot->state = Slot::EMPTY;
+            break;
+        }
+
+        uint32_t n = std::min<uint32_t>(size - bytesRead, slot->result - within);
+        memcpy(buf + bytesRead, slot->data + within, n);
+        bytesRead += n;
+        _position += n;
+
+        // Read to the end of a slot, keep the pipe full from here on
+        if ( _position >= slot->offset + slot->length )
+            readAhead();
+    }
+
+    return bytesRead;
+};
+
+uint32_t SMBMStream::write(const uint8_t *buf, uint32_t size) {
+    if ( !isOpen() || !(mode & std::ios_base::out) )
+        return 0;
+
+    uint32_t max = smb2_get_max_write_size(_smb);
+    if ( max == 0 )
+        max = SMB_READ_CHUNK_MAX;
+
+    uint32_t bytesWritten = 0;
+    while ( bytesWritten < size ) {
+        uint32_t chunk = std::min(size - bytesWritten, max);
+        int r = smb2_pwrite(_smb, _handle, (uint8_t *)buf + bytesWritten, chunk, _position);
+        if ( r <= 0 ) {
+            Debug_printv("write failed error[%s]", smb2_get_error(_smb));
+            _error = 1;
+            break;
+        }
+        bytesWritten += r;
+        _position += r;
+    }
+
+    return bytesWritten;
+}
@@ -1,3 +1,188 @@
 // SMB:// - Server Messagee Block Protocol
 // https://en.wikipedia.org/wiki/Server_Message_Block
 //
+// smb://[user[:password]@]server/share/path
+//
+// Reads are pipelined with libsmb2's async API: once a stream is read
+// sequentially a window of preads is kept in flight ahead of the reader,
+// each as large as the server's negotiated max read size allows, so it pays
+// one round trip instead of one per request. A seek elsewhere costs a
+// single read. Connected share sessions are pooled and reused by
+// the next open.
+//
+
+#ifndef MEATLOAF_SCHEME_SMB
+#define MEATLOAF_SCHEME_SMB
+
+#include "meatloaf.h"
+
+#include <mutex>
+#include <vector>
+
+#include <smb2/smb2.h>
+#include <smb2/libsmb2.h>
+
+#include "../../../include/debug.h"
+
+// Idle connected sessions kept per process, oldest is dropped first
+#define SMB_POOL_MAX_IDLE 2
+// Reads kept in flight ahead of the reader
+#define SMB_READS_IN_FLIGHT 4
+// Largest single read, the server's max read size is used when smaller
+#define SMB_READ_CHUNK_MAX 8192
+// Seconds before a request is given up on
+#define SMB_TIMEOUT 10
+
+
+/**
+ * Process-wide pool of connected smb2 contexts keyed by user@server/share.
+ * A context serves one stream or listing at a time.
+ */
+class MeatSmbPool {
+    struct IdleSession {
+        std::string key;
+        struct smb2_context *smb;
+    };
+
+    std::vector<IdleSession> _idle;
+    std::mutex _mutex;
+
+public:
+    static MeatSmbPool& instance();
+    static std::string key(PeoplesUrlParser *url);
+
+    // Splits a url path into the share and the path within it
+    static void splitPath(std::string path, std::string &share, std::string &file);
+
+    // Connected context for the share in url, nullptr if it can't connect
+    struct smb2_context *acquire(PeoplesUrlParser *url);
+    void release(PeoplesUrlParser *url, struct smb2_context *smb);
+};
+
+
+/********************************************************
+ * File implementations
+ ********************************************************/
+
+class SMBMFile: public MFile {
+
+public:
+    SMBMFile(std::string path): MFile(path) {};
+    ~SMBMFile() override {};
+
+    bool isDirectory() override;
+
+    MStream* getSourceStream(std::ios_base::openmode mode=std::ios_base::in) override ; // has to return OPENED stream
+    MStream* getDecodedStream(std::shared_ptr<MStream> src);
+    MStream* createStream(std::ios_base::openmode mode) override;
+
+    time_t getLastWrite() override { return 0; };
+    time_t getCreationTime() override { return 0; };
+    bool rewindDirectory() override ;
+    MFile* getNextFileInDir() override ;
+    bool mkDir() override { return false; };
+    bool exists() override ;
+    uint32_t size() override ;
+    bool remove() override { return false; };
+    bool rename(std::string dest) override { return false; };
+
+private:
+    // One stat per file
+    enum { STAT_UNKNOWN, STAT_FILE, STAT_DIR, STAT_MISSING } _stat = STAT_UNKNOWN;
+    uint32_t _size = 0;
+    void stat();
+
+    // The whole enumeration is read at rewind and kept for this handle
+    struct DirEntry {
+        std::string name;
+        uint32_t size;
+        bool is_dir;
+    };
+    std::vector<DirEntry> _entries;
+    size_t _entry = 0;
+    bool dirIsOpen = false;
+};
+
+
+/********************************************************
+ * Streams
+ ********************************************************/
+
+class SMBMStream: public MStream {
+
+public:
+    SMBMStream(std::string path) {
+        url = path;
+    };
+
+    ~SMBMStream() {
+        close();
+    };
+
+    // MStream methods
+    bool isOpen() override { return _handle != nullptr; };
+    bool isBrowsable() override { return false; };
+    bool isRandomAccess() override { return true; };
+
+    bool open(std::ios_base::openmode mode) override;
+    void close() override;
+
+    uint32_t read(uint8_t* buf, uint32_t size) override;
+    uint32_t write(const uint8_t *buf, uint32_t size) override;
+
+    bool seek(uint32_t pos) override;
+
+protected:
+    std::unique_ptr<PeoplesUrlParser> _url;
+    struct smb2_context *_smb = nullptr;
+    struct smb2fh *_handle = nullptr;
+
+    // One pread of the read-ahead window, its buffer is owned by libsmb2
+    // from when it is issued until its callback runs
+    struct Slot {
+        SMBMStream *stream;
+        uint8_t *data;
+        uint32_t offset;
+        uint32_t length;
+        int result;
+        enum { EMPTY, PENDING, DONE } state;
+    };
+    Slot _slots[SMB_READS_IN_FLIGHT];
+    std::vector<uint8_t> _window;
+    uint32_t _chunk = 0;
+    uint32_t _window_end = 0;   // file offset after the last read issued
+    int _pending = 0;
+    bool _broken = false;       // the context failed and can't be pooled
+
+    static void readCallback(struct smb2_context *smb, int status, void *command_data, void *cb_data);
+    bool issue(Slot &slot, uint32_t offset);
+    void fill(uint32_t offset);
+    void readAhead();
+    bool wait(Slot &slot);
+    void drain();
+};
+
+
+
+/********************************************************
+ * FS
+ ********************************************************/
+
+class SMBMFileSystem: public MFileSystem
+{
+    MFile* getFile(std::string path) override {
+        return new SMBMFile(path);
+    }
+
+    bool handles(std::string name) {
+        if ( mstr::equals(name, (char *)"smb:", false) )
+            return true;
+
+        return false;
+    }
+public:
+    SMBMFileSystem(): MFileSystem("smb") {};
+};
+
+
+#endif /* MEATLOAF_SCHEME_SMB */
@@ -1,5 +1,8 @@
 #include "t64.h"
 
+#include <algorithm>
+#include <cstring>
+
 //#include "meat_broker.h"
 #include "endianness.h"
 
@@ -22,46 +25,43 @@ std::string T64MStream::decodeType(uint8_t file_type, bool show_hidden)
     return type;
 }
 
-bool T64MStream::seekEntry( std::string filename )
+int16_t T64MStream::loadEntries()
 {
-    size_t index = 1;
-    mstr::replaceAll(filename, "\\", "/");
-    bool wildcard =  ( mstr::contains(filename, "*") || mstr::contains(filename, "?") );
-
-    // Read Directory Entries
-    if ( filename.size() )
+    // Directory size from the header, the used count is often wrong so take the larger
+    uint8_t counts[6];
+    containerStream->seek(0x20);
+    if (containerStream->read(counts, sizeof(counts)) != sizeof(counts))
+        return -1;
+
+    uint32_t count = std::max(UINT16_FROM_HILOBYTES(counts[3], counts[2]), UINT16_FROM_HILOBYTES(counts[5], counts[4]));
+    uint32_t room = (containerStream->size() > 0x40) ? (containerStream->size() - 0x40) / sizeof(Entry) : 0;
+    if (count == 0 || count > room)
+        count = room;
+
+    // One read for the whole table
+    std::vector<Entry> table(count);
+    containerStream->seek(0x40);
+    count = containerStream->read((uint8_t *)table.data(), count * sizeof(Entry)) / sizeof(Entry);
+
+    for (uint32_t i = 0; i < count && table[i].file_type != 0x00; i++)
     {
-        while ( seekEntry( index ) )
-        {
-            std::string entryFilename = entry.filename;
-            uint8_t i = entryFilename.find_first_of(0xA0);
-            entryFilename = entryFilename.substr(0, i);
-            //mstr::rtrimA0(entryFilename);
-            entryFilename = mstr::toUTF8(entryFilename);
-
-            //Debug_printv("filename[%s] entry.filename[%s]", filename.c_str(), entryFilename.c_str());
-
-            if ( filename == entryFilename ) // Match exact
-            {
-                return true;
-            }
-            else if ( wildcard ) // Wildcard Match
-            {
-                if (filename == "*") // Match first PRG
-                {
-                    filename = entryFilename;
-                    return true;
-                }
-                else if ( mstr::compare(filename, entryFilename) ) // X?XX?X* Wildcard match
-                {
-                    return true;
-                }
-            }
-
-            index++;
-        }
+        std::string name(table[i].filename, strnlen(table[i].filename, sizeof(table[i].filename)));
+        name = mstr::toUTF8(name.substr(0, name.find_first_of(0xA0)));
+
+        entries.push_back(table[i]);
+        addEntryName(std::move(name));
     }
 
+    entry_count = entries.size();
+    Debug_printv("entries[%d]", entry_count);
+    return entry_count;
+}
+
+bool T64MStream::seekEntry( std::string filename )
+{
+    if ( seekEntry( findEntry(filename) ) )
+        return true;
+
     entry.filename[0] = '\0';
 
     return false;
@@ -69,24 +69,14 @@ bool T64MStream::seekEntry( std::string filename )
 
 bool T64MStream::seekEntry( uint16_t index )
 {
-    // Calculate Sector offset & Entry offset
-    index--;
-    uint16_t entryOffset = 0x40 + (index * sizeof(entry));
-
-    //Debug_printv("----------");
-    //Debug_printv("index[%d] sectorOffset[%d] entryOffset[%d] entry_index[%d]", index, sectorOffset, entryOffset, entry_index);
-
-    containerStream->seek(entryOffset);
-    containerStream->read((uint8_t *)&entry, sizeof(entry));
-
-    //Debug_printv("r[%d] file_type[%02X] file_name[%.16s]", r, entry.file_type, entry.filename);
-
-    //if ( next_track == 0 && next_sector == 0xFF )
-    entry_index = index + 1;    
-    if ( entry.file_type == 0x00 )
-        return false;
-    else
+    if ( index && index <= entries.size() )
+    {
+        entry = entries[index - 1];
+        entry_index = index;
         return true;
+    }
+
+    return false;
 }
 
 
@@ -202,7 +192,7 @@ MFile* T64MFile::getNextFileInDir() {
 
     if ( image->seekNextImageEntry() )
     {
-        std::string filename = image->entry.filename;
+        std::string filename(image->entry.filename, strnlen(image->entry.filename, sizeof(image->entry.filename)));
         uint8_t i = filename.find_first_of(0xA0);
         filename = filename.substr(0, i);
         // mstr::rtrimA0(filename);
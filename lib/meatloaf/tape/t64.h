@@ -19,7 +19,9 @@ class T64MStream : public MMediaStream {
     // override everything that requires overriding here
 
 public:
-    T64MStream(std::shared_ptr<MStream> is) : MMediaStream(is) { };
+    T64MStream(std::shared_ptr<MStream> is) : MMediaStream(is) {
+        loadEntries();
+    };
 
 protected:
     struct Header {
@@ -42,6 +44,10 @@ protected:
         containerStream->read((uint8_t*)&header, 24);
     }
 
+    // Directory table, read once at open
+    std::vector<Entry> entries;
+    int16_t loadEntries();
+
     bool seekEntry( std::string filename ) override;
     bool seekEntry( uint16_t index ) override;
 
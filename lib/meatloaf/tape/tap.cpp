@@ -1,5 +1,8 @@
 #include "tap.h"
 
+#include <algorithm>
+#include <cstring>
+
 #include "meat_broker.h"
 #include "endianness.h"
 
@@ -7,71 +10,312 @@
  * Streams
  ********************************************************/
 
+// Next pulse length in TAP units, 0 at the end of the image
+uint32_t TAPMStream::readPulse()
+{
+    auto next = [this]() -> int16_t {
+        if (_tap_offset < _window_offset || _tap_offset >= _window_offset + _window_size)
+        {
+            _window_offset = _tap_offset;
+            _window_size = 0;
+            if (containerStream->seek(_tap_offset))
+                _window_size = containerStream->read(_window, sizeof(_window));
+            if (_window_size == 0)
+                return -1;
+        }
+        return _window[_tap_offset++ - _window_offset];
+    };
+
+    int16_t b = next();
+    if (b < 0)
+        return 0;
+    if (b)
+        return b;
+
+    // Overflow, a pause. Version 1 follows it with the length in cycles
+    if (header.version == 0)
+        return 0x100;
+
+    uint32_t cycles = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        b = next();
+        if (b < 0)
+            return 0;
+        cycles |= b << (8 * i);
+    }
+    return std::max<uint32_t>(cycles / 8, 0x100);
+}
+
+// 'S'hort, 'M'edium, 'L'ong, '?' for anything else, 0 at the end of the image
+char TAPMStream::readPulseType()
+{
+    uint32_t pulse = readPulse();
+    if (pulse == 0)
+        return 0;
+    if (pulse <= TAP_ROM_SHORT_MAX)
+        return 'S';
+    if (pulse <= TAP_ROM_MEDIUM_MAX)
+        return 'M';
+    if (pulse <= TAP_ROM_LONG_MAX)
+        return 'L';
+    return '?';
+}
+
+// ROM loader byte at the current pulse, -1 on a bad pulse or parity, -2 at the end of a block
+int16_t TAPMStream::readByte()
+{
+    // Long-medium marks a byte, long-short the end of the block
+    if (readPulseType() != 'L')
+        return -1;
+    char marker = readPulseType();
+    if (marker == 'S')
+        return -2;
+    if (marker != 'M')
+        return -1;
+
+    // Eight bits low first, then odd parity. Short-medium is 0, medium-short is 1
+    uint8_t value = 0;
+    uint8_t parity = 1;
+    for (int bit = 0; bit < 9; bit++)
+    {
+        char a = readPulseType();
+        char b = readPulseType();
+
+        uint8_t v;
+        if (a == 'S' && b == 'M')
+            v = 0;
+        else if (a == 'M' && b == 'S')
+            v = 1;
+        else
+            return -1;
+
+        if (bit < 8)
+        {
+            value |= v << bit;
+            parity ^= v;
+        }
+        else if (v != parity)
+            return -1;
+    }
+
+    return value;
+}
+
+// Find the next block and step past its countdown. Returns which copy it
+// is (0 first, 1 repeat) or -1 at the end of the image.
+int8_t TAPMStream::findBlock()
+{
+    while (true)
+    {
+        uint32_t pilot = 0;
+        char type;
+        while ((type = readPulseType()) == 'S')
+            pilot++;
+
+        if (type == 0)
+            return -1;
+        if (type != 'L' || pilot < TAP_ROM_MIN_PILOT)
+            continue;
+
+        // Back onto the long pulse that starts the first byte marker
+        _tap_offset--;
+
+        // $89 ... $81 before the first copy, $09 ... $01 before the repeat
+        int16_t first = readByte();
+        if (first != 0x89 && first != 0x09)
+            continue;
+
+        bool found = true;
+        for (uint8_t count = first - 1; (count & 0x7F) > 0; count--)
+        {
+            if (readByte() != count)
+            {
+                found = false;
+                break;
+            }
+        }
+
+        if (found)
+            return (first == 0x89) ? 0 : 1;
+    }
+}
+
+// Scan the tape for program headers and note where each copy of their data
+// starts. Data bytes are a fixed number of pulses apart, so the data blocks
+// are stepped over instead of decoded.
+int16_t TAPMStream::loadEntries()
+{
+    seekHeader();
+    if (strncmp(header.signature, "C64-TAPE-RAW", sizeof(header.signature)) != 0)
+    {
+        Debug_printv("Error: invalid signature, not a TAP file?");
+        return -1;
+    }
+
+    enum { WAIT_HEADER, WAIT_HEADER_REPEAT, WAIT_DATA, WAIT_DATA_REPEAT } state = WAIT_HEADER;
+
+    _tap_offset = sizeof(header);
+    int8_t copy;
+    while ((copy = findBlock()) >= 0)
+    {
+        uint32_t offset = _tap_offset;
+
+        if (state == WAIT_HEADER_REPEAT && copy == 1)
+        {
+            _tap_offset = offset + (TAP_ROM_HEADER_SIZE + 1) * TAP_ROM_BYTE_PULSES;
+            state = WAIT_DATA;
+            continue;
+        }
+
+        if (state == WAIT_HEADER_REPEAT || state == WAIT_DATA || (state == WAIT_DATA_REPEAT && copy == 1))
+        {
+            auto &e = entries.back();
+            e.data_offset[copy] = offset;
+            _tap_offset = offset + (e.end_address - e.start_address + 1) * TAP_ROM_BYTE_PULSES;
+            state = (copy == 0) ? WAIT_DATA_REPEAT : WAIT_HEADER;
+            continue;
+        }
+
+        uint8_t block[TAP_ROM_HEADER_SIZE];
+        uint8_t checksum = 0;
+        int i;
+        for (i = 0; i < TAP_ROM_HEADER_SIZE; i++)
+        {
+            int16_t b = readByte();
+            if (b < 0)
+                break;
+            block[i] = b;
+            checksum ^= b;
+        }
+
+        state = WAIT_HEADER;
+        if (i < TAP_ROM_HEADER_SIZE || readByte() != checksum)
+            continue;
+
+        // Programs only, data files and the end of tape marker are skipped
+        if (block[0] != 1 && block[0] != 3)
+            continue;
+
+        Entry e;
+        e.filename = std::string((char *)block + 5, 16);
+        e.filename.erase(e.filename.find_last_not_of(' ') + 1);
+        e.file_type = block[0];
+        e.start_address = block[1] | block[2] << 8;
+        e.end_address = block[3] | block[4] << 8;
+        e.data_offset[0] = 0;
+        e.data_offset[1] = 0;
+        if (e.end_address <= e.start_address)
+            continue;
+
+        entries.push_back(e);
+        state = (copy == 0) ? WAIT_HEADER_REPEAT : WAIT_DATA;
+
+        Debug_printv("filename[%s] start[%04X] end[%04X] offset[%lu]", e.filename.c_str(), e.start_address, e.end_address, offset);
+    }
+
+    // A program without any of its data can't be loaded
+    entries.erase(std::remove_if(entries.begin(), entries.end(), [](const Entry &e) {
+        return !e.data_offset[0] && !e.data_offset[1];
+    }), entries.end());
+
+    entry_count = entries.size();
+    return entry_count;
+}
+
 bool TAPMStream::seekEntry( std::string filename )
 {
-    uint8_t index = 1;
-    uint8_t i = filename.find_first_of(0xA0);
-    filename = filename.substr(0, i);
-    //mstr::rtrimA0(filename);
+    size_t index = 1;
     mstr::replaceAll(filename, "\\", "/");
+    bool wildcard = (mstr::contains(filename, "*") || mstr::contains(filename, "?"));
 
     // Read Directory Entries
     if ( filename.size() )
     {
         while ( seekEntry( index ) )
         {
-            std::string entryFilename = entry.filename;
-            mstr::rtrimA0(entryFilename);
-            Debug_printv("filename[%s] entry.filename[%.16s]", filename.c_str(), entryFilename.c_str());
+            std::string entryFilename = mstr::toUTF8(entry.filename);
+
+            //Debug_printv("filename[%s] entry.filename[%s]", filename.c_str(), entryFilename.c_str());
 
-            // Read Entry From Stream
-            if (filename == "*")
+            if ( filename == entryFilename ) // Match exact
             {
-                filename = entryFilename;
+                return true;
             }
-            
-            if ( mstr::compare(filename, entryFilename) )
+            else if ( wildcard ) // Wildcard Match
             {
-                // Move stream pointer to start track/sector
-                return true;
+                if (filename == "*") // Match first PRG
+                {
+                    filename = entryFilename;
+                    return true;
+                }
+                else if ( mstr::compare(filename, entryFilename) ) // X?XX?X* Wildcard match
+                {
+                    return true;
+                }
             }
+
             index++;
         }
     }
 
-    entry.filename[0] = '\0';
+    entry.filename.clear();
 
     return false;
 }
 
 bool TAPMStream::seekEntry( uint16_t index )
 {
-    // Calculate Sector offset & Entry offset
-    index--;
-    uint16_t entryOffset = 0x40 + (index * sizeof(entry));
+    if ( index && index <= entries.size() )
+    {
+        index--;
+        entry = entries[index];
+        entry_index = index + 1;
+        return true;
+    }
 
-    //Debug_printv("----------");
-    //Debug_printv("index[%d] sectorOffset[%d] entryOffset[%d] entry_index[%d]", index, sectorOffset, entryOffset, entry_index);
+    return false;
+}
 
-    containerStream->seek(entryOffset);
-    containerStream->read((uint8_t *)&entry, sizeof(entry));
+// Either copy will do, the repeat covers bytes the first one lost
+int16_t TAPMStream::readDataByte(uint32_t index)
+{
+    for (int copy = 0; copy < 2; copy++)
+    {
+        if (!entry.data_offset[copy])
+            continue;
 
-    //Debug_printv("r[%d] file_type[%02X] file_name[%.16s]", r, entry.file_type, entry.filename);
+        _tap_offset = entry.data_offset[copy] + index * TAP_ROM_BYTE_PULSES;
+        int16_t b = readByte();
+        if (b >= 0)
+            return b;
 
-    //if ( next_track == 0 && next_sector == 0xFF )
-    entry_index = index + 1;    
-    if ( entry.file_type == 0x00 )
-        return false;
-    else
-        return true;
-}
+        Debug_printv("bad byte index[%lu] copy[%d]", index, copy);
+    }
 
+    return -1;
+}
 
 uint32_t TAPMStream::readFile(uint8_t* buf, uint32_t size) {
     uint32_t bytesRead = 0;
 
-    bytesRead += containerStream->read(buf, size);
-    _position += bytesRead;
+    while ( bytesRead < size && _position + bytesRead < _size )
+    {
+        uint32_t pos = _position + bytesRead;
+        if ( pos < 2 )
+        {
+            buf[bytesRead++] = _load_address[pos];
+            continue;
+        }
+
+        int16_t b = readDataByte(pos - 2);
+        if ( b < 0 )
+        {
+            _error = 1;
+            break;
+        }
+        buf[bytesRead++] = b;
+    }
 
     return bytesRead;
 }
@@ -86,20 +330,20 @@ bool TAPMStream::seekPath(std::string path) {
     // call image method to obtain file bytes here, return true on success:
     if ( seekEntry(path) )
     {
-        //auto entry = containerImage->entry;
-        auto type = decodeType(entry.file_type).c_str();
-        size_t start_address = UINT16_FROM_LE_UINT16(entry.start_address);
-        size_t end_address = UINT16_FROM_LE_UINT16(entry.end_address);
-        size_t data_offset = UINT32_FROM_LE_UINT32(entry.data_offset);
-        Debug_printv("filename [%.16s] type[%s] start_address[%zu] end_address[%zu] data_offset[%zu]", entry.filename, type, start_address, end_address, data_offset);
+        Debug_printv("filename [%s] start_address[%04X] end_address[%04X] data_offset[%lu/%lu]", entry.filename.c_str(), entry.start_address, entry.end_address, entry.data_offset[0], entry.data_offset[1]);
 
         // Calculate file size
-        _size = ( end_address - start_address );
+        _size = ( entry.end_address - entry.start_address ) + 2; // 2 bytes for load address
+
+        // Load Address
+        _load_address[0] = entry.start_address & 0xFF;
+        _load_address[1] = entry.start_address >> 8;
 
         // Set position to beginning of file
-        containerStream->seek(entry.data_offset);
+        _position = 0;
+        _error = 0;
 
-        Debug_printv("File Size: size[%ld] available[%ld]", _size, available());
+        Debug_printv("File Size: size[%lu] available[%lu]", _size, available());
         
         return true;
     }
@@ -143,8 +387,8 @@ bool TAPMFile::rewindDirectory() {
     image->seekHeader();
 
     // Set Media Info Fields
-    media_header = mstr::format("%.24", image->header.disk_name);
-    media_id = "tap";
+    media_header = mstr::format("%.12s", image->header.signature);
+    media_id = mstr::format("TAP v%d", image->header.version);
     media_blocks_free = 0;
     media_block_size = image->block_size;
     media_image = name;
@@ -165,11 +409,11 @@ MFile* TAPMFile::getNextFileInDir() {
 
     if ( image->seekNextImageEntry() )
     {
-        std::string fileName = mstr::format("%.16s", image->entry.filename);
+        std::string fileName = image->entry.filename;
         mstr::replaceAll(fileName, "/", "\\");
         //Debug_printv( "entry[%s]", (streamFile->url + "/" + fileName).c_str() );
         auto file = MFSOwner::File(streamFile->url + "/" + fileName);
-        file->extension = image->decodeType(image->entry.file_type);
+        file->extension = "PRG";
         return file;
     }
     else
@@ -186,7 +430,7 @@ uint32_t TAPMFile::size() {
     // use TAP to get size of the file in image
     auto image = ImageBroker::obtain<TAPMStream>(streamFile->url);
 
-    size_t bytes = UINT16_FROM_LE_UINT16(image->entry.end_address) - UINT16_FROM_LE_UINT16(image->entry.start_address);
+    size_t bytes = image->entry.end_address - image->entry.start_address + 2;
 
     return bytes;
 }
@@ -21,31 +21,54 @@
  * Streams
  ********************************************************/
 
+// Pulse lengths in TAP units (8 cycles) for the standard CBM ROM loader
+#define TAP_ROM_SHORT_MAX   0x36    // ~0x30 nominal
+#define TAP_ROM_MEDIUM_MAX  0x49    // ~0x42 nominal
+#define TAP_ROM_LONG_MAX    0x70    // ~0x56 nominal
+
+// Every ROM loader byte is a marker, 8 data bits and a parity bit,
+// two pulses each
+#define TAP_ROM_BYTE_PULSES 20
+// Short pulses needed before a block counts as found
+#define TAP_ROM_MIN_PILOT   64
+// Bytes in a ROM loader header block
+#define TAP_ROM_HEADER_SIZE 192
+// Container bytes read at once while decoding, about 20 pulses per byte
+#define TAP_WINDOW_SIZE     4096
+
 class TAPMStream : public MMediaStream {
     // override everything that requires overriding here
 
 public:
-    TAPMStream(std::shared_ptr<MStream> is) : MMediaStream(is) { };
+    TAPMStream(std::shared_ptr<MStream> is) : MMediaStream(is) {
+        loadEntries();
+    };
 
 protected:
     struct Header {
-        char disk_name[24];
+        char signature[12];     // C64-TAPE-RAW
+        uint8_t version;        // 0, or 1 with 24 bit long pulses
+        uint8_t platform;
+        uint8_t video;
+        uint8_t reserved;
+        uint32_t data_size;
     };
 
+    // A program found on the tape. The ROM loader records every block
+    // twice, data_offset points at the first data byte of each copy.
     struct Entry {
-        uint8_t entry_type;
-        uint8_t file_type;
+        std::string filename;
+        uint8_t file_type;      // header block type, 1 and 3 are programs
         uint16_t start_address;
         uint16_t end_address;
-        uint16_t free_1;
-        uint32_t data_offset;
-        uint32_t free_2;
-        char filename[16];
+        uint32_t data_offset[2];
     };
 
+    std::vector<Entry> entries;
+    int16_t loadEntries();
+
     void seekHeader() override {
-        Debug_printv("here");
-        containerStream->seek(0x28);
+        containerStream->seek(0);
         containerStream->read((uint8_t*)&header, sizeof(header));
     }
 
@@ -59,6 +82,20 @@ protected:
     Entry entry;
 
 private:
+    // Pulse decoding, through a window of the container
+    uint8_t _window[TAP_WINDOW_SIZE];
+    uint32_t _window_offset = 0;
+    uint32_t _window_size = 0;
+    uint32_t _tap_offset = 0;
+
+    uint32_t readPulse();
+    char readPulseType();
+    int16_t readByte();
+    int8_t findBlock();
+    int16_t readDataByte(uint32_t index);
+
+    uint8_t _load_address[2] = { 0, 0 };
+
     friend class TAPMFile;
 };
 
@@ -1,5 +1,7 @@
 #include "tcrt.h"
 
+#include <cstring>
+
 //#include "meat_broker.h"
 
 /********************************************************
@@ -58,49 +60,37 @@ std::string TCRTMStream::decodeType(uint8_t file_type, bool show_hidden)
     return type;
 }
 
-bool TCRTMStream::seekEntry( std::string filename )
+int16_t TCRTMStream::loadEntries()
 {
-    size_t index = 1;
-    mstr::replaceAll(filename, "\\", "/");
-    bool wildcard =  ( mstr::contains(filename, "*") || mstr::contains(filename, "?") );
+    uint32_t count = TCRT_MAX_ENTRIES;
+    uint32_t room = (containerStream->size() > 0xE7) ? (containerStream->size() - 0xE7) / sizeof(Entry) : 0;
+    if (count > room)
+        count = room;
+
+    // One read for the whole table
+    std::vector<Entry> table(count);
+    containerStream->seek(0xE7);
+    count = containerStream->read((uint8_t *)table.data(), count * sizeof(Entry)) / sizeof(Entry);
 
-    // Read Directory Entries
-    if ( filename.size() )
+    for (uint32_t i = 0; i < count && table[i].file_type != 0xFF; i++)
     {
-        while ( seekEntry( index ) )
-        {
-            std::string entryFilename = entry.filename;
-            uint8_t i = entryFilename.find_first_of(0x01);
-            entryFilename = entryFilename.substr(0, i);
-            //mstr::rtrimA0(entryFilename);
-            entryFilename = mstr::toUTF8(entryFilename);
-
-            //Debug_printv("index[%d] filename[%s] entry.filename[%s] entry.file_type[%d]", index, filename.c_str(), entryFilename.c_str(), entry.file_type);
-
-            if ( filename == entryFilename ) // Match exact
-            {
-                return true;
-            }
-            else if ( wildcard ) // Wildcard Match
-            {
-                if (filename == "*") // Match first PRG
-                {
-                    if (entry.file_type < 0xFE) // Skip system files
-                    {
-                        filename = entryFilename;
-                        return true;
-                    }
-                }
-                else if ( mstr::compare(filename, entryFilename) ) // X?XX?X* Wildcard match
-                {
-                    return true;
-                }
-            }
-
-            index++;
-        }
+        std::string name(table[i].filename, strnlen(table[i].filename, sizeof(table[i].filename)));
+        name = mstr::toUTF8(name.substr(0, name.find_first_of(0x01)));
+
+        entries.push_back(table[i]);
+        addEntryName(std::move(name));
     }
 
+    entry_count = entries.size();
+    Debug_printv("entries[%d]", entry_count);
+    return entry_count;
+}
+
+bool TCRTMStream::seekEntry( std::string filename )
+{
+    if ( seekEntry( findEntry(filename) ) )
+        return true;
+
     entry.filename[0] = '\0';
 
     return false;
@@ -108,27 +98,14 @@ bool TCRTMStream::seekEntry( std::string filename )
 
 bool TCRTMStream::seekEntry( uint16_t index )
 {
-    // Calculate Sector offset & Entry offset
-    index--;
-    uint16_t entryOffset = 0xE7 + (index * 32);
-
-    //Debug_printv("----------");
-    //Debug_printv("index[%d] entryOffset[%d] entry_index[%d]", (index + 1), entryOffset, entry_index);
-
-    containerStream->seek(entryOffset);
-    containerStream->read((uint8_t *)&entry, sizeof(entry));
-
-    //uint32_t file_start_address = (0xD8 + (entry.file_start_address[0] << 8 | entry.file_start_address[1] << 16));
-    //uint32_t file_size = (entry.file_size[0] | (entry.file_size[1] << 8) | (entry.file_size[2] << 16)) + 2; // 2 bytes for load address
-    //uint32_t file_load_address = entry.file_load_address[0] | entry.file_load_address[1] << 8;
-
-    //Debug_printv("file_name[%.16s] file_type[%02X] data_offset[%X] file_size[%d] load_address[%04X]", entry.filename, entry.file_type, file_start_address, file_size, file_load_address);
-
-    entry_index = index + 1;    
-    if ( entry.file_type == 0xFF )
-        return false;
-    else
+    if ( index && index <= entries.size() )
+    {
+        entry = entries[index - 1];
+        entry_index = index;
         return true;
+    }
+
+    return false;
 }
 
 uint32_t TCRTMStream::readFile(uint8_t* buf, uint32_t size) {
@@ -246,7 +223,7 @@ MFile* TCRTMFile::getNextFileInDir() {
     
     if ( r )
     {
-        std::string filename = image->entry.filename;
+        std::string filename(image->entry.filename, strnlen(image->entry.filename, sizeof(image->entry.filename)));
         uint8_t i = filename.find_first_of(0x01);
         filename = filename.substr(0, i);
         // mstr::rtrimA0(filename);
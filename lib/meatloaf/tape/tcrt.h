@@ -7,6 +7,9 @@
 #ifndef MEATLOAF_MEDIA_TCRT
 #define MEATLOAF_MEDIA_TCRT
 
+// Directory slots in the tapecart file system
+#define TCRT_MAX_ENTRIES 127
+
 #include "../meatloaf.h"
 #include "../meat_media.h"
 
@@ -19,7 +22,9 @@ class TCRTMStream : public MMediaStream {
     // override everything that requires overriding here
 
 public:
-    TCRTMStream(std::shared_ptr<MStream> is) : MMediaStream(is) {};
+    TCRTMStream(std::shared_ptr<MStream> is) : MMediaStream(is) {
+        loadEntries();
+    };
 
 protected:
     struct Header {
@@ -43,6 +48,12 @@ protected:
         containerStream->read((uint8_t*)&header, sizeof(header));
     }
 
+    // Directory table, read once at open
+    std::vector<Entry> entries;
+    int16_t loadEntries();
+    // "*" skips system files
+    bool loadableEntry( uint16_t index ) override { return entries[index - 1].file_type < 0xFE; };
+
     bool seekEntry( std::string filename ) override;
     bool seekEntry( uint16_t index ) override;
     bool seekPath(std::string path) override;
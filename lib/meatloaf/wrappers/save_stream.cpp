@@ -0,0 +1,164 @@
+#ifdef BUILD_IEC
+
+#include "save_stream.h"
+
+#include <esp_timer.h>
+
+#include "../../../include/debug.h"
+
+std::mutex SaveStream::_stats_mutex;
+std::map<std::string, SaveStats> SaveStream::_stats;
+
+SaveStream::SaveStream(std::shared_ptr<MStream> target, std::string backend)
+{
+    _target = target;
+    _backend = backend;
+    url = target->url;
+    mode = std::ios_base::out;
+
+    _chunk = (uint8_t *)malloc(SAVE_CHUNK_SIZE);
+    _ring = xStreamBufferCreate(SAVE_CHUNK_SIZE * SAVE_RING_CHUNKS, SAVE_CHUNK_SIZE);
+    _done = xSemaphoreCreateBinary();
+
+    if ( _chunk != nullptr && _ring != nullptr && _done != nullptr
+         && xTaskCreatePinnedToCore(writerTask, "ml_save_writer", SAVE_TASK_STACKSIZE, this, SAVE_TASK_PRIORITY, &_writer, SAVE_TASK_CPUAFFINITY) == pdPASS )
+        return;
+
+    // Not enough memory for the pipeline, write straight through
+    Debug_printv("Writing unbuffered [%s]", url.c_str());
+    _writer = nullptr;
+    if ( _ring != nullptr )
+        vStreamBufferDelete(_ring);
+    if ( _done != nullptr )
+        vSemaphoreDelete(_done);
+    free(_chunk);
+    _ring = nullptr;
+    _done = nullptr;
+    _chunk = nullptr;
+}
+
+void SaveStream::writerTask(void *arg)
+{
+    SaveStream *self = (SaveStream *)arg;
+
+    while ( true )
+    {
+        size_t n = xStreamBufferReceive(self->_ring, self->_chunk + self->_chunk_len,
+                                        SAVE_CHUNK_SIZE - self->_chunk_len, pdMS_TO_TICKS(50));
+        self->_chunk_len += n;
+
+        if ( self->_chunk_len == SAVE_CHUNK_SIZE )
+            self->writeChunk();
+        else if ( self->_closing && xStreamBufferIsEmpty(self->_ring) )
+            break;
+    }
+
+    // Tail of the file
+    if ( self->_chunk_len )
+        self->writeChunk();
+
+    xSemaphoreGive(self->_done);
+    vTaskDelete(NULL);
+}
+
+void SaveStream::writeChunk()
+{
+    // After an error keep draining the ring so the bus side never blocks
+    if ( !_write_error )
+    {
+        int64_t start = esp_timer_get_time();
+        uint32_t n = _target->write(_chunk, _chunk_len);
+        _busy += esp_timer_get_time() - start;
+
+        if ( n != _chunk_len )
+        {
+            Debug_printv("Short write [%lu of %u] [%s]", n, _chunk_len, url.c_str());
+            _write_error = 1;
+        }
+        _written += n;
+    }
+    _chunk_len = 0;
+}
+
+uint32_t SaveStream::write(const uint8_t *buf, uint32_t size)
+{
+    if ( !isOpen() || _write_error )
+        return 0;
+
+    uint32_t bytesWritten = 0;
+
+    if ( _writer == nullptr )
+    {
+        int64_t start = esp_timer_get_time();
+        bytesWritten = _target->write(buf, size);
+        _busy += esp_timer_get_time() - start;
+        _written += bytesWritten;
+        if ( bytesWritten != size )
+            _write_error = 1;
+    }
+    else
+    {
+        while ( bytesWritten < size && !_write_error )
+            bytesWritten += xStreamBufferSend(_ring, buf + bytesWritten, size - bytesWritten, portMAX_DELAY);
+    }
+
+    _position += bytesWritten;
+    if ( _position > _size )
+        _size = _position;
+
+    return bytesWritten;
+}
+
+void SaveStream::close()
+{
+    if ( _target == nullptr )
+        return;
+
+    // Commit: let the writer drain the ring and write the tail
+    if ( _writer != nullptr )
+    {
+        _closing = true;
+        xSemaphoreTake(_done, portMAX_DELAY);
+        _writer = nullptr;
+    }
+
+    int64_t start = esp_timer_get_time();
+    _target->close();
+    _busy += esp_timer_get_time() - start;
+    _error = _write_error;
+    if ( !_error )
+        _error = _target->error();
+
+    SaveStats total;
+    {
+        std::lock_guard<std::mutex> lock(_stats_mutex);
+        SaveStats &s = _stats[_backend];
+        s.saves++;
+        s.bytes += _written;
+        s.us += _busy;
+        total = s;
+    }
+    Debug_printv("%llu bytes committed @ %0.2fcps [%s avg %0.2fcps]%s",
+                 _written, _busy ? _written / (_busy / 1000000.0) : 0,
+                 _backend.c_str(), total.us ? total.bytes / (total.us / 1000000.0) : 0,
+                 _error ? " ERROR" : "");
+    (void)total;
+
+    if ( _ring != nullptr )
+        vStreamBufferDelete(_ring);
+    if ( _done != nullptr )
+        vSemaphoreDelete(_done);
+    free(_chunk);
+    _ring = nullptr;
+    _done = nullptr;
+    _chunk = nullptr;
+    _target.reset();
+}
+
+std::map<std::string, SaveStats> SaveStream::stats()
+{
+    std::lock_guard<std::mutex> lock(_stats_mutex);
+    return _stats;
+}
+
+#endif // BUILD_IEC
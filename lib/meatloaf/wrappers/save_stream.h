@@ -0,0 +1,86 @@
+#ifdef BUILD_IEC
+#ifndef MEATLOAF_WRAPPER_SAVE_STREAM
+#define MEATLOAF_WRAPPER_SAVE_STREAM
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/stream_buffer.h>
+#include <freertos/task.h>
+
+#include "meatloaf.h"
+
+// Bytes handed to the target stream per write, one flash erase sector / eight SD sectors
+#define SAVE_CHUNK_SIZE     4096
+// Chunks the ring can hold before the bus side has to wait for the writer
+#define SAVE_RING_CHUNKS    4
+
+#define SAVE_TASK_STACKSIZE 4096
+#define SAVE_TASK_PRIORITY  5
+#define SAVE_TASK_CPUAFFINITY 0   // the bus runs on core 1
+
+struct SaveStats {
+    uint32_t saves = 0;
+    uint64_t bytes = 0;
+    int64_t us = 0;
+};
+
+/********************************************************
+ * SaveStream
+ *
+ * Write-behind wrapper for SAVE / PRINT# targets.
+ *
+ * Bytes from the bus go into a ring, a writer task drains it to the
+ * target stream in SAVE_CHUNK_SIZE pieces, so the target sees a few
+ * large aligned writes no matter how the data arrived. close() commits:
+ * it waits for the ring to drain, writes the tail and closes the target.
+ ********************************************************/
+
+class SaveStream: public MStream {
+public:
+    SaveStream(std::shared_ptr<MStream> target, std::string backend);
+    ~SaveStream() override {
+        close();
+    }
+
+    bool isOpen() override { return _target != nullptr && _target->isOpen(); };
+    bool open(std::ios_base::openmode mode) override { return isOpen(); };
+    void close() override;
+
+    uint32_t read(uint8_t* buf, uint32_t size) override { return 0; };
+    uint32_t write(const uint8_t *buf, uint32_t size) override;
+    bool seek(uint32_t pos) override { return false; };
+    size_t error() override { return _error ? _error : _write_error.load(); };
+
+    // Throughput so far, per backend (scheme)
+    static std::map<std::string, SaveStats> stats();
+
+private:
+    std::shared_ptr<MStream> _target;
+    std::string _backend;
+
+    StreamBufferHandle_t _ring = nullptr;
+    TaskHandle_t _writer = nullptr;
+    SemaphoreHandle_t _done = nullptr;
+    volatile bool _closing = false;
+    std::atomic<uint8_t> _write_error{0};   // set by the writer task, moved to _error on close()
+
+    uint8_t *_chunk = nullptr;      // writer side staging buffer
+    size_t _chunk_len = 0;
+    uint64_t _written = 0;
+    int64_t _busy = 0;              // time spent in the target stream
+
+    static void writerTask(void *arg);
+    void writeChunk();
+
+    static std::mutex _stats_mutex;
+    static std::map<std::string, SaveStats> _stats;
+};
+
+#endif // MEATLOAF_WRAPPER_SAVE_STREAM
+#endif // BUILD_IEC
@@ -21,7 +21,7 @@
 
 #define ENTRY_BUFFER_SIZE 256
 
-NetworkProtocolFS::NetworkProtocolFS(std::string *rx_buf, std::string *tx_buf, std::string *sp_buf)
+NetworkProtocolFS::NetworkProtocolFS(NetworkRxBuffer *rx_buf, std::string *tx_buf, std::string *sp_buf)
     : NetworkProtocol(rx_buf, tx_buf, sp_buf)
 {
     fileSize = 0;
@@ -217,7 +217,7 @@ bool NetworkProtocolFS::read_file(unsigned short len)
         }
 
         // Append to receive buffer.
-        receiveBuffer->insert(receiveBuffer->end(), buf.begin(), buf.end());
+        receiveBuffer->write(buf.data(), buf.size());
         fileSize -= len;
     }
     else
@@ -233,7 +233,7 @@ bool NetworkProtocolFS::read_dir(unsigned short len)
 
     if (receiveBuffer->length() == 0)
     {
-        *receiveBuffer = dirBuffer.substr(0, len);
+        receiveBuffer->write(dirBuffer.substr(0, len));
         dirBuffer.erase(0, len);
         dirBuffer.shrink_to_fit();
     }
@@ -37,7 +37,7 @@ public:
      * @param sp_buf pointer to special buffer
      * @return a NetworkProtocolFS object
      */
-    NetworkProtocolFS(std::string *rx_buf, std::string *tx_buf, std::string *sp_buf);
+    NetworkProtocolFS(NetworkRxBuffer *rx_buf, std::string *tx_buf, std::string *sp_buf);
 
     /**
      * dTOR
@@ -32,7 +32,7 @@ DELETE, MKCOL, RMCOL, COPY, MOVE, are all handled via idempotent XIO commands.
 DELETE can be done via special/XIO if you do not want to handle the response, otherwise use aux1=5/9 with normal open/read.
 */
 
-NetworkProtocolHTTP::NetworkProtocolHTTP(std::string *rx_buf, std::string *tx_buf, std::string *sp_buf)
+NetworkProtocolHTTP::NetworkProtocolHTTP(NetworkRxBuffer *rx_buf, std::string *tx_buf, std::string *sp_buf)
     : NetworkProtocolFS(rx_buf, tx_buf, sp_buf)
 {
     rename_implemented = true;
@@ -38,7 +38,7 @@ public:
      * @param sp_buf pointer to special buffer
      * @return a NetworkProtocolFS object
      */
-    NetworkProtocolHTTP(std::string *rx_buf, std::string *tx_buf, std::string *sp_buf);
+    NetworkProtocolHTTP(NetworkRxBuffer *rx_buf, std::string *tx_buf, std::string *sp_buf);
 
     /**
      * dTOR
@@ -13,6 +13,7 @@
 #include "status_error_codes.h"
 #include "utils.h"
 #include "string_utils.h"
+#include "U8Char.h"
 
 #include <vector>
 
@@ -70,7 +71,7 @@ using namespace std;
  * @param tx_buf pointer to transmit buffer
  * @param sp_buf pointer to special buffer
  */
-NetworkProtocol::NetworkProtocol(std::string *rx_buf,
+NetworkProtocol::NetworkProtocol(NetworkRxBuffer *rx_buf,
                                  std::string *tx_buf,
                                  std::string *sp_buf)
 {
@@ -80,6 +81,7 @@ NetworkProtocol::NetworkProtocol(std::string *rx_buf,
     receiveBuffer = rx_buf;
     transmitBuffer = tx_buf;
     specialBuffer = sp_buf;
+    translate_receive_buffer();
     error = 1;
     login = password = nullptr;
 }
@@ -109,6 +111,7 @@ bool NetworkProtocol::open(PeoplesUrlParser *urlParser, cmdFrame_t *cmdFrame)
 {
     // Set translation mode, Bits 0-1 of aux2
     translation_mode = cmdFrame->aux2 & 0x7F; // we now have more xlation modes.
+    translate_receive_buffer();
 
     // Persist aux1/aux2 values for later.
     aux1_open = cmdFrame->aux1;
@@ -124,6 +127,7 @@ void NetworkProtocol::set_open_params(uint8_t p1, uint8_t p2)
     aux1_open = p1;
     aux2_open = p2;
     translation_mode = p2 & 0x7F;
+    translate_receive_buffer();
 #ifdef VERBOSE_PROTOCOL
     Debug_printf("Changed open params to aux1_open = %d, aux2_open = %d. Set translation_mode to %d\r\n", p1, p2, translation_mode);
 #endif
@@ -158,7 +162,7 @@ bool NetworkProtocol::read(unsigned short len)
 #ifdef VERBOSE_PROTOCOL
     Debug_printf("NetworkProtocol::read(%u)\r\n", len);
 #endif
-    translate_receive_buffer();
+    // Translation already happened as the data was written to receiveBuffer.
     error = 1;
     return false;
 }
@@ -189,50 +193,103 @@ bool NetworkProtocol::status(NetworkStatus *status)
     return false;
 }
 
-/**
- * Perform end of line translation on receive buffer. based on translation_mode.
- * @param rx_buf The receive buffer to transform
- * @param len The length of the receive buffer
- * @return length after transformation.
-  */
-void NetworkProtocol::translate_receive_buffer()
+namespace
 {
-#ifdef VERBOSE_PROTOCOL
-    Debug_printf("#### Translating receive buffer, mode: %u\r\n", translation_mode);
+    /**
+     * One table per translation mode, built once. Slot 0 holds the table used
+     * for modes without an end of line translation (ATASCII control codes only).
+     */
+    struct ReceiveTranslationTables
+    {
+        uint16_t table[TRANSLATION_MODE_PETSCII + 1][256];
+        bool passthrough[TRANSLATION_MODE_PETSCII + 1];
+
+        ReceiveTranslationTables()
+        {
+            for (int mode = 0; mode <= TRANSLATION_MODE_PETSCII; mode++)
+            {
+                passthrough[mode] = true;
+
+                for (int c = 0; c < 256; c++)
+                {
+                    uint16_t t = translate(mode, c);
+                    table[mode][c] = t;
+                    if (t != c)
+                        passthrough[mode] = false;
+                }
+            }
+        }
+
+        static uint16_t translate(int mode, uint8_t c)
+        {
+#ifdef BUILD_ATARI
+            if (c == ASCII_BELL)
+                c = ATASCII_BUZZER;
+            else if (c == ASCII_BACKSPACE)
+                c = ATASCII_DEL;
+            else if (c == ASCII_TAB)
+                c = ATASCII_TAB;
 #endif
-    if (translation_mode == 0)
-        return;
 
-    #ifdef BUILD_ATARI
-    replace(receiveBuffer->begin(), receiveBuffer->end(), ASCII_BELL, ATASCII_BUZZER);
-    replace(receiveBuffer->begin(), receiveBuffer->end(), ASCII_BACKSPACE, ATASCII_DEL);
-    replace(receiveBuffer->begin(), receiveBuffer->end(), ASCII_TAB, ATASCII_TAB);
-    #endif   
+            switch (mode)
+            {
+            case TRANSLATION_MODE_CR:
+                if (c == ASCII_CR)
+                    c = EOL;
+                break;
+            case TRANSLATION_MODE_LF:
+                if (c == ASCII_LF)
+                    c = EOL;
+                break;
+            case TRANSLATION_MODE_CRLF:
+                if (c == ASCII_LF)
+                    return RX_TRANSLATE_DROP;
+                if (c == ASCII_CR)
+                    c = EOL;
+                break;
+            case TRANSLATION_MODE_PETSCII:
+                // Same as mstr::toUTF8(), which skips 0x00 and everything from 0x80 up
+                if (c == 0 || c >= 0x80)
+                    return RX_TRANSLATE_DROP;
+                c = (uint8_t)U8Char((char)c).toUtf8()[0];
+                break;
+            }
+
+            return c;
+        }
+    };
+}
 
-    switch (translation_mode)
-    {
-    case TRANSLATION_MODE_CR:
-        replace(receiveBuffer->begin(), receiveBuffer->end(), ASCII_CR, EOL);
-        break;
-    case TRANSLATION_MODE_LF:
-        replace(receiveBuffer->begin(), receiveBuffer->end(), ASCII_LF, EOL);
-        break;
-    case TRANSLATION_MODE_CRLF:
-    #ifndef BUILD_APPLE
-        // With Apple2, we would be translating CR to CR; a waste of CPU
-        replace(receiveBuffer->begin(), receiveBuffer->end(), ASCII_CR, EOL);
-    #endif
-        break;
-    case TRANSLATION_MODE_PETSCII:
+/**
+ * Translation table for a receive translation mode
+ * @param mode translation mode (0-4, higher values only get the ATASCII control code mapping)
+ * @return table of 256 entries, nullptr when no byte is changed
+ */
+const uint16_t *NetworkProtocol::receive_translation_table(uint8_t mode)
+{
+    static const ReceiveTranslationTables tables;
+
+    if (mode == TRANSLATION_MODE_NONE)
+        return nullptr;
+
+    if (mode > TRANSLATION_MODE_PETSCII)
+        mode = 0;
+
+    return tables.passthrough[mode] ? nullptr : tables.table[mode];
+}
+
+/**
+ * Install the receive translation for translation_mode on the receive buffer.
+ * Bytes are translated once, as the protocol writes them into the buffer,
+ * instead of rescanning the whole buffer on every read.
+ */
+void NetworkProtocol::translate_receive_buffer()
+{
 #ifdef VERBOSE_PROTOCOL
-        Debug_printf("!!! PETSCII !!!\r\n");
+    Debug_printf("#### Receive translation mode: %u\r\n", translation_mode);
 #endif
-        *receiveBuffer = mstr::toUTF8(*receiveBuffer);
-        break;
-    }
-
-    if (translation_mode == TRANSLATION_MODE_CRLF)
-        receiveBuffer->erase(std::remove(receiveBuffer->begin(), receiveBuffer->end(), '\n'), receiveBuffer->end());
+    if (receiveBuffer != nullptr)
+        receiveBuffer->setTranslation(receive_translation_table(translation_mode));
 }
 
 /**
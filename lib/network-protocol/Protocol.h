@@ -5,6 +5,7 @@
 
 #include "bus.h"
 #include "networkStatus.h"
+#include "network_rx_buffer.h"
 #include "peoples_url_parser.h"
 
 class NetworkProtocol
@@ -15,7 +16,7 @@ public:
     /**
      * Pointer to the receive buffer
      */
-    std::string *receiveBuffer = nullptr;
+    NetworkRxBuffer *receiveBuffer = nullptr;
 
     /**
      * Pointer to the transmit buffer
@@ -38,7 +39,7 @@ public:
      * @param tx_buf pointer to transmit buffer
      * @param sp_buf pointer to special buffer
      */
-    NetworkProtocol(std::string *rx_buf, std::string *tx_buf, std::string *sp_buf);
+    NetworkProtocol(NetworkRxBuffer *rx_buf, std::string *tx_buf, std::string *sp_buf);
 
     /**
      * dtor - Tear down network protocol object
@@ -204,10 +205,16 @@ protected:
     unsigned char aux2_open = 0;
 
     /**
-     * Perform end of line translation on receive buffer.
+     * Install the receive translation for translation_mode. Received bytes
+     * are translated once, as they are written into the receive buffer.
      */
     void translate_receive_buffer();
 
+    /**
+     * @brief Translation table for a translation mode, nullptr when bytes pass through unchanged.
+     */
+    static const uint16_t *receive_translation_table(uint8_t mode);
+
     /**
      * Perform end of line translation on transmit buffer.
      * @return new buffer length.
@@ -19,7 +19,7 @@
 ProtocolParser::ProtocolParser() {}
 ProtocolParser::~ProtocolParser() {}
 
-NetworkProtocol* ProtocolParser::createProtocol(std::string scheme, std::string *receiveBuffer, std::string *transmitBuffer, std::string *specialBuffer, std::string *login, std::string *password)
+NetworkProtocol* ProtocolParser::createProtocol(std::string scheme, NetworkRxBuffer *receiveBuffer, std::string *transmitBuffer, std::string *specialBuffer, std::string *login, std::string *password)
 {
     NetworkProtocol* protocol = nullptr;
 
@@ -9,7 +9,7 @@ class ProtocolParser
 public:
     ProtocolParser();
     ~ProtocolParser();
-    NetworkProtocol* createProtocol(std::string scheme, std::string *receiveBuffer, std::string *transmitBuffer, std::string *specialBuffer, std::string *login, std::string *password);
+    NetworkProtocol* createProtocol(std::string scheme, NetworkRxBuffer *receiveBuffer, std::string *transmitBuffer, std::string *specialBuffer, std::string *login, std::string *password);
 };
 
 #endif /* PROTOCOLPARSER_H */
\ No newline at end of file
@@ -16,7 +16,7 @@
 
 #include <vector>
 
-NetworkProtocolSD::NetworkProtocolSD(std::string *rx_buf, std::string *tx_buf, std::string *sp_buf)
+NetworkProtocolSD::NetworkProtocolSD(NetworkRxBuffer *rx_buf, std::string *tx_buf, std::string *sp_buf)
     : NetworkProtocolFS(rx_buf, tx_buf, sp_buf)
 {
     rename_implemented = true;
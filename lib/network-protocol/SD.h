@@ -15,7 +15,7 @@ public:
      * @param sp_buf pointer to special buffer
      * @return a NetworkProtocolFS object
      */
-    NetworkProtocolSD(std::string *rx_buf, std::string *tx_buf, std::string *sp_buf);
+    NetworkProtocolSD(NetworkRxBuffer *rx_buf, std::string *tx_buf, std::string *sp_buf);
 
     /**
      * dTOR
@@ -14,7 +14,7 @@ public:
      * @param sp_buf pointer to special buffer
      * @return a NetworkProtocolFS object
      */
-    NetworkProtocolSMB(std::string *rx_buf, std::string *tx_buf, std::string *sp_buf);
+    NetworkProtocolSMB(NetworkRxBuffer *rx_buf, std::string *tx_buf, std::string *sp_buf);
 
     /**
      * dTOR
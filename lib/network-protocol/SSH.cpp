@@ -12,7 +12,7 @@
 
 #define RXBUF_SIZE 65535
 
-NetworkProtocolSSH::NetworkProtocolSSH(std::string *rx_buf, std::string *tx_buf, std::string *sp_buf)
+NetworkProtocolSSH::NetworkProtocolSSH(NetworkRxBuffer *rx_buf, std::string *tx_buf, std::string *sp_buf)
     : NetworkProtocol(rx_buf, tx_buf, sp_buf)
 {
     Debug_printf("NetworkProtocolSSH::NetworkProtocolSSH(%p,%p,%p)\r\n", rx_buf, tx_buf, sp_buf);
@@ -279,8 +279,7 @@ unsigned short NetworkProtocolSSH::available()
             int len = ssh_channel_read(channel, rxbuf, RXBUF_SIZE, 0);
             if (len != SSH_AGAIN)
             {
-                receiveBuffer->append(rxbuf, len);
-                translate_receive_buffer();
+                receiveBuffer->write((const uint8_t *)rxbuf, len);
             }
         }
     }
@@ -25,7 +25,7 @@
  * @param sp_buf pointer to special buffer
  * @return a NetworkProtocolTCP object
  */
-NetworkProtocolTCP::NetworkProtocolTCP(std::string *rx_buf, std::string *tx_buf, std::string *sp_buf)
+NetworkProtocolTCP::NetworkProtocolTCP(NetworkRxBuffer *rx_buf, std::string *tx_buf, std::string *sp_buf)
     : NetworkProtocol(rx_buf, tx_buf, sp_buf)
 {
     Debug_printf("NetworkProtocolTCP::ctor\r\n");
@@ -115,7 +115,6 @@ bool NetworkProtocolTCP::close()
 bool NetworkProtocolTCP::read(unsigned short len)
 {
     unsigned short actual_len = 0;
-    std::vector<uint8_t> newData = std::vector<uint8_t>(len);
 
     Debug_printf("NetworkProtocolTCP::read(%u)\r\n", len);
 
@@ -128,8 +127,9 @@ bool NetworkProtocolTCP::read(unsigned short len)
             return true; // error
         }
 
-        // Do the read from client socket.
-        actual_len = client.read(newData.data(), len);
+        // Do the read from client socket, straight into the receive buffer.
+        uint8_t *newData = receiveBuffer->reserve(len);
+        actual_len = client.read(newData, len);
 
         // bail if the connection is reset.
         if (errno == ECONNRESET)
@@ -144,8 +144,8 @@ bool NetworkProtocolTCP::read(unsigned short len)
             return true;
         }
 
-        // Add new data to buffer.
-        receiveBuffer->insert(receiveBuffer->end(), newData.begin(), newData.end());
+        // Publish the new data, translating it in place.
+        receiveBuffer->commit(actual_len);
     }    
     error = 1;
     return NetworkProtocol::read(len);
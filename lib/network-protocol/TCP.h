@@ -16,7 +16,7 @@ public:
     /**
      * ctor
      */
-    NetworkProtocolTCP(std::string *rx_buf, std::string *tx_buf, std::string *sp_buf);
+    NetworkProtocolTCP(NetworkRxBuffer *rx_buf, std::string *tx_buf, std::string *sp_buf);
 
     /**
      * dtor
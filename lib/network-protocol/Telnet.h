@@ -14,7 +14,7 @@ public:
     /**
      * ctor
      */
-    NetworkProtocolTELNET(std::string *rx_buf, std::string *tx_buf, std::string *sp_buf);
+    NetworkProtocolTELNET(NetworkRxBuffer *rx_buf, std::string *tx_buf, std::string *sp_buf);
 
     /**
      * dtor
@@ -38,7 +38,7 @@ public:
     /**
      * Get Receive Buffer
      */
-    std::string *getReceiveBuffer() { return receiveBuffer; }
+    NetworkRxBuffer *getReceiveBuffer() { return receiveBuffer; }
 
     /**
      * Get Transmit buffer
@@ -8,7 +8,7 @@
 
 #include <vector>
 
-NetworkProtocolTest::NetworkProtocolTest(std::string *rx_buf, std::string *tx_buf, std::string *sp_buf)
+NetworkProtocolTest::NetworkProtocolTest(NetworkRxBuffer *rx_buf, std::string *tx_buf, std::string *sp_buf)
     : NetworkProtocol(rx_buf, tx_buf, sp_buf)
 {
     Debug_printf("NetworkProtocolTest::NetworkProtocolTest(%p,%p,%p)\r\n", rx_buf, tx_buf, sp_buf);
@@ -62,13 +62,13 @@ bool NetworkProtocolTest::close()
 bool NetworkProtocolTest::read(unsigned short len)
 {
     if (receiveBuffer->length() == 0)
-        *receiveBuffer += test_data.substr(0, len);
+        receiveBuffer->write(test_data.substr(0, len));
 
     error = 1;
 
     Debug_printf("NetworkProtocolTest::read(%u)\r\n", len);
-    for (int i = 0; i < receiveBuffer->length(); i++)
-        Debug_printf("%02x ", (unsigned char)receiveBuffer->at(i));
+    for (unsigned char c : receiveBuffer->toString())
+        Debug_printf("%02x ", c);
     Debug_printf("\r\n");
 
     return NetworkProtocol::read(len);
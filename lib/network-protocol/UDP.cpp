@@ -19,7 +19,7 @@
 
 
 
-NetworkProtocolUDP::NetworkProtocolUDP(std::string *rx_buf, std::string *tx_buf, std::string *sp_buf)
+NetworkProtocolUDP::NetworkProtocolUDP(NetworkRxBuffer *rx_buf, std::string *tx_buf, std::string *sp_buf)
     : NetworkProtocol(rx_buf, tx_buf, sp_buf)
 {
     Debug_printf("NetworkProtocolUDP::ctor\r\n");
@@ -112,7 +112,7 @@ bool NetworkProtocolUDP::read(unsigned short len)
         udp.read(newData.data(), len);
 
         // Add new data to buffer.
-        receiveBuffer->insert(receiveBuffer->end(),newData.begin(),newData.end());
+        receiveBuffer->write(newData.data(), newData.size());
     }
 
     // Return success
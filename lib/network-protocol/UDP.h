@@ -14,7 +14,7 @@ public:
     /**
      * ctor
      */
-    NetworkProtocolUDP(std::string *rx_buf, std::string *tx_buf, std::string *sp_buf);
+    NetworkProtocolUDP(NetworkRxBuffer *rx_buf, std::string *tx_buf, std::string *sp_buf);
 
     /**
      * dtor
@@ -7,6 +7,8 @@
 #include <memory>
 #include <string>
 
+#include "network_rx_buffer.h"
+
 class NetworkProtocol;
 class FNJSON;
 class PeoplesUrlParser;
@@ -14,7 +16,7 @@ class PeoplesUrlParser;
 struct NetworkData {
     std::unique_ptr<NetworkProtocol> protocol;
     std::unique_ptr<FNJSON> json;
-    std::string receiveBuffer;
+    NetworkRxBuffer receiveBuffer;
     std::string transmitBuffer;
     std::string specialBuffer;
     std::string deviceSpec;
@@ -0,0 +1,302 @@
+/**
+ * Network receive ring buffer
+ */
+
+#include "network_rx_buffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Smallest allocation, enough for a typical IEC talk or a short HTTP read
+#define RX_BUFFER_MIN_SIZE 512
+
+void NetworkRxBuffer::clear()
+{
+    _head = 0;
+    _count = 0;
+    _petscii_ready = 0;
+    _utf8_cp = 0;
+    _utf8_need = 0;
+}
+
+void NetworkRxBuffer::shrink_to_fit()
+{
+    if (_count == 0)
+    {
+        _head = 0;
+        std::vector<uint8_t>().swap(_buf);
+    }
+}
+
+/**
+ * Index one past the last stored byte, without wrapping
+ */
+size_t NetworkRxBuffer::tail() const
+{
+    return _head + _count;
+}
+
+/**
+ * Free bytes available at the tail before the end of storage or the head
+ */
+size_t NetworkRxBuffer::contiguousFree() const
+{
+    size_t cap = _buf.size();
+    size_t t = tail();
+
+    if (t < cap)
+        return cap - t;
+
+    return _head - (t - cap);
+}
+
+/**
+ * Move the contents to the start of a new allocation of at least capacity bytes
+ */
+void NetworkRxBuffer::relayout(size_t capacity)
+{
+    size_t cap = std::max<size_t>(RX_BUFFER_MIN_SIZE, _buf.size());
+    while (cap < capacity)
+        cap *= 2;
+
+    std::vector<uint8_t> nb(cap);
+    size_t first = std::min(_count, _buf.size() - _head);
+    if (first)
+        memcpy(nb.data(), &_buf[_head], first);
+    if (_count > first)
+        memcpy(nb.data() + first, _buf.data(), _count - first);
+
+    _buf.swap(nb);
+    _head = 0;
+}
+
+/**
+ * Translate len bytes from src to dst, dst may equal src.
+ * @return number of bytes written to dst.
+ */
+size_t NetworkRxBuffer::translate(uint8_t *dst, const uint8_t *src, size_t len) const
+{
+    if (_table == nullptr)
+    {
+        if (dst != src)
+            memcpy(dst, src, len);
+        return len;
+    }
+
+    uint8_t *out = dst;
+    for (size_t i = 0; i < len; i++)
+    {
+        uint16_t t = _table[src[i]];
+        if (t != RX_TRANSLATE_DROP)
+            *out++ = (uint8_t)t;
+    }
+    return out - dst;
+}
+
+size_t NetworkRxBuffer::write(const uint8_t *data, size_t len)
+{
+    size_t stored = 0;
+
+    if (len > _buf.size() - _count)
+        relayout(_count + len);
+
+    while (len)
+    {
+        size_t n = std::min(len, contiguousFree());
+        size_t t = tail();
+        uint8_t *dst = &_buf[t < _buf.size() ? t : t - _buf.size()];
+        size_t m = translate(dst, data, n);
+
+        _count += m;
+        stored += m;
+        data += n;
+        len -= n;
+    }
+
+    return stored;
+}
+
+uint8_t *NetworkRxBuffer::reserve(size_t len)
+{
+    if (_count == 0)
+        _head = 0;
+
+    if (contiguousFree() < len)
+        relayout(_count + len);
+
+    size_t t = tail();
+    return &_buf[t < _buf.size() ? t : t - _buf.size()];
+}
+
+size_t NetworkRxBuffer::commit(size_t len)
+{
+    size_t t = tail();
+    uint8_t *p = &_buf[t < _buf.size() ? t : t - _buf.size()];
+    size_t m = translate(p, p, len);
+
+    _count += m;
+    return m;
+}
+
+void NetworkRxBuffer::append(const char *data, size_t len)
+{
+    const uint16_t *table = _table;
+
+    _table = nullptr;
+    write((const uint8_t *)data, len);
+    _table = table;
+}
+
+void NetworkRxBuffer::assign(const std::string &s)
+{
+    clear();
+    append(s);
+}
+
+const uint8_t *NetworkRxBuffer::peek(size_t &len) const
+{
+    len = std::min(_count, _buf.size() - _head);
+    return len ? &_buf[_head] : nullptr;
+}
+
+const uint8_t *NetworkRxBuffer::peekPetscii(size_t &len, void (*prepare)(uint8_t *, unsigned short))
+{
+    while (_petscii_ready == 0 && _count > 0)
+    {
+        size_t n;
+        uint8_t *p = &_buf[_head];
+
+        peek(n);
+        if (prepare != nullptr)
+        {
+            for (size_t i = 0; i < n; i += 0xFFFF)
+                prepare(p + i, (unsigned short)std::min<size_t>(n - i, 0xFFFF));
+        }
+        size_t m = toPetscii(p, n);
+
+        // Keep the converted bytes at the head and drop the slack in front of them
+        if (m < n)
+        {
+            memmove(p + (n - m), p, m);
+            _head += n - m;
+            _count -= n - m;
+            if (_head == _buf.size() || _count == 0)
+                _head = 0;
+        }
+        _petscii_ready = m;
+    }
+
+    len = _petscii_ready;
+    return len ? &_buf[_head] : nullptr;
+}
+
+/**
+ * Convert UTF-8 to PETSCII in place. Same mapping as U8Char::toPetscii():
+ * code points above 0xFF become '?', stray or unsupported lead bytes become 0.
+ */
+size_t NetworkRxBuffer::toPetscii(uint8_t *buf, size_t len)
+{
+    uint8_t *out = buf;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        uint8_t b = buf[i];
+        uint16_t cp;
+
+        if (_utf8_need)
+        {
+            _utf8_cp = (_utf8_cp << 6) | (b & 0x3F);
+            if (--_utf8_need)
+                continue;
+            cp = _utf8_cp;
+        }
+        else if (b < 0x80)
+            cp = b;
+        else if ((b & 0xE0) == 0xC0)
+        {
+            _utf8_cp = b & 0x1F;
+            _utf8_need = 1;
+            continue;
+        }
+        else if ((b & 0xF0) == 0xE0)
+        {
+            _utf8_cp = b & 0x0F;
+            _utf8_need = 2;
+            continue;
+        }
+        else
+            cp = 0;
+
+        if (cp > 0xFF)
+            cp = '?';
+        else if (cp > 0x40 && cp < 0x5B)
+            cp += 0x20;
+        else if (cp > 0x60 && cp < 0x7B)
+            cp -= 0x20;
+
+        *out++ = (uint8_t)cp;
+    }
+
+    return out - buf;
+}
+
+void NetworkRxBuffer::consume(size_t len)
+{
+    len = std::min(len, _count);
+
+    _head += len;
+    if (_head >= _buf.size())
+        _head -= _buf.size();
+    _count -= len;
+    if (_count == 0)
+        _head = 0;
+
+    _petscii_ready = (len < _petscii_ready) ? _petscii_ready - len : 0;
+}
+
+size_t NetworkRxBuffer::read(uint8_t *dst, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len)
+    {
+        size_t n;
+        const uint8_t *p = peek(n);
+        if (n == 0)
+            break;
+
+        n = std::min(n, len - done);
+        memcpy(dst + done, p, n);
+        consume(n);
+        done += n;
+    }
+
+    return done;
+}
+
+void NetworkRxBuffer::drainTo(std::string &out)
+{
+    size_t n;
+    const uint8_t *p;
+
+    out.reserve(out.size() + _count);
+    while ((p = peek(n)) != nullptr)
+    {
+        out.append((const char *)p, n);
+        consume(n);
+    }
+}
+
+std::string NetworkRxBuffer::toString() const
+{
+    std::string s;
+    size_t first = std::min(_count, _buf.size() - _head);
+
+    s.reserve(_count);
+    if (first)
+        s.append((const char *)&_buf[_head], first);
+    if (_count > first)
+        s.append((const char *)_buf.data(), _count - first);
+
+    return s;
+}
@@ -0,0 +1,136 @@
+// network_rx_buffer.h
+#ifndef NETWORK_RX_BUFFER_H
+#define NETWORK_RX_BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Translation table entry meaning "remove this byte from the stream"
+ */
+#define RX_TRANSLATE_DROP 0x100
+
+/**
+ * Receive buffer shared between a network protocol adapter and the bus device.
+ *
+ * A growable ring: protocols append at the tail, the device sends straight out
+ * of the head in contiguous segments and consumes what it sent, so nothing is
+ * shifted or copied once it has arrived.
+ *
+ * Data written by the protocol goes through a 256 entry translation table
+ * exactly once, on arrival. Each entry is the output byte, or RX_TRANSLATE_DROP.
+ */
+class NetworkRxBuffer
+{
+public:
+    NetworkRxBuffer() = default;
+
+    /**
+     * @brief Number of bytes waiting in the buffer.
+     */
+    size_t length() const { return _count; }
+    size_t size() const { return _count; }
+    bool empty() const { return _count == 0; }
+
+    /**
+     * @brief Drop all data and any pending PETSCII conversion state.
+     */
+    void clear();
+
+    /**
+     * @brief Release the storage when the buffer is empty.
+     */
+    void shrink_to_fit();
+
+    /**
+     * @brief Set the arrival translation table, nullptr to pass data through untouched.
+     */
+    void setTranslation(const uint16_t *table) { _table = table; }
+
+    /**
+     * @brief Append data from the protocol, translating it on the way in.
+     * @return number of bytes stored after translation.
+     */
+    size_t write(const uint8_t *data, size_t len);
+    size_t write(const std::string &s) { return write((const uint8_t *)s.data(), s.size()); }
+
+    /**
+     * @brief Get len bytes of contiguous free space at the tail so a protocol
+     * can read straight into the buffer. Must be followed by commit().
+     */
+    uint8_t *reserve(size_t len);
+
+    /**
+     * @brief Publish len bytes written into the space returned by reserve(),
+     * translating them in place.
+     * @return number of bytes stored after translation.
+     */
+    size_t commit(size_t len);
+
+    /**
+     * @brief Append data verbatim, bypassing the translation table.
+     */
+    void append(const char *data, size_t len);
+    void append(const std::string &s) { append(s.data(), s.size()); }
+
+    /**
+     * @brief Replace the buffer contents verbatim.
+     */
+    void assign(const std::string &s);
+
+    /**
+     * @brief Contiguous readable segment at the head.
+     * @param len receives the segment length, 0 when empty.
+     */
+    const uint8_t *peek(size_t &len) const;
+
+    /**
+     * @brief Like peek(), but converts the head segment from UTF-8 to PETSCII
+     * in place first. Each byte is converted once; a multi-byte sequence split
+     * across segments is carried over to the next one.
+     * @param prepare optional fixup run over the raw segment before conversion.
+     */
+    const uint8_t *peekPetscii(size_t &len, void (*prepare)(uint8_t *, unsigned short) = nullptr);
+
+    /**
+     * @brief Remove len bytes from the head.
+     */
+    void consume(size_t len);
+
+    /**
+     * @brief Copy up to len bytes from the head into dst and consume them.
+     * @return number of bytes copied.
+     */
+    size_t read(uint8_t *dst, size_t len);
+
+    /**
+     * @brief Append the whole buffer to out and empty it.
+     */
+    void drainTo(std::string &out);
+
+    /**
+     * @brief Copy of the contents, for the few callers that need a linear string.
+     */
+    std::string toString() const;
+
+private:
+    std::vector<uint8_t> _buf;
+    size_t _head = 0;
+    size_t _count = 0;
+    const uint16_t *_table = nullptr;
+
+    // PETSCII conversion of the head segment
+    size_t _petscii_ready = 0;      // leading bytes already converted
+    uint16_t _utf8_cp = 0;          // partially decoded code point
+    uint8_t _utf8_need = 0;         // continuation bytes still expected
+
+    size_t tail() const;
+    size_t contiguousFree() const;
+    void relayout(size_t capacity);
+    size_t translate(uint8_t *dst, const uint8_t *src, size_t len) const;
+    size_t toPetscii(uint8_t *buf, size_t len);
+};
+
+#endif // NETWORK_RX_BUFFER_H
@@ -26,14 +26,14 @@ void atari820::pdf_handle_char(uint16_t c, uint8_t aux1, uint8_t aux2)
     // aux1 == 29   sideways mode
     if (aux1 == 'N' && sideFlag)
     {
-        fprintf(_file, ")]TJ\n/F1 12 Tf [(");
+        pdf_printf(")]TJ\n/F1 12 Tf [(");
         fontNumber = 1;
         fontSize = 12;
         sideFlag = false;
     }
     else if (aux1 == 'S' && !sideFlag)
     {
-        fprintf(_file, ")]TJ\n/F2 12 Tf [(");
+        pdf_printf(")]TJ\n/F2 12 Tf [(");
         fontNumber = 2;
         fontSize = 12;
         sideFlag = true;
@@ -47,13 +47,13 @@ void atari820::pdf_handle_char(uint16_t c, uint8_t aux1, uint8_t aux2)
         if (!sideFlag || c > 47)
         {
             if (c == ('\\') || c == '(' || c == ')')
-                fwrite("\\", 1, 1, _file);
-            fwrite(&c, 1, 1, _file);
+                pdf_putc('\\');
+            pdf_putc(c);
         }
         else
         {
             if (c < 48)
-                fwrite(" ", 1, 1, _file);
+                pdf_putc(' ');
         }
 
         pdf_X += charWidth; // update x position
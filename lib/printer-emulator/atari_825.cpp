@@ -89,17 +89,17 @@ void atari825::pdf_handle_char(uint16_t c, uint8_t aux1, uint8_t aux2)
 
             if (epson_font_mask & fnt_proportional)
             {
-                fprintf(_file, " )%d(", (int)(280 - epson_cmd.cmd * 40));
+                pdf_printf(" )%d(", (int)(280 - epson_cmd.cmd * 40));
                 pdf_X += 0.48 * (double)epson_cmd.cmd;
             }
             else if (epson_font_mask & fnt_compressed)
             {
-                fprintf(_file, " )%d(", (int)(360 - epson_cmd.cmd * 40)); // need correct value for 16.7 CPI
+                pdf_printf(" )%d(", (int)(360 - epson_cmd.cmd * 40)); // need correct value for 16.7 CPI
                 pdf_X += 0.48 * (double)epson_cmd.cmd;
             }
             else
             {
-                fprintf(_file, " )%d(", (int)(600 - epson_cmd.cmd * 60)); // need correct value for 10 CPI
+                pdf_printf(" )%d(", (int)(600 - epson_cmd.cmd * 60)); // need correct value for 10 CPI
                 pdf_X += 0.72 * (double)epson_cmd.cmd;
             }
 
@@ -156,20 +156,20 @@ void atari825::pdf_handle_char(uint16_t c, uint8_t aux1, uint8_t aux2)
         check_font();
         if (epson_font_mask & fnt_proportional)
         {
-            // fprintf(_file, " )%d(", (int)(280 - epson_cmd.cmd * 40));
-            fprintf(_file, ")%d(", (int)(c * 40));
+            // pdf_printf(" )%d(", (int)(280 - epson_cmd.cmd * 40));
+            pdf_printf(")%d(", (int)(c * 40));
             pdf_X -= 0.48 * (double)c;
         }
         else if (epson_font_mask & fnt_compressed)
         {
-            // fprintf(_file, " )%d(", (int)(360 - epson_cmd.cmd * 40)); // need correct value for 16.7 CPI
-            fprintf(_file, ")%d(", (int)(c * 40));
+            // pdf_printf(" )%d(", (int)(360 - epson_cmd.cmd * 40)); // need correct value for 16.7 CPI
+            pdf_printf(")%d(", (int)(c * 40));
             pdf_X -= 0.48 * (double)c;
         }
         else
         {
-            // fprintf(_file, " )%d(", (int)(600 - epson_cmd.cmd * 60)); // need correct value for 10 CPI
-            fprintf(_file, ")%d(", (int)(c * 60));
+            // pdf_printf(" )%d(", (int)(600 - epson_cmd.cmd * 60)); // need correct value for 10 CPI
+            pdf_printf(")%d(", (int)(c * 60));
             pdf_X -= 0.72 * (double)c;
         }
     }
@@ -203,8 +203,8 @@ void atari825::pdf_handle_char(uint16_t c, uint8_t aux1, uint8_t aux2)
             {
                 check_font();
                 if (c == '\\' || c == '(' || c == ')')
-                    fputc('\\', _file);
-                fputc(c, _file);
+                    pdf_putc('\\');
+                pdf_putc(c);
                 if (epson_font_mask & fnt_proportional)
                 {
                     double dx;
@@ -258,7 +258,7 @@ double atari825::epson_font_width(uint16_t code)
 
 void atari825::epson_set_font(uint8_t F, double w)
 {
-    fprintf(_file, ")]TJ /F%u 12 Tf [(", F);
+    pdf_printf(")]TJ /F%u 12 Tf [(", F);
     charWidth = w;
     fontNumber = F;
     fontUsed[F - 1] = true;
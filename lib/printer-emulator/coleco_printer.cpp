@@ -10,8 +10,8 @@ void colecoprinter::line_output()
         if (c > 31 && c < 128)
         {
             if (c == '\\' || c == '(' || c == ')')
-                fputc('\\', _file);
-            fputc(c, _file);
+                pdf_putc('\\');
+            pdf_putc(c);
 
             pdf_X += charWidth; // update x position
         }
@@ -43,11 +43,11 @@ void epson80::print_8bit_gfx(uint8_t c)
     // e.g., [(0)100(1)100(4)100(50)]TJ
     // lead with '0' to enter a space
     // then shift back with 133 and print each pin
-    fprintf(_file, "0");
+    pdf_printf("0");
     for (unsigned i = 0; i < 8; i++)
     {
         if ((c >> i) & 0x01)
-            fprintf(_file, ")133(%u", i + 1);
+            pdf_printf(")133(%u", i + 1);
     }
 }
 
@@ -246,7 +246,7 @@ void epson80::pdf_handle_char(uint16_t c, uint8_t aux1, uint8_t aux2)
                     charWidth = 0.3;
                     break;
                 }
-                fprintf(_file, ")]TJ /F%d 9 Tf 100 Tz [(", NUMFONTS); // set font to GFX mode
+                pdf_printf(")]TJ /F%d 9 Tf 100 Tz [(", NUMFONTS); // set font to GFX mode
                 fontUsed[NUMFONTS - 1] = true;
             }
 
@@ -259,13 +259,13 @@ void epson80::pdf_handle_char(uint16_t c, uint8_t aux1, uint8_t aux2)
                     break;
                 case 'L': // Sets dot graphics mode to 960 dots per 8" line
                 case 'Y': // on FX-80 this is double speed but with gotcha
-                    fprintf(_file, ")66.5(");
+                    pdf_printf(")66.5(");
                     break;
                 case 'Z': // on FX-80 this is double speed but with gotcha
-                    fprintf(_file, ")99.75(");
+                    pdf_printf(")99.75(");
                     break;
                 }
-                //fprintf(_file, "]TJ [(");
+                //pdf_printf("]TJ [(");
                 if (epson_cmd.ctr == (epson_cmd.N + 2))
                 {
                     // reset font
@@ -374,13 +374,13 @@ void epson80::pdf_handle_char(uint16_t c, uint8_t aux1, uint8_t aux2)
             {
                 if (!BOLflag)
                     pdf_end_line();   // close out string array
-                fprintf(_file,"ET\r\n"); // close out text object
+                pdf_printf("ET\r\n"); // close out text object
                 // set new margins
                 leftMargin = 18.0;  // (8.5-8.0)/2*72
                 printWidth = 576.0; // 8 inches
                 pdf_begin_text(pdf_Y);
                 // start text string array at beginning of line
-                fprintf(_file,"[(");
+                pdf_printf("[(");
                 BOLflag = false;
                 shortFlag = false;
             } */
@@ -391,13 +391,13 @@ void epson80::pdf_handle_char(uint16_t c, uint8_t aux1, uint8_t aux2)
             {
                 if (!BOLflag)
                     pdf_end_line();   // close out string array
-                fprintf(_file,"ET\r\n"); // close out text object
+                pdf_printf("ET\r\n"); // close out text object
                 // set new margins
                 leftMargin = 75.6;  // (8.5-6.4)/2.0*72.0;
                 printWidth = 460.8; //6.4*72.0; // 6.4 inches
                 pdf_begin_text(pdf_Y);
                 // start text string array at beginning of line
-                fprintf(_file,"[(");
+                pdf_printf("[(");
                 BOLflag = false;
                 shortFlag = true;
             } */
@@ -419,7 +419,7 @@ void epson80::pdf_handle_char(uint16_t c, uint8_t aux1, uint8_t aux2)
             One quirk in using the backspace. In expanded mode, CHR$(8) causes a full double
             width backspace as we would expect. The fun begins when several backspaces
             are done in succession. All except for the first one are normal-width backspaces */
-            fprintf(_file, ")%d(", (int)(charWidth / lineHeight * 900.));
+            pdf_printf(")%d(", (int)(charWidth / lineHeight * 900.));
             pdf_X -= charWidth; // update x position
             break;
         case 9: // Horizontal Tabulation. Print head moves to next tab stop
@@ -470,8 +470,8 @@ void epson80::pdf_handle_char(uint16_t c, uint8_t aux1, uint8_t aux2)
                     epson_set_font(new_F, new_w);
                 }
                 if (c == '\\' || c == '(' || c == ')')
-                    fputc('\\', _file);
-                fputc(c, _file);
+                    pdf_putc('\\');
+                pdf_putc(c);
                 pdf_X += charWidth; // update x position
             }
             break;
@@ -565,7 +565,7 @@ double epson80::epson_font_width(uint16_t code)
 
 void epson80::epson_set_font(uint8_t F, double w)
 {
-    fprintf(_file, ")]TJ /F%u 9 Tf 120 Tz [(", F);
+    pdf_printf(")]TJ /F%u 9 Tf 120 Tz [(", F);
     charWidth = w;
     fontNumber = F;
     fontUsed[F - 1] = true;
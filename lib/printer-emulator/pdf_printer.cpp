@@ -1,5 +1,7 @@
 #include "pdf_printer.h"
 
+#include <stdarg.h>
+
 #include "../../include/global_defines.h"
 #include "../../include/debug.h"
 
@@ -7,39 +9,118 @@
 
 #include "utils.h"
 
+void pdfPrinter::pdf_write(const void *buf, size_t len)
+{
+    if (_stream_open)
+    {
+        _page_stream.append((const char *)buf, len);
+        return;
+    }
+
+    _out_buf.append((const char *)buf, len);
+    if (_out_buf.size() >= PDF_WRITE_BUF_SIZE)
+        pdf_flush();
+}
+
+void pdfPrinter::pdf_printf(const char *fmt, ...)
+{
+    char buf[128];
+    va_list args;
+
+    va_start(args, fmt);
+    int len = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    if (len < 0)
+        return;
+
+    if (len < (int)sizeof(buf))
+    {
+        pdf_write(buf, len);
+        return;
+    }
+
+    // Too long for the stack buffer
+    char *lbuf = (char *)malloc(len + 1);
+    if (lbuf == nullptr)
+        return;
+    va_start(args, fmt);
+    vsnprintf(lbuf, len + 1, fmt, args);
+    va_end(args);
+    pdf_write(lbuf, len);
+    free(lbuf);
+}
+
+// Write out whatever has been collected in the output buffer
+void pdfPrinter::pdf_flush()
+{
+    if (_out_buf.empty())
+        return;
+
+    if (_snapshot_sink != nullptr)
+    {
+        _snapshot_ok = _snapshot_ok && (*_snapshot_sink)((const uint8_t *)_out_buf.data(), _out_buf.size());
+        _pdf_written += _out_buf.size();
+    }
+    else if (_file != nullptr)
+    {
+        _pdf_written += fwrite(_out_buf.data(), 1, _out_buf.size(), _file);
+        // snapshotOutput() reads the file back through its own handle
+        fflush(_file);
+    }
+    else
+        return;
+
+    _out_buf.clear();
+}
+
+// Record the document offset of an object for the xref table
+void pdfPrinter::pdf_mark_obj(int obj)
+{
+    if (objLocations.size() <= (size_t)obj)
+        objLocations.resize(obj + 1, 0);
+    objLocations[obj] = pdf_tell();
+}
+
 void pdfPrinter::pdf_header()
 {
     Debug_println("pdf header");
     pdf_Y = 0;
     pdf_X = 0;
     pdf_pageCounter = 0;
-    fprintf(_file, "%%PDF-1.4\n");
+    pageObjects.clear();
+    objLocations.clear();
+    _out_buf.clear();
+    _page_stream.clear();
+    _stream_open = false;
+    _pdf_written = 0;
+    pdf_printf("%%PDF-1.4\n");
     // first object: catalog of pages
     pdf_objCtr = 1;
-    objLocations[pdf_objCtr] = ftell(_file);
-    fprintf(_file, "1 0 obj\n<</Type /Catalog /Pages 2 0 R>>\nendobj\n");
+    pdf_mark_obj(pdf_objCtr);
+    pdf_printf("1 0 obj\n<</Type /Catalog /Pages 2 0 R>>\nendobj\n");
     // object 2 0 R is printed by pdf_page_resource() before xref
     // object 3 0 R is printed at pdf_font_resource() before xref
     pdf_objCtr = 3; // set up counter for pdf_add_font()
+    pdf_flush();
 }
 
 void pdfPrinter::pdf_page_resource()
 {
-    objLocations[2] = ftell(_file); // hard code page catalog as object #2
-    fprintf(_file, "2 0 obj\n<</Type /Pages /Kids [ ");
+    pdf_mark_obj(2); // hard code page catalog as object #2
+    pdf_printf("2 0 obj\n<</Type /Pages /Kids [ ");
     for (int i = 0; i < pdf_pageCounter; i++)
     {
-        fprintf(_file, "%d 0 R ", pageObjects[i]);
+        pdf_printf("%d 0 R ", pageObjects[i]);
     }
-    fprintf(_file, "] /Count %d>>\nendobj\n", pdf_pageCounter);
+    pdf_printf("] /Count %d>>\nendobj\n", pdf_pageCounter);
 }
 
 void pdfPrinter::pdf_font_resource()
 {
     int fntCtr = 0;
-    objLocations[3] = ftell(_file);
+    pdf_mark_obj(3);
     // font catalog
-    fprintf(_file, "3 0 obj\n<</Font <<");
+    pdf_printf("3 0 obj\n<</Font <<");
     for (int i = 0; i < MAXFONTS; i++)
     {
         if (fontUsed[i])
@@ -49,23 +130,34 @@ void pdfPrinter::pdf_font_resource()
             //  font descriptor
             //  font widths
             //  font file
-            fprintf(_file, "/F%d %d 0 R ", i + 1, pdf_objCtr + 1 + fntCtr * 4); /// F1 4 0 R /F2 8 0 R>>>>\nendobj\n
+            pdf_printf("/F%d %d 0 R ", i + 1, pdf_objCtr + 1 + fntCtr * 4); /// F1 4 0 R /F2 8 0 R>>>>\nendobj\n
             fntCtr++;
         }
     }
-    fprintf(_file, ">>>>\nendobj\n");
+    pdf_printf(">>>>\nendobj\n");
 }
 
 void pdfPrinter::pdf_add_fonts() // pdfFont_t *fonts[],
 {
     Debug_print("pdf add fonts: ");
 
+    // Each font file is split into 7 segments by "%d" placeholders which are
+    // replaced with object numbers. Segments marked 'newobj' start a new object;
+    // the others refer to an object 'ref' numbers ahead of the current one.
+    static const struct
+    {
+        bool newobj;
+        int ref;
+    } segments[7] = {{true, 0}, {false, 1}, {false, 3}, {true, 0}, {false, 1}, {true, 0}, {true, 0}};
+
     // OPEN LUT FILE
     char fname[30]; // filename: /f/shortname/Fi
     sprintf(fname, SYSTEM_DIR "/font/%s/LUT", shortname.c_str());
     FILE *lut = fsFlash.file_open(fname);
     int maxFonts = util_parseInt(lut);
 
+    char *buf = (char *)malloc(PDF_WRITE_BUF_SIZE);
+
     // font dictionary
     for (int i = 0; i < maxFonts; i++)
     {
@@ -83,92 +175,38 @@ void pdfPrinter::pdf_add_fonts() // pdfFont_t *fonts[],
             sprintf(fname, SYSTEM_DIR "/font/%s/F%d", shortname.c_str(), i + 1); // e.g. /f/a820/F2
             FILE *fff = fsFlash.file_open(fname);                 // Font File File - fff
 
-            fgetc(fff); // '%'
-            fp++;
-            fgetc(fff); // 'd'
-            fp++;
-            pdf_objCtr++; // = 6;
-            objLocations[pdf_objCtr] = ftell(_file);
-            fprintf(_file, "%d", pdf_objCtr); // 6
-            while (fp < fontObjPos[0])
-            {
-                fputc(fgetc(fff), _file);
-                fp++;
-            }
-            fgetc(fff); // '%'
-            fp++;
-            fgetc(fff); // 'd'
-            fp++;
-            fprintf(_file, "%d", pdf_objCtr + 1); // 7
-            while (fp < fontObjPos[1])
-            {
-                fputc(fgetc(fff), _file);
-                fp++;
-            }
-            fgetc(fff); // '%'
-            fp++;
-            fgetc(fff); // 'd'
-            fp++;
-            fprintf(_file, "%d", pdf_objCtr + 3); // 9
-            while (fp < fontObjPos[2])
+            for (int j = 0; j < 7; j++)
             {
-                fputc(fgetc(fff), _file);
-                fp++;
-            }
-            fgetc(fff); // '%'
-            fp++;
-            fgetc(fff); // 'd'
-            fp++;
-            pdf_objCtr++; // = 7;
-            objLocations[pdf_objCtr] = ftell(_file);
-            fprintf(_file, "%d", pdf_objCtr); // 7
-            while (fp < fontObjPos[3])
-            {
-                fputc(fgetc(fff), _file);
-                fp++;
-            }
-            fgetc(fff); // '%'
-            fp++;
-            fgetc(fff); // 'd'
-            fp++;
-            fprintf(_file, "%d", pdf_objCtr + 1); // 8
-            while (fp < fontObjPos[4])
-            {
-                fputc(fgetc(fff), _file);
-                fp++;
-            }
-            fgetc(fff); // '%'
-            fp++;
-            fgetc(fff); // 'd'
-            fp++;
-            pdf_objCtr++; // = 8;
-            objLocations[pdf_objCtr] = ftell(_file);
-            fprintf(_file, "%d", pdf_objCtr); // 8
-            while (fp < fontObjPos[5])
-            {
-                fputc(fgetc(fff), _file);
-                fp++;
-            }
-            fgetc(fff); // '%'
-            fp++;
-            fgetc(fff); // 'd'
-            fp++;
-            pdf_objCtr++; // = 9;
-            objLocations[pdf_objCtr] = ftell(_file);
-            fprintf(_file, "%d", pdf_objCtr); // 9
-            // insert rest of file
-            while (fp < fontObjPos[6]) //(fff.available())
-            {
-                fputc(fgetc(fff), _file);
-                fp++;
+                fseek(fff, 2, SEEK_CUR); // '%d'
+                fp += 2;
+                if (segments[j].newobj)
+                {
+                    pdf_objCtr++;
+                    pdf_mark_obj(pdf_objCtr);
+                }
+                pdf_printf("%d", pdf_objCtr + segments[j].ref);
+
+                // copy the rest of the segment in blocks
+                while (fp < fontObjPos[j])
+                {
+                    size_t want = fontObjPos[j] - fp;
+                    if (want > PDF_WRITE_BUF_SIZE)
+                        want = PDF_WRITE_BUF_SIZE;
+                    size_t got = fread(buf, 1, want, fff);
+                    if (got == 0)
+                        break;
+                    pdf_write(buf, got);
+                    fp += got;
+                }
             }
             fclose(fff);
-            fputc('\n', _file); // make sure there's a seperator
+            pdf_putc('\n'); // make sure there's a seperator
         }
         else
             Debug_print("unused; ");
     }
 
+    free(buf);
     fclose(lut);
     Debug_println("done.");
 }
@@ -177,19 +215,17 @@ void pdfPrinter::pdf_new_page()
 { // open a new page
     Debug_println("pdf new page");
     pdf_objCtr++;
-    pageObjects[pdf_pageCounter] = pdf_objCtr;
-    objLocations[pdf_objCtr] = ftell(_file);
-    fprintf(_file, "%d 0 obj\n<</Type /Page /Parent 2 0 R /Resources 3 0 R /MediaBox [0 0 %g %g] /Contents [ ", pdf_objCtr, pageWidth, pageHeight);
+    pageObjects.push_back(pdf_objCtr);
+    pdf_mark_obj(pdf_objCtr);
+    pdf_printf("%d 0 obj\n<</Type /Page /Parent 2 0 R /Resources 3 0 R /MediaBox [0 0 %g %g] /Contents [ ", pdf_objCtr, pageWidth, pageHeight);
     pdf_objCtr++; // increment for the contents stream object
-    fprintf(_file, "%d 0 R ", pdf_objCtr);
-    fprintf(_file, "]>>\nendobj\n");
+    pdf_printf("%d 0 R ", pdf_objCtr);
+    pdf_printf("]>>\nendobj\n");
 
-    // open content stream
-    objLocations[pdf_objCtr] = ftell(_file);
-    fprintf(_file, "%d 0 obj\n<</Length ", pdf_objCtr);
-    idx_stream_length = ftell(_file);
-    fprintf(_file, "0000000000 >>\nstream\n");
-    idx_stream_start = ftell(_file);
+    // open content stream, it is collected in memory until the page ends
+    _stream_obj = pdf_objCtr;
+    _page_stream.clear();
+    _stream_open = true;
 
     // open new text object
     pdf_begin_text(pageHeight - topMargin);
@@ -199,10 +235,10 @@ void pdfPrinter::pdf_begin_text(double Y)
 {
     Debug_println("pdf begin text");
     // open new text object
-    fprintf(_file, "BT\n");
+    pdf_printf("BT\n");
     TOPflag = false;
-    fprintf(_file, "/F%u %g Tf %d Tz\n", fontNumber, fontSize, fontHorizScale);
-    fprintf(_file, "%g %g Td\n", leftMargin, Y);
+    pdf_printf("/F%u %g Tf %d Tz\n", fontNumber, fontSize, fontHorizScale);
+    pdf_printf("%g %g Td\n", leftMargin, Y);
     pdf_Y = Y; // reset print roller to top of page
     pdf_X = 0; // set carriage to LHS
     BOLflag = true;
@@ -214,11 +250,11 @@ void pdfPrinter::pdf_new_line()
 
     // position new line and start text string array
     if (pdf_dY != 0)
-        fprintf(_file, "0 Ts ");
+        pdf_printf("0 Ts ");
 #if !defined(BUILD_APPLE) && !defined(BUILD_RC2014)
     pdf_dY -= lineHeight;
 #endif
-    fprintf(_file, "0 %g Td [(", pdf_dY);
+    pdf_printf("0 %g Td [(", pdf_dY);
     pdf_Y += pdf_dY; // line feed
     pdf_dY = 0;
     // pdf_X = 0;              // CR over in end line()
@@ -228,7 +264,7 @@ void pdfPrinter::pdf_new_line()
 void pdfPrinter::pdf_end_line()
 {
     Debug_println("pdf end line");
-    fprintf(_file, ")]TJ\n"); // close the line
+    pdf_printf(")]TJ\n"); // close the line
     // pdf_Y -= lineHeight; // line feed - moved to new line()
     pdf_X = 0; // CR
     BOLflag = true;
@@ -238,7 +274,20 @@ void pdfPrinter::pdf_end_line()
 
 void pdfPrinter::pdf_set_rise()
 {
-    fprintf(_file, ")]TJ %g Ts [(", pdf_dY);
+    pdf_printf(")]TJ %g Ts [(", pdf_dY);
+}
+
+// Emit the collected content stream as its object. It is left uncompressed:
+// zlib is not part of the firmware build, and the RLE-only deflate used for
+// PNG output gains nothing on text operators.
+void pdfPrinter::pdf_write_stream()
+{
+    _stream_open = false;
+    pdf_mark_obj(_stream_obj);
+
+    pdf_printf("%d 0 obj\n<</Length %u>>\nstream\n", _stream_obj, (unsigned)_page_stream.size());
+    pdf_write(_page_stream.data(), _page_stream.size());
+    pdf_printf("endstream\nendobj\n");
 }
 
 void pdfPrinter::pdf_end_page()
@@ -247,15 +296,11 @@ void pdfPrinter::pdf_end_page()
     // close text object & stream
     if (!BOLflag)
         pdf_end_line();
-    fprintf(_file, "ET\n");
-    idx_stream_stop = ftell(_file);
-    fprintf(_file, "endstream\nendobj\n");
-    size_t idx_temp = ftell(_file);
-    fflush(_file);
-    fseek(_file, idx_stream_length, SEEK_SET);
-    fprintf(_file, "%10u", (unsigned)(idx_stream_stop - idx_stream_start));
-    fflush(_file);
-    fseek(_file, idx_temp, SEEK_SET);
+    pdf_printf("ET\n");
+    pdf_write_stream();
+    _page_stream.clear();
+    _page_stream.shrink_to_fit();
+    pdf_flush();
     // set counters
     pdf_pageCounter++;
     TOPflag = true;
@@ -264,19 +309,28 @@ void pdfPrinter::pdf_end_page()
 void pdfPrinter::pdf_xref()
 {
     Debug_println("pdf xref");
-    size_t xref = ftell(_file);
+    size_t xref = pdf_tell();
     pdf_objCtr++;
-    fprintf(_file, "xref\n");
-    fprintf(_file, "0 %d\n", pdf_objCtr);
-    fprintf(_file, "0000000000 65535 f\n");
+    pdf_printf("xref\n");
+    pdf_printf("0 %d\n", pdf_objCtr);
+    pdf_printf("0000000000 65535 f\n");
     for (int i = 1; i < pdf_objCtr; i++)
     {
-        fprintf(_file, "%010u 00000 n\n", (unsigned)objLocations[i]);
+        pdf_printf("%010u 00000 n\n", (unsigned)objLocations[i]);
     }
-    fprintf(_file, "trailer <</Size %d/Root 1 0 R>>\n", pdf_objCtr);
-    fprintf(_file, "startxref\n");
-    fprintf(_file, "%u\n", (unsigned)xref);
-    fprintf(_file, "%%%%EOF\n");
+    pdf_printf("trailer <</Size %d/Root 1 0 R>>\n", pdf_objCtr);
+    pdf_printf("startxref\n");
+    pdf_printf("%u\n", (unsigned)xref);
+    pdf_printf("%%%%EOF\n");
+}
+
+// Resources, fonts and cross reference table that close out the document
+void pdfPrinter::pdf_trailer()
+{
+    pdf_font_resource();
+    pdf_add_fonts();
+    pdf_page_resource();
+    pdf_xref();
 }
 
 bool pdfPrinter::process_buffer(uint8_t n, uint8_t aux1, uint8_t aux2)
@@ -321,6 +375,8 @@ bool pdfPrinter::process_buffer(uint8_t n, uint8_t aux1, uint8_t aux2)
      *          CR/EOL when rise/=0. simply put "0 Ts" in the stream.
      *
      */
+    std::lock_guard<std::mutex> lock(_pdf_mutex);
+
     int i = 0;
     uint16_t c;
     uint16_t cc;
@@ -403,11 +459,14 @@ bool pdfPrinter::process_buffer(uint8_t n, uint8_t aux1, uint8_t aux2)
         pdf_end_page();
 #endif // BUILD_APPLE
 
+    pdf_flush();
     return true;
 }
 
 void pdfPrinter::pre_close_file()
 {
+    std::lock_guard<std::mutex> lock(_pdf_mutex);
+
     if (TOPflag && pdf_pageCounter == 0)
         pdf_new_page(); // make a blank page
     if (!BOLflag)
@@ -415,10 +474,59 @@ void pdfPrinter::pre_close_file()
     if (!TOPflag || pdf_pageCounter == 0)
         pdf_end_page();
 
-    pdf_font_resource();
-    pdf_add_fonts();
-    pdf_page_resource();
-    pdf_xref();
+    pdf_trailer();
+    pdf_flush();
 
     // printer_emu::pageEject();
 }
+
+// Serve the pages written so far followed by a closed copy of the page in
+// progress and the document trailer. The printer state is left untouched so
+// printing can continue afterwards.
+bool pdfPrinter::snapshotOutput(const std::function<bool(const uint8_t *, size_t)> &sink)
+{
+    std::lock_guard<std::mutex> lock(_pdf_mutex);
+
+    if (!printer_emu::snapshotOutput(sink))
+        return false;
+
+    int objCtr = pdf_objCtr;
+    int pageCounter = pdf_pageCounter;
+    std::vector<size_t> locations = objLocations;
+    std::vector<int> pages = pageObjects;
+    bool streamOpen = _stream_open;
+    size_t written = _pdf_written;
+    std::string outBuf = _out_buf;
+    size_t pageStreamLen = _page_stream.size();
+
+    _snapshot_sink = &sink;
+    _snapshot_ok = true;
+
+    // anything not yet flushed to the file
+    pdf_flush();
+
+    if (_stream_open)
+    {
+        if (!BOLflag)
+            pdf_printf(")]TJ\n");
+        pdf_printf("ET\n");
+        pdf_write_stream();
+        pdf_pageCounter++;
+    }
+    pdf_trailer();
+    pdf_flush();
+
+    bool ok = _snapshot_ok;
+    _snapshot_sink = nullptr;
+
+    pdf_objCtr = objCtr;
+    pdf_pageCounter = pageCounter;
+    objLocations = locations;
+    pageObjects = pages;
+    _stream_open = streamOpen;
+    _page_stream.resize(pageStreamLen);
+    _out_buf = outBuf;
+    _pdf_written = written;
+
+    return ok;
+}
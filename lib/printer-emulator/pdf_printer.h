@@ -5,6 +5,8 @@
  inherited from by other, full-fledged printer classes (e.g. Atari 820/822)
 */
 #include <string>
+#include <vector>
+#include <mutex>
 
 #include "../../include/atascii.h"
 
@@ -12,6 +14,7 @@
 
 
 #define MAXFONTS 33 // maximum number of fonts can use
+#define PDF_WRITE_BUF_SIZE 4096 // output is collected in memory and written to the file in blocks of this size
 
 enum class colorMode_t
 {
@@ -47,11 +50,32 @@ protected:
     bool textMode = true;
     colorMode_t colorMode = colorMode_t::off;
 
-    int pageObjects[256];
+    std::vector<int> pageObjects;
     int pdf_pageCounter = 0.;
-    size_t objLocations[256]; // reference table storage
+    std::vector<size_t> objLocations; // reference table storage
     int pdf_objCtr = 0;       // count the objects
 
+    // Buffered output. Printer emulators write through pdf_printf/pdf_putc/pdf_write;
+    // page content goes to _page_stream until the page is closed, everything else
+    // goes to _out_buf which is written to the file in PDF_WRITE_BUF_SIZE blocks.
+    std::string _out_buf;
+    std::string _page_stream;
+    bool _stream_open = false;
+    int _stream_obj = 0;          // object number of the open content stream
+    size_t _pdf_written = 0;      // bytes of the document already written to the file
+    std::mutex _pdf_mutex;        // serializes printing against snapshotOutput()
+    const std::function<bool(const uint8_t *, size_t)> *_snapshot_sink = nullptr;
+    bool _snapshot_ok = true;
+
+    void pdf_printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+    void pdf_putc(uint8_t c) { pdf_write(&c, 1); };
+    void pdf_write(const void *buf, size_t len);
+    size_t pdf_tell() { return _pdf_written + _out_buf.size(); };
+    void pdf_mark_obj(int obj);
+    void pdf_flush();
+    void pdf_write_stream();
+    void pdf_trailer();
+
     void pdf_header();
     void pdf_add_fonts(); // pdfFont_t *fonts[],
     void pdf_new_page();
@@ -64,10 +88,6 @@ protected:
     void pdf_font_resource();
     void pdf_xref();
 
-    size_t idx_stream_length = 0; // file location of stream length indictor
-    size_t idx_stream_start = 0;  // file location of start of stream
-    size_t idx_stream_stop = 0;   // file location of end of stream
-
     virtual void pdf_clear_modes() = 0;
     virtual void pdf_handle_char(uint16_t c, uint8_t aux1, uint8_t aux2) = 0;
     virtual bool process_buffer(uint8_t linelen, uint8_t aux1, uint8_t aux2) override;
@@ -77,7 +97,9 @@ protected:
 public:
 
     // virtual const char *modelname(void) = 0;
-    pdfPrinter() { _paper_type = PDF; };
+    pdfPrinter() { _paper_type = PDF; _out_buf.reserve(PDF_WRITE_BUF_SIZE); };
+
+    virtual bool snapshotOutput(const std::function<bool(const uint8_t *, size_t)> &sink) override;
 
 };
 
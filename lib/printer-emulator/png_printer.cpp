@@ -1,11 +1,25 @@
 #include "png_printer.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "../../include/debug.h"
 
 
 // rewrite of TinyPngOut https://www.nayuki.io/page/tiny-png-output
 
-#define DEFLATE_MAX_BLOCK_SIZE 0xFFFF
+// DEFLATE length codes 257..285 (RFC 1951 3.2.5)
+static const uint16_t deflate_len_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t deflate_len_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+#define ADLER_MOD 65521
+#define ADLER_NMAX 5552 // largest n such that 255n(n+1)/2 + (n+1)(ADLER_MOD-1) fits in 32 bits
 
 void pngPrinter::uint32_to_array(uint32_t src, uint8_t dest[4])
 {
@@ -15,69 +29,62 @@ void pngPrinter::uint32_to_array(uint32_t src, uint8_t dest[4])
     dest[3] = (uint8_t)(src & 0xff);
 }
 
-uint32_t pngPrinter::update_adler32(uint32_t adler, uint8_t data)
+void pngPrinter::update_adler32(const uint8_t *buf, size_t len)
 {
     // https://gist.github.com/kornelski/710db9d30a64db0807c5bfbdbdecf85e
-    unsigned s1 = adler & 0xffff;
-    unsigned s2 = (adler >> 16) & 0xffff;
-
-    s1 += data;
-    s1 %= 65521;
-
-    s2 += s1;
-    s2 %= 65521;
-
-    return (s2 << 16) | s1;
+    // modulo is deferred until the sums could overflow
+    while (len > 0)
+    {
+        size_t n = (len < ADLER_NMAX) ? len : ADLER_NMAX;
+        len -= n;
+        while (n--)
+        {
+            adler_s1 += *buf++;
+            adler_s2 += adler_s1;
+        }
+        adler_s1 %= ADLER_MOD;
+        adler_s2 %= ADLER_MOD;
+    }
 }
 
 uint32_t pngPrinter::rc_crc32(uint32_t crc, const uint8_t *buf, size_t len)
-// https://rosettacode.org/wiki/CRC-32#Implementation_2
+// slice-by-8 CRC-32 https://create.stephan-brumme.com/crc32/#slicing-by-8-overview
 {
-    static uint32_t table[256];
+    static uint32_t table[8][256];
     static int have_table = 0;
-    uint32_t rem;
-    uint8_t octet;
-    int i, j;
-    const uint8_t *p, *q;
 
     /* This check is not thread safe; there is no mutex. */
     if (have_table == 0)
     {
-        /* Calculate CRC table. */
-        for (i = 0; i < 256; i++)
+        /* Calculate CRC tables. */
+        for (int i = 0; i < 256; i++)
         {
-            rem = i; /* remainder from polynomial division */
-            for (j = 0; j < 8; j++)
-            {
-                if (rem & 1)
-                {
-                    rem >>= 1;
-                    rem ^= 0xedb88320;
-                }
-                else
-                    rem >>= 1;
-            }
-            table[i] = rem;
+            uint32_t rem = i; /* remainder from polynomial division */
+            for (int j = 0; j < 8; j++)
+                rem = (rem & 1) ? (rem >> 1) ^ 0xedb88320 : (rem >> 1);
+            table[0][i] = rem;
         }
+        for (int i = 0; i < 256; i++)
+            for (int s = 1; s < 8; s++)
+                table[s][i] = (table[s - 1][i] >> 8) ^ table[0][table[s - 1][i] & 0xff];
         have_table = 1;
     }
 
     crc = ~crc;
-    q = buf + len;
-    for (p = buf; p < q; p++)
+    while (len >= 8)
     {
-        octet = *p; /* Cast to unsigned octet. */
-        crc = (crc >> 8) ^ table[(crc & 0xff) ^ octet];
+        uint32_t one = crc ^ ((uint32_t)buf[0] | ((uint32_t)buf[1] << 8) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24));
+        uint32_t two = (uint32_t)buf[4] | ((uint32_t)buf[5] << 8) | ((uint32_t)buf[6] << 16) | ((uint32_t)buf[7] << 24);
+        crc = table[7][one & 0xff] ^ table[6][(one >> 8) & 0xff] ^ table[5][(one >> 16) & 0xff] ^ table[4][one >> 24] ^
+              table[3][two & 0xff] ^ table[2][(two >> 8) & 0xff] ^ table[1][(two >> 16) & 0xff] ^ table[0][two >> 24];
+        buf += 8;
+        len -= 8;
     }
+    while (len--)
+        crc = (crc >> 8) ^ table[0][(crc & 0xff) ^ *buf++];
     return ~crc;
 }
 
-// uint32_t pngPrinter::rc_crc32(uint32_t crc, uint8_t c)
-// // pass a single character
-// {
-//     rc_crc32(crc, &c, 1);
-// }
-
 void pngPrinter::png_signature()
 {
     Debug_println("Writing PNG Signature.");
@@ -111,7 +118,7 @@ void pngPrinter::png_header()
         0x08,                   // 16       1 byte depth
         0x03,                   // 17       0x03 color with palette
         0x00,                   // 18       compression method always 0
-        0x00,                   // 19       no filter
+        0x00,                   // 19       filter method 0 (adaptive, per scanline)
         0x00,                   // 20       no interlace
         0, 0, 0, 0,             // 21-24    IHDR CRC-32 placeholder
     };
@@ -126,7 +133,7 @@ void pngPrinter::png_header()
         chunk type code and chunk data fields, but 
         not including the length field.
     */
-    crc_value = rc_crc32(0, &header[4], 17);
+    uint32_t crc_value = rc_crc32(0, &header[4], 17);
     uint32_to_array(crc_value, &header[21]);
     fwrite(header, 1, 25, _file);
 }
@@ -189,7 +196,7 @@ void pngPrinter::png_palette()
     uint8_t ccc[] = {0, 0, 0, 0}; // crc placeholder
 
     uint32_to_array(768, &len[0]);
-    crc_value = rc_crc32(0, &data[0], 4 + 768);
+    uint32_t crc_value = rc_crc32(0, &data[0], 4 + 768);
     uint32_to_array(crc_value, &ccc[0]);
 
     fwrite(len, 1, 4, _file);
@@ -219,141 +226,233 @@ void pngPrinter::png_data()
     significance and can occur at any point in the compressed datastream
 */
     Debug_println("Starting PNG Image Data...");
-    uint8_t data[] = {
-        // IDAT chunk
-        0x00, 0x00, 0x00, 0x00, // 0-3      size placeholder
+
+    // Deflate-compressed datastreams within PNG are stored in the “zlib” format
+    // https://tools.ietf.org/html/rfc1950#page-4
+    // Compression method/flags code: 1 byte (For PNG compression method 0, the zlib compression method/flags code must specify method code 8 (“deflate” compression))
+    deflate_put_byte(0x08); // ZLIB "Deflate" compression scheme, 256 byte window (only distance 1 is used)
+    //  Additional flags/check bits: 1 byte (must be such that method + flags, when viewed as a 16-bit unsigned integer stored in MSB order (CMF*256 + FLG), is a multiple of 31.)
+    deflate_put_byte(0x1D); // precompute so that 0x081D is divisible by 31 [ (0x800 / 31 + 1) * 31 - 0x800 ]
+
+    // One fixed Huffman block holds the whole image: BFINAL = 1, BTYPE = 01
+    deflate_put_bits(1, 1);
+    deflate_put_bits(1, 2);
+}
+
+// Append a byte to the IDAT buffer, writing a chunk out when it fills
+void pngPrinter::deflate_put_byte(uint8_t c)
+{
+    idat_buf[idat_len++] = c;
+    if (idat_len == PNG_IDAT_CHUNK_SIZE)
+        png_idat_flush();
+}
+
+// Write the buffered compressed data as one IDAT chunk
+void pngPrinter::png_idat_flush()
+{
+    if (idat_len == 0)
+        return;
+
+    uint8_t head[] = {
+        0x00, 0x00, 0x00, 0x00, // 0-3      size
         'I', 'D', 'A', 'T',     // 4-7      IDAT
     };
-    crc_value = rc_crc32(0, &data[4], 4); // begin CRC calculation
-
-    // Compute data size
-    // imgSize = (width + 1) * height; // +1 per line for filter 0's
-    uint32_t numBlocks = imgSize / DEFLATE_MAX_BLOCK_SIZE;
-    if (imgSize % DEFLATE_MAX_BLOCK_SIZE != 0)
-        numBlocks++; // Round up
+    uint8_t ccc[] = {0, 0, 0, 0};
 
-    dataSize += numBlocks * 5; // 5 bytes per DEFLATE uncompressed block header
-    dataSize += 2;             // 2 bytes for zlib header
-    dataSize += 4;             // 4 bytes for zlib Adler-32 checksum
-    dataSize += imgSize;       // plus the image data
+    uint32_to_array(idat_len, &head[0]);
+    uint32_t crc = rc_crc32(0, &head[4], 4);
+    crc = rc_crc32(crc, idat_buf, idat_len);
+    uint32_to_array(crc, &ccc[0]);
 
-    uint32_to_array(dataSize, &data[0]); // store the computed size
+    fwrite(head, 1, 8, _file);
+    fwrite(idat_buf, 1, idat_len, _file);
+    fwrite(ccc, 1, 4, _file);
 
-    fwrite(data, 1, 8, _file); // write out the IDAT header
+    idat_total += idat_len;
+    idat_len = 0;
 }
 
-void pngPrinter::png_add_data(uint8_t *buf, uint32_t n)
+// DEFLATE packs data elements starting with the least significant bit
+void pngPrinter::deflate_put_bits(uint32_t bits, uint8_t n)
 {
-    uint8_t c = 0;
-    // Deflate-compressed datastreams within PNG are stored in the “zlib” format
-    // https://tools.ietf.org/html/rfc1950#page-4
+    bit_buf |= bits << bit_cnt;
+    bit_cnt += n;
+    while (bit_cnt >= 8)
+    {
+        deflate_put_byte((uint8_t)bit_buf);
+        bit_buf >>= 8;
+        bit_cnt -= 8;
+    }
+}
 
-    if (img_pos == 0)
+// Huffman codes are packed starting with the most significant bit
+void pngPrinter::deflate_put_huff(uint32_t code, uint8_t n)
+{
+    uint32_t rev = 0;
+    for (uint8_t i = 0; i < n; i++)
     {
-        Debug_println("Writing ZLIB header.");
-        // write out a ZLIB header
-        // Compression method/flags code: 1 byte (For PNG compression method 0, the zlib compression method/flags code must specify method code 8 (“deflate” compression))
-        c = 0x08; // ZLIB "Deflate" compression scheme
-        crc_value = rc_crc32(crc_value, c);
-        fputc(c, _file);
-        //  Additional flags/check bits: 1 byte (must be such that method + flags, when viewed as a 16-bit unsigned integer stored in MSB order (CMF*256 + FLG), is a multiple of 31.)
-        c = 0x1D; // precompute so that 0x081D is divisible by 31 [ (0x800 / 31 + 1) * 31 - 0x800 ]
-        crc_value = rc_crc32(crc_value, c);
-        fputc(c, _file);
-
-        //printf("new image\r\n");
+        rev = (rev << 1) | (code & 1);
+        code >>= 1;
     }
+    deflate_put_bits(rev, n);
+}
 
-    uint32_t idx = 0;
-    while (idx < n)
+// Fixed Huffman literal/length alphabet (RFC 1951 3.2.6)
+void pngPrinter::deflate_symbol(uint16_t sym)
+{
+    if (sym < 144)
+        deflate_put_huff(0x30 + sym, 8);
+    else if (sym < 256)
+        deflate_put_huff(0x190 + sym - 144, 9);
+    else if (sym < 280)
+        deflate_put_huff(sym - 256, 7);
+    else
+        deflate_put_huff(0xC0 + sym - 280, 8);
+}
+
+// Emit the pending repeats of the last literal as a distance 1 match
+void pngPrinter::deflate_flush_run()
+{
+    if (run_len < DEFLATE_MIN_MATCH)
     {
-        // at beginning of block?
-        if (blk_pos == 0)
+        while (run_len > 0)
         {
-            blkSize = DEFLATE_MAX_BLOCK_SIZE;
-            uint8_t c = 0;
-            if (imgSize - img_pos <= (uint32_t)blkSize)
-            {
-                c = 1; // final block
-                blkSize = (uint16_t)(imgSize - img_pos);
-            }
-
-            Debug_println("Writing ZLIB block header.");
-            // write out block header
-            crc_value = rc_crc32(crc_value, c);
-            fputc(c, _file);
-
-            // write out block size
-            c = (uint8_t)(blkSize >> 0);
-            crc_value = rc_crc32(crc_value, c);
-            fputc(c, _file);
-            c = (uint8_t)(blkSize >> 8);
-            crc_value = rc_crc32(crc_value, c);
-            fputc(c, _file);
-            c = (uint8_t)((blkSize >> 0) ^ 0xFF);
-            crc_value = rc_crc32(crc_value, c);
-            fputc(c, _file);
-            c = (uint8_t)((blkSize >> 8) ^ 0xFF);
-            crc_value = rc_crc32(crc_value, c);
-            fputc(c, _file);
-
-            //printf("new block\r\n");
+            deflate_symbol((uint8_t)run_byte);
+            run_len--;
         }
+        return;
+    }
 
-        //at beginning of a line?
-        if (Xpos == 0)
+    uint8_t i = 28;
+    while (deflate_len_base[i] > run_len)
+        i--;
+    deflate_symbol(257 + i);
+    if (deflate_len_extra[i])
+        deflate_put_bits(run_len - deflate_len_base[i], deflate_len_extra[i]);
+    deflate_put_huff(0, 5); // distance code 0 = distance 1
+    run_len = 0;
+}
+
+void pngPrinter::deflate_data(const uint8_t *buf, size_t len)
+{
+    update_adler32(buf, len);
+    for (size_t i = 0; i < len; i++)
+    {
+        if (buf[i] == run_byte)
+        {
+            if (++run_len == DEFLATE_MAX_MATCH)
+                deflate_flush_run();
+        }
+        else
         {
-            Debug_printf("Starting PNG line %d ... ",Ypos);
-            c = 0;
-            crc_value = rc_crc32(crc_value, c);
-            adler_value = update_adler32(adler_value, c);
-            fputc(c, _file);
-            //printf("\nnew line %d ", c);
-
-            img_pos++;
-            blk_pos++;
+            deflate_flush_run();
+            deflate_symbol(buf[i]);
+            run_byte = buf[i];
         }
+    }
+}
+
+void pngPrinter::deflate_finish()
+{
+    Debug_println("Writing ZLIB Adler checksum.");
+    deflate_flush_run();
+    deflate_symbol(256); // end of block
+    if (bit_cnt > 0)
+        deflate_put_bits(0, 8 - bit_cnt); // pad to a byte boundary
+
+    uint8_t data[] = {0, 0, 0, 0}; // Adler32 Check value: 4 bytes
+    uint32_to_array((adler_s2 << 16) | adler_s1, &data[0]);
+    for (int i = 0; i < 4; i++)
+        deflate_put_byte(data[i]);
+    png_idat_flush();
+}
+
+// Choose a filter for the assembled scanline using the minimum sum of absolute
+// differences heuristic (https://www.w3.org/TR/PNG/#12Filter-selection)
+void pngPrinter::png_filter_line()
+{
+    uint32_t score[5] = {0, 0, 0, 0, 0};
+    for (uint32_t x = 0; x < width; x++)
+    {
+        uint8_t a = (x > 0) ? cur_line[x - 1] : 0;
+        uint8_t b = prev_line[x];
+        uint8_t c = (x > 0) ? prev_line[x - 1] : 0;
+        int p = a + b - c;
+        int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+        uint8_t paeth = (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+
+        score[0] += abs((int8_t)cur_line[x]);
+        score[1] += abs((int8_t)(cur_line[x] - a));
+        score[2] += abs((int8_t)(cur_line[x] - b));
+        score[3] += abs((int8_t)(cur_line[x] - ((a + b) >> 1)));
+        score[4] += abs((int8_t)(cur_line[x] - paeth));
+    }
 
-        // put byte from buffer
-        c = buf[idx];
-        crc_value = rc_crc32(crc_value, c);
-        adler_value = update_adler32(adler_value, c);
-        fputc(c, _file);
-        //printf("%d ", c);
+    uint8_t type = 0;
+    for (uint8_t i = 1; i < 5; i++)
+        if (score[i] < score[type])
+            type = i;
 
-        Xpos++;
-        idx++;
-        img_pos++;
-        blk_pos++;
+    filt_line[0] = type;
+    for (uint32_t x = 0; x < width; x++)
+    {
+        uint8_t a = (x > 0) ? cur_line[x - 1] : 0;
+        uint8_t b = prev_line[x];
+        uint8_t c = (x > 0) ? prev_line[x - 1] : 0;
+        uint8_t pred = 0;
+        switch (type)
+        {
+        case 1:
+            pred = a;
+            break;
+        case 2:
+            pred = b;
+            break;
+        case 3:
+            pred = (a + b) >> 1;
+            break;
+        case 4:
+        {
+            int p = a + b - c;
+            int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+            pred = (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+            break;
+        }
+        }
+        filt_line[x + 1] = cur_line[x] - pred;
+    }
+    memcpy(prev_line, cur_line, width);
+}
 
-        // check for end of's
+void pngPrinter::png_add_data(uint8_t *buf, uint32_t n)
+{
+    uint32_t idx = 0;
+    while (idx < n && img_pos < imgSize)
+    {
+        uint32_t count = width - Xpos;
+        if (count > n - idx)
+            count = n - idx;
+        memcpy(&cur_line[Xpos], &buf[idx], count);
+        Xpos += count;
+        idx += count;
+
+        // check for end of line
         if (Xpos == width)
         {
-            Debug_println("Finished PNG line.");
+            png_filter_line();
+            deflate_data(filt_line, width + 1);
+            img_pos += width + 1;
             Xpos = 0;
             Ypos++;
-        }
-        if (blk_pos == blkSize)
-        {
-            Debug_println("End of ZLIB block.");
-            blk_pos = 0;
+
+            if (img_pos == imgSize)
+            {
+                deflate_finish();
+                png_end();
+                Debug_printf("PNG image complete: %lu bytes compressed from %lu\r\n", (unsigned long)idat_total, (unsigned long)imgSize);
+            }
         }
     };
-
-    if (img_pos == imgSize)
-    {
-        Debug_println("Writing ZLIB Adler checksum and PNG data CRC.");
-        uint8_t data[] = {
-            0, 0, 0, 0, // Adler32 Check value: 4 bytes
-            0, 0, 0, 0  // CRC32: 4 bytes
-        };
-        uint32_to_array(adler_value, &data[0]);
-        for (int i = 0; i < 4; i++)
-            crc_value = rc_crc32(crc_value, data[i]); // crc_value = rc_crc32(crc_value, data[0],4); ?????????
-        uint32_to_array(crc_value, &data[4]);
-        fwrite(data, 1, 8, _file);
-        png_end();
-    }
 }
 
 void pngPrinter::png_end()
@@ -366,19 +465,41 @@ void pngPrinter::png_end()
     fwrite(end, 1, 12, _file);
 }
 
-// TODO: Anything here?
 void pngPrinter::pre_close_file()
 {
-
+    // The compressed stream only becomes valid once every scanline has been
+    // sent, so blank out the rest of the page if the print job ended early
+    if (img_pos < imgSize && _file != nullptr)
+    {
+        Debug_printf("Padding PNG from line %d\r\n", Ypos);
+        memset(line_buffer, 0, width);
+        while (img_pos < imgSize)
+            png_add_data(line_buffer, width);
+    }
 }
 
 void pngPrinter::post_new_file()
 {
+    img_pos = 0;
+    Xpos = 0;
+    Ypos = 0;
+    adler_s1 = 1;
+    adler_s2 = 0;
+    bit_buf = 0;
+    bit_cnt = 0;
+    run_byte = -1;
+    run_len = 0;
+    idat_len = 0;
+    idat_total = 0;
+    BOLflag = true;
+    line_index = 0;
+    memset(prev_line, 0, sizeof(prev_line));
+
     // call PNG header routines
     png_signature();
     png_header();
     png_palette();
-    // start IDAT chunk and now ready for data
+    // start IDAT stream and now ready for data
     png_data();
 }
 
@@ -413,4 +534,3 @@ bool pngPrinter::process_buffer(uint8_t n, uint8_t aux1, uint8_t aux2)
     }
     return true;
 }
-
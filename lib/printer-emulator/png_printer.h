@@ -5,11 +5,15 @@
 
 #include "printer_emulator.h"
 
-#define DEFLATE_MAX_BLOCK_SIZE 0xFFFF
+// Compressed bytes held in memory before they are written out as one IDAT chunk
+#define PNG_IDAT_CHUNK_SIZE 2048
 
 class pngPrinter : public printer_emu
 {
     // complete rewrite of TinyPngOut https://www.nayuki.io/page/tiny-png-output
+    // The image data is filtered per scanline and compressed with a single
+    // fixed-Huffman DEFLATE block using run-length (distance 1) matches.
+    // Only the previous and current scanline plus one IDAT chunk are held in memory.
 protected:
     const uint32_t width = 320;
     const uint32_t height = 192;
@@ -18,11 +22,8 @@ protected:
     uint32_t img_pos = 0;                    // serial position within image data including BOL filter p's
     uint16_t Xpos = 0;                       // current position within image line
     uint16_t Ypos = 0;                       // current image line number
-    uint32_t dataSize = 0;                   // size of data for IDAT chunk
-    uint16_t blkSize = 0;                    // size of zlib block
-    uint16_t blk_pos = 0;                    // serial position within zlib block
-    uint32_t crc_value = 0;                  // running crc32 value
-    uint32_t adler_value = 1;                // running checksum (initilize to 1 https://en.wikipedia.org/wiki/Adler-32)
+    uint32_t adler_s1 = 1;                   // running Adler-32 sums (s1 starts at 1 https://en.wikipedia.org/wiki/Adler-32)
+    uint32_t adler_s2 = 0;
 
     uint8_t line_buffer[320];
 
@@ -30,10 +31,25 @@ protected:
     uint16_t line_index = 0;
     uint8_t rep_code = 0;
 
+    // scanline filtering
+    uint8_t cur_line[320];                   // unfiltered scanline being assembled
+    uint8_t prev_line[320];                  // previous unfiltered scanline (zero before the first line)
+    uint8_t filt_line[321];                  // filter type byte + filtered scanline
+
+    // deflate (fixed Huffman + RLE) state
+    uint32_t bit_buf = 0;                    // pending output bits, LSB first
+    uint8_t bit_cnt = 0;
+    int16_t run_byte = -1;                   // last literal emitted, -1 at start of stream
+    uint16_t run_len = 0;                    // pending repeats of run_byte
+
+    // IDAT chunk output buffer
+    uint8_t idat_buf[PNG_IDAT_CHUNK_SIZE];
+    uint16_t idat_len = 0;
+    uint32_t idat_total = 0;                 // total compressed bytes written (for stats)
+
     void uint32_to_array(uint32_t src, uint8_t dest[4]);
-    uint32_t update_adler32(uint32_t adler, uint8_t data);
-    uint32_t rc_crc32(uint32_t crc, const uint8_t *buf, size_t len);
-    uint32_t rc_crc32(uint32_t crc, uint8_t c) { return rc_crc32(crc, &c, 1); }
+    void update_adler32(const uint8_t *buf, size_t len);
+    static uint32_t rc_crc32(uint32_t crc, const uint8_t *buf, size_t len);
 
     void png_signature();
     void png_header();
@@ -42,13 +58,23 @@ protected:
     void png_add_data(uint8_t *buf, uint32_t n);
     void png_end();
 
+    void png_filter_line();
+    void png_idat_flush();
+    void deflate_put_byte(uint8_t c);
+    void deflate_put_bits(uint32_t bits, uint8_t n);
+    void deflate_put_huff(uint32_t code, uint8_t n);
+    void deflate_symbol(uint16_t sym);
+    void deflate_flush_run();
+    void deflate_data(const uint8_t *buf, size_t len);
+    void deflate_finish();
+
     virtual void post_new_file() override;
     virtual void pre_close_file() override;
     virtual bool process_buffer(uint8_t linelen, uint8_t aux1, uint8_t aux2) override;
 public:
     pngPrinter() { _paper_type = PNG;};
-    const char *modelname()  override 
-    { 
+    const char *modelname()  override
+    {
         #ifdef BUILD_ATARI
             return sioPrinter::printer_model_str[sioPrinter::PRINTER_PNG];
         #elif BUILD_CBM
@@ -4,8 +4,6 @@
 
 #include "fsFlash.h"
 
-#define PRINTER_OUTFILE "/paper"
-
 // initialzie printer by creating an output file
 void printer_emu::initPrinter(FileSystem *fs)
 {
@@ -66,6 +64,30 @@ size_t printer_emu::getOutputSize()
     return result == -1 ? 0 : result;
 }
 
+bool printer_emu::snapshotOutput(const std::function<bool(const uint8_t *, size_t)> &sink)
+{
+    if (_output_started == false)
+        return false;
+
+    FILE *f = _FS->file_open(PRINTER_OUTFILE);
+    if (f == nullptr)
+        return false;
+
+    uint8_t *buf = (uint8_t *)malloc(PRINTER_FILE_COPY_BUFLEN);
+    size_t count = 0;
+    bool ok = true;
+    do
+    {
+        count = fread(buf, 1, PRINTER_FILE_COPY_BUFLEN, f);
+        if (count > 0)
+            ok = sink(buf, count);
+    } while (ok && count > 0);
+    fclose(f);
+    free(buf);
+
+    return ok;
+}
+
 // All the work is done here in the derived classes. Open and close the output file before proceeding
 bool printer_emu::process(uint8_t linelen, uint8_t aux1, uint8_t aux2)
 {
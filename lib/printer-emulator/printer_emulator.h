@@ -3,8 +3,12 @@
 
 //#include "../../include/atascii.h"
 
+#include <functional>
+
 #include "fnFsSD.h"
 
+#define PRINTER_OUTFILE "/paper"
+
 // TODO: Combine html_printer.cpp/h and file_printer.cpp/h
 
 // I think the way we're using this value is as a switch to tell the printer
@@ -75,6 +79,9 @@ public:
     virtual const char *modelname()=0;
     size_t getOutputSize();
 
+    // Feed a readable copy of the output so far to sink without ending the print job
+    virtual bool snapshotOutput(const std::function<bool(const uint8_t *, size_t)> &sink);
+
     void setEOLBypass(bool t) { _eol_bypass = t; };
 
     bool getEOLBypass() { return _eol_bypass; }
@@ -28,8 +28,11 @@
 // using namespace std;
 
 #ifdef ESP_PLATFORM // OS
-QueueHandle_t rxq;
-QueueHandle_t txq;
+#include <freertos/FreeRTOS.h>
+#include <freertos/stream_buffer.h>
+
+StreamBufferHandle_t rxbuf; // console output, on its way to the computer
+StreamBufferHandle_t txbuf; // keyboard input from the computer
 #endif
 
 typedef struct
@@ -105,6 +108,113 @@ uint32 _HardwareIn(const uint32 Port) {
 	return 0;
 }
 
+/* Disk cache */
+/*===============================================================================*/
+// BDOS moves one 128 byte record per call. The file last used stays open and
+// reads come out of a block read ahead of them, so the SD card sees one fread
+// per CPM_CACHE_SIZE bytes instead of an open/seek/read/close per record.
+// Writes go straight to the open file, which is closed (and flushed) when
+// another file is used, before anything looks at it by name, and whenever the
+// console waits for a key.
+#define CPM_CACHE_SIZE 4096
+
+struct
+{
+	char path[128];
+	FILE *f;
+	bool writable;
+	long start;			// file offset of data[0]
+	size_t len;			// bytes valid in data
+	uint8_t *data;
+} diskCache = {"", nullptr, false, 0, 0, nullptr};
+
+void _cache_close(void)
+{
+	if (diskCache.f)
+		fclose(diskCache.f);
+	diskCache.f = nullptr;
+	diskCache.path[0] = 0;
+	diskCache.start = 0;
+	diskCache.len = 0;
+}
+
+FILE *_cache_open(char *path, bool writable)
+{
+	if (diskCache.f && strcmp(diskCache.path, path) == 0 && (diskCache.writable || !writable))
+		return diskCache.f;
+
+	_cache_close();
+
+	// Tried again on every open, without it records are read one by one
+	if (diskCache.data == nullptr)
+		diskCache.data = (uint8_t *)malloc(CPM_CACHE_SIZE);
+
+	diskCache.f = fnSDFAT.file_open(path, writable ? "r+" : "r");
+	if (diskCache.f == nullptr && writable && !fnSDFAT.exists(path))
+		diskCache.f = fnSDFAT.file_open(path, "w+");
+	if (diskCache.f == nullptr)
+		return nullptr;
+
+	strlcpy(diskCache.path, path, sizeof(diskCache.path));
+	diskCache.writable = writable;
+	return diskCache.f;
+}
+
+// Copy the record at fpos to DMA, padded with ^Z. Returns the bytes read, -1 if fpos can't be reached.
+int _cache_read(FILE *f, long fpos)
+{
+	// No memory for the block, read the record on its own
+	if (diskCache.data == nullptr)
+	{
+		uint8_t record[BlkSZ];
+		if (fseek(f, fpos, SEEK_SET) != 0)
+			return -1;
+		int n = fread(record, 1, BlkSZ, f);
+		if (n)
+		{
+			memset(_RamSysAddr(dmaAddr), 0x1a, BlkSZ);
+			memcpy(_RamSysAddr(dmaAddr), record, n);
+		}
+		return n;
+	}
+
+	if (fpos < diskCache.start || fpos + BlkSZ > diskCache.start + (long)diskCache.len)
+	{
+		if (fseek(f, fpos, SEEK_SET) != 0)
+			return -1;
+		diskCache.start = fpos;
+		diskCache.len = fread(diskCache.data, 1, CPM_CACHE_SIZE, f);
+	}
+
+	long avail = diskCache.start + (long)diskCache.len - fpos;
+	int n = avail < BlkSZ ? (avail > 0 ? avail : 0) : BlkSZ;
+	if (n)
+	{
+		memset(_RamSysAddr(dmaAddr), 0x1a, BlkSZ);
+		memcpy(_RamSysAddr(dmaAddr), diskCache.data + (fpos - diskCache.start), n);
+	}
+	return n;
+}
+
+// Write the DMA record at fpos. Returns the bytes written, -1 if fpos can't be reached.
+int _cache_write(FILE *f, long fpos)
+{
+	if (fseek(f, fpos, SEEK_SET) != 0)
+		return -1;
+
+	uint8_t *src = _RamSysAddr(dmaAddr);
+	int n = fwrite(src, 1, BlkSZ, f);
+
+	// Keep the read block in step with the file
+	for (int i = 0; i < n; i++)
+	{
+		long pos = fpos + i;
+		if (pos >= diskCache.start && pos < diskCache.start + (long)diskCache.len)
+			diskCache.data[pos - diskCache.start] = src[i];
+	}
+	return n;
+}
+
 /* filesystem (disk) abstraction fuctions */
 /*===============================================================================*/
 FILE *rootdir;
@@ -138,6 +248,7 @@ int _sys_select(uint8_t *disk)
 long _sys_filesize(uint8_t *fn)
 {
 	unsigned long fs = -1;
+	_cache_close();
 	FILE *fp = fnSDFAT.file_open(full_path((char *)fn), "r");
 
 	if (fp)
@@ -164,6 +275,7 @@ int _sys_openfile(uint8_t *fn)
 
 int _sys_makefile(uint8_t *fn)
 {
+	_cache_close();
 	FILE *fp = fnSDFAT.file_open(full_path((char *)fn), "w");
 	if (fp)
 	{
@@ -176,6 +288,7 @@ int _sys_makefile(uint8_t *fn)
 
 int _sys_deletefile(uint8_t *fn)
 {
+	_cache_close();
 	return fnSDFAT.remove(full_path((char *)fn));
 }
 
@@ -183,6 +296,7 @@ int _sys_renamefile(uint8_t *fn, uint8_t *newname)
 {
 	std::string from, to;
 
+	_cache_close();
 	from = std::string(full_path((char *)fn));
 	to = std::string(full_path((char *)newname));
 
@@ -194,179 +308,66 @@ void _sys_logbuffer(uint8_t *buffer)
 	// not implemented at present.
 }
 
-bool _sys_extendfile(char *fn, unsigned long fpos)
-{
-	FILE *fp = fnSDFAT.file_open(full_path((char *)fn), "a");
-
-	if (!fp)
-		return false;
-
-	long origSize = fnSDFAT.filesize(full_path(fn));
-
-	// This was patterned after the arduino abstraction, and I do not like how this works.
-
-	if (fpos > origSize)
-	{
-		for (long i = 0; i < (origSize - fpos); ++i)
-		{
-			if (fwrite("\0", sizeof(uint8_t), 1, fp) != 1)
-			{
-				fclose(fp);
-				return false;
-			}
-		}
-	}
-	fclose(fp);
-	return true;
-}
-
 uint8_t _sys_readseq(uint8_t *fn, long fpos)
 {
-	uint8_t result = 0xff;
-	FILE *f;
-	uint8_t bytesread;
-	uint8_t dmabuf[BlkSZ];
-	int seekErr;
-
-	f = fnSDFAT.file_open(full_path((char *)fn), "r");
+	FILE *f = _cache_open(full_path((char *)fn), false);
 	if (!f)
-	{
-		result = 0x10;
-		return result;
-	}
+		return 0x10;
 
-	seekErr = fseek(f, fpos, SEEK_SET);
-	if (f)
-	{
-		if (fpos > 0 && seekErr != 0)
-		{
-			// EOF
-			result = 0x01;
-		}
-		else
-		{
-			// set DMA buffer to EOF
-			memset(dmabuf, 0x1a, BlkSZ);
-			bytesread = fread(&dmabuf[0], BlkSZ, sizeof(uint8_t), f);
-			if (bytesread)
-				memcpy((uint8_t *)&RAM[dmaAddr], dmabuf, BlkSZ);
-			result = bytesread ? 0x00 : 0x01;
-		}
-	}
-	else
-	{
-		result = 0x10;
-	}
-	fclose(f);
-	return (result);
+	// Nothing there is end of file
+	return _cache_read(f, fpos) > 0 ? 0x00 : 0x01;
 }
 
 uint8_t _sys_writeseq(uint8_t *fn, long fpos)
 {
-	uint8_t result = 0xff;
-	FILE *f;
-
-	if (_sys_extendfile((char *)fn, fpos))
-		f = fnSDFAT.file_open(full_path((char *)fn), "r+");
-	else
-		return result;
+	FILE *f = _cache_open(full_path((char *)fn), true);
+	if (!f)
+		return 0x10;
 
-	if (f)
-	{
-		if (fseek(f, fpos, SEEK_SET) == 0)
-		{
-			if (fwrite(_RamSysAddr(dmaAddr), BlkSZ, sizeof(uint8_t), f))
-				result = 0x00;
-		}
-		else
-		{
-			result = 0x01;
-		}
-	}
-	else
-	{
-		result = 0x10;
-	}
-	fclose(f);
-	return (result);
+	int n = _cache_write(f, fpos);
+	return n == BlkSZ ? 0x00 : (n < 0 ? 0x01 : 0xff);
 }
 
 uint8_t _sys_readrand(uint8_t *fn, long fpos)
 {
-	uint8 result = 0xff;
-	FILE *f;
-	uint8 bytesread;
-	uint8 dmabuf[BlkSZ];
+	uint8 result;
 	long extSize;
 
-	f = fnSDFAT.file_open(full_path((char *)fn), "r+");
-	if (f)
-	{
-		if (fseek(f, fpos, SEEK_SET) == 0)
-		{
-			memset(dmabuf, 0x1A, BlkSZ);
-			bytesread = fread(&dmabuf[0], BlkSZ, sizeof(uint8_t), f);
-			if (bytesread)
-				memcpy((uint8_t *)&RAM[dmaAddr], dmabuf, BlkSZ);
-			result = bytesread ? 0x00 : 0x01;
-		}
-		else
-		{
-			if (fpos >= 65536L * BlkSZ)
-			{
-				result = 0x06; // seek past 8MB (largest file size in CP/M)
-			}
-			else
-			{
-				extSize = _sys_filesize((uint8_t *)full_path((char *)fn));
+	FILE *f = _cache_open(full_path((char *)fn), false);
+	if (!f)
+		return 0x10;
 
-				// round file size up to next full logical extent
-				extSize = ExtSZ * ((extSize / ExtSZ) + ((extSize % ExtSZ) ? 1 : 0));
-				if (fpos < extSize)
-					result = 0x01; // reading unwritten data
-				else
-					result = 0x04; // seek to unwritten extent
-			}
-		}
+	int n = _cache_read(f, fpos);
+	if (n >= 0)
+		return n ? 0x00 : 0x01;
+
+	if (fpos >= 65536L * BlkSZ)
+	{
+		result = 0x06; // seek past 8MB (largest file size in CP/M)
 	}
 	else
 	{
-		result = 0x10;
+		fseek(f, 0, SEEK_END);
+		extSize = ftell(f);
+
+		// round file size up to next full logical extent
+		extSize = ExtSZ * ((extSize / ExtSZ) + ((extSize % ExtSZ) ? 1 : 0));
+		if (fpos < extSize)
+			result = 0x01; // reading unwritten data
+		else
+			result = 0x04; // seek to unwritten extent
 	}
-	fclose(f);
 	return (result);
 }
 
 uint8_t _sys_writerand(uint8_t *fn, long fpos)
 {
-	uint8 result = 0xff;
-	FILE *f;
-
-	if (_sys_extendfile((char *)fn, fpos))
-	{
-		f = fnSDFAT.file_open(full_path((char *)fn), "r+");
-	}
-	else
-		return result;
+	FILE *f = _cache_open(full_path((char *)fn), true);
+	if (!f)
+		return 0x10;
 
-	if (f)
-	{
-		if (fseek(f, fpos, SEEK_SET) == 0)
-		{
-			if (fwrite(_RamSysAddr(dmaAddr), BlkSZ, sizeof(uint8_t), f))
-				result = 0x00;
-		}
-		else
-		{
-			result = 0x06;
-		}
-	}
-	else
-	{
-		result = 0x10;
-	}
-	fclose(f);
-	return (result);
+	int n = _cache_write(f, fpos);
+	return n == BlkSZ ? 0x00 : (n < 0 ? 0x06 : 0xff);
 }
 
 uint8_t findNextDirName[17];
@@ -435,6 +436,7 @@ uint8_t _findfirst(uint8_t isdir)
 	uint8 path[4] = {'?', FOLDERCHAR, '?', 0};
 	path[0] = filename[0];
 	path[2] = filename[2];
+	_cache_close();
 	fnSDFAT.dir_close();
 	fnSDFAT.dir_open(full_path((char *)path), "*", 0);
 	_HostnameToFCBname(filename, pattern);
@@ -461,6 +463,7 @@ uint8_t _findfirstallusers(uint8_t isdir)
 
 uint8_t _Truncate(char *fn, uint8_t rc)
 {
+	_cache_close();
 	// Implement some other way.
 	return 0;
 }
@@ -514,7 +517,7 @@ uint8_t _sys_makedisk(uint8_t drive)
 int _kbhit(void)
 {
 #ifdef ESP_PLATFORM // OS
-	return uxQueueMessagesWaiting(txq);
+	return xStreamBufferBytesAvailable(txbuf);
 #else
 	return 0;
 #endif
@@ -524,7 +527,10 @@ uint8_t _getch(void)
 {
 	uint8_t c;
 #ifdef ESP_PLATFORM // OS
-	xQueueReceive(txq,&c,portMAX_DELAY);
+	// Waiting for the user, a good time to get written data onto the card
+	if (!xStreamBufferBytesAvailable(txbuf))
+		_cache_close();
+	xStreamBufferReceive(txbuf, &c, 1, portMAX_DELAY);
 #endif
 	return c;
 }
@@ -533,7 +539,7 @@ uint8_t _getche(void)
 {
 	uint8_t c = _getch();
 #ifdef ESP_PLATFORM // OS
-	xQueueSend(rxq,&c,portMAX_DELAY);
+	xStreamBufferSend(rxbuf, &c, 1, portMAX_DELAY);
 #endif
 	return c;
 }
@@ -541,7 +547,7 @@ uint8_t _getche(void)
 void _putch(uint8_t ch)
 {
 #ifdef ESP_PLATFORM // OS
-	xQueueSend(rxq,&ch,portMAX_DELAY);
+	xStreamBufferSend(rxbuf, &ch, 1, portMAX_DELAY);
 #endif
 }
 
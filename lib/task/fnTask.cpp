@@ -1,5 +1,3 @@
-#ifndef ESP_PLATFORM
-
 #include "fnTask.h"
 #include "debug.h"
 
@@ -10,6 +8,12 @@ fnTask::fnTask()
     _state = TASK_READY;
     _reason = TASK_COMPLETED;
     _callback = nullptr;
+    _priority = PRIORITY_NORMAL;
+    _after = 0;
+    _seq = 0;
+    _started = false;
+    _pause_request = false;
+    _abort_request = false;
 }
 
 
@@ -34,7 +38,7 @@ fnTestTask::~fnTestTask()
 int fnTestTask::get_progress()
 {
     Debug_printf("fnTestTask::get_progress #%d\n", _id);
-    return 0;
+    return _i;
 }
 
 void * fnTestTask::get_result()
@@ -75,5 +79,3 @@ int fnTestTask::step()
         return 0;   // continue
     return 1;       // done
 }
-
-#endif // !ESP_PLATFORM
\ No newline at end of file
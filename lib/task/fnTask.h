@@ -2,6 +2,7 @@
 #define _FN_TASK_H
 
 #include <stdint.h>
+#include <atomic>
 
 class fnTaskManager;
 
@@ -22,34 +23,56 @@ public:
         TASK_ABORTED
     };
 
+    // order in which waiting tasks are picked up by a worker, first come first served within a level
+    enum task_priority
+    {
+        PRIORITY_LOW = 0,
+        PRIORITY_NORMAL,
+        PRIORITY_HIGH
+    };
+
+    // called from the worker on every state change, the task is deleted after TASK_DONE returns
+    typedef void (*task_callback)(fnTask *t, task_state new_state);
+
     fnTask();
     virtual ~fnTask() = 0;
 
     // state, progress and results
     task_state get_state() {return _state;};
     done_reason get_done_reason() {return _reason;};
+    task_priority get_priority() {return _priority;};
     virtual int get_progress() {return 0;};         // optional
     virtual void * get_result() {return nullptr;};  // optional
 
 protected:
-    // task state management
+    // task state management, start/pause/step run on a worker, resume on the thread
+    // calling resume_task(), abort on a worker or the thread calling abort_task()
     // READY -> RUNNING
     virtual int start() = 0;                        // mandatory, must be implemented in sub-class
-    // RUNNING -> PAUSED
+    // RUNNING -> PAUSED, after the current step
     virtual int pause() {return 0;};                // optional
-    // PAUSED -> RUNNING
+    // PAUSED -> READY
     virtual int resume() {return 0;};               // optional
-    // -> DONE/ABORTED, result is not available
+    // -> DONE/ABORTED, result is not available, may come right after pause()
     virtual int abort() {return 0;};                // optional
-    // do some work
+    // do some work, 0 to continue, >0 when done, <0 on failure
+    // keep each step short, pause and abort requests are handled between steps
     virtual int step() = 0;                         // mandatory, must be implemented in sub-class
 
     friend fnTaskManager;
 
     uint8_t _id;                                    // task ID 1..255, 0 is invalid / not yet assigned ID
-    task_state _state;
+    std::atomic<task_state> _state;
     done_reason _reason;
-    void (*_callback)(fnTask *t, task_state new_state);
+    task_callback _callback;
+
+private:
+    task_priority _priority;
+    uint8_t _after;                                 // task ID that has to complete first, 0 for none
+    uint32_t _seq;                                  // submission order
+    bool _started;                                  // start() was called
+    std::atomic<bool> _pause_request;
+    std::atomic<bool> _abort_request;
 };
 
 class fnTestTask : public fnTask
@@ -1,6 +1,4 @@
-#ifndef ESP_PLATFORM
-
-#include <list>
+#include <vector>
 
 #include "fnTaskManager.h"
 #include "debug.h"
@@ -14,6 +12,10 @@ fnTaskManager::fnTaskManager()
     // Debug_println("fnTaskManager::fnTaskManager");
     _next_tid = 1;
     _task_count = 0;
+    _next_seq = 0;
+    _workers_running = 0;
+    _workers_started = false;
+    _stopping = false;
 }
 
 fnTaskManager::~fnTaskManager()
@@ -24,20 +26,185 @@ fnTaskManager::~fnTaskManager()
 
 void fnTaskManager::shutdown()
 {
-    // abort tasks, if any
+    std::unique_lock<std::mutex> lock(_mutex);
+    _stopping = true;
+
+    // running tasks stop at their next step and are aborted by their worker
     for (auto it = _task_map.begin(); it != _task_map.end(); ++it)
+        it->second->_abort_request = true;
+    _wake.notify_all();
+    _changed.wait(lock, [this] { return _workers_running == 0; });
+
+    // abort tasks that never got to run, if any
+    while (!_task_map.empty())
     {
-        Debug_printf("Aborting task %d\n", it->first);
-        it->second->abort();
-        delete it->second;
+        Debug_printf("Aborting task %d\n", _task_map.begin()->first);
+        finish_task(lock, _task_map.begin()->second, fnTask::TASK_ABORTED);
+    }
+    lock.unlock();
+
+#ifndef ESP_PLATFORM
+    for (auto &t : _workers)
+        t.join();
+    _workers.clear();
+#endif
+}
+
+// Workers are started with the first task, not at static construction
+void fnTaskManager::start_workers()
+{
+    if (_workers_started)
+        return;
+    _workers_started = true;
+
+    for (int i = 0; i < TASKMGR_WORKERS; i++)
+    {
+#ifdef ESP_PLATFORM
+        if (xTaskCreatePinnedToCore(worker_task, "fn_task_worker", TASKMGR_STACKSIZE, this, TASKMGR_PRIORITY, nullptr, TASKMGR_CPUAFFINITY) != pdPASS)
+        {
+            Debug_printf("fnTaskManager failed to start worker %d\n", i);
+            continue;
+        }
+#else
+        _workers.emplace_back(&fnTaskManager::worker, this);
+#endif
+        _workers_running++;
     }
-    _task_map.clear();
-    _task_count = 0;
 }
 
-int fnTaskManager::submit_task(fnTask * t)
+#ifdef ESP_PLATFORM
+void fnTaskManager::worker_task(void *arg)
+{
+    ((fnTaskManager *)arg)->worker();
+    vTaskDelete(nullptr);
+}
+#endif
+
+void fnTaskManager::worker()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_stopping)
+    {
+        fnTask *task = next_task();
+        if (task == nullptr)
+        {
+            _wake.wait(lock);
+            continue;
+        }
+
+        // the task is ours until it's paused or done
+        bool started = task->_started;
+        task->_started = true;
+        task->_state = fnTask::TASK_RUNNING;
+        lock.unlock();
+
+        if (task->_callback != nullptr)
+            task->_callback(task, fnTask::TASK_RUNNING);
+
+        // READY -> RUNNING, or back from a pause where resume() was already called
+        int result = started ? 0 : task->start();
+        if (result > 0)
+            result = 0;
+        while (result == 0 && !task->_pause_request && !task->_abort_request)
+            result = task->step();
+
+        bool paused = (result == 0 && !task->_abort_request);
+        if (paused)
+        {
+            // RUNNING -> PAUSED
+            task->pause();
+            if (task->_callback != nullptr)
+                task->_callback(task, fnTask::TASK_PAUSED);
+        }
+
+        lock.lock();
+        // abort_task() saw it RUNNING and left it to us, even if it paused meanwhile
+        if (paused && task->_abort_request)
+            paused = false;
+        if (paused)
+        {
+            task->_state = fnTask::TASK_PAUSED;
+            _changed.notify_all();
+        }
+        else
+        {
+            finish_task(lock, task, result > 0 ? fnTask::TASK_COMPLETED : fnTask::TASK_ABORTED);
+        }
+    }
+
+    _workers_running--;
+    _changed.notify_all();
+}
+
+// Highest priority READY task whose dependency has completed, oldest first
+fnTask * fnTaskManager::next_task()
+{
+    fnTask *next = nullptr;
+    for (auto it = _task_map.begin(); it != _task_map.end(); ++it)
+    {
+        fnTask *task = it->second;
+        if (task->_state != fnTask::TASK_READY || task->_after != 0)
+            continue;
+        if (next == nullptr || task->_priority > next->_priority
+            || (task->_priority == next->_priority && task->_seq < next->_seq))
+            next = task;
+    }
+    return next;
+}
+
+// Takes the task out of the manager, tells its owner and deletes it. Called
+// and returns with lock held, but the task's own code runs without it.
+void fnTaskManager::finish_task(std::unique_lock<std::mutex> &lock, fnTask *task, fnTask::done_reason reason)
+{
+    uint8_t tid = task->_id;
+    _task_map.erase(tid);
+    _task_count -= 1;
+
+    // tasks waiting on this one can go now, or go with it
+    std::vector<std::pair<uint8_t, fnTask *>> dependents;
+    for (auto it = _task_map.begin(); it != _task_map.end(); ++it)
+    {
+        if (it->second->_after != tid)
+            continue;
+        if (reason == fnTask::TASK_COMPLETED)
+            it->second->_after = 0;
+        else
+            dependents.push_back(*it);
+    }
+    if (reason == fnTask::TASK_COMPLETED)
+        _wake.notify_all();
+
+    lock.unlock();
+
+    Debug_printf("%s task %d\n", reason == fnTask::TASK_COMPLETED ? "completed" : "aborted", tid);
+    if (reason == fnTask::TASK_ABORTED)
+        task->abort();
+    task->_reason = reason;
+    task->_state = fnTask::TASK_DONE;
+    if (task->_callback != nullptr)
+        task->_callback(task, fnTask::TASK_DONE);
+    delete task;
+
+    lock.lock();
+
+    for (auto &d : dependents)
+    {
+        // unless someone else got to it first
+        auto it = _task_map.find(d.first);
+        if (it != _task_map.end() && it->second == d.second && it->second->_after == tid)
+            finish_task(lock, d.second, fnTask::TASK_ABORTED);
+    }
+
+    _changed.notify_all();
+}
+
+int fnTaskManager::submit_task(fnTask * t, fnTask::task_priority priority, fnTask::task_callback callback, uint8_t after)
 {
     Debug_println("submit_task");
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (_stopping)
+        return 0;
 
     for (auto it = _task_map.begin(); it != _task_map.end(); ++it)
     {
@@ -49,19 +216,32 @@ int fnTaskManager::submit_task(fnTask * t)
     }
 
     uint8_t tid = get_free_tid();
-    if (tid == 0) 
+    if (tid == 0)
     {
         Debug_println(" failed to get free task ID");
+        return 0;
     }
-    else 
-    {
-        // store task
-        t->_id = tid;
-        _task_count += 1;
-        _task_map[tid] = t;
-        _next_tid = tid+1;
-        Debug_printf(" submitted #%d\n", tid);
-    }
+
+    // store task
+    t->_id = tid;
+    t->_state = fnTask::TASK_READY;
+    t->_priority = priority;
+    t->_callback = callback;
+    // a dependency that is already gone has completed
+    t->_after = (after != 0 && _task_map.find(after) != _task_map.end()) ? after : 0;
+    t->_seq = _next_seq++;
+    t->_started = false;
+    t->_pause_request = false;
+    t->_abort_request = false;
+    _task_count += 1;
+    _task_map[tid] = t;
+    _next_tid = tid+1;
+    if (_next_tid == 0)
+        _next_tid = 1;
+    Debug_printf(" submitted #%d\n", tid);
+
+    start_workers();
+    _wake.notify_one();
     return tid;
 }
 
@@ -83,131 +263,74 @@ uint8_t fnTaskManager::get_free_tid()
     return tid;
 }
 
+// The task is deleted once it's done, only use the pointer from the task's own callback
+// or while it can't finish
 fnTask * fnTaskManager::get_task(uint8_t tid)
 {
     Debug_printf("get_task %d\n", tid);
+    std::lock_guard<std::mutex> lock(_mutex);
     std::map<uint8_t, fnTask *>::iterator it = _task_map.find(tid);
     if (it == _task_map.end())
         return nullptr;
     return it->second;
 }
 
+// The worker pauses the task after its current step
 int fnTaskManager::pause_task(uint8_t tid)
 {
     Debug_printf("pause_task %d\n", tid);
-    fnTask *task = get_task(tid);
-    if (task == nullptr)
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _task_map.find(tid);
+    if (it == _task_map.end())
         return -1;
+    fnTask *task = it->second;
     if (task->_state != fnTask::TASK_RUNNING)
         return -1;
-    int result = task->pause();
-    task->_state = fnTask::TASK_PAUSED;
-    // TODO callback
-    return result;
+    task->_pause_request = true;
+    return 0;
 }
 
+// Back in the queue, where it keeps its place among tasks of the same priority
 int fnTaskManager::resume_task(uint8_t tid)
 {
     Debug_printf("resume_task %d\n", tid);
-    fnTask *task = get_task(tid);
-    if (task == nullptr)
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _task_map.find(tid);
+    if (it == _task_map.end())
         return -1;
+    fnTask *task = it->second;
     if (task->_state != fnTask::TASK_PAUSED)
         return -1;
     int result = task->resume();
-    task->_state = fnTask::TASK_RUNNING;
-    // TODO callback
+    task->_pause_request = false;
+    task->_state = fnTask::TASK_READY;
+    _wake.notify_one();
     return result;
 }
 
+// A running task is aborted by its worker after the current step, anything else right away
 int fnTaskManager::abort_task(uint8_t tid)
 {
     Debug_printf("abort_task %d\n", tid);
-    fnTask *task = get_task(tid);
-    if (task == nullptr)
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto it = _task_map.find(tid);
+    if (it == _task_map.end())
         return -1;
-    int result = task->abort();
-    task->_state = fnTask::TASK_DONE;
-    task->_reason = fnTask::TASK_ABORTED;
-    // TODO callback
-    // remove aborted task
-    _task_count -= 1;
-    _task_map.erase(tid);
-    delete task;
-    return result;
+    fnTask *task = it->second;
+    task->_abort_request = true;
+    if (task->_state != fnTask::TASK_RUNNING)
+        finish_task(lock, task, fnTask::TASK_ABORTED);
+    return 0;
 }
 
-int fnTaskManager::complete_task(uint8_t tid)
+bool fnTaskManager::wait_idle(uint32_t timeout_ms)
 {
-    Debug_printf("complete_task %d\n", tid);
-    fnTask *task = get_task(tid);
-    if (task == nullptr)
-        return -1;
-    task->_state = fnTask::TASK_DONE;
-    task->_reason = fnTask::TASK_COMPLETED;
-    // TODO callback
-    // remove completed task
-    _task_count -= 1;
-    _task_map.erase(tid);
-    delete task;
-    return 0;
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _changed.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] { return _task_count == 0; });
 }
 
 bool fnTaskManager::service()
 {
-    if (_task_count == 0)
-        return true; // idle
-
-    bool idle = true; // was service() idle?
-    int result;
-    fnTask *task;
-    std::list <uint8_t> failed;
-    std::list <uint8_t> completed;
-
-    // update READY and RUNNING tasks
-    for (auto it = _task_map.begin(); it != _task_map.end(); ++it)
-    {
-        task = it->second;
-        switch (task->_state)
-        {
-        case fnTask::TASK_READY:
-            idle = false;
-            result = task->start();
-            if (result < 0)
-                // failed to start task
-                failed.push_back(it->first);
-            else
-                task->_state = fnTask::TASK_RUNNING;
-            break;
-
-        case fnTask::TASK_RUNNING:
-            idle = false;
-            result = task->step();
-            if (result < 0)
-                // failure in task execution
-                failed.push_back(it->first);
-            else if (result > 0)
-            {
-                // task completed
-                completed.push_back(it->first);
-            }
-            break;
-        default:
-            ;
-        }
-    }
-
-    if (!idle)
-    {
-        // handle failed tasks, if any
-        for (auto it = failed.begin(); it != failed.end(); ++it)
-            abort_task(*it);
-        // handle completed tasks, if any
-        for (auto it = completed.begin(); it != completed.end(); ++it)
-            complete_task(*it);
-    }
-
-    return idle;
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _task_count == 0; // idle
 }
-
-#endif // !ESP_PLATFORM
\ No newline at end of file
@@ -2,10 +2,30 @@
 #define _FN_TASKMANAGER_H
 
 #include <stdint.h>
+#include <condition_variable>
 #include <map>
+#include <mutex>
+
+#ifdef ESP_PLATFORM
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#else
+#include <thread>
+#include <vector>
+#endif
 
 #include "fnTask.h"
 
+// Submitted tasks are run by a small pool of workers, so a long task only
+// holds up the tasks behind it once every worker is busy. On the ESP the
+// workers are FreeRTOS tasks on the core the bus doesn't run on, elsewhere
+// they are std::threads. Callers only ever enqueue, nothing runs on the
+// caller's task.
+#define TASKMGR_WORKERS         2
+#define TASKMGR_STACKSIZE       8192
+#define TASKMGR_PRIORITY        5
+#define TASKMGR_CPUAFFINITY     0   // the bus runs on core 1
+
 
 class fnTaskManager
 {
@@ -13,21 +33,46 @@ class fnTaskManager
 public:
     fnTaskManager();
     ~fnTaskManager();
-    int submit_task(fnTask * t);
+
+    // Takes ownership of t, returns its task ID or 0 if it can't be queued.
+    // A task submitted with after set waits for that task to complete, and is
+    // aborted along with it.
+    int submit_task(fnTask * t, fnTask::task_priority priority = fnTask::PRIORITY_NORMAL,
+                    fnTask::task_callback callback = nullptr, uint8_t after = 0);
     fnTask * get_task(uint8_t tid);
     int pause_task(uint8_t tid);
     int resume_task(uint8_t tid);
     int abort_task(uint8_t tid);
+
+    // Blocks until no tasks are left, false on time-out
+    bool wait_idle(uint32_t timeout_ms);
+    // True if no tasks are queued or running, the work itself happens on the workers
     bool service();
 
 private:
-    int complete_task(uint8_t tid);
+    void start_workers();
+    void worker();
+    fnTask * next_task();
+    void finish_task(std::unique_lock<std::mutex> &lock, fnTask *task, fnTask::done_reason reason);
     uint8_t get_free_tid();
     void shutdown();
 
+#ifdef ESP_PLATFORM
+    static void worker_task(void *arg);
+#else
+    std::vector<std::thread> _workers;
+#endif
+
+    std::mutex _mutex;
+    std::condition_variable _wake;          // a task became runnable, or shutdown
+    std::condition_variable _changed;       // a task finished, or a worker exited
     std::map<uint8_t, fnTask *> _task_map;
     uint8_t _next_tid;
     uint8_t _task_count;
+    uint32_t _next_seq;
+    int _workers_running;
+    bool _workers_started;
+    bool _stopping;
 };
 
 // global task manager
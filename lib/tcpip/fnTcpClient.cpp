@@ -595,6 +595,29 @@ int fnTcpClient::available()
     return res;
 }
 
+// Block until there is data to read or timeout_ms passes.
+// Returns bytes available, 0 on timeout or once the peer has closed (check connected())
+int fnTcpClient::wait_available(uint32_t timeout_ms)
+{
+    int res = available();
+    int sockfd = fd();
+    if (res > 0 || !_connected || sockfd < 0)
+        return res;
+
+    fd_set fdset;
+    FD_ZERO(&fdset);
+    FD_SET(sockfd, &fdset);
+
+    struct timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+    if (select(sockfd + 1, &fdset, nullptr, nullptr, &tv) <= 0)
+        return 0;
+
+    return available();
+}
+
 // Send all pending data and clear receive buffer
 void fnTcpClient::flush()
 {
@@ -37,6 +37,7 @@ public:
     int read_until(char terminator, char *buf, size_t size);
 
     int available();
+    int wait_available(uint32_t timeout_ms);
     int peek();
     void flush();
     uint8_t connected();
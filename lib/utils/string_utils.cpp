@@ -238,6 +238,20 @@ namespace mstr {
         return true; /* matched completely */
     }
 
+    bool matchPattern(const std::string &pattern, const std::string &name)
+    {
+        for (size_t index = 0; index < pattern.size(); index++) {
+            if (pattern[index] == '*')
+                return true; /* rest is not interesting, it's a match */
+            if (index >= name.size())
+                return false; /* name is too short */
+            if (pattern[index] != '?' && pattern[index] != name[index])
+                return false; /* does not match */
+        }
+
+        return pattern.size() == name.size();
+    }
+
     // convert to lowercase (in place)
     void toLower(std::string &s)
     {
@@ -537,9 +551,11 @@ namespace mstr {
     std::string format(const char *format, ...)
     {
         // Format our string
-        va_list args;
+        va_list args, size_args;
         va_start(args, format);
-        char text[vsnprintf(NULL, 0, format, args) + 1];
+        va_copy(size_args, args);
+        char text[vsnprintf(NULL, 0, format, size_args) + 1];
+        va_end(size_args);
         vsnprintf(text, sizeof text, format, args);
         va_end(args);
 
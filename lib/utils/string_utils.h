@@ -33,6 +33,7 @@ namespace mstr {
     bool equals(const char* s1, const char *s2, bool case_sensitive);
     bool contains(std::string &s1, const char *s2, bool case_sensitive = true);
     bool compare(std::string &s1, std::string &s2, bool case_sensitive = true); // s1 is Wildcard string, s2 is potential match
+    bool matchPattern(const std::string &pattern, const std::string &name); // CBM DOS pattern, whole name must match
 
     std::vector<std::string> split(std::string toSplit, char ch, int limit = 9999);
     void toLower(std::string &s);
@@ -0,0 +1,159 @@
+#include "trace.h"
+
+#include <sstream>
+
+#ifndef DISABLE_TRACE
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_rom_sys.h>
+#endif
+
+#include "string_utils.h"
+
+TraceEvent Trace::ring[TRACE_RING_SIZE];
+std::atomic<uint32_t> Trace::head(0);
+
+std::atomic<uint32_t> Trace::count[TRACE_OPS][TRACE_BUCKETS];
+std::atomic<uint64_t> Trace::total_us[TRACE_OPS];
+std::atomic<uint32_t> Trace::max_us[TRACE_OPS];
+
+const char *Trace::name(trace_op_t op)
+{
+    static const char *names[TRACE_OPS] = {
+        "File",
+        "getSourceStream",
+        "seekPath",
+        "read",
+        "seekSector",
+        "sendBytes",
+    };
+
+    return (op < TRACE_OPS) ? names[op] : "?";
+}
+
+void Trace::record(trace_op_t op, uint8_t core, uint32_t cycles, uint32_t arg)
+{
+#ifndef DISABLE_TRACE
+    // Each core has its own cycle counter, a span that moved can't be timed
+    if (esp_cpu_get_core_id() != core)
+        return;
+
+    uint32_t us = cycles / esp_rom_get_cpu_ticks_per_us();
+
+    uint32_t i = head.fetch_add(1, std::memory_order_relaxed);
+    TraceEvent &e = ring[i & (TRACE_RING_SIZE - 1)];
+    e.seq.store(0, std::memory_order_relaxed);
+    e.op = op;
+    e.core = core;
+    e.task = (uint32_t)(uintptr_t)xTaskGetCurrentTaskHandle();
+    e.start_us = (uint32_t)esp_timer_get_time() - us;
+    e.cycles = cycles;
+    e.arg = arg;
+    e.seq.store(i + 1, std::memory_order_release);
+
+    uint8_t bucket = us ? 32 - __builtin_clz(us) : 0;
+    if (bucket >= TRACE_BUCKETS)
+        bucket = TRACE_BUCKETS - 1;
+
+    count[op][bucket].fetch_add(1, std::memory_order_relaxed);
+    total_us[op].fetch_add(us, std::memory_order_relaxed);
+
+    uint32_t max = max_us[op].load(std::memory_order_relaxed);
+    while (us > max && !max_us[op].compare_exchange_weak(max, us, std::memory_order_relaxed))
+        ;
+#endif
+}
+
+void Trace::reset()
+{
+    for (int op = 0; op < TRACE_OPS; op++)
+    {
+        for (int b = 0; b < TRACE_BUCKETS; b++)
+            count[op][b].store(0);
+        total_us[op].store(0);
+        max_us[op].store(0);
+    }
+
+    for (auto &e : ring)
+        e.seq.store(0);
+}
+
+// Upper bound of the bucket holding the given fraction of the spans
+static uint32_t trace_percentile(const uint32_t *buckets, uint32_t n, uint32_t percent)
+{
+    uint32_t want = (n * percent + 99) / 100;
+    uint32_t seen = 0;
+    for (int b = 0; b < TRACE_BUCKETS; b++)
+    {
+        seen += buckets[b];
+        if (seen >= want)
+            return 1 << b;
+    }
+    return 1 << (TRACE_BUCKETS - 1);
+}
+
+std::string Trace::histograms()
+{
+    std::stringstream out;
+
+    for (int op = 0; op < TRACE_OPS; op++)
+    {
+        uint32_t buckets[TRACE_BUCKETS];
+        uint32_t n = 0;
+        for (int b = 0; b < TRACE_BUCKETS; b++)
+        {
+            buckets[b] = count[op][b].load(std::memory_order_relaxed);
+            n += buckets[b];
+        }
+
+        out << mstr::format("%-16s %8lu", name((trace_op_t)op), n);
+        if (n)
+        {
+            out << mstr::format(" avg %lluus p50 <%luus p99 <%luus max %luus ",
+                                total_us[op].load() / n, trace_percentile(buckets, n, 50),
+                                trace_percentile(buckets, n, 99), max_us[op].load());
+
+            for (int b = 0; b < TRACE_BUCKETS; b++)
+                if (buckets[b])
+                    out << mstr::format(" <%lu:%lu", 1UL << b, buckets[b]);
+        }
+        out << "\r\n";
+    }
+
+    return out.str();
+}
+
+std::string Trace::chrome()
+{
+    std::stringstream out;
+
+    out << "{\"traceEvents\":[";
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"core 0\"}},";
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"core 1\"}}";
+
+#ifndef DISABLE_TRACE
+    // Oldest first, skipping any slot that is being rewritten right now
+    uint32_t end = head.load(std::memory_order_acquire);
+    uint32_t start = (end > TRACE_RING_SIZE) ? end - TRACE_RING_SIZE : 0;
+    uint32_t ticks_per_us = esp_rom_get_cpu_ticks_per_us();
+
+    for (uint32_t i = start; i < end; i++)
+    {
+        TraceEvent &slot = ring[i & (TRACE_RING_SIZE - 1)];
+        if (slot.seq.load(std::memory_order_acquire) != i + 1)
+            continue;
+
+        struct { uint8_t op, core; uint32_t task, start_us, cycles, arg; } e = {
+            slot.op, slot.core, slot.task, slot.start_us, slot.cycles, slot.arg
+        };
+        if (slot.seq.load(std::memory_order_acquire) != i + 1)
+            continue;
+
+        out << mstr::format(",{\"name\":\"%s\",\"cat\":\"meatloaf\",\"ph\":\"X\",\"ts\":%lu,\"dur\":%.3f,\"pid\":%d,\"tid\":%lu,\"args\":{\"bytes\":%lu}}",
+                            name((trace_op_t)e.op), e.start_us, (double)e.cycles / ticks_per_us, e.core, e.task, e.arg);
+    }
+#endif
+
+    out << "],\"displayTimeUnit\":\"ms\"}";
+    return out.str();
+}
@@ -0,0 +1,106 @@
+#ifndef MEATLOAF_TRACE
+#define MEATLOAF_TRACE
+
+//
+// Lightweight tracing of the LOAD path
+//
+// TRACE_SPAN(op) times the rest of the enclosing scope with the CPU cycle
+// counter. When the scope ends the span goes into a fixed ring of the last
+// TRACE_RING_SIZE events, written without locks, and into a log2 latency
+// histogram for its operation.
+//
+// Trace::histograms() prints the histograms (console 'trace', web UI),
+// Trace::chrome() exports the ring as Chrome trace JSON for
+// chrome://tracing or https://ui.perfetto.dev (web UI /trace.json).
+//
+// Build with DISABLE_TRACE to compile the spans out.
+//
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#if defined(TEST_NATIVE) && !defined(DISABLE_TRACE)
+#define DISABLE_TRACE
+#endif
+
+#ifndef DISABLE_TRACE
+#include <esp_cpu.h>
+#include <esp_timer.h>
+#endif
+
+// Events kept, a power of two
+#define TRACE_RING_SIZE     256
+// Histogram buckets: < 1us, < 2us, < 4us ... the last one takes everything longer
+#define TRACE_BUCKETS       24
+
+typedef enum {
+    TRACE_FILE = 0,         // MFSOwner::File(), URL to MFile
+    TRACE_SOURCE_STREAM,    // MFile::getSourceStream(), open and decode
+    TRACE_SEEK_PATH,        // finding the file in its container
+    TRACE_READ,             // reading from the container or file
+    TRACE_SEEK_SECTOR,      // disk image sector seek
+    TRACE_SEND_BYTES,       // bytes out on the bus
+    TRACE_OPS
+} trace_op_t;
+
+struct TraceEvent {
+    std::atomic<uint32_t> seq; // index + 1 once complete, 0 while being written
+    uint8_t op;
+    uint8_t core;
+    uint32_t task;
+    uint32_t start_us;      // esp_timer, wraps after 71 minutes
+    uint32_t cycles;
+    uint32_t arg;           // bytes moved, where it applies
+};
+
+class Trace {
+    static TraceEvent ring[TRACE_RING_SIZE];
+    static std::atomic<uint32_t> head;
+
+    static std::atomic<uint32_t> count[TRACE_OPS][TRACE_BUCKETS];
+    static std::atomic<uint64_t> total_us[TRACE_OPS];
+    static std::atomic<uint32_t> max_us[TRACE_OPS];
+
+public:
+    static const char *name(trace_op_t op);
+
+    static void record(trace_op_t op, uint8_t core, uint32_t cycles, uint32_t arg);
+    static void reset();
+
+    // One line per operation: count, average, p50, p99, max, then the buckets
+    static std::string histograms();
+    static std::string chrome();
+};
+
+#ifndef DISABLE_TRACE
+
+class TraceSpan {
+    trace_op_t _op;
+    uint8_t _core;
+    uint32_t _start;
+
+public:
+    uint32_t arg = 0;
+
+    TraceSpan(trace_op_t op) : _op(op) {
+        _core = esp_cpu_get_core_id();
+        _start = esp_cpu_get_cycle_count();
+    }
+
+    ~TraceSpan() {
+        Trace::record(_op, _core, esp_cpu_get_cycle_count() - _start, arg);
+    }
+};
+
+#define TRACE_SPAN(op)      TraceSpan _trace_span(op)
+#define TRACE_ARG(value)    _trace_span.arg = (value)
+
+#else
+
+#define TRACE_SPAN(op)      do {} while (0)
+#define TRACE_ARG(value)    do {} while (0)
+
+#endif // DISABLE_TRACE
+
+#endif // MEATLOAF_TRACE
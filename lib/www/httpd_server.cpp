@@ -28,6 +28,10 @@
 
 #include "template.h"
 
+#include "printer.h"
+
+#include "trace.h"
+
 #define MIN(a, b) \
     ({ __typeof__ (a) _a = (a); \
        __typeof__ (b) _b = (b); \
@@ -83,6 +87,14 @@ esp_err_t cHttpdServer::get_handler(httpd_req_t *httpd_req)
     {
         send_http_error(httpd_req, 404);
     }
+    else if (uri == "/print")
+    {
+        send_printer_output(httpd_req);
+    }
+    else if (uri == "/trace.json")
+    {
+        send_trace(httpd_req);
+    }
     else
     {
         send_file(httpd_req, uri.c_str());
@@ -426,6 +438,9 @@ httpd_handle_t cHttpdServer::start_server(serverstate &state)
     if (exists("/sd/.www"))
         httpdocs = "/sd/.www/";
 
+    // Parse the templates once instead of on every request
+    compile_templates(state._FS, httpdocs.c_str());
+
     if (httpd_start(&(state.hServer), &config) == ESP_OK)
     {
         /* Register URI handlers */
@@ -599,22 +614,21 @@ void cHttpdServer::send_file_parsed(httpd_req_t *req, const char *filename)
         // Set the response content type
         set_file_content_type(req, filename);
 
-        // We're going to load the whole thing into memory, so watch out for big files!
-        size_t sz = FileSystem::filesize(file) + 1;
-        char *buf = (char *)calloc(sz, 1);
-        if (buf == NULL)
+        // Compiled at startup, or now if the file is new or changed
+        const compiled_template *tpl = get_template(filename, file);
+        if (tpl == nullptr)
         {
-            Debug_printf("Couldn't allocate %u bytes to load file contents!\r\n", sz);
             err = 500;
         }
         else
         {
-            fread(buf, 1, sz, file);
-            std::string contents(buf);
-            free(buf);
-            contents = parse_contents(contents);
-
-            httpd_resp_send(req, contents.c_str(), contents.length());
+            // The length isn't known until the tags are filled in, so this goes out chunked
+            bool ok = render_template(tpl, file, [req](const char *buf, size_t len) {
+                return httpd_resp_send_chunk(req, buf, len) == ESP_OK;
+            });
+            if (!ok)
+                Debug_printv("Failed to send parsed file [%s]", filename);
+            httpd_resp_send_chunk(req, NULL, 0);
         }
         fclose(file);
     }
@@ -623,6 +637,73 @@ void cHttpdServer::send_file_parsed(httpd_req_t *req, const char *filename)
         send_http_error(req, err);
 }
 
+// Send a copy of the virtual printer output while the print job is still open
+void cHttpdServer::send_printer_output(httpd_req_t *req)
+{
+    printer_emu *pe = nullptr;
+#if defined( BUILD_ATARI ) || defined( BUILD_APPLE ) || defined( BUILD_IEC )
+    if (fnPrinters.get_ptr(0) != nullptr)
+        pe = fnPrinters.get_ptr(0)->getPrinterPtr();
+#endif
+
+    if (pe == nullptr)
+    {
+        send_http_error(req, 404);
+        return;
+    }
+
+    switch (pe->getPaperType())
+    {
+    case PDF:
+        httpd_resp_set_type(req, "application/pdf");
+        break;
+    case SVG:
+        httpd_resp_set_type(req, "image/svg+xml");
+        break;
+    case PNG:
+        httpd_resp_set_type(req, "image/png");
+        break;
+    case HTML:
+    case HTML_ATASCII:
+        httpd_resp_set_type(req, HTTPD_TYPE_TEXT);
+        break;
+    default:
+        httpd_resp_set_type(req, "text/plain");
+        break;
+    }
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+
+    bool sent = false;
+    bool ok = pe->snapshotOutput([req, &sent](const uint8_t *buf, size_t len) {
+        if (httpd_resp_send_chunk(req, (const char *)buf, len) != ESP_OK)
+            return false;
+        sent = true;
+        return true;
+    });
+
+    // Once part of the response is out the status can't change anymore
+    if (!ok && !sent)
+    {
+        Debug_printv("No printer output to send");
+        send_http_error(req, 404);
+        return;
+    }
+    if (!ok)
+        Debug_printv("Printer output cut short");
+    httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// Recent spans as Chrome trace JSON, for chrome://tracing or ui.perfetto.dev
+void cHttpdServer::send_trace(httpd_req_t *req)
+{
+    std::string json = Trace::chrome();
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"meatloaf-trace.json\"");
+    httpd_resp_send(req, json.data(), json.size());
+}
+
 // Send some meaningful(?) error message to client
 void cHttpdServer::send_http_error(httpd_req_t *req, int errnum)
 {
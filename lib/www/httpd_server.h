@@ -34,6 +34,8 @@ private:
     static void set_file_content_type(httpd_req_t *req, const char *filepath);
     static void send_file(httpd_req_t *req, const char *filename);
     static void send_file_parsed(httpd_req_t *req, const char *filename);
+    static void send_printer_output(httpd_req_t *req);
+    static void send_trace(httpd_req_t *req);
     static void send_http_error(httpd_req_t *req, int errnum);
 
 public:
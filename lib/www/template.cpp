@@ -1,7 +1,11 @@
 
 #include "template.h"
 
+#include <algorithm>
+#include <map>
 #include <sstream>
+#include <string.h>
+#include <sys/stat.h>
 
 #include "../../include/debug.h"
 
@@ -13,6 +17,13 @@
 
 #include "fnWiFi.h"
 
+#include "network/http.h"
+#include "trace.h"
+
+#ifdef BUILD_IEC
+#include "../device/iec/drive_prefetch.h"
+#endif
+
 #ifdef ENABLE_SSDP
 #include "ssdp.h"
 #endif
@@ -34,39 +45,6 @@ bool is_parsable(const char *extension)
 }
 
 
-// Look for anything between {{ and }} tags
-// And send that to a routine that looks for suitable substitutions
-// Returns string with subtitutions in place
-std::string parse_contents(const std::string &contents)
-{
-    //Debug_printv("parsing");
-    std::stringstream ss;
-    uint pos = 0, x, y;
-    do
-    {
-        x = contents.find("{{", pos);
-        if (x == std::string::npos)
-        {
-            ss << contents.substr(pos);
-            break;
-        }
-        // Found opening tag, now find ending
-        y = contents.find("}}", x + 2);
-        if (y == std::string::npos)
-        {
-            ss << contents.substr(pos);
-            break;
-        }
-        // Now we have starting and ending tags
-        if (x > 0)
-            ss << contents.substr(pos, x - pos);
-        ss << substitute_tag(contents.substr(x + 2, y - x - 2));
-        pos = y + 2;
-    } while (true);
-
-    return ss.str();
-}
-
 long uptime_seconds()
 {
     return fnSystem.get_uptime() / 1000000;
@@ -95,194 +73,194 @@ std::string format_uptime()
 }
 
 
-const std::string substitute_tag(const std::string &tag)
+enum tagids
 {
-    enum tagids
-    {
-        DEVICE_HOSTNAME = 0,
-        DEVICE_VERSION,
-        DEVICE_IPADDRESS,
-        DEVICE_IPMASK,
-        DEVICE_IPGATEWAY,
-        DEVICE_IPDNS,
-        DEVICE_WIFISSID,
-        DEVICE_WIFIBSSID,
-        DEVICE_WIFIMAC,
-        DEVICE_WIFIDETAIL,
-        DEVICE_FLASH_SIZE,
-        DEVICE_FLASH_USED,
-        DEVICE_SD_SIZE,
-        DEVICE_SD_USED,
-        DEVICE_UPTIME_STRING,
-        DEVICE_UPTIME,
-        DEVICE_CURRENTTIME,
-        DEVICE_TIMEZONE,
-        DEVICE_ROTATION_SOUNDS,
-        DEVICE_UDPSTREAM_HOST,
-        DEVICE_HEAPSIZE,
-        DEVICE_SYSSDK,
-        DEVICE_SYSCPUREV,
-        DEVICE_SIOVOLTS,
-        DEVICE_SIO_HSINDEX,
-        DEVICE_SIO_HSBAUD,
-        DEVICE_PRINTER1_MODEL,
-        DEVICE_PRINTER1_PORT,
-        DEVICE_PLAY_RECORD,
-        DEVICE_PULLDOWN,
-        DEVICE_CASSETTE_ENABLED,
-        DEVICE_CONFIG_ENABLED,
-        DEVICE_STATUS_WAIT_ENABLED,
-        DEVICE_BOOT_MODE,
-        DEVICE_PRINTER_ENABLED,
-        DEVICE_MODEM_ENABLED,
-        DEVICE_MODEM_SNIFFER_ENABLED,
-        DEVICE_DRIVE1HOST,
-        DEVICE_DRIVE2HOST,
-        DEVICE_DRIVE3HOST,
-        DEVICE_DRIVE4HOST,
-        DEVICE_DRIVE5HOST,
-        DEVICE_DRIVE6HOST,
-        DEVICE_DRIVE7HOST,
-        DEVICE_DRIVE8HOST,
-        DEVICE_DRIVE1MOUNT,
-        DEVICE_DRIVE2MOUNT,
-        DEVICE_DRIVE3MOUNT,
-        DEVICE_DRIVE4MOUNT,
-        DEVICE_DRIVE5MOUNT,
-        DEVICE_DRIVE6MOUNT,
-        DEVICE_DRIVE7MOUNT,
-        DEVICE_DRIVE8MOUNT,
-        DEVICE_HOST1,
-        DEVICE_HOST2,
-        DEVICE_HOST3,
-        DEVICE_HOST4,
-        DEVICE_HOST5,
-        DEVICE_HOST6,
-        DEVICE_HOST7,
-        DEVICE_HOST8,
-        DEVICE_DRIVE1,
-        DEVICE_DRIVE2,
-        DEVICE_DRIVE3,
-        DEVICE_DRIVE4,
-        DEVICE_DRIVE5,
-        DEVICE_DRIVE6,
-        DEVICE_DRIVE7,
-        DEVICE_DRIVE8,
-        DEVICE_HOST1PREFIX,
-        DEVICE_HOST2PREFIX,
-        DEVICE_HOST3PREFIX,
-        DEVICE_HOST4PREFIX,
-        DEVICE_HOST5PREFIX,
-        DEVICE_HOST6PREFIX,
-        DEVICE_HOST7PREFIX,
-        DEVICE_HOST8PREFIX,
-        DEVICE_ERRMSG,
-        DEVICE_HARDWARE_VER,
-        DEVICE_PRINTER_LIST,
-        DEVICE_UUID,
-        DEVICE_LASTTAG
-    };
+    DEVICE_HOSTNAME = 0,
+    DEVICE_VERSION,
+    DEVICE_IPADDRESS,
+    DEVICE_IPMASK,
+    DEVICE_IPGATEWAY,
+    DEVICE_IPDNS,
+    DEVICE_WIFISSID,
+    DEVICE_WIFIBSSID,
+    DEVICE_WIFIMAC,
+    DEVICE_WIFIDETAIL,
+    DEVICE_FLASH_SIZE,
+    DEVICE_FLASH_USED,
+    DEVICE_SD_SIZE,
+    DEVICE_SD_USED,
+    DEVICE_UPTIME_STRING,
+    DEVICE_UPTIME,
+    DEVICE_CURRENTTIME,
+    DEVICE_TIMEZONE,
+    DEVICE_ROTATION_SOUNDS,
+    DEVICE_UDPSTREAM_HOST,
+    DEVICE_HEAPSIZE,
+    DEVICE_SYSSDK,
+    DEVICE_SYSCPUREV,
+    DEVICE_SIOVOLTS,
+    DEVICE_SIO_HSINDEX,
+    DEVICE_SIO_HSBAUD,
+    DEVICE_PRINTER1_MODEL,
+    DEVICE_PRINTER1_PORT,
+    DEVICE_PLAY_RECORD,
+    DEVICE_PULLDOWN,
+    DEVICE_CASSETTE_ENABLED,
+    DEVICE_CONFIG_ENABLED,
+    DEVICE_STATUS_WAIT_ENABLED,
+    DEVICE_BOOT_MODE,
+    DEVICE_PRINTER_ENABLED,
+    DEVICE_MODEM_ENABLED,
+    DEVICE_MODEM_SNIFFER_ENABLED,
+    DEVICE_DRIVE1HOST,
+    DEVICE_DRIVE2HOST,
+    DEVICE_DRIVE3HOST,
+    DEVICE_DRIVE4HOST,
+    DEVICE_DRIVE5HOST,
+    DEVICE_DRIVE6HOST,
+    DEVICE_DRIVE7HOST,
+    DEVICE_DRIVE8HOST,
+    DEVICE_DRIVE1MOUNT,
+    DEVICE_DRIVE2MOUNT,
+    DEVICE_DRIVE3MOUNT,
+    DEVICE_DRIVE4MOUNT,
+    DEVICE_DRIVE5MOUNT,
+    DEVICE_DRIVE6MOUNT,
+    DEVICE_DRIVE7MOUNT,
+    DEVICE_DRIVE8MOUNT,
+    DEVICE_HOST1,
+    DEVICE_HOST2,
+    DEVICE_HOST3,
+    DEVICE_HOST4,
+    DEVICE_HOST5,
+    DEVICE_HOST6,
+    DEVICE_HOST7,
+    DEVICE_HOST8,
+    DEVICE_DRIVE1,
+    DEVICE_DRIVE2,
+    DEVICE_DRIVE3,
+    DEVICE_DRIVE4,
+    DEVICE_DRIVE5,
+    DEVICE_DRIVE6,
+    DEVICE_DRIVE7,
+    DEVICE_DRIVE8,
+    DEVICE_HOST1PREFIX,
+    DEVICE_HOST2PREFIX,
+    DEVICE_HOST3PREFIX,
+    DEVICE_HOST4PREFIX,
+    DEVICE_HOST5PREFIX,
+    DEVICE_HOST6PREFIX,
+    DEVICE_HOST7PREFIX,
+    DEVICE_HOST8PREFIX,
+    DEVICE_ERRMSG,
+    DEVICE_HARDWARE_VER,
+    DEVICE_PRINTER_LIST,
+    DEVICE_UUID,
+    DEVICE_HTTP_POOL,
+    DEVICE_HTTP_TTFB,
+    DEVICE_PREFETCH,
+    DEVICE_TRACE,
+    DEVICE_LASTTAG
+};
 
-    const char *tagids[DEVICE_LASTTAG] =
-    {
-        "DEVICE_HOSTNAME",
-        "DEVICE_VERSION",
-        "DEVICE_IPADDRESS",
-        "DEVICE_IPMASK",
-        "DEVICE_IPGATEWAY",
-        "DEVICE_IPDNS",
-        "DEVICE_WIFISSID",
-        "DEVICE_WIFIBSSID",
-        "DEVICE_WIFIMAC",
-        "DEVICE_WIFIDETAIL",
-        "DEVICE_FLASH_SIZE",
-        "DEVICE_FLASH_USED",
-        "DEVICE_SD_SIZE",
-        "DEVICE_SD_USED",
-        "DEVICE_UPTIME_STRING",
-        "DEVICE_UPTIME",
-        "DEVICE_CURRENTTIME",
-        "DEVICE_TIMEZONE",
-        "DEVICE_ROTATION_SOUNDS",
-        "DEVICE_UDPSTREAM_HOST",
-        "DEVICE_HEAPSIZE",
-        "DEVICE_SYSSDK",
-        "DEVICE_SYSCPUREV",
-        "DEVICE_SIOVOLTS",
-        "DEVICE_SIO_HSINDEX",
-        "DEVICE_SIO_HSBAUD",
-        "DEVICE_PRINTER1_MODEL",
-        "DEVICE_PRINTER1_PORT",
-        "DEVICE_PLAY_RECORD",
-        "DEVICE_PULLDOWN",
-        "DEVICE_CASSETTE_ENABLED",
-        "DEVICE_CONFIG_ENABLED",
-        "DEVICE_STATUS_WAIT_ENABLED",
-        "DEVICE_BOOT_MODE",
-        "DEVICE_PRINTER_ENABLED",
-        "DEVICE_MODEM_ENABLED",
-        "DEVICE_MODEM_SNIFFER_ENABLED",
-        "DEVICE_DRIVE1HOST",
-        "DEVICE_DRIVE2HOST",
-        "DEVICE_DRIVE3HOST",
-        "DEVICE_DRIVE4HOST",
-        "DEVICE_DRIVE5HOST",
-        "DEVICE_DRIVE6HOST",
-        "DEVICE_DRIVE7HOST",
-        "DEVICE_DRIVE8HOST",
-        "DEVICE_DRIVE1MOUNT",
-        "DEVICE_DRIVE2MOUNT",
-        "DEVICE_DRIVE3MOUNT",
-        "DEVICE_DRIVE4MOUNT",
-        "DEVICE_DRIVE5MOUNT",
-        "DEVICE_DRIVE6MOUNT",
-        "DEVICE_DRIVE7MOUNT",
-        "DEVICE_DRIVE8MOUNT",
-        "DEVICE_HOST1",
-        "DEVICE_HOST2",
-        "DEVICE_HOST3",
-        "DEVICE_HOST4",
-        "DEVICE_HOST5",
-        "DEVICE_HOST6",
-        "DEVICE_HOST7",
-        "DEVICE_HOST8",
-        "DEVICE_DRIVE1",
-        "DEVICE_DRIVE2",
-        "DEVICE_DRIVE3",
-        "DEVICE_DRIVE4",
-        "DEVICE_DRIVE5",
-        "DEVICE_DRIVE6",
-        "DEVICE_DRIVE7",
-        "DEVICE_DRIVE8",
-        "DEVICE_HOST1PREFIX",
-        "DEVICE_HOST2PREFIX",
-        "DEVICE_HOST3PREFIX",
-        "DEVICE_HOST4PREFIX",
-        "DEVICE_HOST5PREFIX",
-        "DEVICE_HOST6PREFIX",
-        "DEVICE_HOST7PREFIX",
-        "DEVICE_HOST8PREFIX",
-        "DEVICE_ERRMSG",
-        "DEVICE_HARDWARE_VER",
-        "DEVICE_PRINTER_LIST",
-        "DEVICE_UUID"
-    };
+static const char *tagids[DEVICE_LASTTAG] =
+{
+    "DEVICE_HOSTNAME",
+    "DEVICE_VERSION",
+    "DEVICE_IPADDRESS",
+    "DEVICE_IPMASK",
+    "DEVICE_IPGATEWAY",
+    "DEVICE_IPDNS",
+    "DEVICE_WIFISSID",
+    "DEVICE_WIFIBSSID",
+    "DEVICE_WIFIMAC",
+    "DEVICE_WIFIDETAIL",
+    "DEVICE_FLASH_SIZE",
+    "DEVICE_FLASH_USED",
+    "DEVICE_SD_SIZE",
+    "DEVICE_SD_USED",
+    "DEVICE_UPTIME_STRING",
+    "DEVICE_UPTIME",
+    "DEVICE_CURRENTTIME",
+    "DEVICE_TIMEZONE",
+    "DEVICE_ROTATION_SOUNDS",
+    "DEVICE_UDPSTREAM_HOST",
+    "DEVICE_HEAPSIZE",
+    "DEVICE_SYSSDK",
+    "DEVICE_SYSCPUREV",
+    "DEVICE_SIOVOLTS",
+    "DEVICE_SIO_HSINDEX",
+    "DEVICE_SIO_HSBAUD",
+    "DEVICE_PRINTER1_MODEL",
+    "DEVICE_PRINTER1_PORT",
+    "DEVICE_PLAY_RECORD",
+    "DEVICE_PULLDOWN",
+    "DEVICE_CASSETTE_ENABLED",
+    "DEVICE_CONFIG_ENABLED",
+    "DEVICE_STATUS_WAIT_ENABLED",
+    "DEVICE_BOOT_MODE",
+    "DEVICE_PRINTER_ENABLED",
+    "DEVICE_MODEM_ENABLED",
+    "DEVICE_MODEM_SNIFFER_ENABLED",
+    "DEVICE_DRIVE1HOST",
+    "DEVICE_DRIVE2HOST",
+    "DEVICE_DRIVE3HOST",
+    "DEVICE_DRIVE4HOST",
+    "DEVICE_DRIVE5HOST",
+    "DEVICE_DRIVE6HOST",
+    "DEVICE_DRIVE7HOST",
+    "DEVICE_DRIVE8HOST",
+    "DEVICE_DRIVE1MOUNT",
+    "DEVICE_DRIVE2MOUNT",
+    "DEVICE_DRIVE3MOUNT",
+    "DEVICE_DRIVE4MOUNT",
+    "DEVICE_DRIVE5MOUNT",
+    "DEVICE_DRIVE6MOUNT",
+    "DEVICE_DRIVE7MOUNT",
+    "DEVICE_DRIVE8MOUNT",
+    "DEVICE_HOST1",
+    "DEVICE_HOST2",
+    "DEVICE_HOST3",
+    "DEVICE_HOST4",
+    "DEVICE_HOST5",
+    "DEVICE_HOST6",
+    "DEVICE_HOST7",
+    "DEVICE_HOST8",
+    "DEVICE_DRIVE1",
+    "DEVICE_DRIVE2",
+    "DEVICE_DRIVE3",
+    "DEVICE_DRIVE4",
+    "DEVICE_DRIVE5",
+    "DEVICE_DRIVE6",
+    "DEVICE_DRIVE7",
+    "DEVICE_DRIVE8",
+    "DEVICE_HOST1PREFIX",
+    "DEVICE_HOST2PREFIX",
+    "DEVICE_HOST3PREFIX",
+    "DEVICE_HOST4PREFIX",
+    "DEVICE_HOST5PREFIX",
+    "DEVICE_HOST6PREFIX",
+    "DEVICE_HOST7PREFIX",
+    "DEVICE_HOST8PREFIX",
+    "DEVICE_ERRMSG",
+    "DEVICE_HARDWARE_VER",
+    "DEVICE_PRINTER_LIST",
+    "DEVICE_UUID",
+    "DEVICE_HTTP_POOL",
+    "DEVICE_HTTP_TTFB",
+    "DEVICE_PREFETCH",
+    "DEVICE_TRACE"
+};
 
+// Works out the current value of a tag
+static std::string tag_value(int tagid)
+{
     std::stringstream resultstream;
 
 #ifdef DEBUG
-    // Debug_printf("Substituting tag '%s'\r\n", tag.c_str());
+    // Debug_printf("Substituting tag '%s'\r\n", tagids[tagid]);
 #endif
 
-    int tagid;
-    for (tagid = 0; tagid < DEVICE_LASTTAG; tagid++)
-    {
-        if (0 == tag.compare(tagids[tagid]))
-        {
-            break;
-        }
-    }
-
     int drive_slot, host_slot;
     char disk_id;
 
@@ -533,6 +511,39 @@ const std::string substitute_tag(const std::string &tag)
     case DEVICE_HARDWARE_VER:
         resultstream << fnSystem.get_hardware_ver_str();
         break;
+    case DEVICE_HTTP_POOL:
+        {
+            auto s = MeatHttpPool::instance().stats();
+            resultstream << s.created << " opened, " << s.reused << " reused, "
+                         << s.idle << " idle, " << s.dropped << " closed";
+        }
+        break;
+    case DEVICE_HTTP_TTFB:
+        {
+            // Average time to first byte in ms, fresh connections vs pooled ones
+            auto s = MeatHttpPool::instance().stats();
+            resultstream << "new " << (s.ttfb_new_count ? s.ttfb_new_us / s.ttfb_new_count / 1000 : 0) << " ms ("
+                         << s.ttfb_new_count << "), reused "
+                         << (s.ttfb_reused_count ? s.ttfb_reused_us / s.ttfb_reused_count / 1000 : 0) << " ms ("
+                         << s.ttfb_reused_count << ")";
+        }
+        break;
+    case DEVICE_PREFETCH:
+#ifdef BUILD_IEC
+        {
+            // Read-ahead LOADs used, of those predicted, and the time they would have taken
+            auto s = LoadPrefetch::instance().stats();
+            resultstream << s.hits << " hits of " << s.predictions << " ("
+                         << (s.predictions ? s.hits * 100 / s.predictions : 0) << "%), "
+                         << s.misses << " missed, " << s.late << " late, "
+                         << s.saved_us / 1000 << " ms saved";
+        }
+#endif
+        break;
+    case DEVICE_TRACE:
+        // Latency histograms of the LOAD path, one line per operation
+        resultstream << Trace::histograms();
+        break;
     case DEVICE_PRINTER_LIST:
         // {
         //     char *result = (char *) malloc(MAX_PRINTER_LIST_BUFFER);
@@ -555,7 +566,6 @@ const std::string substitute_tag(const std::string &tag)
         // }
         break;
     default:
-        resultstream << tag;
         break;
     }
 #ifdef DEBUG
@@ -563,3 +573,270 @@ const std::string substitute_tag(const std::string &tag)
 #endif
     return resultstream.str();
 }
+
+// Tags that can't change before the next reboot, their values are worked out once
+static bool is_static_tag(int tagid)
+{
+    if (tagid >= DEVICE_DRIVE1 && tagid <= DEVICE_HOST8PREFIX)
+        return true; // not filled in on this platform
+
+    switch (tagid)
+    {
+    case DEVICE_VERSION:
+    case DEVICE_UUID:
+    case DEVICE_WIFIMAC:
+    case DEVICE_FLASH_SIZE:
+    case DEVICE_SYSSDK:
+    case DEVICE_SYSCPUREV:
+    case DEVICE_HARDWARE_VER:
+    case DEVICE_ERRMSG:
+    case DEVICE_PRINTER_LIST:
+        return true;
+    default:
+        return false;
+    }
+}
+
+const std::string substitute_tag(int tagid)
+{
+    static std::string static_values[DEVICE_LASTTAG];
+    static bool static_known[DEVICE_LASTTAG] = {};
+
+    if (tagid < 0 || tagid >= DEVICE_LASTTAG)
+        return "";
+
+    if (!is_static_tag(tagid))
+        return tag_value(tagid);
+
+    if (!static_known[tagid])
+    {
+        static_values[tagid] = tag_value(tagid);
+        static_known[tagid] = true;
+    }
+    return static_values[tagid];
+}
+
+static int find_tag(const char *name, size_t len)
+{
+    for (int tagid = 0; tagid < DEVICE_LASTTAG; tagid++)
+    {
+        if (strncmp(tagids[tagid], name, len) == 0 && tagids[tagid][len] == '\0')
+            return tagid;
+    }
+    return -1;
+}
+
+// Unknown tags are replaced with their name
+const std::string substitute_tag(const std::string &tag)
+{
+    int tagid = find_tag(tag.data(), tag.size());
+    if (tagid < 0)
+        return tag;
+    return substitute_tag(tagid);
+}
+
+// Look for anything between {{ and }} tags and turn the file into spans of
+// literal text and tags. Reads the file a chunk at a time, tags may span chunks.
+static bool compile_template(FILE *file, compiled_template &tpl)
+{
+    enum { LITERAL, OPENING, TAG, CLOSING } state = LITERAL;
+    char buf[TEMPLATE_CHUNK_SIZE];
+    char name[TEMPLATE_TAG_MAX];
+    size_t name_len = 0;
+    uint32_t pos = 0;
+    uint32_t literal = 0;   // start of the current literal text
+    uint32_t tag = 0;       // start of the current tag's {{
+
+    tpl.spans.clear();
+    auto add = [&tpl](uint32_t length, int tagid) {
+        if (length > 0)
+            tpl.spans.push_back({length, tagid});
+    };
+    auto add_name = [&name, &name_len](char c) {
+        if (name_len < TEMPLATE_TAG_MAX)
+            name[name_len] = c;
+        name_len++;
+    };
+
+    fseek(file, 0, SEEK_SET);
+    size_t count;
+    while ((count = fread(buf, 1, sizeof(buf), file)) > 0)
+    {
+        for (size_t i = 0; i < count; i++, pos++)
+        {
+            char c = buf[i];
+            switch (state)
+            {
+            case LITERAL:
+                if (c == '{')
+                    state = OPENING;
+                break;
+            case OPENING:
+                if (c == '{')
+                {
+                    state = TAG;
+                    tag = pos - 1;
+                    name_len = 0;
+                }
+                else
+                    state = LITERAL;
+                break;
+            case TAG:
+                if (c == '}')
+                    state = CLOSING;
+                else
+                    add_name(c);
+                break;
+            case CLOSING:
+                if (c != '}')
+                {
+                    // a single } is part of the tag
+                    add_name('}');
+                    add_name(c);
+                    state = TAG;
+                    break;
+                }
+                add(tag - literal, TEMPLATE_LITERAL);
+                {
+                    int tagid = (name_len <= TEMPLATE_TAG_MAX) ? find_tag(name, name_len) : -1;
+                    if (tagid >= 0)
+                    {
+                        add(pos + 1 - tag, tagid);
+                    }
+                    else
+                    {
+                        // Unknown tags are replaced with their name
+                        add(2, TEMPLATE_SKIP);
+                        add(name_len, TEMPLATE_LITERAL);
+                        add(2, TEMPLATE_SKIP);
+                    }
+                }
+                literal = pos + 1;
+                state = LITERAL;
+                break;
+            }
+        }
+    }
+    if (ferror(file))
+        return false;
+
+    // An opening tag without an ending is left as it is
+    add(pos - literal, TEMPLATE_LITERAL);
+    return true;
+}
+
+// Compiled templates by path, only used from the web server's task
+static std::map<std::string, compiled_template> templates;
+
+const compiled_template *get_template(const char *path, FILE *file)
+{
+    long size = -1;
+    time_t modified = 0;
+    struct stat st;
+    if (fstat(fileno(file), &st) == 0)
+    {
+        size = st.st_size;
+        modified = st.st_mtime;
+    }
+    else
+        size = FileSystem::filesize(file);
+
+    auto it = templates.find(path);
+    if (it != templates.end() && it->second.size == size && it->second.modified == modified)
+        return &it->second;
+
+    compiled_template &tpl = templates[path];
+    if (!compile_template(file, tpl))
+    {
+        Debug_printv("Failed to compile template [%s]", path);
+        templates.erase(path);
+        return nullptr;
+    }
+    tpl.size = size;
+    tpl.modified = modified;
+    Debug_printv("Compiled template [%s] into %u spans", path, tpl.spans.size());
+    return &tpl;
+}
+
+void compile_templates(FileSystem *fs, const char *dir)
+{
+    if (fs == nullptr || !fs->dir_open(dir, "", 0))
+        return;
+
+    std::vector<std::string> paths;
+    fsdir_entry_t *entry;
+    while ((entry = fs->dir_read()) != nullptr)
+    {
+        const char *extension = strrchr(entry->filename, '.');
+        if (!entry->isDir && extension != nullptr && is_parsable(extension + 1))
+            paths.push_back(std::string(dir) + entry->filename);
+    }
+    fs->dir_close();
+
+    for (auto &path : paths)
+    {
+        FILE *file = fs->file_open(path.c_str());
+        if (file == nullptr)
+            continue;
+        get_template(path.c_str(), file);
+        fclose(file);
+    }
+}
+
+// Literal text is copied from the file and tags are replaced with their values
+// through a single output chunk, so the page is never held in memory as a whole
+bool render_template(const compiled_template *tpl, FILE *file, const std::function<bool(const char *, size_t)> &send)
+{
+    char in[TEMPLATE_CHUNK_SIZE];
+    char out[TEMPLATE_CHUNK_SIZE];
+    size_t in_len = 0, in_pos = 0, out_len = 0;
+
+    auto emit = [&](const char *data, size_t len) {
+        while (len > 0)
+        {
+            if (out_len == sizeof(out))
+            {
+                if (!send(out, out_len))
+                    return false;
+                out_len = 0;
+            }
+            size_t n = std::min(len, sizeof(out) - out_len);
+            memcpy(out + out_len, data, n);
+            out_len += n;
+            data += n;
+            len -= n;
+        }
+        return true;
+    };
+
+    fseek(file, 0, SEEK_SET);
+    for (const template_span &span : tpl->spans)
+    {
+        if (span.tag >= 0)
+        {
+            std::string value = substitute_tag(span.tag);
+            if (!emit(value.data(), value.size()))
+                return false;
+        }
+
+        // Skip over the tag, or copy the literal text
+        uint32_t left = span.length;
+        while (left > 0)
+        {
+            if (in_pos == in_len)
+            {
+                in_len = fread(in, 1, sizeof(in), file);
+                in_pos = 0;
+                if (in_len == 0)
+                    return false; // file got shorter since it was compiled
+            }
+            size_t n = std::min((size_t)left, in_len - in_pos);
+            if (span.tag == TEMPLATE_LITERAL && !emit(in + in_pos, n))
+                return false;
+            in_pos += n;
+            left -= n;
+        }
+    }
+
+    return out_len == 0 || send(out, out_len);
+}
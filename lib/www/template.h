@@ -2,14 +2,51 @@
 #ifndef HTTP_TEMPLATES_H
 #define HTTP_TEMPLATES_H
 
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <functional>
 #include <string>
+#include <vector>
+
+#include "fnFS.h"
+
+#define TEMPLATE_CHUNK_SIZE 512 // File reads and response chunks while compiling/rendering
+#define TEMPLATE_TAG_MAX     32 // Longer tags can't be known ones
+
+#define TEMPLATE_LITERAL    -1  // Span is sent as it is in the file
+#define TEMPLATE_SKIP       -2  // Span is dropped
+
+// A parsable file compiled into spans covering it from start to end. Literal
+// text stays in the file and is read again while rendering, only the span
+// offsets are kept in memory.
+struct template_span
+{
+    uint32_t length;
+    int tag;                // tag ID, replaced by its value, or TEMPLATE_LITERAL/TEMPLATE_SKIP
+};
+
+struct compiled_template
+{
+    long size = -1;         // of the file when it was compiled, to notice it changed
+    time_t modified = 0;
+    std::vector<template_span> spans;
+};
 
 std::string format_uptime();
 long uptime_seconds();
 
 const std::string substitute_tag(const std::string &tag);
+const std::string substitute_tag(int tagid);
 
-std::string parse_contents(const std::string &contents);
 bool is_parsable(const char *extension);
 
-#endif // HTTP_TEMPLATES_H
\ No newline at end of file
+// Compiles every parsable file in dir, called when the web server starts
+void compile_templates(FileSystem *fs, const char *dir);
+// Compiled template for path, compiled again if the file changed since
+const compiled_template *get_template(const char *path, FILE *file);
+// Streams the file with tags replaced to send, in chunks of up to TEMPLATE_CHUNK_SIZE
+bool render_template(const compiled_template *tpl, FILE *file, const std::function<bool(const char *, size_t)> &send);
+
+#endif // HTTP_TEMPLATES_H
@@ -0,0 +1,199 @@
+// fnConfig binary snapshot
+//
+//   pio test -e native -f native/test_config
+//
+
+#include "unity.h"
+
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+
+// the snapshot code is private to fnConfig
+#define private public
+#include "../lib/config/fnConfig.h"
+#undef private
+
+#include "../lib/config/fnConfig.cpp"
+#include "../lib/config/fnc_snapshot.cpp"
+
+static const char *INI_PATH = "/tmp/test_config.ini";
+static const char *SNAPSHOT_PATH = "/tmp/test_config.bin";
+
+static const std::string INI = "[General]\r\ndevicename=test\r\n";
+
+static void fill(fnConfig &c)
+{
+    c._general.devicename = "kitchen";
+    c._general.timezone = "CET-1CEST,M3.5.0,M10.5.0/3";
+    c._general.hsio_index = 8;
+    c._general.rotation_sounds = false;
+    c._general.boot_mode = 1;
+    c._wifi.ssid = "meatnet";
+    c._wifi.passphrase = std::string("p\0ss", 4);
+    c._wifi_stored[2].ssid = "backup";
+    c._wifi_stored[2].enabled = true;
+    c._bt.bt_baud = 57600;
+    strcpy(c._network.sntpserver, "time.example.org");
+    c._host_slots[1].type = fnConfig::HOSTTYPE_TNFS;
+    c._host_slots[1].name = "tnfs.example.org";
+    c._mount_slots[7].host_slot = 1;
+    c._mount_slots[7].mode = fnConfig::MOUNTMODE_WRITE;
+    c._mount_slots[7].path = "/games/disk.d64";
+    c._tape_slots[0].host_slot = 0;
+    c._phonebook_slots[15].phnumber = "5551234";
+    c._phonebook_slots[15].hostname = "bbs.example.org";
+    c._phonebook_slots[15].port = "6400";
+    c._cpm.ccp = "ccp.bin";
+    c._denable.device_3_enabled = false;
+    c._boip.host = "boip.example.org";
+    c._boip.port = 2000;
+}
+
+static void check(fnConfig &c)
+{
+    TEST_ASSERT_EQUAL_STRING("kitchen", c._general.devicename.c_str());
+    TEST_ASSERT_EQUAL_STRING("CET-1CEST,M3.5.0,M10.5.0/3", c._general.timezone.c_str());
+    TEST_ASSERT_EQUAL(8, c._general.hsio_index);
+    TEST_ASSERT_FALSE(c._general.rotation_sounds);
+    TEST_ASSERT_EQUAL(1, c._general.boot_mode);
+    TEST_ASSERT_EQUAL_STRING("meatnet", c._wifi.ssid.c_str());
+    TEST_ASSERT_TRUE(c._wifi.passphrase == std::string("p\0ss", 4));
+    TEST_ASSERT_EQUAL_STRING("backup", c._wifi_stored[2].ssid.c_str());
+    TEST_ASSERT_TRUE(c._wifi_stored[2].enabled);
+    TEST_ASSERT_FALSE(c._wifi_stored[3].enabled);
+    TEST_ASSERT_EQUAL(57600, c._bt.bt_baud);
+    TEST_ASSERT_EQUAL_STRING("time.example.org", c._network.sntpserver);
+    TEST_ASSERT_EQUAL(fnConfig::HOSTTYPE_TNFS, c._host_slots[1].type);
+    TEST_ASSERT_EQUAL_STRING("tnfs.example.org", c._host_slots[1].name.c_str());
+    TEST_ASSERT_EQUAL(1, c._mount_slots[7].host_slot);
+    TEST_ASSERT_EQUAL(fnConfig::MOUNTMODE_WRITE, c._mount_slots[7].mode);
+    TEST_ASSERT_EQUAL_STRING("/games/disk.d64", c._mount_slots[7].path.c_str());
+    TEST_ASSERT_EQUAL(HOST_SLOT_INVALID, c._mount_slots[0].host_slot);
+    TEST_ASSERT_EQUAL(0, c._tape_slots[0].host_slot);
+    TEST_ASSERT_EQUAL_STRING("bbs.example.org", c._phonebook_slots[15].hostname.c_str());
+    TEST_ASSERT_EQUAL_STRING("6400", c._phonebook_slots[15].port.c_str());
+    TEST_ASSERT_EQUAL_STRING("ccp.bin", c._cpm.ccp.c_str());
+    TEST_ASSERT_FALSE(c._denable.device_3_enabled);
+    TEST_ASSERT_TRUE(c._denable.device_4_enabled);
+    TEST_ASSERT_EQUAL_STRING("boip.example.org", c._boip.host.c_str());
+    TEST_ASSERT_EQUAL(2000, c._boip.port);
+}
+
+void setUp(void)
+{
+    remove(SNAPSHOT_PATH);
+}
+
+void tearDown(void)
+{
+    remove(SNAPSHOT_PATH);
+}
+
+void test_crc32()
+{
+    TEST_ASSERT_EQUAL_HEX32(0xCBF43926, fnConfig::_crc32("123456789", 9));
+    TEST_ASSERT_EQUAL_HEX32(0, fnConfig::_crc32("", 0));
+}
+
+void test_snapshot_path()
+{
+    fnConfig c;
+    c._general.config_file_path = INI_PATH;
+    TEST_ASSERT_EQUAL_STRING(SNAPSHOT_PATH, c._snapshot_path().c_str());
+    c._general.config_file_path = "/tmp/dir.d/fujinet";
+    TEST_ASSERT_EQUAL_STRING("/tmp/dir.d/fujinet.bin", c._snapshot_path().c_str());
+}
+
+void test_encode_decode()
+{
+    fnConfig a, b;
+    fill(a);
+    std::string payload = a._snapshot_encode();
+
+    TEST_ASSERT_TRUE(b._snapshot_decode(payload));
+    check(b);
+    TEST_ASSERT_TRUE(payload == b._snapshot_encode());
+
+    // anything short or long is refused
+    fnConfig c;
+    TEST_ASSERT_FALSE(c._snapshot_decode(payload.substr(0, payload.size() - 1)));
+    TEST_ASSERT_FALSE(c._snapshot_decode(payload + "x"));
+    TEST_ASSERT_FALSE(c._snapshot_decode(""));
+}
+
+void test_store_load()
+{
+    fnConfig a;
+    a._general.config_file_path = INI_PATH;
+    fill(a);
+    a._snapshot_store(INI, a._snapshot_encode());
+
+    fnConfig b;
+    b._general.config_file_path = INI_PATH;
+    TEST_ASSERT_TRUE(b._snapshot_load(INI));
+    check(b);
+}
+
+void test_stale_snapshot_ignored()
+{
+    fnConfig a;
+    a._general.config_file_path = INI_PATH;
+    fill(a);
+    a._snapshot_store(INI, a._snapshot_encode());
+
+    // the INI was edited since
+    fnConfig b;
+    b._general.config_file_path = INI_PATH;
+    TEST_ASSERT_FALSE(b._snapshot_load(INI + "timezone=UTC\r\n"));
+    std::string edited = INI;
+    edited[edited.size() - 3] = 'x';
+    TEST_ASSERT_FALSE(b._snapshot_load(edited));
+    TEST_ASSERT_EQUAL_STRING("Meatloaf", b._general.devicename.c_str());
+}
+
+void test_damaged_snapshot_ignored()
+{
+    fnConfig a;
+    a._general.config_file_path = INI_PATH;
+    fill(a);
+    a._snapshot_store(INI, a._snapshot_encode());
+
+    // flip a byte in the payload
+    FILE *f = fopen(SNAPSHOT_PATH, "r+b");
+    TEST_ASSERT_NOT_NULL(f);
+    fseek(f, sizeof(config_snapshot_header) + 4, SEEK_SET);
+    int c = fgetc(f);
+    fseek(f, sizeof(config_snapshot_header) + 4, SEEK_SET);
+    fputc(c ^ 0x20, f);
+    fclose(f);
+
+    fnConfig b;
+    b._general.config_file_path = INI_PATH;
+    TEST_ASSERT_FALSE(b._snapshot_load(INI));
+
+    // and one cut short
+    a._snapshot_store(INI, a._snapshot_encode().substr(0, 10));
+    TEST_ASSERT_FALSE(b._snapshot_load(INI));
+    TEST_ASSERT_EQUAL_STRING("Meatloaf", b._general.devicename.c_str());
+}
+
+void process()
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_crc32);
+    RUN_TEST(test_snapshot_path);
+    RUN_TEST(test_encode_decode);
+    RUN_TEST(test_store_load);
+    RUN_TEST(test_stale_snapshot_ignored);
+    RUN_TEST(test_damaged_snapshot_ignored);
+
+    UNITY_END();
+}
+
+int main(int argc, char **argv)
+{
+    process();
+}
@@ -0,0 +1,581 @@
+// Host benchmarks for the meatloaf media layer
+//
+// Builds a fixed corpus of disk, tape and archive images in CORPUS_PATH and
+// times the operations the bus depends on for each format: listing the
+// directory, opening a file by exact name and by wildcard, and reading a
+// whole file. Every case checks its result, so a broken reader fails the
+// test instead of reporting a fast number.
+//
+//   pio test -e native -f native/test_meatloaf_bench
+//
+// Output follows Google Benchmark's console format, one line per case:
+//
+//   bench.d64/directory            371566 ns        539 iterations
+//   bench.d64/read                 110608 ns       1809 iterations     217.0 MB/s
+//
+// The corpus is generated from a fixed seed, so numbers from different
+// builds on the same machine can be compared directly.
+//
+
+#include "unity.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "../lib/meatloaf/meatloaf.h"
+
+#define CORPUS_PATH         "/tmp/meatloaf_bench"
+#define CORPUS_FILES        24
+#define CORPUS_LOAD_ADDRESS 0x0801
+
+// Each case runs for at least this long
+#define BENCH_MIN_NS        200000000ULL
+#define BENCH_MIN_ITERATIONS 3
+
+struct CorpusFile {
+    std::string name;
+    std::vector<uint8_t> data; // load address first
+};
+
+static std::vector<CorpusFile> corpus;
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+
+/********************************************************
+ * Corpus
+ ********************************************************/
+
+static void corpus_files()
+{
+    // FILE00 is the big one the read cases use, the rest vary in size
+    uint32_t seed = 0x6d656174;
+    for (int i = 0; i < CORPUS_FILES; i++)
+    {
+        CorpusFile f;
+        char name[8];
+        snprintf(name, sizeof(name), "FILE%02d", i);
+        f.name = name;
+
+        uint32_t size = (i == 0) ? 24000 : 100 + (i * 1237) % 3000;
+        f.data.resize(size);
+        f.data[0] = CORPUS_LOAD_ADDRESS & 0xFF;
+        f.data[1] = CORPUS_LOAD_ADDRESS >> 8;
+        for (uint32_t b = 2; b < size; b++)
+        {
+            seed = seed * 1103515245 + 12345;
+            f.data[b] = seed >> 16;
+        }
+
+        corpus.push_back(f);
+    }
+}
+
+static void corpus_name(uint8_t *dst, const std::string &name, uint8_t pad)
+{
+    memset(dst, pad, 16);
+    memcpy(dst, name.data(), name.size());
+}
+
+static void corpus_write(const std::string &image, const std::vector<uint8_t> &data)
+{
+    FILE *f = fopen((std::string(CORPUS_PATH) + "/" + image).c_str(), "wb");
+    TEST_ASSERT_NOT_NULL(f);
+    TEST_ASSERT_EQUAL(data.size(), fwrite(data.data(), 1, data.size(), f));
+    fclose(f);
+}
+
+// 1541/1571/1581 layout: header and directory on their own track, the files
+// in 254 byte blocks on the tracks below it
+struct CbmGeometry {
+    const char *image;
+    uint32_t size;
+    uint8_t data_sectors;       // sectors per track below the directory track
+    uint8_t dir_track;
+    uint32_t dir_block;         // first block of the directory track
+    uint8_t header_sector;
+    uint8_t header_offset;
+    uint8_t dir_sector;
+};
+
+static void corpus_cbm(const CbmGeometry &g)
+{
+    std::vector<uint8_t> img(g.size, 0);
+    auto block = [&](uint8_t track, uint8_t sector) {
+        uint32_t index = (track == g.dir_track) ? g.dir_block + sector : (track - 1) * g.data_sectors + sector;
+        return &img[index * 256];
+    };
+
+    uint8_t *header = block(g.dir_track, g.header_sector) + g.header_offset;
+    corpus_name(header, "MEATLOAF BENCH", 0xA0);
+    memcpy(header + 18, "ML 2A", 5);
+
+    uint8_t track = 1, sector = 0;
+    uint8_t dir_sector = g.dir_sector;
+    uint8_t *dir = nullptr;
+    for (size_t i = 0; i < corpus.size(); i++)
+    {
+        if (i % 8 == 0)
+        {
+            uint8_t *next = block(g.dir_track, dir_sector);
+            if (dir)
+            {
+                dir[0] = g.dir_track;
+                dir[1] = dir_sector;
+            }
+            dir = next;
+            dir[0] = 0;
+            dir[1] = 0xFF;
+            dir_sector += 3;
+        }
+
+        auto &f = corpus[i];
+        uint8_t *e = dir + (i % 8) * 32;
+        uint16_t blocks = (f.data.size() + 253) / 254;
+        e[2] = 0x82;
+        e[3] = track;
+        e[4] = sector;
+        corpus_name(e + 5, f.name, 0xA0);
+        e[30] = blocks & 0xFF;
+        e[31] = blocks >> 8;
+
+        for (uint16_t b = 0; b < blocks; b++)
+        {
+            uint8_t *s = block(track, sector);
+            uint32_t offset = b * 254;
+            uint32_t len = std::min<uint32_t>(254, f.data.size() - offset);
+            memcpy(s + 2, &f.data[offset], len);
+
+            if (++sector == g.data_sectors)
+            {
+                track++;
+                sector = 0;
+            }
+            TEST_ASSERT_TRUE(track < g.dir_track);
+
+            if (b + 1 < blocks)
+            {
+                s[0] = track;
+                s[1] = sector;
+            }
+            else
+            {
+                s[0] = 0;
+                s[1] = len + 1;
+            }
+        }
+    }
+
+    corpus_write(g.image, img);
+}
+
+static void corpus_t64()
+{
+    std::vector<uint8_t> img(0x40 + (corpus.size() + 1) * 32, 0);
+    memcpy(&img[0], "C64S tape image file", 20);
+    img[0x20] = 0x01;
+    img[0x22] = corpus.size() + 1;
+    img[0x24] = corpus.size();
+    corpus_name(&img[0x28], "MEATLOAF BENCH", 0x20);
+
+    for (size_t i = 0; i < corpus.size(); i++)
+    {
+        auto &f = corpus[i];
+        uint8_t *e = &img[0x40 + i * 32];
+        uint32_t offset = img.size();
+        uint16_t end = CORPUS_LOAD_ADDRESS + f.data.size() - 2;
+        e[0] = 0x01;
+        e[1] = 0x82;
+        e[2] = f.data[0];
+        e[3] = f.data[1];
+        e[4] = end & 0xFF;
+        e[5] = end >> 8;
+        memcpy(e + 8, &offset, 4);
+        corpus_name(e + 16, f.name, 0xA0);
+
+        img.insert(img.end(), f.data.begin() + 2, f.data.end());
+    }
+
+    corpus_write("bench.t64", img);
+}
+
+// CBM ROM loader pulses, in TAP units
+static void tap_pulses(std::vector<uint8_t> &img, char a, char b)
+{
+    for (char p : { a, b })
+        img.push_back(p == 'S' ? 0x30 : (p == 'M' ? 0x42 : 0x56));
+}
+
+static void tap_byte(std::vector<uint8_t> &img, uint8_t value)
+{
+    uint8_t parity = 1;
+    tap_pulses(img, 'L', 'M');
+    for (int bit = 0; bit < 8; bit++)
+    {
+        uint8_t v = (value >> bit) & 1;
+        tap_pulses(img, v ? 'M' : 'S', v ? 'S' : 'M');
+        parity ^= v;
+    }
+    tap_pulses(img, parity ? 'M' : 'S', parity ? 'S' : 'M');
+}
+
+// Both copies of a block, as the ROM saves it
+static void tap_block(std::vector<uint8_t> &img, const uint8_t *data, size_t size)
+{
+    for (uint8_t copy = 0; copy < 2; copy++)
+    {
+        img.insert(img.end(), copy ? 0x4F : 0x800, 0x30);
+        for (uint8_t count = copy ? 0x09 : 0x89; count & 0x7F; count--)
+            tap_byte(img, count);
+
+        uint8_t checksum = 0;
+        for (size_t i = 0; i < size; i++)
+        {
+            tap_byte(img, data[i]);
+            checksum ^= data[i];
+        }
+        tap_byte(img, checksum);
+        tap_pulses(img, 'L', 'S');
+    }
+    img.insert(img.end(), 0x4E, 0x30);
+    img.push_back(0x00);
+}
+
+static void corpus_tap()
+{
+    std::vector<uint8_t> img(0x14, 0);
+    memcpy(&img[0], "C64-TAPE-RAW", 12);
+
+    for (auto &f : corpus)
+    {
+        uint8_t header[192];
+        uint16_t end = CORPUS_LOAD_ADDRESS + f.data.size() - 2;
+        memset(header, 0x20, sizeof(header));
+        header[0] = 0x01;
+        header[1] = f.data[0];
+        header[2] = f.data[1];
+        header[3] = end & 0xFF;
+        header[4] = end >> 8;
+        corpus_name(header + 5, f.name, 0x20);
+
+        tap_block(img, header, sizeof(header));
+        tap_block(img, f.data.data() + 2, f.data.size() - 2);
+    }
+
+    uint32_t size = img.size() - 0x14;
+    memcpy(&img[0x10], &size, 4);
+    corpus_write("bench.tap", img);
+}
+
+static void corpus_tcrt()
+{
+    // File data is addressed in 256 byte steps from 0xD8
+    std::vector<uint8_t> img(0xD8 + 0x400, 0);
+    memcpy(&img[0], "tapecartImage\r\n\x1a", 16);
+    corpus_name(&img[0x18], "MEATLOAF BENCH", 0x00);
+
+    for (size_t i = 0; i < corpus.size(); i++)
+    {
+        auto &f = corpus[i];
+        uint8_t *e = &img[0xE7 + i * 32];
+        uint32_t start = (img.size() - 0xD8) >> 8;
+        uint32_t size = f.data.size() - 2;
+        corpus_name(e, f.name, 0x00);
+        e[16] = 0x00;
+        e[17] = start & 0xFF;
+        e[18] = start >> 8;
+        e[19] = size & 0xFF;
+        e[20] = size >> 8;
+        e[21] = size >> 16;
+        e[22] = f.data[0];
+        e[23] = f.data[1];
+
+        img.insert(img.end(), f.data.begin() + 2, f.data.end());
+        img.resize(0xD8 + (((img.size() - 0xD8) + 255) & ~255));
+    }
+    img[0xE7 + corpus.size() * 32 + 16] = 0xFF;
+
+    corpus_write("bench.tcrt", img);
+}
+
+static void crt_chip(std::vector<uint8_t> &img, uint16_t bank, uint16_t load_address, const uint8_t *data)
+{
+    uint8_t chip[16] = { 'C', 'H', 'I', 'P', 0x00, 0x00, 0x20, 0x10, 0x00, 0x02 };
+    chip[10] = bank >> 8;
+    chip[11] = bank & 0xFF;
+    chip[12] = load_address >> 8;
+    chip[13] = load_address & 0xFF;
+    chip[14] = 0x20;
+    img.insert(img.end(), chip, chip + sizeof(chip));
+    img.insert(img.end(), data, data + 0x2000);
+}
+
+static void corpus_crt()
+{
+    // EasyFlash, the directory in bank 0 and the files packed from bank 1 on
+    // so the larger ones cross 8K and bank boundaries
+    std::vector<uint8_t> rom(0x4000, 0xFF);
+    std::vector<uint8_t> dir(0x2000, 0xFF);
+    for (size_t i = 0; i < corpus.size(); i++)
+    {
+        auto &f = corpus[i];
+        uint8_t *e = &dir[0x1800 + i * 24];
+        uint32_t address = rom.size();
+        corpus_name(e, f.name, 0x00);
+        e[16] = 0x01;
+        e[17] = address / 0x4000;
+        e[18] = 0x00;
+        e[19] = address & 0xFF;
+        e[20] = (address >> 8) & 0x3F;
+        e[21] = f.data.size() & 0xFF;
+        e[22] = f.data.size() >> 8;
+        e[23] = f.data.size() >> 16;
+
+        rom.insert(rom.end(), f.data.begin(), f.data.end());
+    }
+    dir[0x1800 + corpus.size() * 24 + 16] = 0x1F;
+    memcpy(&rom[0], dir.data(), dir.size());
+    rom.resize((rom.size() + 0x3FFF) & ~0x3FFF, 0xFF);
+
+    std::vector<uint8_t> img(0x40, 0);
+    memcpy(&img[0], "C64 CARTRIDGE   ", 16);
+    img[0x13] = 0x40;
+    img[0x14] = 0x01;
+    img[0x17] = 32;
+    img[0x18] = 0x01;
+    memcpy(&img[0x20], "MEATLOAF BENCH", 14);
+
+    for (size_t bank = 0; bank < rom.size() / 0x4000; bank++)
+    {
+        crt_chip(img, bank, 0x8000, &rom[bank * 0x4000]);
+        crt_chip(img, bank, 0xA000, &rom[bank * 0x4000 + 0x2000]);
+    }
+
+    corpus_write("bench.crt", img);
+}
+
+static void corpus_ark()
+{
+    uint32_t header = corpus.size() * 29 + 1;
+    std::vector<uint8_t> img(((header + 253) / 254) * 254, 0);
+    img[0] = corpus.size();
+
+    for (size_t i = 0; i < corpus.size(); i++)
+    {
+        auto &f = corpus[i];
+        uint8_t *e = &img[1 + i * 29];
+        uint16_t blocks = (f.data.size() + 253) / 254;
+        e[0] = 0x82;
+        e[1] = f.data.size() - (blocks - 1) * 254 + 1;
+        corpus_name(e + 2, f.name, 0xA0);
+        e[27] = blocks & 0xFF;
+        e[28] = blocks >> 8;
+
+        size_t offset = img.size();
+        img.resize(offset + blocks * 254, 0);
+        memcpy(&img[offset], f.data.data(), f.data.size());
+    }
+
+    corpus_write("bench.ark", img);
+}
+
+static void corpus_lbr()
+{
+    std::string text = "DWB " + std::to_string(corpus.size()) + " \r";
+    for (auto &f : corpus)
+        text += f.name + "\rP\r " + std::to_string(f.data.size()) + " \r";
+
+    std::vector<uint8_t> img(text.begin(), text.end());
+    for (auto &f : corpus)
+        img.insert(img.end(), f.data.begin(), f.data.end());
+
+    corpus_write("bench.lbr", img);
+}
+
+static void corpus_build()
+{
+    if (!corpus.empty())
+        return;
+
+    corpus_files();
+    mkdir(CORPUS_PATH, 0755);
+
+    corpus_cbm({ "bench.d64", 174848, 21, 18, 357, 0, 0x90, 1 });
+    corpus_cbm({ "bench.d71", 349696, 21, 18, 357, 0, 0x90, 1 });
+    corpus_cbm({ "bench.d81", 819200, 40, 40, 1560, 0, 0x04, 3 });
+    corpus_t64();
+    corpus_tap();
+    corpus_tcrt();
+    corpus_crt();
+    corpus_ark();
+    corpus_lbr();
+
+    // The same program as a plain file, for a baseline
+    corpus_write("FILE00.prg", corpus[0].data);
+}
+
+
+/********************************************************
+ * Benchmark runner
+ ********************************************************/
+
+static void bench(const std::string &name, uint64_t bytes, std::function<void()> fn)
+{
+    using clock = std::chrono::steady_clock;
+
+    // One untimed run, so the first iteration doesn't pay for the image cache
+    fn();
+
+    uint64_t iterations = 0;
+    uint64_t elapsed = 0;
+    auto start = clock::now();
+    while (elapsed < BENCH_MIN_NS || iterations < BENCH_MIN_ITERATIONS)
+    {
+        fn();
+        iterations++;
+        elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+    }
+
+    uint64_t per = elapsed / iterations;
+    if (bytes)
+        printf("%-24s %12llu ns %10llu iterations %9.1f MB/s\n", name.c_str(),
+               (unsigned long long)per, (unsigned long long)iterations, (double)bytes * 1000 / per);
+    else
+        printf("%-24s %12llu ns %10llu iterations\n", name.c_str(),
+               (unsigned long long)per, (unsigned long long)iterations);
+}
+
+static std::string bench_url(const std::string &image, const std::string &file)
+{
+    std::string url = CORPUS_PATH;
+    if (!image.empty())
+        url += "/" + image;
+    return url + "/" + file;
+}
+
+static void bench_directory(const std::string &image)
+{
+    bench(image + "/directory", 0, [&]() {
+        std::unique_ptr<MFile> dir(MFSOwner::File(bench_url(image, "")));
+        TEST_ASSERT_NOT_NULL(dir);
+        TEST_ASSERT_TRUE(dir->rewindDirectory());
+
+        int count = 0;
+        std::unique_ptr<MFile> entry(dir->getNextFileInDir());
+        while (entry != nullptr)
+        {
+            count++;
+            entry.reset(dir->getNextFileInDir());
+        }
+        TEST_ASSERT_EQUAL(CORPUS_FILES, count);
+    });
+}
+
+static void bench_open(const std::string &image, const std::string &pattern, const char *label, size_t expect)
+{
+    bench(image + "/" + label, 0, [&]() {
+        std::unique_ptr<MFile> file(MFSOwner::File(bench_url(image, pattern)));
+        TEST_ASSERT_NOT_NULL(file);
+
+        std::unique_ptr<MStream> stream(file->getSourceStream());
+        TEST_ASSERT_NOT_NULL(stream);
+        TEST_ASSERT_EQUAL(corpus[expect].data.size(), stream->size());
+    });
+}
+
+static void bench_read(const std::string &name, const std::string &image, const std::string &file)
+{
+    auto &expect = corpus[0].data;
+
+    bench(name, expect.size(), [&]() {
+        std::unique_ptr<MFile> f(MFSOwner::File(bench_url(image, file)));
+        TEST_ASSERT_NOT_NULL(f);
+
+        std::unique_ptr<MStream> stream(f->getSourceStream());
+        TEST_ASSERT_NOT_NULL(stream);
+
+        // The load address one byte at a time, as the bus asks for it
+        std::vector<uint8_t> data(expect.size());
+        uint32_t count = 0;
+        while (count < data.size())
+        {
+            uint32_t want = (count < 2) ? 1 : std::min<uint32_t>(256, data.size() - count);
+            uint32_t len = stream->read(&data[count], want);
+            if (len < 1)
+                break;
+            count += std::min(len, want);
+        }
+
+        TEST_ASSERT_EQUAL(expect.size(), count);
+        TEST_ASSERT_EQUAL_MEMORY(expect.data(), data.data(), expect.size());
+    });
+}
+
+static void bench_image(const std::string &image)
+{
+    corpus_build();
+
+    bench_directory(image);
+    // Names arrive from the bus already converted from PETSCII
+    bench_open(image, "file17", "open", 17);
+    bench_open(image, "file2?", "open_wildcard", 20);
+    bench_read(image + "/read", image, "file00");
+}
+
+
+/********************************************************
+ * Cases
+ ********************************************************/
+
+void test_bench_flash(void)
+{
+    corpus_build();
+    bench_read("flash/read", "", "FILE00.prg");
+}
+
+void test_bench_d64(void)  { bench_image("bench.d64"); }
+void test_bench_d71(void)  { bench_image("bench.d71"); }
+void test_bench_d81(void)  { bench_image("bench.d81"); }
+void test_bench_t64(void)  { bench_image("bench.t64"); }
+void test_bench_tap(void)  { bench_image("bench.tap"); }
+void test_bench_tcrt(void) { bench_image("bench.tcrt"); }
+void test_bench_crt(void)  { bench_image("bench.crt"); }
+void test_bench_ark(void)  { bench_image("bench.ark"); }
+void test_bench_lbr(void)  { bench_image("bench.lbr"); }
+
+
+void process()
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_bench_flash);
+    RUN_TEST(test_bench_d64);
+    RUN_TEST(test_bench_d71);
+    RUN_TEST(test_bench_d81);
+    RUN_TEST(test_bench_t64);
+    RUN_TEST(test_bench_tap);
+    RUN_TEST(test_bench_tcrt);
+    RUN_TEST(test_bench_crt);
+    RUN_TEST(test_bench_ark);
+    RUN_TEST(test_bench_lbr);
+
+    UNITY_END();
+}
+
+int main(int argc, char **argv)
+{
+    process();
+}
@@ -0,0 +1,187 @@
+#include "unity.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+
+//
+// Z80 core exerciser and benchmark
+//
+// test_z80_exerciser runs a built in program in the style of zexdoc: it puts
+// the ALU instructions through every combination of operands, sums the
+// resulting AF values and compares the sum with the one the core has always
+// produced. It runs a known number of T-states, so it also reports the
+// emulated clock speed.
+//
+// test_z80_zexdoc runs the real zexdoc.com or zexall.com when the ZEXDOC
+// environment variable points to one.
+//
+
+#include "../lib/runcpm/globals.h"
+
+extern "C" void _puts(const char* str) { fputs(str, stdout); }
+void _HardwareOut(const uint32 Port, const uint32 Value) {}
+uint32 _HardwareIn(const uint32 Port) { return 0xff; }
+
+#include "../lib/runcpm/cpu.h"
+
+static std::string console;
+
+// BDOS: only console output, which is all the exercisers use
+extern "C" void _Bdos(void)
+{
+    std::string out;
+
+    switch (LOW_REGISTER(BC))
+    {
+    case 2:
+        out += (char)LOW_REGISTER(DE);
+        break;
+    case 9:
+        for (uint16 i = DE; RAM[i] != '$'; i++)
+            out += (char)RAM[i];
+        break;
+    }
+
+    fputs(out.c_str(), stdout);
+    console += out;
+}
+
+// BIOS: only BOOT, at $0000, which ends the run
+extern "C" void _Bios(void)
+{
+    if (LOW_REGISTER(PCX) == 0x00)
+        Status = 1;
+}
+
+static void load(const uint8 *code, size_t len)
+{
+    memset(RAM, 0, MEMSIZE);
+
+    // $0000 OUT ($FF),A          BOOT
+    // $0005 JP $FE00             BDOS, also tells the program where memory ends
+    // $FE00 IN A,($FF) / RET
+    static const uint8 page0[] = {0xd3, 0xff, 0x00, 0x00, 0x00, 0xc3, 0x00, 0xfe};
+    static const uint8 bdos[] = {0xdb, 0xff, 0xc9};
+    memcpy(RAM, page0, sizeof(page0));
+    memcpy(RAM + 0xfe00, bdos, sizeof(bdos));
+    memcpy(RAM + 0x0100, code, len);
+
+    console.clear();
+    Z80reset();
+    PC = 0x0100;
+    SP = 0xfe00;
+}
+
+static double seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void setUp(void)
+{
+    if (RAM == nullptr)
+        RAM = (uint8 *)malloc(MEMSIZE);
+}
+
+void tearDown(void)
+{
+}
+
+// For D = 0..255, E = 0..255: A = D op E for each op, AF summed into IY
+static const uint8 exerciser[] = {
+    0xfd, 0x21, 0x00, 0x00,         // 0100 LD IY,0             14
+    0x11, 0x00, 0x00,               // 0104 LD DE,0             10
+                                    // 0107 loop:
+    0x7a, 0x83,                     //      LD A,D / ADD A,E    8
+    0xf5, 0xc1, 0xfd, 0x09,         //      PUSH AF / POP BC / ADD IY,BC    36
+    0x7a, 0x8b,                     //      ADC A,E             8
+    0xf5, 0xc1, 0xfd, 0x09,
+    0x7a, 0x93,                     //      SUB E               8
+    0xf5, 0xc1, 0xfd, 0x09,
+    0x7a, 0x9b,                     //      SBC A,E             8
+    0xf5, 0xc1, 0xfd, 0x09,
+    0x7a, 0xa3,                     //      AND E               8
+    0xf5, 0xc1, 0xfd, 0x09,
+    0x7a, 0xab,                     //      XOR E               8
+    0xf5, 0xc1, 0xfd, 0x09,
+    0x7a, 0xb3,                     //      OR E                8
+    0xf5, 0xc1, 0xfd, 0x09,
+    0x7a, 0xbb,                     //      CP E                8
+    0xf5, 0xc1, 0xfd, 0x09,
+    0x7a, 0x27,                     //      DAA                 8
+    0xf5, 0xc1, 0xfd, 0x09,
+    0x7a, 0xed, 0x44,               //      NEG                 12
+    0xf5, 0xc1, 0xfd, 0x09,
+    0x1c,                           //      INC E               4
+    0xc2, 0x07, 0x01,               //      JP NZ,loop          10
+    0x14,                           //      INC D               4
+    0xc2, 0x07, 0x01,               //      JP NZ,loop          10
+    0xfd, 0x22, 0x80, 0x00,         //      LD ($0080),IY       20
+    0xc3, 0x00, 0x00,               //      JP 0                10 + 11 for the OUT
+};
+#define EXERCISER_TSTATES   (14 + 10 + 65536 * (84 + 10 * 36 + 14) + 256 * 14 + 20 + 10 + 11)
+#define EXERCISER_SUM       0xb707
+#define EXERCISER_PASSES    32
+
+void test_z80_exerciser(void)
+{
+    double start = seconds();
+
+    for (int pass = 0; pass < EXERCISER_PASSES; pass++)
+    {
+        load(exerciser, sizeof(exerciser));
+        Z80run();
+
+        TEST_ASSERT_EQUAL_INT(1, Status);
+        TEST_ASSERT_EQUAL_HEX16(EXERCISER_SUM, RAM[0x80] | (RAM[0x81] << 8));
+    }
+
+    double elapsed = seconds() - start;
+    printf("%d T-states in %.3fs, %.1f MHz\r\n", EXERCISER_PASSES * EXERCISER_TSTATES, elapsed,
+           EXERCISER_PASSES * (double)EXERCISER_TSTATES / elapsed / 1e6);
+}
+
+void test_z80_zexdoc(void)
+{
+    const char *path = getenv("ZEXDOC");
+    if (path == nullptr)
+        TEST_IGNORE_MESSAGE("set ZEXDOC to the path of zexdoc.com or zexall.com");
+
+    FILE *f = fopen(path, "rb");
+    if (f == nullptr)
+        TEST_IGNORE_MESSAGE("can't open ZEXDOC");
+
+    static uint8 code[0xfe00 - 0x0100];
+    size_t len = fread(code, 1, sizeof(code), f);
+    fclose(f);
+
+    load(code, len);
+    double start = seconds();
+    Z80run();
+    double elapsed = seconds() - start;
+
+    printf("\r\n%s finished in %.1fs\r\n", path, elapsed);
+    TEST_ASSERT_EQUAL_INT(1, Status);
+    TEST_ASSERT_TRUE(console.find("Tests complete") != std::string::npos);
+    TEST_ASSERT_TRUE(console.find("ERROR") == std::string::npos);
+}
+
+void process()
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_z80_exerciser);
+    RUN_TEST(test_z80_zexdoc);
+
+    UNITY_END();
+}
+
+int main(int argc, char **argv)
+{
+    process();
+}
@@ -0,0 +1,270 @@
+// fnTaskManager worker pool on std::thread
+//
+//   pio test -e native -f native/test_taskmanager
+//
+
+#include "unity.h"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../lib/task/fnTaskManager.h"
+
+// Blocks its worker until released, then finishes
+class GateTask : public fnTask
+{
+public:
+    std::atomic<bool> open{false};
+    std::atomic<bool> entered{false};
+
+protected:
+    int start() override { entered = true; return 0; };
+    int step() override
+    {
+        while (!open)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return 1;
+    };
+};
+
+// Records its name when started, runs a number of steps then finishes,
+// fails or keeps going forever (count < 0)
+static std::mutex log_mutex;
+static std::vector<std::string> started;
+static std::vector<std::string> aborted;
+static std::vector<std::string> completed;
+static std::thread::id caller;
+static std::atomic<bool> ran_on_caller{false};
+
+class LogTask : public fnTask
+{
+public:
+    LogTask(std::string name, int count, bool fail = false) : _name(name), _count(count), _fail(fail) {};
+    std::string _name;
+    std::atomic<int> _steps{0};
+
+protected:
+    int start() override
+    {
+        if (std::this_thread::get_id() == caller)
+            ran_on_caller = true;
+        std::lock_guard<std::mutex> lock(log_mutex);
+        started.push_back(_name);
+        return 0;
+    };
+    int step() override
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if (_count >= 0 && ++_steps >= _count)
+            return _fail ? -1 : 1;
+        if (_count < 0)
+            ++_steps;
+        return 0;
+    };
+    int abort() override
+    {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        aborted.push_back(_name);
+        return 0;
+    };
+
+private:
+    int _count;
+    bool _fail;
+};
+
+// Holds its worker inside pause() until released
+class SlowPauseTask : public LogTask
+{
+public:
+    SlowPauseTask(std::string name) : LogTask(name, -1) {};
+    std::atomic<bool> pausing{false};
+    std::atomic<bool> release{false};
+
+protected:
+    int pause() override
+    {
+        pausing = true;
+        while (!release)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return 0;
+    };
+};
+
+void log_done(fnTask *t, fnTask::task_state state)
+{
+    if (state != fnTask::TASK_DONE || t->get_done_reason() != fnTask::TASK_COMPLETED)
+        return;
+    std::lock_guard<std::mutex> lock(log_mutex);
+    completed.push_back(((LogTask *)t)->_name);
+}
+
+static void wait_for(std::function<bool()> cond)
+{
+    for (int i = 0; i < 2000 && !cond(); i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    TEST_ASSERT_TRUE(cond());
+}
+
+void setUp(void)
+{
+    std::lock_guard<std::mutex> lock(log_mutex);
+    started.clear();
+    aborted.clear();
+    completed.clear();
+    caller = std::this_thread::get_id();
+    ran_on_caller = false;
+}
+
+void tearDown(void)
+{
+}
+
+void test_priority_order()
+{
+    fnTaskManager mgr;
+
+    // Hold both workers
+    GateTask *a = new GateTask();
+    GateTask *b = new GateTask();
+    mgr.submit_task(a);
+    mgr.submit_task(b);
+    wait_for([&] { return a->entered && b->entered; });
+
+    mgr.submit_task(new LogTask("low", 1), fnTask::PRIORITY_LOW, log_done);
+    mgr.submit_task(new LogTask("normal", 1), fnTask::PRIORITY_NORMAL, log_done);
+    mgr.submit_task(new LogTask("high1", 1), fnTask::PRIORITY_HIGH, log_done);
+    mgr.submit_task(new LogTask("high2", 1), fnTask::PRIORITY_HIGH, log_done);
+
+    // One worker works through the queue on its own
+    a->open = true;
+    wait_for([&] { std::lock_guard<std::mutex> lock(log_mutex); return completed.size() == 4; });
+    b->open = true;
+    TEST_ASSERT_TRUE(mgr.wait_idle(2000));
+
+    std::vector<std::string> expect = {"high1", "high2", "normal", "low"};
+    TEST_ASSERT_TRUE(started == expect);
+    TEST_ASSERT_FALSE(ran_on_caller);
+    TEST_ASSERT_TRUE(mgr.service());
+}
+
+void test_long_task_does_not_block()
+{
+    fnTaskManager mgr;
+
+    LogTask *forever = new LogTask("forever", -1);
+    uint8_t tid = mgr.submit_task(forever, fnTask::PRIORITY_HIGH, log_done);
+    mgr.submit_task(new LogTask("short", 3), fnTask::PRIORITY_LOW, log_done);
+
+    // The short task finishes on the other worker
+    wait_for([&] { std::lock_guard<std::mutex> lock(log_mutex); return completed.size() == 1; });
+    TEST_ASSERT_EQUAL_STRING("short", completed[0].c_str());
+    TEST_ASSERT_FALSE(mgr.service());
+
+    // Cancel the long one mid-run
+    TEST_ASSERT_EQUAL(0, mgr.abort_task(tid));
+    TEST_ASSERT_TRUE(mgr.wait_idle(2000));
+    TEST_ASSERT_EQUAL(1, aborted.size());
+    TEST_ASSERT_EQUAL_STRING("forever", aborted[0].c_str());
+    TEST_ASSERT_NULL(mgr.get_task(tid));
+}
+
+void test_dependencies()
+{
+    fnTaskManager mgr;
+
+    uint8_t first = mgr.submit_task(new LogTask("first", 5), fnTask::PRIORITY_LOW, log_done);
+    mgr.submit_task(new LogTask("second", 1), fnTask::PRIORITY_HIGH, log_done, first);
+    TEST_ASSERT_TRUE(mgr.wait_idle(2000));
+
+    std::vector<std::string> expect = {"first", "second"};
+    TEST_ASSERT_TRUE(completed == expect);
+
+    // A failed task takes the ones waiting on it along
+    uint8_t failing = mgr.submit_task(new LogTask("failing", 3, true), fnTask::PRIORITY_NORMAL, log_done);
+    uint8_t waiting = mgr.submit_task(new LogTask("waiting", 1), fnTask::PRIORITY_NORMAL, log_done, failing);
+    mgr.submit_task(new LogTask("chained", 1), fnTask::PRIORITY_NORMAL, log_done, waiting);
+    TEST_ASSERT_TRUE(mgr.wait_idle(2000));
+
+    expect = {"failing", "waiting", "chained"};
+    TEST_ASSERT_TRUE(aborted == expect);
+    TEST_ASSERT_EQUAL(2, completed.size());
+}
+
+void test_pause_resume()
+{
+    fnTaskManager mgr;
+
+    LogTask *task = new LogTask("paused", 200);
+    uint8_t tid = mgr.submit_task(task, fnTask::PRIORITY_NORMAL, log_done);
+    wait_for([&] { return task->_steps > 5; });
+
+    TEST_ASSERT_EQUAL(0, mgr.pause_task(tid));
+    wait_for([&] { return task->get_state() == fnTask::TASK_PAUSED; });
+    int steps = task->_steps;
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    TEST_ASSERT_EQUAL(steps, task->_steps);
+
+    TEST_ASSERT_EQUAL(0, mgr.resume_task(tid));
+    TEST_ASSERT_TRUE(mgr.wait_idle(5000));
+    TEST_ASSERT_EQUAL(1, completed.size());
+    // start() runs once
+    TEST_ASSERT_EQUAL(1, started.size());
+}
+
+void test_abort_while_pausing()
+{
+    fnTaskManager mgr;
+
+    SlowPauseTask *task = new SlowPauseTask("pausing");
+    uint8_t tid = mgr.submit_task(task);
+    wait_for([&] { return task->_steps > 0; });
+
+    // the abort lands after the worker decided to pause, it's still RUNNING
+    TEST_ASSERT_EQUAL(0, mgr.pause_task(tid));
+    wait_for([&] { return task->pausing.load(); });
+    TEST_ASSERT_EQUAL(0, mgr.abort_task(tid));
+    task->release = true;
+
+    TEST_ASSERT_TRUE(mgr.wait_idle(5000));
+    TEST_ASSERT_EQUAL(1, aborted.size());
+}
+
+void test_shutdown_aborts()
+{
+    std::vector<std::string> expect;
+    {
+        fnTaskManager mgr;
+        LogTask *forever = new LogTask("running", -1);
+        mgr.submit_task(forever);
+        mgr.submit_task(new LogTask("queued1", -1));
+        mgr.submit_task(new LogTask("queued2", -1));
+        mgr.submit_task(new LogTask("queued3", 1), fnTask::PRIORITY_LOW);
+        wait_for([&] { return forever->_steps > 0; });
+    }
+    TEST_ASSERT_EQUAL(4, aborted.size());
+}
+
+void process()
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_priority_order);
+    RUN_TEST(test_long_task_does_not_block);
+    RUN_TEST(test_dependencies);
+    RUN_TEST(test_pause_resume);
+    RUN_TEST(test_abort_while_pausing);
+    RUN_TEST(test_shutdown_aborts);
+
+    UNITY_END();
+}
+
+int main(int argc, char **argv)
+{
+    process();
+}